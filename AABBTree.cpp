@@ -0,0 +1,483 @@
+//--------------------------------------------------------------------------------------
+// Dynamic AABB tree (bounding volume hierarchy) over scene objects
+//--------------------------------------------------------------------------------------
+
+#include "AABBTree.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cfloat>
+
+
+// Component of a vector by axis index (0 = x, 1 = y, 2 = z)
+static float Axis(const CVector3& v, int axis)
+{
+	return (&v.x)[axis];
+}
+
+
+CAABBTree::CAABBTree(float fatMargin /*= 0.5f*/)
+{
+	mRoot = NullNode;
+	mFreeList = NullNode;
+	mProxyCount = 0;
+	mFatMargin = fatMargin;
+}
+
+
+//--------------------------------------------------------------------------------------
+// Node pool
+//--------------------------------------------------------------------------------------
+
+int CAABBTree::AllocateNode()
+{
+	if (mFreeList == NullNode)
+	{
+		// Grow the pool and thread the new nodes onto the free list
+		const auto oldSize = static_cast<int>(mNodes.size());
+		const auto newSize = std::max(16, oldSize * 2);
+		mNodes.resize(newSize);
+		for (auto i = oldSize; i < newSize - 1; ++i)
+		{
+			mNodes[i].next = i + 1;
+			mNodes[i].height = -1;
+		}
+		mNodes[newSize - 1].next = NullNode;
+		mNodes[newSize - 1].height = -1;
+		mFreeList = oldSize;
+	}
+
+	const auto nodeId = mFreeList;
+	auto& node = mNodes[nodeId];
+	mFreeList = node.next;
+
+	node.parent = NullNode;
+	node.child1 = NullNode;
+	node.child2 = NullNode;
+	node.height = 0;
+	node.userData = nullptr;
+	return nodeId;
+}
+
+void CAABBTree::FreeNode(int nodeId)
+{
+	mNodes[nodeId].next = mFreeList;
+	mNodes[nodeId].height = -1;
+	mFreeList = nodeId;
+}
+
+
+//--------------------------------------------------------------------------------------
+// Proxies
+//--------------------------------------------------------------------------------------
+
+int CAABBTree::CreateProxy(const CAABB& box, void* userData)
+{
+	const auto proxyId = AllocateNode();
+
+	auto& node = mNodes[proxyId];
+	node.box = box;
+	node.box.Inflate(mFatMargin);
+	node.userData = userData;
+	node.height = 0;
+
+	InsertLeaf(proxyId);
+	++mProxyCount;
+
+	return proxyId;
+}
+
+void CAABBTree::DestroyProxy(int proxyId)
+{
+	assert(mNodes[proxyId].IsLeaf());
+
+	RemoveLeaf(proxyId);
+	FreeNode(proxyId);
+	--mProxyCount;
+}
+
+bool CAABBTree::MoveProxy(int proxyId, const CAABB& box, const CVector3& displacement)
+{
+	assert(mNodes[proxyId].IsLeaf());
+
+	// Still inside the fat box - nothing to do. This is the common case for objects that are static or move slowly
+	if (mNodes[proxyId].box.Contains(box)) return false;
+
+	RemoveLeaf(proxyId);
+
+	// Fatten the box and also stretch it in the direction of travel so a moving object stays inside for a few frames
+	auto fatBox = box;
+	fatBox.Inflate(mFatMargin);
+
+	const auto predict = 2.0f;
+	if (displacement.x < 0) fatBox.min.x += displacement.x * predict; else fatBox.max.x += displacement.x * predict;
+	if (displacement.y < 0) fatBox.min.y += displacement.y * predict; else fatBox.max.y += displacement.y * predict;
+	if (displacement.z < 0) fatBox.min.z += displacement.z * predict; else fatBox.max.z += displacement.z * predict;
+
+	mNodes[proxyId].box = fatBox;
+
+	InsertLeaf(proxyId);
+	return true;
+}
+
+void CAABBTree::Clear()
+{
+	mNodes.clear();
+	mRoot = NullNode;
+	mFreeList = NullNode;
+	mProxyCount = 0;
+}
+
+
+//--------------------------------------------------------------------------------------
+// Incremental insertion / removal
+//--------------------------------------------------------------------------------------
+
+// Insert a leaf, choosing the sibling that minimises the increase in total surface area (branch and bound
+// descent), then walk back up refitting boxes and rebalancing
+void CAABBTree::InsertLeaf(int leaf)
+{
+	if (mRoot == NullNode)
+	{
+		mRoot = leaf;
+		mNodes[mRoot].parent = NullNode;
+		return;
+	}
+
+	const auto leafBox = mNodes[leaf].box;
+
+	// Find the best sibling
+	auto index = mRoot;
+	while (!mNodes[index].IsLeaf())
+	{
+		const auto child1 = mNodes[index].child1;
+		const auto child2 = mNodes[index].child2;
+
+		const auto area = mNodes[index].box.SurfaceArea();
+		const auto combinedArea = Merge(mNodes[index].box, leafBox).SurfaceArea();
+
+		// Cost of creating a new parent for this node and the new leaf
+		const auto cost = 2.0f * combinedArea;
+
+		// Minimum cost of pushing the leaf further down the tree
+		const auto inheritanceCost = 2.0f * (combinedArea - area);
+
+		auto childCost = [&](int child)
+		{
+			const auto merged = Merge(leafBox, mNodes[child].box).SurfaceArea();
+			if (mNodes[child].IsLeaf()) return merged + inheritanceCost;
+			return merged - mNodes[child].box.SurfaceArea() + inheritanceCost;
+		};
+
+		const auto cost1 = childCost(child1);
+		const auto cost2 = childCost(child2);
+
+		if (cost < cost1 && cost < cost2) break;
+
+		index = cost1 < cost2 ? child1 : child2;
+	}
+
+	const auto sibling = index;
+
+	// Create a new parent to hold the sibling and the leaf
+	const auto oldParent = mNodes[sibling].parent;
+	const auto newParent = AllocateNode();
+	mNodes[newParent].parent = oldParent;
+	mNodes[newParent].box = Merge(leafBox, mNodes[sibling].box);
+	mNodes[newParent].height = mNodes[sibling].height + 1;
+	mNodes[newParent].child1 = sibling;
+	mNodes[newParent].child2 = leaf;
+	mNodes[sibling].parent = newParent;
+	mNodes[leaf].parent = newParent;
+
+	if (oldParent != NullNode)
+	{
+		if (mNodes[oldParent].child1 == sibling) mNodes[oldParent].child1 = newParent;
+		else                                     mNodes[oldParent].child2 = newParent;
+	}
+	else
+	{
+		mRoot = newParent;
+	}
+
+	// Walk back up the tree fixing heights and boxes
+	index = mNodes[leaf].parent;
+	while (index != NullNode)
+	{
+		index = Balance(index);
+
+		const auto child1 = mNodes[index].child1;
+		const auto child2 = mNodes[index].child2;
+
+		mNodes[index].height = 1 + std::max(mNodes[child1].height, mNodes[child2].height);
+		mNodes[index].box = Merge(mNodes[child1].box, mNodes[child2].box);
+
+		index = mNodes[index].parent;
+	}
+}
+
+void CAABBTree::RemoveLeaf(int leaf)
+{
+	if (leaf == mRoot)
+	{
+		mRoot = NullNode;
+		return;
+	}
+
+	const auto parent = mNodes[leaf].parent;
+	const auto grandParent = mNodes[parent].parent;
+	const auto sibling = mNodes[parent].child1 == leaf ? mNodes[parent].child2 : mNodes[parent].child1;
+
+	if (grandParent != NullNode)
+	{
+		// Connect the sibling to the grand parent and destroy the parent
+		if (mNodes[grandParent].child1 == parent) mNodes[grandParent].child1 = sibling;
+		else                                      mNodes[grandParent].child2 = sibling;
+		mNodes[sibling].parent = grandParent;
+		FreeNode(parent);
+
+		// Adjust ancestor bounds
+		auto index = grandParent;
+		while (index != NullNode)
+		{
+			index = Balance(index);
+
+			const auto child1 = mNodes[index].child1;
+			const auto child2 = mNodes[index].child2;
+
+			mNodes[index].box = Merge(mNodes[child1].box, mNodes[child2].box);
+			mNodes[index].height = 1 + std::max(mNodes[child1].height, mNodes[child2].height);
+
+			index = mNodes[index].parent;
+		}
+	}
+	else
+	{
+		mRoot = sibling;
+		mNodes[sibling].parent = NullNode;
+		FreeNode(parent);
+	}
+}
+
+// If node A is imbalanced (children heights differ by more than one) rotate the taller child up. Returns the new
+// root of the sub-tree that A was the root of. A has children B and C, the taller of which becomes the new root
+int CAABBTree::Balance(int iA)
+{
+	auto& A = mNodes[iA];
+	if (A.IsLeaf() || A.height < 2) return iA;
+
+	const auto iB = A.child1;
+	const auto iC = A.child2;
+	const auto balance = mNodes[iC].height - mNodes[iB].height;
+
+	// Rotate C up (or B up, symmetrically)
+	auto rotate = [&](int iUp, int iOther, bool upIsChild2) -> int
+	{
+		auto& up = mNodes[iUp];
+		const auto iF = up.child1;
+		const auto iG = up.child2;
+
+		// Swap A and the child being rotated up
+		up.child1 = iA;
+		up.parent = A.parent;
+		A.parent = iUp;
+
+		if (up.parent != NullNode)
+		{
+			if (mNodes[up.parent].child1 == iA) mNodes[up.parent].child1 = iUp;
+			else                                mNodes[up.parent].child2 = iUp;
+		}
+		else
+		{
+			mRoot = iUp;
+		}
+
+		// Keep the taller grandchild under the rotated node, move the other down to A
+		auto keep = iF, move = iG;
+		if (mNodes[iF].height < mNodes[iG].height) std::swap(keep, move);
+
+		up.child2 = keep;
+		if (upIsChild2) A.child2 = move;
+		else            A.child1 = move;
+		mNodes[move].parent = iA;
+
+		A.box = Merge(mNodes[iOther].box, mNodes[move].box);
+		up.box = Merge(A.box, mNodes[keep].box);
+
+		A.height = 1 + std::max(mNodes[iOther].height, mNodes[move].height);
+		up.height = 1 + std::max(A.height, mNodes[keep].height);
+
+		return iUp;
+	};
+
+	if (balance > 1)  return rotate(iC, iB, true);
+	if (balance < -1) return rotate(iB, iC, false);
+
+	return iA;
+}
+
+
+//--------------------------------------------------------------------------------------
+// SAH rebuild
+//--------------------------------------------------------------------------------------
+
+void CAABBTree::Rebuild()
+{
+	if (mRoot == NullNode) return;
+
+	// Collect the leaves and free all internal nodes
+	std::vector<int> leaves;
+	leaves.reserve(mProxyCount);
+
+	for (auto i = 0; i < static_cast<int>(mNodes.size()); ++i)
+	{
+		if (mNodes[i].height < 0) continue; // Free node
+
+		if (mNodes[i].IsLeaf())
+		{
+			leaves.push_back(i);
+		}
+		else
+		{
+			FreeNode(i);
+		}
+	}
+
+	mRoot = BuildSAH(leaves, 0, static_cast<int>(leaves.size()));
+	mNodes[mRoot].parent = NullNode;
+}
+
+// Top-down build using binned SAH over leaf centroids along the widest centroid axis
+int CAABBTree::BuildSAH(std::vector<int>& leaves, int first, int last)
+{
+	const auto count = last - first;
+	if (count == 1) return leaves[first];
+
+	auto bounds = CAABB::Empty();
+	auto centroidBounds = CAABB::Empty();
+	for (auto i = first; i < last; ++i)
+	{
+		bounds.Encapsulate(mNodes[leaves[i]].box);
+		centroidBounds.Encapsulate(mNodes[leaves[i]].box.Centre());
+	}
+
+	// Choose the split axis
+	const auto extent = centroidBounds.max - centroidBounds.min;
+	auto axis = 0;
+	if (extent.y > extent.x) axis = 1;
+	if (extent.z > Axis(extent, axis)) axis = 2;
+
+	const auto axisMin = Axis(centroidBounds.min, axis);
+	const auto axisExtent = Axis(extent, axis);
+
+	auto mid = first + count / 2;
+
+	if (axisExtent > 1e-6f && count > 2)
+	{
+		const int NumBins = 16;
+		struct Bin { CAABB box = CAABB::Empty(); int count = 0; } bins[NumBins];
+
+		auto binOf = [&](int leaf)
+		{
+			const auto c = Axis(mNodes[leaf].box.Centre(), axis);
+			return std::min(NumBins - 1, static_cast<int>(NumBins * (c - axisMin) / axisExtent));
+		};
+
+		for (auto i = first; i < last; ++i)
+		{
+			auto& bin = bins[binOf(leaves[i])];
+			bin.box.Encapsulate(mNodes[leaves[i]].box);
+			bin.count++;
+		}
+
+		// Sweep from both sides to get the area / count of each side of every split plane
+		float leftArea[NumBins - 1], rightArea[NumBins - 1];
+		int leftCount[NumBins - 1], rightCount[NumBins - 1];
+
+		auto box = CAABB::Empty();
+		auto n = 0;
+		for (auto i = 0; i < NumBins - 1; ++i)
+		{
+			box.Encapsulate(bins[i].box);
+			n += bins[i].count;
+			leftArea[i] = n ? box.SurfaceArea() : 0.0f;
+			leftCount[i] = n;
+		}
+
+		box = CAABB::Empty();
+		n = 0;
+		for (auto i = NumBins - 1; i > 0; --i)
+		{
+			box.Encapsulate(bins[i].box);
+			n += bins[i].count;
+			rightArea[i - 1] = n ? box.SurfaceArea() : 0.0f;
+			rightCount[i - 1] = n;
+		}
+
+		auto bestCost = FLT_MAX;
+		auto bestSplit = -1;
+		for (auto i = 0; i < NumBins - 1; ++i)
+		{
+			if (leftCount[i] == 0 || rightCount[i] == 0) continue;
+			const auto cost = leftArea[i] * leftCount[i] + rightArea[i] * rightCount[i];
+			if (cost < bestCost)
+			{
+				bestCost = cost;
+				bestSplit = i;
+			}
+		}
+
+		if (bestSplit >= 0)
+		{
+			const auto split = std::partition(leaves.begin() + first, leaves.begin() + last,
+			                                  [&](int leaf) { return binOf(leaf) <= bestSplit; });
+			mid = static_cast<int>(split - leaves.begin());
+		}
+	}
+
+	// Degenerate distribution (all centroids together) - fall back to a median split
+	if (mid == first || mid == last)
+	{
+		mid = first + count / 2;
+		std::nth_element(leaves.begin() + first, leaves.begin() + mid, leaves.begin() + last, [&](int a, int b)
+		{
+			return Axis(mNodes[a].box.Centre(), axis) < Axis(mNodes[b].box.Centre(), axis);
+		});
+	}
+
+	const auto child1 = BuildSAH(leaves, first, mid);
+	const auto child2 = BuildSAH(leaves, mid, last);
+
+	const auto nodeId = AllocateNode();
+	auto& node = mNodes[nodeId];
+	node.child1 = child1;
+	node.child2 = child2;
+	node.box = Merge(mNodes[child1].box, mNodes[child2].box);
+	node.height = 1 + std::max(mNodes[child1].height, mNodes[child2].height);
+	mNodes[child1].parent = nodeId;
+	mNodes[child2].parent = nodeId;
+
+	return nodeId;
+}
+
+
+//--------------------------------------------------------------------------------------
+// Statistics
+//--------------------------------------------------------------------------------------
+
+float CAABBTree::GetAreaRatio() const
+{
+	if (mRoot == NullNode) return 0.0f;
+
+	const auto rootArea = mNodes[mRoot].box.SurfaceArea();
+	if (rootArea <= 0.0f) return 0.0f;
+
+	auto totalArea = 0.0f;
+	for (const auto& node : mNodes)
+	{
+		if (node.height < 0) continue;
+		totalArea += node.box.SurfaceArea();
+	}
+
+	return totalArea / rootArea;
+}
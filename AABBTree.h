@@ -0,0 +1,230 @@
+//--------------------------------------------------------------------------------------
+// Dynamic AABB tree (bounding volume hierarchy) over scene objects
+//--------------------------------------------------------------------------------------
+// Each object is a leaf ("proxy") holding a "fat" box - its real bounds grown by a margin so small
+// movements don't require the tree to change. Leaves are inserted / removed incrementally and the
+// tree is kept balanced with rotations. A full surface area heuristic (SAH) rebuild can be requested
+// when the tree quality has degraded (e.g. after loading a level).
+//
+// Queries walk the tree with an explicit stack and call back into user code for each leaf found, so
+// culling, light assignment and picking only touch the part of the scene that matters.
+
+#pragma once
+
+#include "BoundingVolumes.h"
+
+#include <vector>
+
+
+class CAABBTree
+{
+public:
+	static const int NullNode = -1;
+
+	//-------------------------------------
+	// Construction / Usage
+	//-------------------------------------
+
+	// The margin is added to each side of a proxy's box when it is inserted
+	explicit CAABBTree(float fatMargin = 0.5f);
+
+	// Insert a new leaf with the given (tight) bounds. Returns the proxy id used in later calls
+	int CreateProxy(const CAABB& box, void* userData);
+
+	// Remove a leaf from the tree
+	void DestroyProxy(int proxyId);
+
+	// Update a leaf with new (tight) bounds. If the box is still inside the fat box nothing happens, otherwise
+	// the leaf is re-inserted with a new fat box extended in the direction of travel (displacement).
+	// Returns true if the leaf was re-inserted
+	bool MoveProxy(int proxyId, const CAABB& box, const CVector3& displacement = { 0, 0, 0 });
+
+	// Rebuild the whole tree top-down using the binned surface area heuristic. Gives a much better tree
+	// than incremental insertion but is O(n log n) so only call on demand (after loading, large edits, etc.)
+	void Rebuild();
+
+	void Clear();
+
+
+	//-------------------------------------
+	// Queries
+	//-------------------------------------
+	// The callback is called with the proxy id of each leaf found. Return false from the callback to stop the query
+
+	// All leaves whose fat box overlaps the given box
+	template <typename Callback>
+	void Query(const CAABB& box, Callback&& callback) const
+	{
+		Traverse([&](const CAABB& nodeBox) { return nodeBox.Overlaps(box); }, callback);
+	}
+
+	// All leaves whose fat box overlaps the given sphere
+	template <typename Callback>
+	void Query(const CSphere& sphere, Callback&& callback) const
+	{
+		Traverse([&](const CAABB& nodeBox) { return sphere.Overlaps(nodeBox); }, callback);
+	}
+
+	// All leaves whose fat box is at least partially inside the frustum
+	template <typename Callback>
+	void Query(const CFrustum& frustum, Callback&& callback) const
+	{
+		Traverse([&](const CAABB& nodeBox) { return frustum.Intersects(nodeBox); }, callback);
+	}
+
+	// Walk the leaves hit by a ray in the range [0, maxT]. The callback is called as callback(proxyId, ray, maxT)
+	// and returns the new maximum distance: return the hit distance to clip the ray (closest hit queries), maxT to
+	// continue unchanged (all hits queries) or 0 to stop
+	template <typename Callback>
+	void RayCast(const CRay& ray, float maxT, Callback&& callback) const;
+
+
+	//-------------------------------------
+	// Data access
+	//-------------------------------------
+
+	void* GetUserData(int proxyId) const { return mNodes[proxyId].userData; }
+
+	const CAABB& GetFatAABB(int proxyId) const { return mNodes[proxyId].box; }
+
+	int GetProxyCount() const { return mProxyCount; }
+
+	// Height of the tree (0 for a single leaf, -1 when empty)
+	int GetHeight() const { return mRoot == NullNode ? -1 : mNodes[mRoot].height; }
+
+	// Sum of the surface areas of all internal nodes divided by the root area. Lower is better, useful to
+	// decide when a Rebuild is worthwhile
+	float GetAreaRatio() const;
+
+
+//-------------------------------------
+// Private members
+//-------------------------------------
+private:
+
+	struct Node
+	{
+		CAABB box;
+		void* userData;
+
+		union
+		{
+			int parent;
+			int next; // Used by the free list
+		};
+
+		int child1;
+		int child2;
+
+		int height; // Leaf = 0, free node = -1
+
+		bool IsLeaf() const { return child1 == NullNode; }
+	};
+
+	int  AllocateNode();
+	void FreeNode(int node);
+
+	void InsertLeaf(int leaf);
+	void RemoveLeaf(int leaf);
+
+	// Perform a left or right rotation if the node is imbalanced. Returns the new root of the sub-tree
+	int Balance(int node);
+
+	// Recursive helper for Rebuild - builds a sub-tree over leaves[first, last) and returns its root
+	int BuildSAH(std::vector<int>& leaves, int first, int last);
+
+	template <typename Test, typename Callback>
+	void Traverse(Test&& test, Callback& callback) const;
+
+
+	std::vector<Node> mNodes;
+	int mRoot;
+	int mFreeList;
+	int mProxyCount;
+	float mFatMargin;
+};
+
+
+//--------------------------------------------------------------------------------------
+// Template implementations
+//--------------------------------------------------------------------------------------
+
+template <typename Test, typename Callback>
+void CAABBTree::Traverse(Test&& test, Callback& callback) const
+{
+	if (mRoot == NullNode) return;
+
+	// Explicit stack - the tree is balanced so depth stays small, but a thread_local buffer avoids
+	// reallocating the stack on every query
+	thread_local std::vector<int> stack;
+	const auto base = stack.size();
+	stack.push_back(mRoot);
+
+	while (stack.size() > base)
+	{
+		const auto nodeId = stack.back();
+		stack.pop_back();
+
+		const auto& node = mNodes[nodeId];
+		if (!test(node.box)) continue;
+
+		if (node.IsLeaf())
+		{
+			if (!callback(nodeId))
+			{
+				stack.resize(base);
+				return;
+			}
+		}
+		else
+		{
+			stack.push_back(node.child1);
+			stack.push_back(node.child2);
+		}
+	}
+}
+
+template <typename Callback>
+void CAABBTree::RayCast(const CRay& ray, float maxT, Callback&& callback) const
+{
+	if (mRoot == NullNode) return;
+
+	thread_local std::vector<int> stack;
+	const auto base = stack.size();
+	stack.push_back(mRoot);
+
+	while (stack.size() > base)
+	{
+		const auto nodeId = stack.back();
+		stack.pop_back();
+
+		const auto& node = mNodes[nodeId];
+		float tEnter;
+		if (!ray.Intersects(node.box, 0.0f, maxT, tEnter)) continue;
+
+		if (node.IsLeaf())
+		{
+			const float newMaxT = callback(nodeId, ray, maxT);
+			if (newMaxT <= 0.0f)
+			{
+				stack.resize(base);
+				return;
+			}
+			maxT = newMaxT;
+		}
+		else
+		{
+			// Visit the nearer child first so the ray gets clipped early for closest hit queries
+			float t1, t2;
+			const auto hit1 = ray.Intersects(mNodes[node.child1].box, 0.0f, maxT, t1);
+			const auto hit2 = ray.Intersects(mNodes[node.child2].box, 0.0f, maxT, t2);
+			if (hit1 && hit2)
+			{
+				if (t1 < t2) { stack.push_back(node.child2); stack.push_back(node.child1); }
+				else         { stack.push_back(node.child1); stack.push_back(node.child2); }
+			}
+			else if (hit1) stack.push_back(node.child1);
+			else if (hit2) stack.push_back(node.child2);
+		}
+	}
+}
@@ -0,0 +1,934 @@
+//--------------------------------------------------------------------------------------
+// Skeletal animation - clips sampled into node poses and blended in layers
+//--------------------------------------------------------------------------------------
+
+#include "Animation.h"
+
+#include <algorithm>
+#include <atomic>
+#include <bitset>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <future>
+#include <mutex>
+#include <stdexcept>
+#include <xmmintrin.h>
+
+
+const float CAnimationClip::DefaultSampleRate = 30.0f;
+
+
+namespace
+{
+	// Key values at a time, interpolating between the keys either side. rest if there are no keys
+	template <typename T, typename Interpolate>
+	T InterpolateKeys(const std::vector<std::pair<float, T>>& keys, float time, const T& rest, Interpolate interpolate)
+	{
+		if (keys.empty())  return rest;
+		if (time <= keys.front().first)  return keys.front().second;
+		if (time >= keys.back().first)   return keys.back().second;
+
+		const auto next = std::upper_bound(keys.begin(), keys.end(), time, [](float t, const std::pair<float, T>& key) { return t < key.first; });
+		const auto& previous = *(next - 1);
+		const auto span = next->first - previous.first;
+		return interpolate(previous.second, next->second, span > 0.0f ? (time - previous.first) / span : 0.0f);
+	}
+
+	CVector3 Lerp(const CVector3& v1, const CVector3& v2, float t)
+	{
+		return v1 + (v2 - v1) * t;
+	}
+
+	// Put a time in the range of a clip
+	float ClipTime(float time, float duration, bool loop)
+	{
+		if (duration <= 0.0f)  return 0.0f;
+		if (!loop)  return std::min(std::max(time, 0.0f), duration);
+
+		time = std::fmod(time, duration);
+		return time < 0.0f ? time + duration : time;
+	}
+
+
+	// Four quaternions in SSE registers, one component per register
+	struct QuaternionSoA
+	{
+		__m128 x, y, z, w;
+	};
+
+	QuaternionSoA LoadRotations(const CAnimationPose& pose, unsigned int i)
+	{
+		return { _mm_loadu_ps(pose.Channel(CAnimationPose::RotationX) + i), _mm_loadu_ps(pose.Channel(CAnimationPose::RotationY) + i),
+		         _mm_loadu_ps(pose.Channel(CAnimationPose::RotationZ) + i), _mm_loadu_ps(pose.Channel(CAnimationPose::RotationW) + i) };
+	}
+
+	void StoreRotations(CAnimationPose& pose, unsigned int i, const QuaternionSoA& q)
+	{
+		_mm_storeu_ps(pose.Channel(CAnimationPose::RotationX) + i, q.x);
+		_mm_storeu_ps(pose.Channel(CAnimationPose::RotationY) + i, q.y);
+		_mm_storeu_ps(pose.Channel(CAnimationPose::RotationZ) + i, q.z);
+		_mm_storeu_ps(pose.Channel(CAnimationPose::RotationW) + i, q.w);
+	}
+
+	__m128 DotRotations(const QuaternionSoA& a, const QuaternionSoA& b)
+	{
+		return _mm_add_ps(_mm_add_ps(_mm_mul_ps(a.x, b.x), _mm_mul_ps(a.y, b.y)), _mm_add_ps(_mm_mul_ps(a.z, b.z), _mm_mul_ps(a.w, b.w)));
+	}
+
+	QuaternionSoA NormaliseRotations(const QuaternionSoA& q)
+	{
+		const auto invLength = _mm_div_ps(_mm_set1_ps(1.0f), _mm_sqrt_ps(DotRotations(q, q)));
+		return { _mm_mul_ps(q.x, invLength), _mm_mul_ps(q.y, invLength), _mm_mul_ps(q.z, invLength), _mm_mul_ps(q.w, invLength) };
+	}
+
+	// a + (b - a) * t for each component
+	__m128 LerpSSE(__m128 a, __m128 b, __m128 t)
+	{
+		return _mm_add_ps(a, _mm_mul_ps(_mm_sub_ps(b, a), t));
+	}
+
+	// Weights of four nodes starting at node i
+	__m128 NodeWeights(float weight, const float* nodeWeights, unsigned int i)
+	{
+		const auto w = _mm_set1_ps(weight);
+		return nodeWeights ? _mm_mul_ps(w, _mm_loadu_ps(nodeWeights + i)) : w;
+	}
+
+
+	//-------------------------------------
+	// Compressed clips
+	//-------------------------------------
+
+	// File identifier ("ANIM") and version written by CAnimationClip::Save
+	const uint32_t AnimationFileId = 0x4D494E41;
+	const uint32_t AnimationFileVersion = 1;
+
+	// Chunks kept in memory by each streamed clip
+	const unsigned int StreamedChunks = 4;
+
+	// One quantised key of a compressed track. Rotations pack the three smallest components in 15 bits each and
+	// which component was left out in the top 2 bits (bits 0-14, 15-29, 30-44 and 45-46 of the 48)
+	struct CompressedKey
+	{
+		uint16_t values[3];
+	};
+
+	// The components other than the largest of a unit quaternion are within +-1/sqrt(2)
+	const float SmallestThreeRange = 0.70710678f;
+	const float SmallestThreeStep = 2.0f * SmallestThreeRange / 32767.0f;
+
+	// Values of a track at one frame, rotations use all four
+	struct TrackValue
+	{
+		float v[4];
+	};
+
+	// Number of values in a track starting at a channel, 0 for channels that don't start a track
+	int TrackValues(unsigned int channel)
+	{
+		return channel == CAnimationPose::RotationX ? 4 : (channel == CAnimationPose::PositionX || channel == CAnimationPose::ScaleX) ? 3 : 0;
+	}
+
+	float TrackError(unsigned int channel, const AnimationCompression& settings)
+	{
+		return channel == CAnimationPose::RotationX ? settings.rotationError :
+		       channel == CAnimationPose::PositionX ? settings.positionError : settings.scaleError;
+	}
+
+	uint16_t Quantise(float value, float minimum, float step, float maximumStep)
+	{
+		if (step <= 0.0f)  return 0;
+		return static_cast<uint16_t>(std::lround(std::min(std::max((value - minimum) / step, 0.0f), maximumStep)));
+	}
+
+	template <typename Track>
+	CompressedKey QuantiseKey(const Track& track, const TrackValue& value)
+	{
+		CompressedKey key = {};
+		if (track.channel != CAnimationPose::RotationX)
+		{
+			for (int i = 0; i < 3; ++i)  key.values[i] = Quantise(value.v[i], track.minimum[i], track.step[i], 65535.0f);
+			return key;
+		}
+
+		// Smallest three: q and -q are the same rotation, so make the largest component positive and leave it out,
+		// it can be found from the other three as the quaternion has unit length
+		unsigned int largest = 0;
+		for (unsigned int i = 1; i < 4; ++i)
+		{
+			if (std::abs(value.v[i]) > std::abs(value.v[largest]))  largest = i;
+		}
+		const auto sign = value.v[largest] < 0.0f ? -1.0f : 1.0f;
+		uint64_t bits = static_cast<uint64_t>(largest) << 45;
+		for (unsigned int i = 0, shift = 0; i < 4; ++i)
+		{
+			if (i == largest) continue;
+			bits |= static_cast<uint64_t>(Quantise(value.v[i] * sign, -SmallestThreeRange, SmallestThreeStep, 32767.0f)) << shift;
+			shift += 15;
+		}
+		for (int i = 0; i < 3; ++i)  key.values[i] = static_cast<uint16_t>(bits >> (i * 16));
+		return key;
+	}
+
+	template <typename Track>
+	TrackValue DecodeKey(const Track& track, const CompressedKey& key)
+	{
+		TrackValue value = {};
+		if (track.channel != CAnimationPose::RotationX)
+		{
+			for (int i = 0; i < 3; ++i)  value.v[i] = track.minimum[i] + key.values[i] * track.step[i];
+			return value;
+		}
+
+		const auto bits = key.values[0] | static_cast<uint64_t>(key.values[1]) << 16 | static_cast<uint64_t>(key.values[2]) << 32;
+		const auto largest = static_cast<unsigned int>(bits >> 45);
+		auto lengthSq = 0.0f;
+		for (unsigned int i = 0, shift = 0; i < 4; ++i)
+		{
+			if (i == largest) continue;
+			value.v[i] = ((bits >> shift) & 0x7FFF) * SmallestThreeStep - SmallestThreeRange;
+			lengthSq += value.v[i] * value.v[i];
+			shift += 15;
+		}
+		value.v[largest] = std::sqrt(std::max(1.0f - lengthSq, 0.0f));
+		return value;
+	}
+
+	// Keys in a chunk before a frame, from the track's mask of frames with keys
+	unsigned int KeysBefore(uint64_t frameMask, unsigned int frame)
+	{
+		return static_cast<unsigned int>(std::bitset<64>(frameMask & ((uint64_t(1) << frame) - 1)).count());
+	}
+
+	// Linear interpolation of two track values, rotations the shorter way round and left unnormalised
+	template <typename Track>
+	TrackValue InterpolateValues(const Track& track, const TrackValue& a, const TrackValue& b, float t)
+	{
+		const auto numValues = TrackValues(track.channel);
+		auto sign = 1.0f;
+		if (numValues == 4 && a.v[0] * b.v[0] + a.v[1] * b.v[1] + a.v[2] * b.v[2] + a.v[3] * b.v[3] < 0.0f)  sign = -1.0f;
+
+		TrackValue value = {};
+		for (int i = 0; i < numValues; ++i)  value.v[i] = a.v[i] + (b.v[i] * sign - a.v[i]) * t;
+		return value;
+	}
+
+	// Whether an interpolated value is within the error of the original. Rotations are compared once normalised,
+	// in the same hemisphere as the original
+	template <typename Track>
+	bool WithinError(const Track& track, TrackValue value, const TrackValue& original, float error)
+	{
+		const auto numValues = TrackValues(track.channel);
+		if (numValues == 4)
+		{
+			auto dot = 0.0f, lengthSq = 0.0f;
+			for (int i = 0; i < 4; ++i)
+			{
+				dot += value.v[i] * original.v[i];
+				lengthSq += value.v[i] * value.v[i];
+			}
+			const auto scale = (dot < 0.0f ? -1.0f : 1.0f) / std::sqrt(lengthSq);
+			for (int i = 0; i < 4; ++i)  value.v[i] *= scale;
+		}
+		for (int i = 0; i < numValues; ++i)
+		{
+			if (std::abs(value.v[i] - original.v[i]) > error)  return false;
+		}
+		return true;
+	}
+
+
+	// Binary file helpers, counts are in elements
+	template <typename T>
+	void Write(std::ofstream& file, const T* data, size_t count)
+	{
+		file.write(reinterpret_cast<const char*>(data), count * sizeof(T));
+	}
+
+	template <typename T>
+	bool Read(std::ifstream& file, T* data, size_t count)
+	{
+		return static_cast<bool>(file.read(reinterpret_cast<char*>(data), count * sizeof(T)));
+	}
+}
+
+
+/*-----------------------------------------------------------------------------------------
+    Poses
+-----------------------------------------------------------------------------------------*/
+
+void CAnimationPose::Resize(unsigned int numNodes)
+{
+	mNumNodes = numNodes;
+	mStride = (numNodes + 3) & ~3u;
+	mData.assign(NumChannels * mStride, 0.0f);
+	std::fill_n(Channel(RotationW), mStride, 1.0f);
+	std::fill_n(Channel(ScaleX), mStride * 3, 1.0f);
+}
+
+void CAnimationPose::SetNode(unsigned int node, const CVector3& position, const CQuaternion& rotation, const CVector3& scale)
+{
+	const float values[NumChannels] = { rotation.x, rotation.y, rotation.z, rotation.w, position.x, position.y, position.z, scale.x, scale.y, scale.z };
+	for (int channel = 0; channel < NumChannels; ++channel)  mData[channel * mStride + node] = values[channel];
+}
+
+CMatrix4x4 CAnimationPose::NodeMatrix(unsigned int node) const
+{
+	auto value = [&](EChannel channel) { return mData[channel * mStride + node]; };
+	return MatrixFromTransform({ value(PositionX), value(PositionY), value(PositionZ) },
+	                           { value(RotationX), value(RotationY), value(RotationZ), value(RotationW) },
+	                           { value(ScaleX), value(ScaleY), value(ScaleZ) });
+}
+
+
+/*-----------------------------------------------------------------------------------------
+    Clips
+-----------------------------------------------------------------------------------------*/
+
+CAnimationClip::CAnimationClip(const std::string& name, float duration, const std::vector<CMatrix4x4>& restMatrices,
+                               const std::vector<AnimationKeys>& keys, float sampleRate)
+	: mName(name), mDuration(std::max(duration, 0.0f))
+{
+	if (keys.size() != restMatrices.size())  throw std::runtime_error("Animation " + name + " doesn't match its node hierarchy");
+
+	mNumNodes = static_cast<unsigned int>(restMatrices.size());
+	mStride = (mNumNodes + 3) & ~3u;
+
+	// Evenly spaced frames, the last one exactly at the end of the clip
+	mNumFrames = std::max(2u, static_cast<unsigned int>(std::ceil(mDuration * sampleRate)) + 1);
+	mSampleRate = mDuration > 0.0f ? (mNumFrames - 1) / mDuration : 0.0f;
+
+	// Start every frame at the identity, which the padding nodes keep
+	CAnimationPose identity;
+	identity.Resize(mNumNodes);
+	mFrames.resize(static_cast<size_t>(mNumFrames) * FrameSize());
+	for (unsigned int frame = 0; frame < mNumFrames; ++frame)
+	{
+		std::copy_n(identity.Channel(CAnimationPose::RotationX), FrameSize(), &mFrames[frame * FrameSize()]);
+	}
+
+	for (unsigned int node = 0; node < mNumNodes; ++node)
+	{
+		CVector3 restPosition, restScale;
+		CQuaternion restRotation;
+		DecomposeMatrix(restMatrices[node], restPosition, restRotation, restScale);
+
+		const auto& nodeKeys = keys[node];
+		auto previousRotation = restRotation;
+		for (unsigned int frame = 0; frame < mNumFrames; ++frame)
+		{
+			const auto time = mSampleRate > 0.0f ? frame / mSampleRate : 0.0f;
+			const auto position = InterpolateKeys(nodeKeys.positions, time, restPosition, Lerp);
+			const auto scale = InterpolateKeys(nodeKeys.scales, time, restScale, Lerp);
+			auto rotation = Normalise(InterpolateKeys(nodeKeys.rotations, time, restRotation, Slerp));
+
+			// Keep each frame in the same half of the quaternion sphere as the frame before, so sampling can interpolate
+			// the components directly
+			if (Dot(rotation, previousRotation) < 0.0f)  rotation = { -rotation.x, -rotation.y, -rotation.z, -rotation.w };
+			previousRotation = rotation;
+
+			const float values[CAnimationPose::NumChannels] = { rotation.x, rotation.y, rotation.z, rotation.w,
+			                                                    position.x, position.y, position.z, scale.x, scale.y, scale.z };
+			for (int channel = 0; channel < CAnimationPose::NumChannels; ++channel)
+			{
+				mFrames[frame * FrameSize() + channel * mStride + node] = values[channel];
+			}
+		}
+	}
+}
+
+
+void CAnimationClip::Sample(float time, bool loop, CAnimationPose& pose) const
+{
+	if (pose.NumNodes() != mNumNodes)  pose.Resize(mNumNodes);
+
+	const auto frame = ClipTime(time, mDuration, loop) * mSampleRate;
+	if (mCompressed)
+	{
+		SampleCompressed(frame, pose);
+	}
+	else
+	{
+		// The two frames either side of the time
+		const auto frame0 = std::min(static_cast<unsigned int>(frame), mNumFrames - 2);
+		const auto t = _mm_set1_ps(std::min(frame - frame0, 1.0f));
+
+		// Interpolate every channel of the frames, which have the pose's layout
+		const auto count = FrameSize();
+		const auto a = &mFrames[frame0 * count];
+		const auto b = a + count;
+		auto out = pose.Channel(CAnimationPose::RotationX);
+		for (unsigned int i = 0; i < count; i += 4)
+		{
+			_mm_storeu_ps(out + i, LerpSSE(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i), t));
+		}
+	}
+
+	// The frames are in the same hemisphere, so that is an nlerp once the rotations are normalised
+	for (unsigned int i = 0; i < mStride; i += 4)
+	{
+		StoreRotations(pose, i, NormaliseRotations(LoadRotations(pose, i)));
+	}
+}
+
+
+/*-----------------------------------------------------------------------------------------
+    Compression
+-----------------------------------------------------------------------------------------*/
+
+// A chunk holds each track in turn: a 64-bit mask of the frames in the chunk that have keys, then those keys.
+// Every track has a key on the first and last frame of each chunk, so sampling never needs another chunk
+
+void CAnimationClip::Compress(const AnimationCompression& settings)
+{
+	if (mCompressed) return;
+
+	const auto frameSize = FrameSize();
+	auto value = [&](unsigned int frame, unsigned int channel, unsigned int node) { return mFrames[frame * frameSize + channel * mStride + node]; };
+
+	// Tracks that stay within the error of their first frame keep that value throughout
+	mConstantPose.assign(mFrames.begin(), mFrames.begin() + frameSize);
+	mTracks.clear();
+	for (unsigned int node = 0; node < mNumNodes; ++node)
+	{
+		for (auto channel : { CAnimationPose::RotationX, CAnimationPose::PositionX, CAnimationPose::ScaleX })
+		{
+			const auto numValues = TrackValues(channel);
+			const auto error = TrackError(channel, settings);
+
+			Track track = { static_cast<uint16_t>(node), static_cast<uint16_t>(channel), {}, {} };
+			auto constant = true;
+			for (int i = 0; i < numValues; ++i)
+			{
+				auto minimum = value(0, channel + i, node);
+				auto maximum = minimum;
+				for (unsigned int frame = 1; frame < mNumFrames; ++frame)
+				{
+					minimum = std::min(minimum, value(frame, channel + i, node));
+					maximum = std::max(maximum, value(frame, channel + i, node));
+				}
+				constant = constant && std::max(maximum - value(0, channel + i, node), value(0, channel + i, node) - minimum) <= error;
+				if (i < 3)
+				{
+					track.minimum[i] = minimum;
+					track.step[i] = (maximum - minimum) / 65535.0f;
+				}
+			}
+			if (!constant)  mTracks.push_back(track);
+		}
+	}
+
+	// Each chunk keeps the fewest keys of each track that interpolate to within the error of every frame. The error
+	// is measured after quantisation, so includes both
+	mNumChunks = (mNumFrames - 1 + ChunkIntervals - 1) / ChunkIntervals;
+	mChunkData.clear();
+	mChunkOffsets.assign(1, 0);
+
+	std::vector<CompressedKey> keys;
+	std::vector<CompressedKey> quantised(ChunkIntervals + 1);
+	std::vector<TrackValue> original(ChunkIntervals + 1);
+	std::vector<TrackValue> decoded(ChunkIntervals + 1);
+	for (unsigned int chunk = 0; chunk < mNumChunks; ++chunk)
+	{
+		const auto firstFrame = chunk * ChunkIntervals;
+		const auto numChunkFrames = std::min(static_cast<unsigned int>(ChunkIntervals), mNumFrames - 1 - firstFrame) + 1;
+
+		for (const auto& track : mTracks)
+		{
+			const auto numValues = TrackValues(track.channel);
+			for (unsigned int frame = 0; frame < numChunkFrames; ++frame)
+			{
+				for (int i = 0; i < numValues; ++i)  original[frame].v[i] = value(firstFrame + frame, track.channel + i, track.node);
+				quantised[frame] = QuantiseKey(track, original[frame]);
+				decoded[frame] = DecodeKey(track, quantised[frame]);
+			}
+
+			// Whether interpolating from key frame a to b recreates the frames between them
+			const auto error = TrackError(track.channel, settings);
+			auto interpolates = [&](unsigned int a, unsigned int b)
+			{
+				for (auto frame = a + 1; frame < b; ++frame)
+				{
+					const auto t = static_cast<float>(frame - a) / (b - a);
+					if (!WithinError(track, InterpolateValues(track, decoded[a], decoded[b], t), original[frame], error))  return false;
+				}
+				return true;
+			};
+
+			// Extend each key as far as possible
+			keys.assign(1, quantised[0]);
+			uint64_t frameMask = 1;
+			unsigned int key = 0;
+			while (key < numChunkFrames - 1)
+			{
+				auto next = key + 1;
+				while (next + 1 < numChunkFrames && interpolates(key, next + 1))  ++next;
+				keys.push_back(quantised[next]);
+				frameMask |= uint64_t(1) << next;
+				key = next;
+			}
+
+			// The mask of frames with keys, then the keys
+			const auto start = mChunkData.size();
+			mChunkData.resize(start + sizeof(frameMask) + keys.size() * sizeof(CompressedKey));
+			std::memcpy(&mChunkData[start], &frameMask, sizeof(frameMask));
+			std::memcpy(&mChunkData[start + sizeof(frameMask)], keys.data(), keys.size() * sizeof(CompressedKey));
+		}
+		mChunkOffsets.push_back(mChunkData.size());
+	}
+
+	mCompressed = true;
+	std::vector<float>().swap(mFrames);
+}
+
+
+void CAnimationClip::SampleCompressed(float frame, CAnimationPose& pose) const
+{
+	std::copy(mConstantPose.begin(), mConstantPose.end(), pose.Channel(CAnimationPose::RotationX));
+
+	const auto chunk = std::min(static_cast<unsigned int>(frame) / ChunkIntervals, mNumChunks - 1);
+	const auto chunkFrame = frame - static_cast<float>(chunk * ChunkIntervals);
+
+	std::shared_ptr<const std::vector<unsigned char>> holder;
+	auto data = ChunkData(chunk, holder);
+	if (!data) return;
+
+	// The frames either side of the time, the keys of every track are found from them
+	const auto lastFrame = std::min(static_cast<unsigned int>(ChunkIntervals), mNumFrames - 1 - chunk * ChunkIntervals);
+	const auto frame0 = std::min(static_cast<unsigned int>(chunkFrame), lastFrame - 1);
+
+	for (const auto& track : mTracks)
+	{
+		uint64_t frameMask;
+		std::memcpy(&frameMask, data, sizeof(frameMask));
+		const auto keys = reinterpret_cast<const CompressedKey*>(data + sizeof(frameMask));
+		data += sizeof(frameMask) + std::bitset<64>(frameMask).count() * sizeof(CompressedKey);
+
+		// The keys either side of the frame. There are keys on the first and last frames of the chunk
+		auto keyFrame0 = frame0;
+		while (!(frameMask >> keyFrame0 & 1))  --keyFrame0;
+		auto keyFrame1 = frame0 + 1;
+		while (!(frameMask >> keyFrame1 & 1))  ++keyFrame1;
+		const auto key = keys + KeysBefore(frameMask, keyFrame0);
+		const auto t = std::min(std::max((chunkFrame - keyFrame0) / (keyFrame1 - keyFrame0), 0.0f), 1.0f);
+
+		const auto result = InterpolateValues(track, DecodeKey(track, key[0]), DecodeKey(track, key[1]), t);
+		for (int i = 0; i < TrackValues(track.channel); ++i)
+		{
+			pose.Channel(static_cast<CAnimationPose::EChannel>(track.channel + i))[track.node] = result.v[i];
+		}
+	}
+}
+
+
+/*-----------------------------------------------------------------------------------------
+    Files and streaming
+-----------------------------------------------------------------------------------------*/
+
+struct CAnimationClip::Stream
+{
+	std::ifstream file;
+	uint64_t      dataStart; // File position of the first chunk
+
+	// Loaded chunks (nullptr if not), only read and written with std::atomic_load / atomic_store so sampling a loaded
+	// chunk never waits. When each was last used, for dropping the oldest
+	std::vector<std::shared_ptr<const std::vector<unsigned char>>> chunks;
+	std::unique_ptr<std::atomic<unsigned int>[]> lastUsed;
+	std::atomic<unsigned int>                    useCount{ 0 };
+
+	// Held while reading the file or changing which chunks are loaded
+	std::mutex fileMutex;
+
+	// The chunk after the one being sampled is read on its own thread, one at a time. Declared last so it is waited for
+	// before the rest of the stream is destroyed
+	std::atomic<bool> readingAhead{ false };
+	std::future<void> readAhead;
+
+	// Read a chunk unless it is already loaded, dropping the least recently used chunk if there are too many. nullptr if
+	// the chunk can't be read
+	std::shared_ptr<const std::vector<unsigned char>> Read(unsigned int chunk, const std::vector<uint64_t>& chunkOffsets);
+};
+
+CAnimationClip::~CAnimationClip() = default;
+
+
+std::shared_ptr<const std::vector<unsigned char>> CAnimationClip::Stream::Read(unsigned int chunk, const std::vector<uint64_t>& chunkOffsets)
+{
+	std::lock_guard<std::mutex> lock(fileMutex);
+
+	// Another thread may have read it while this one waited
+	auto data = std::atomic_load(&chunks[chunk]);
+	if (data)  return data;
+
+	// Make room by dropping the least recently used chunk. Threads still sampling it hold their own reference
+	const auto numChunks = static_cast<unsigned int>(chunks.size());
+	unsigned int numLoaded = 0;
+	auto oldest = chunk;
+	for (unsigned int c = 0; c < numChunks; ++c)
+	{
+		if (!std::atomic_load(&chunks[c])) continue;
+		++numLoaded;
+		if (oldest == chunk || lastUsed[c] < lastUsed[oldest])  oldest = c;
+	}
+	if (numLoaded >= StreamedChunks)  std::atomic_store(&chunks[oldest], std::shared_ptr<const std::vector<unsigned char>>());
+
+	auto read = std::make_shared<std::vector<unsigned char>>(chunkOffsets[chunk + 1] - chunkOffsets[chunk]);
+	file.clear();
+	file.seekg(dataStart + chunkOffsets[chunk]);
+	file.read(reinterpret_cast<char*>(read->data()), read->size());
+	if (!file)  return nullptr;
+
+	data = std::move(read);
+	lastUsed[chunk] = ++useCount;
+	std::atomic_store(&chunks[chunk], data);
+	return data;
+}
+
+
+size_t CAnimationClip::MemoryBytes() const
+{
+	if (!mCompressed)  return mFrames.size() * sizeof(float);
+
+	auto bytes = mConstantPose.size() * sizeof(float) + mTracks.size() * sizeof(Track) + mChunkOffsets.size() * sizeof(uint64_t);
+	if (!mStream)  return bytes + mChunkData.size();
+
+	for (const auto& chunk : mStream->chunks)
+	{
+		if (const auto data = std::atomic_load(&chunk))  bytes += data->size();
+	}
+	return bytes;
+}
+
+
+const unsigned char* CAnimationClip::ChunkData(unsigned int chunk, std::shared_ptr<const std::vector<unsigned char>>& holder) const
+{
+	if (!mStream)  return &mChunkData[mChunkOffsets[chunk]];
+
+	// Only a chunk that isn't loaded yet waits for the file, which read ahead usually avoids
+	auto& stream = *mStream;
+	holder = std::atomic_load(&stream.chunks[chunk]);
+	if (!holder)  holder = stream.Read(chunk, mChunkOffsets);
+	if (!holder)  return nullptr;
+	stream.lastUsed[chunk] = ++stream.useCount;
+
+	// Start reading the chunk that plays next (the first one when looping) if it isn't loaded and no read ahead is running
+	const auto next = (chunk + 1) % mNumChunks;
+	if (next != chunk && !std::atomic_load(&stream.chunks[next]) && !stream.readingAhead.exchange(true))
+	{
+		stream.readAhead = std::async(std::launch::async, [&stream, next, this]
+		{
+			stream.Read(next, mChunkOffsets);
+			stream.readingAhead = false;
+		});
+	}
+	return holder->data();
+}
+
+
+void CAnimationClip::Save(const std::string& fileName) const
+{
+	if (!mCompressed)  throw std::runtime_error("Animation " + mName + " must be compressed to be saved");
+
+	std::ofstream file(fileName, std::ios::binary);
+	if (!file)  throw std::runtime_error("Error creating animation file " + fileName);
+
+	const uint32_t header[] = { AnimationFileId, AnimationFileVersion, static_cast<uint32_t>(mName.size()) };
+	Write(file, header, 3);
+	Write(file, mName.data(), mName.size());
+	const float times[] = { mDuration, mSampleRate };
+	Write(file, times, 2);
+	const uint32_t sizes[] = { mNumNodes, mNumFrames, mNumChunks, static_cast<uint32_t>(mTracks.size()) };
+	Write(file, sizes, 4);
+	Write(file, mConstantPose.data(), mConstantPose.size());
+	Write(file, mTracks.data(), mTracks.size());
+	Write(file, mChunkOffsets.data(), mChunkOffsets.size());
+
+	for (unsigned int chunk = 0; chunk < mNumChunks; ++chunk)
+	{
+		std::shared_ptr<const std::vector<unsigned char>> holder;
+		const auto data = ChunkData(chunk, holder);
+		if (!data)  throw std::runtime_error("Error reading animation " + mName);
+		Write(file, data, mChunkOffsets[chunk + 1] - mChunkOffsets[chunk]);
+	}
+	if (!file)  throw std::runtime_error("Error writing animation file " + fileName);
+}
+
+
+std::shared_ptr<CAnimationClip> CAnimationClip::Load(const std::string& fileName, bool stream)
+{
+	std::ifstream file(fileName, std::ios::binary);
+	if (!file)  throw std::runtime_error("Error opening animation file " + fileName);
+	const auto error = std::runtime_error("Error reading animation file " + fileName);
+
+	uint32_t header[3];
+	if (!Read(file, header, 3) || header[0] != AnimationFileId || header[1] != AnimationFileVersion)  throw error;
+
+	std::shared_ptr<CAnimationClip> clip(new CAnimationClip());
+	clip->mName.resize(header[2]);
+	float times[2];
+	uint32_t sizes[4];
+	if (!Read(file, &clip->mName[0], header[2]) || !Read(file, times, 2) || !Read(file, sizes, 4))  throw error;
+
+	clip->mDuration = times[0];
+	clip->mSampleRate = times[1];
+	clip->mNumNodes = sizes[0];
+	clip->mStride = (clip->mNumNodes + 3) & ~3u;
+	clip->mNumFrames = sizes[1];
+	clip->mNumChunks = sizes[2];
+	clip->mCompressed = true;
+	if (clip->mNumFrames < 2 || clip->mNumChunks != (clip->mNumFrames - 1 + ChunkIntervals - 1) / ChunkIntervals)  throw error;
+
+	clip->mConstantPose.resize(clip->FrameSize());
+	clip->mTracks.resize(sizes[3]);
+	clip->mChunkOffsets.resize(clip->mNumChunks + 1);
+	if (!Read(file, clip->mConstantPose.data(), clip->mConstantPose.size()) || !Read(file, clip->mTracks.data(), clip->mTracks.size()) ||
+	    !Read(file, clip->mChunkOffsets.data(), clip->mChunkOffsets.size()))  throw error;
+	for (const auto& track : clip->mTracks)
+	{
+		if (track.node >= clip->mNumNodes || TrackValues(track.channel) == 0)  throw error;
+	}
+
+	if (stream)
+	{
+		clip->mStream = std::make_unique<Stream>();
+		clip->mStream->dataStart = static_cast<uint64_t>(file.tellg());
+		clip->mStream->chunks.resize(clip->mNumChunks);
+		clip->mStream->lastUsed = std::make_unique<std::atomic<unsigned int>[]>(clip->mNumChunks);
+		clip->mStream->file = std::move(file);
+	}
+	else
+	{
+		clip->mChunkData.resize(clip->mChunkOffsets.back());
+		if (!Read(file, clip->mChunkData.data(), clip->mChunkData.size()))  throw error;
+	}
+	return clip;
+}
+
+
+/*-----------------------------------------------------------------------------------------
+    Blending
+-----------------------------------------------------------------------------------------*/
+
+void BlendPoses(const CAnimationPose& a, const CAnimationPose& b, float weight, const float* nodeWeights, CAnimationPose& out)
+{
+	if (out.NumNodes() != a.NumNodes())  out.Resize(a.NumNodes());
+
+	const auto signMask = _mm_set1_ps(-0.0f);
+	for (unsigned int i = 0; i < out.Stride(); i += 4)
+	{
+		const auto t = NodeWeights(weight, nodeWeights, i);
+
+		// Rotations the shorter way round: flip b where it is in the other hemisphere from a, then nlerp
+		const auto qa = LoadRotations(a, i);
+		auto qb = LoadRotations(b, i);
+		const auto flip = _mm_and_ps(DotRotations(qa, qb), signMask);
+		qb = { _mm_xor_ps(qb.x, flip), _mm_xor_ps(qb.y, flip), _mm_xor_ps(qb.z, flip), _mm_xor_ps(qb.w, flip) };
+		const auto q = NormaliseRotations({ LerpSSE(qa.x, qb.x, t), LerpSSE(qa.y, qb.y, t), LerpSSE(qa.z, qb.z, t), LerpSSE(qa.w, qb.w, t) });
+
+		for (int channel = CAnimationPose::PositionX; channel < CAnimationPose::NumChannels; ++channel)
+		{
+			const auto c = static_cast<CAnimationPose::EChannel>(channel);
+			_mm_storeu_ps(out.Channel(c) + i, LerpSSE(_mm_loadu_ps(a.Channel(c) + i), _mm_loadu_ps(b.Channel(c) + i), t));
+		}
+		StoreRotations(out, i, q);
+	}
+}
+
+
+void AddPose(const CAnimationPose& base, const CAnimationPose& additive, const CAnimationPose& reference, float weight,
+             const float* nodeWeights, CAnimationPose& out)
+{
+	if (out.NumNodes() != base.NumNodes())  out.Resize(base.NumNodes());
+
+	const auto one = _mm_set1_ps(1.0f);
+	const auto signMask = _mm_set1_ps(-0.0f);
+	for (unsigned int i = 0; i < out.Stride(); i += 4)
+	{
+		const auto t = NodeWeights(weight, nodeWeights, i);
+
+		// Rotation from the reference to the additive pose, d = conjugate(r) * a
+		const auto r = LoadRotations(reference, i);
+		const auto a = LoadRotations(additive, i);
+		QuaternionSoA d;
+		d.x = _mm_sub_ps(_mm_add_ps(_mm_mul_ps(r.w, a.x), _mm_mul_ps(r.z, a.y)), _mm_add_ps(_mm_mul_ps(r.x, a.w), _mm_mul_ps(r.y, a.z)));
+		d.y = _mm_sub_ps(_mm_add_ps(_mm_mul_ps(r.w, a.y), _mm_mul_ps(r.x, a.z)), _mm_add_ps(_mm_mul_ps(r.y, a.w), _mm_mul_ps(r.z, a.x)));
+		d.z = _mm_sub_ps(_mm_add_ps(_mm_mul_ps(r.w, a.z), _mm_mul_ps(r.y, a.x)), _mm_add_ps(_mm_mul_ps(r.z, a.w), _mm_mul_ps(r.x, a.y)));
+		d.w = _mm_add_ps(_mm_add_ps(_mm_mul_ps(r.w, a.w), _mm_mul_ps(r.x, a.x)), _mm_add_ps(_mm_mul_ps(r.y, a.y), _mm_mul_ps(r.z, a.z)));
+
+		// Scale it by the weight: nlerp from the identity, the shorter way round
+		const auto flip = _mm_and_ps(d.w, signMask);
+		d = NormaliseRotations({ _mm_mul_ps(_mm_xor_ps(d.x, flip), t), _mm_mul_ps(_mm_xor_ps(d.y, flip), t), _mm_mul_ps(_mm_xor_ps(d.z, flip), t),
+		                         LerpSSE(one, _mm_xor_ps(d.w, flip), t) });
+
+		// Then apply it after the base rotation, q = b * d, as the reference was turned into the additive pose
+		const auto b = LoadRotations(base, i);
+		QuaternionSoA q;
+		q.x = _mm_add_ps(_mm_add_ps(_mm_mul_ps(b.w, d.x), _mm_mul_ps(b.x, d.w)), _mm_sub_ps(_mm_mul_ps(b.y, d.z), _mm_mul_ps(b.z, d.y)));
+		q.y = _mm_add_ps(_mm_sub_ps(_mm_mul_ps(b.w, d.y), _mm_mul_ps(b.x, d.z)), _mm_add_ps(_mm_mul_ps(b.y, d.w), _mm_mul_ps(b.z, d.x)));
+		q.z = _mm_add_ps(_mm_add_ps(_mm_mul_ps(b.w, d.z), _mm_mul_ps(b.x, d.y)), _mm_sub_ps(_mm_mul_ps(b.z, d.w), _mm_mul_ps(b.y, d.x)));
+		q.w = _mm_sub_ps(_mm_sub_ps(_mm_mul_ps(b.w, d.w), _mm_mul_ps(b.x, d.x)), _mm_add_ps(_mm_mul_ps(b.y, d.y), _mm_mul_ps(b.z, d.z)));
+
+		// Positions move by the difference, scales change by the ratio
+		for (int channel = CAnimationPose::PositionX; channel <= CAnimationPose::PositionZ; ++channel)
+		{
+			const auto c = static_cast<CAnimationPose::EChannel>(channel);
+			const auto difference = _mm_sub_ps(_mm_loadu_ps(additive.Channel(c) + i), _mm_loadu_ps(reference.Channel(c) + i));
+			_mm_storeu_ps(out.Channel(c) + i, _mm_add_ps(_mm_loadu_ps(base.Channel(c) + i), _mm_mul_ps(difference, t)));
+		}
+		for (int channel = CAnimationPose::ScaleX; channel <= CAnimationPose::ScaleZ; ++channel)
+		{
+			const auto c = static_cast<CAnimationPose::EChannel>(channel);
+			const auto ratio = _mm_div_ps(_mm_loadu_ps(additive.Channel(c) + i), _mm_loadu_ps(reference.Channel(c) + i));
+			_mm_storeu_ps(out.Channel(c) + i, _mm_mul_ps(_mm_loadu_ps(base.Channel(c) + i), LerpSSE(one, ratio, t)));
+		}
+		StoreRotations(out, i, NormaliseRotations(q));
+	}
+}
+
+
+/*-----------------------------------------------------------------------------------------
+    Animator
+-----------------------------------------------------------------------------------------*/
+
+CAnimator::CAnimator(const std::vector<CMatrix4x4>& restMatrices)
+{
+	const auto numNodes = static_cast<unsigned int>(restMatrices.size());
+	mRestPose.Resize(numNodes);
+	for (unsigned int node = 0; node < numNodes; ++node)
+	{
+		CVector3 position, scale;
+		CQuaternion rotation;
+		DecomposeMatrix(restMatrices[node], position, rotation, scale);
+		mRestPose.SetNode(node, position, rotation, scale);
+	}
+	mPose = mRestPose;
+	mLayerPose = mRestPose;
+	mFadePose = mRestPose;
+	mReferencePose = mRestPose;
+
+	mLayers.emplace_back();
+}
+
+
+unsigned int CAnimator::AddLayer(EAnimationBlend blend, float weight)
+{
+	mLayers.emplace_back();
+	mLayers.back().blend = blend;
+	mLayers.back().weight = weight;
+	return static_cast<unsigned int>(mLayers.size() - 1);
+}
+
+void CAnimator::Play(std::shared_ptr<const CAnimationClip> clip, unsigned int layer, float fadeTime, bool loop)
+{
+	if (clip && clip->NumNodes() != NumNodes())  throw std::runtime_error("Animation " + clip->Name() + " is for a different node hierarchy");
+
+	// Fade from the current clip, or fade in / out if there is no clip on one side
+	auto& l = mLayers[layer];
+	if (fadeTime > 0.0f && (l.clip || clip))
+	{
+		l.previousClip = l.clip;
+		l.previousTime = l.time;
+		l.previousLoop = l.loop;
+		l.fade = 0.0f;
+		l.fadeTime = fadeTime;
+	}
+	else
+	{
+		l.previousClip.reset();
+		l.fadeTime = 0.0f;
+	}
+
+	l.clip = std::move(clip);
+	l.time = 0.0f;
+	l.loop = loop;
+}
+
+void CAnimator::SetMask(unsigned int layer, const std::vector<float>& nodeWeights)
+{
+	auto& mask = mLayers[layer].mask;
+	mask.clear();
+	if (nodeWeights.empty()) return;
+
+	// Padding nodes are never blended
+	mask.assign(mRestPose.Stride(), 0.0f);
+	std::copy_n(nodeWeights.begin(), std::min<size_t>(nodeWeights.size(), NumNodes()), mask.begin());
+}
+
+
+void CAnimator::Update(float frameTime)
+{
+	for (auto& layer : mLayers)
+	{
+		if (layer.clip)          layer.time = ClipTime(layer.time + frameTime * layer.speed, layer.clip->Duration(), layer.loop);
+		if (layer.previousClip)  layer.previousTime = ClipTime(layer.previousTime + frameTime * layer.speed, layer.previousClip->Duration(), layer.previousLoop);
+
+		if (layer.fadeTime > 0.0f)
+		{
+			layer.fade += frameTime;
+			if (layer.fade >= layer.fadeTime)
+			{
+				layer.previousClip.reset();
+				layer.fadeTime = 0.0f;
+			}
+		}
+	}
+}
+
+
+void CAnimator::Evaluate(std::vector<CMatrix4x4>& nodeMatrices)
+{
+	mPose = mRestPose;
+
+	for (const auto& layer : mLayers)
+	{
+		if (!layer.clip && !layer.previousClip) continue;
+
+		const auto fade = layer.fadeTime > 0.0f ? std::min(layer.fade / layer.fadeTime, 1.0f) : 1.0f;
+		const auto mask = layer.mask.empty() ? nullptr : layer.mask.data();
+
+		if (layer.blend == AnimationBlend_Override)
+		{
+			// Crossfade between the clips, or fade the layer's weight if there is only one
+			auto weight = layer.weight;
+			if (layer.clip && layer.previousClip)
+			{
+				layer.previousClip->Sample(layer.previousTime, layer.previousLoop, mFadePose);
+				layer.clip->Sample(layer.time, layer.loop, mLayerPose);
+				BlendPoses(mFadePose, mLayerPose, fade, nullptr, mLayerPose);
+			}
+			else if (layer.clip)
+			{
+				layer.clip->Sample(layer.time, layer.loop, mLayerPose);
+				weight *= fade;
+			}
+			else
+			{
+				layer.previousClip->Sample(layer.previousTime, layer.previousLoop, mLayerPose);
+				weight *= 1.0f - fade;
+			}
+
+			// A full weight layer over everything hides the layers below
+			if (weight >= 1.0f && !mask)  std::swap(mPose, mLayerPose);
+			else                          BlendPoses(mPose, mLayerPose, weight, mask, mPose);
+		}
+		else
+		{
+			// Each clip adds its change from its own first frame, faded in and out
+			auto add = [&](const CAnimationClip& clip, float time, bool loop, float weight)
+			{
+				clip.Sample(time, loop, mLayerPose);
+				clip.Sample(0.0f, false, mReferencePose);
+				AddPose(mPose, mLayerPose, mReferencePose, weight, mask, mPose);
+			};
+			if (layer.previousClip)  add(*layer.previousClip, layer.previousTime, layer.previousLoop, layer.weight * (1.0f - fade));
+			if (layer.clip)          add(*layer.clip, layer.time, layer.loop, layer.weight * fade);
+		}
+	}
+
+	const auto numNodes = std::min(NumNodes(), static_cast<unsigned int>(nodeMatrices.size()));
+	for (unsigned int node = 1; node < numNodes; ++node)
+	{
+		nodeMatrices[node] = mPose.NodeMatrix(node);
+	}
+}
@@ -0,0 +1,275 @@
+//--------------------------------------------------------------------------------------
+// Skeletal animation - clips sampled into node poses and blended in layers
+//--------------------------------------------------------------------------------------
+// Code in .cpp file
+//
+// A clip holds the local transform (rotation, position, scale) of every node of a mesh's hierarchy. Keys are
+// resampled at import to a fixed rate, so sampling never searches for keys: it interpolates two frames. Each
+// frame is stored as structure-of-arrays (all the rotation x's, then all the rotation y's...), padded to a
+// multiple of 4 nodes, so sampling and blending work on four nodes at a time with SSE. Poses use the same layout.
+//
+// Clips can then be compressed to about a tenth of the size. Tracks (the rotation, position or scale of one node)
+// that don't change are stored once. The others are split into chunks of frames and only keep the frames that
+// can't be interpolated from their neighbours within an error limit. Rotations are quantised to 16 bits for each
+// of their smallest three components, positions and scales to 16 bits across their range. Each key holds its frame
+// and value together, and a chunk holds the keys of all tracks one after another, so sampling reads one small
+// block of memory. Compressed clips can be saved, and long ones streamed from the file a chunk at a time.
+//
+// A CAnimator plays clips on one model in layers. Each layer plays a clip, crossfading from the last one when
+// a new clip is played, and is blended over the layers below it: an override layer replaces them, an additive
+// layer adds how far its clip has moved from its first frame. Layers can be limited to some nodes with a mask
+// (e.g. the upper body). The result is written to the model's node matrices, as used by CMesh::Record.
+// Animators share clips and own all their working memory, so different animators can be updated on different
+// threads at once. No graphics API is used here.
+
+#pragma once
+
+#include "CVector3.h"
+#include "CMatrix4x4.h"
+#include "CQuaternion.h"
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+
+// Local transforms of a set of nodes, in structure-of-arrays form
+class CAnimationPose
+{
+public:
+	enum EChannel { RotationX, RotationY, RotationZ, RotationW, PositionX, PositionY, PositionZ, ScaleX, ScaleY, ScaleZ, NumChannels };
+
+	// Set the number of nodes, all at the identity transform
+	void Resize(unsigned int numNodes);
+
+	unsigned int NumNodes() const { return mNumNodes; }
+
+	// Nodes stored per channel, a multiple of 4. The padding nodes hold the identity transform
+	unsigned int Stride() const { return mStride; }
+
+	float*       Channel(EChannel channel)       { return &mData[channel * mStride]; }
+	const float* Channel(EChannel channel) const { return &mData[channel * mStride]; }
+
+	void SetNode(unsigned int node, const CVector3& position, const CQuaternion& rotation, const CVector3& scale);
+
+	// Local matrix of a node
+	CMatrix4x4 NodeMatrix(unsigned int node) const;
+
+private:
+	unsigned int       mNumNodes = 0;
+	unsigned int       mStride = 0;
+	std::vector<float> mData;
+};
+
+
+// Keys of one node from an imported animation, times in seconds. Empty arrays leave that part of the node at its
+// rest transform
+struct AnimationKeys
+{
+	std::vector<std::pair<float, CVector3>>    positions;
+	std::vector<std::pair<float, CQuaternion>> rotations;
+	std::vector<std::pair<float, CVector3>>    scales;
+};
+
+
+// Largest error compression may add to any value of a sampled pose (see CAnimationClip::Compress)
+struct AnimationCompression
+{
+	float rotationError = 0.0005f; // Quaternion components, about 0.06 degrees
+	float positionError = 0.0005f; // In the units of the mesh
+	float scaleError    = 0.0005f;
+};
+
+
+class CAnimationClip
+{
+public:
+	// Frames per second the keys are resampled to
+	static const float DefaultSampleRate;
+
+	// Frames in each chunk of a compressed clip, not counting the last one which is also the first of the next chunk
+	static const unsigned int ChunkIntervals = 32;
+
+	// Build a clip for a hierarchy of nodes. restMatrices are the local matrices of the nodes when nothing is playing
+	// (the mesh's default matrices) and keys has one entry for each node. Throws a std::runtime_error if the sizes differ
+	CAnimationClip(const std::string& name, float duration, const std::vector<CMatrix4x4>& restMatrices,
+	               const std::vector<AnimationKeys>& keys, float sampleRate = DefaultSampleRate);
+
+	// Load a clip written by Save. A streamed clip keeps the file open and keeps the few most recently used chunks in
+	// memory. Sampling a chunk starts reading the next one on a background thread, so only a jump to a chunk that isn't
+	// loaded waits for the file. Throws a std::runtime_error if the file can't be read
+	static std::shared_ptr<CAnimationClip> Load(const std::string& fileName, bool stream = false);
+
+	~CAnimationClip();
+
+	const std::string& Name() const { return mName; }
+	float              Duration() const { return mDuration; }
+	unsigned int       NumNodes() const { return mNumNodes; }
+	unsigned int       NumFrames() const { return mNumFrames; }
+	bool               IsCompressed() const { return mCompressed; }
+	bool               IsStreamed() const { return mStream != nullptr; }
+
+	// Memory used by the clip's frames, only counting the chunks currently loaded if streamed
+	size_t MemoryBytes() const;
+
+	// Sample the clip at a time in seconds into a pose (resized to the clip's nodes). Times outside the clip wrap
+	// around if looping and are clamped if not. Safe to call from several threads at once
+	void Sample(float time, bool loop, CAnimationPose& pose) const;
+
+
+	// Replace the frames with the compressed format, keeping every sampled value within the given errors of the
+	// original. Do this before the clip is shared, it is not thread safe
+	void Compress(const AnimationCompression& settings = AnimationCompression());
+
+	// Write a compressed clip to a file. Throws a std::runtime_error if the clip isn't compressed or on failure
+	void Save(const std::string& fileName) const;
+
+
+private:
+	// Clips read from files are filled in by Load
+	CAnimationClip() = default;
+
+	// Floats in each frame
+	unsigned int FrameSize() const { return CAnimationPose::NumChannels * mStride; }
+
+	// Sample a compressed clip at a frame (not necessarily a whole number), rotations not normalised
+	void SampleCompressed(float frame, CAnimationPose& pose) const;
+
+	// Data of a compressed chunk. A streamed chunk is loaded if necessary and kept alive by holder while in use.
+	// nullptr if a streamed chunk can't be read
+	const unsigned char* ChunkData(unsigned int chunk, std::shared_ptr<const std::vector<unsigned char>>& holder) const;
+
+	std::string  mName;
+	float        mDuration = 0.0f;
+	float        mSampleRate = 0.0f;
+	unsigned int mNumNodes = 0;
+	unsigned int mStride = 0;    // Nodes per channel, padded to a multiple of 4
+	unsigned int mNumFrames = 0; // Evenly spaced from 0 to the duration
+
+	// NumChannels * mStride floats per frame, laid out like a pose. Empty once compressed
+	std::vector<float> mFrames;
+
+	// A compressed track, one that changes during the clip
+	struct Track
+	{
+		uint16_t node;
+		uint16_t channel;    // First pose channel of the track: RotationX, PositionX or ScaleX
+		float    minimum[3]; // Positions and scales are quantised in steps from the minimum, not used by rotations
+		float    step[3];
+	};
+
+	bool               mCompressed = false;
+	std::vector<float> mConstantPose; // Laid out like a pose, holds the tracks that don't change
+	std::vector<Track> mTracks;       // Tracks with keys in every chunk
+	unsigned int       mNumChunks = 0;
+
+	// Chunks one after another, empty when streamed. Offsets of each chunk and the end, also used to find chunks in
+	// the file when streamed
+	std::vector<unsigned char> mChunkData;
+	std::vector<uint64_t>      mChunkOffsets;
+
+	// File and loaded chunks of a streamed clip, nullptr otherwise
+	struct Stream;
+	std::unique_ptr<Stream> mStream;
+};
+
+
+// Blend from pose a to pose b by weight (0 = a, 1 = b), multiplied by a per node weight if nodeWeights isn't nullptr.
+// out may be a or b, and is resized to match them. a and b must have the same number of nodes
+void BlendPoses(const CAnimationPose& a, const CAnimationPose& b, float weight, const float* nodeWeights, CAnimationPose& out);
+
+// Add the difference of pose additive from pose reference to pose base, scaled by weight and the per node weights as
+// above. out may be base
+void AddPose(const CAnimationPose& base, const CAnimationPose& additive, const CAnimationPose& reference, float weight,
+             const float* nodeWeights, CAnimationPose& out);
+
+
+enum EAnimationBlend
+{
+	AnimationBlend_Override, // Replace the layers below
+	AnimationBlend_Additive, // Add the change from the clip's first frame to the layers below
+};
+
+class CAnimator
+{
+public:
+	// restMatrices are the local node matrices of the model when nothing is playing (the mesh's default matrices).
+	// Starts with one override layer, the base layer, playing nothing
+	explicit CAnimator(const std::vector<CMatrix4x4>& restMatrices);
+
+	unsigned int NumNodes() const { return mRestPose.NumNodes(); }
+
+	//-------------------------------------
+	// Layers
+	//-------------------------------------
+
+	// Add a layer on top of the others, returns its index
+	unsigned int AddLayer(EAnimationBlend blend = AnimationBlend_Override, float weight = 1.0f);
+	unsigned int NumLayers() const { return static_cast<unsigned int>(mLayers.size()); }
+
+	// Play a clip on a layer, crossfading from what the layer was playing over fadeTime seconds. Playing nullptr
+	// fades the layer out. The clip must be for the same hierarchy (same number of nodes)
+	void Play(std::shared_ptr<const CAnimationClip> clip, unsigned int layer = 0, float fadeTime = 0.2f, bool loop = true);
+
+	const CAnimationClip* GetClip(unsigned int layer) const { return mLayers[layer].clip.get(); }
+
+	float GetTime(unsigned int layer) const { return mLayers[layer].time; }
+	void  SetTime(unsigned int layer, float time) { mLayers[layer].time = time; }
+
+	float GetWeight(unsigned int layer) const { return mLayers[layer].weight; }
+	void  SetWeight(unsigned int layer, float weight) { mLayers[layer].weight = weight; }
+
+	// Playback speed, 1 is normal speed, negative plays backwards
+	float GetSpeed(unsigned int layer) const { return mLayers[layer].speed; }
+	void  SetSpeed(unsigned int layer, float speed) { mLayers[layer].speed = speed; }
+
+	// Limit a layer to some nodes, with a weight (0 - 1) for each node. Pass an empty vector for all nodes
+	void SetMask(unsigned int layer, const std::vector<float>& nodeWeights);
+
+
+	//-------------------------------------
+	// Playback
+	//-------------------------------------
+
+	// Move the layers' clips on by the given time
+	void Update(float frameTime);
+
+	// Sample and blend the layers, and write the local matrices of nodes 1 onwards. Node 0, the root, holds the
+	// model's world matrix so is left alone
+	void Evaluate(std::vector<CMatrix4x4>& nodeMatrices);
+
+
+//-------------------------------------
+// Private members
+//-------------------------------------
+private:
+	struct Layer
+	{
+		EAnimationBlend blend = AnimationBlend_Override;
+		float           weight = 1.0f;
+		float           speed = 1.0f;
+		std::vector<float> mask; // Per node weights padded to the pose stride, empty for all nodes
+
+		std::shared_ptr<const CAnimationClip> clip;
+		float time = 0.0f;
+		bool  loop = true;
+
+		// Clip being faded out, and how far through the fade the layer is
+		std::shared_ptr<const CAnimationClip> previousClip;
+		float previousTime = 0.0f;
+		bool  previousLoop = true;
+		float fade = 0.0f;
+		float fadeTime = 0.0f;
+	};
+
+	std::vector<Layer> mLayers;
+
+	// Working poses, kept to avoid allocations every frame
+	CAnimationPose mRestPose;
+	CAnimationPose mPose;
+	CAnimationPose mLayerPose;
+	CAnimationPose mFadePose;
+	CAnimationPose mReferencePose;
+};
@@ -0,0 +1,144 @@
+//--------------------------------------------------------------------------------------
+// Atlas allocator - hands out square tiles of a square texture atlas
+//--------------------------------------------------------------------------------------
+
+#include "AtlasAllocator.h"
+
+
+namespace
+{
+	unsigned int RoundUpToPowerOfTwo(unsigned int value)
+	{
+		unsigned int result = 1;
+		while (result < value) result <<= 1;
+		return result;
+	}
+}
+
+
+CAtlasAllocator::CAtlasAllocator(unsigned int size, unsigned int minTileSize)
+{
+	mSize = RoundUpToPowerOfTwo(size);
+
+	mMaxLevel = 0;
+	while ((mSize >> mMaxLevel) > minTileSize && (mSize >> mMaxLevel) > 1) ++mMaxLevel;
+
+	Clear();
+}
+
+void CAtlasAllocator::Clear()
+{
+	mFreeTiles.assign(mMaxLevel + 1, {});
+	mFreeTiles[0].push_back({ 0, 0, mSize });
+}
+
+
+/*-----------------------------------------------------------------------------------------
+    Allocation
+-----------------------------------------------------------------------------------------*/
+
+bool CAtlasAllocator::Allocate(unsigned int size, AtlasTile& tile)
+{
+	for (auto level = LevelOf(size); level <= mMaxLevel; ++level)
+	{
+		// Smallest free tile at least this big
+		auto parent = static_cast<int>(level);
+		while (parent >= 0 && mFreeTiles[parent].empty()) --parent;
+		if (parent < 0) continue;
+
+		tile = mFreeTiles[parent].back();
+		mFreeTiles[parent].pop_back();
+
+		// Split it down to the size wanted, keeping the first child each time and freeing the other three
+		for (auto split = static_cast<unsigned int>(parent) + 1; split <= level; ++split)
+		{
+			const auto half = TileSize(split);
+			mFreeTiles[split].push_back({ tile.x + half, tile.y,        half });
+			mFreeTiles[split].push_back({ tile.x,        tile.y + half, half });
+			mFreeTiles[split].push_back({ tile.x + half, tile.y + half, half });
+			tile.size = half;
+		}
+		return true;
+	}
+	return false;
+}
+
+void CAtlasAllocator::Free(const AtlasTile& tile)
+{
+	auto freed = tile;
+	auto level = LevelOf(tile.size);
+
+	// Merge with the three siblings while they are all free
+	while (level > 0)
+	{
+		const auto parentSize = freed.size * 2;
+		const auto parentX = freed.x & ~(parentSize - 1);
+		const auto parentY = freed.y & ~(parentSize - 1);
+
+		auto siblingsFree = true;
+		for (unsigned int i = 0; i < 4 && siblingsFree; ++i)
+		{
+			const auto x = parentX + (i & 1) * freed.size;
+			const auto y = parentY + (i >> 1) * freed.size;
+			if (x == freed.x && y == freed.y) continue;
+
+			siblingsFree = false;
+			for (const auto& free : mFreeTiles[level])
+			{
+				if (free.x == x && free.y == y)
+				{
+					siblingsFree = true;
+					break;
+				}
+			}
+		}
+		if (!siblingsFree) break;
+
+		for (unsigned int i = 0; i < 4; ++i)
+		{
+			TakeFree(level, parentX + (i & 1) * freed.size, parentY + (i >> 1) * freed.size);
+		}
+		freed = { parentX, parentY, parentSize };
+		--level;
+	}
+
+	mFreeTiles[level].push_back(freed);
+}
+
+bool CAtlasAllocator::TakeFree(unsigned int level, unsigned int x, unsigned int y)
+{
+	auto& tiles = mFreeTiles[level];
+	for (auto it = tiles.begin(); it != tiles.end(); ++it)
+	{
+		if (it->x == x && it->y == y)
+		{
+			*it = tiles.back();
+			tiles.pop_back();
+			return true;
+		}
+	}
+	return false;
+}
+
+
+/*-----------------------------------------------------------------------------------------
+    Queries
+-----------------------------------------------------------------------------------------*/
+
+unsigned int CAtlasAllocator::LevelOf(unsigned int size) const
+{
+	unsigned int level = 0;
+	while (level < mMaxLevel && TileSize(level + 1) >= size) ++level;
+	return level;
+}
+
+unsigned long long CAtlasAllocator::FreeArea() const
+{
+	unsigned long long area = 0;
+	for (unsigned int level = 0; level <= mMaxLevel; ++level)
+	{
+		const unsigned long long size = TileSize(level);
+		area += size * size * mFreeTiles[level].size();
+	}
+	return area;
+}
@@ -0,0 +1,67 @@
+//--------------------------------------------------------------------------------------
+// Atlas allocator - hands out square tiles of a square texture atlas
+//--------------------------------------------------------------------------------------
+// Code in .cpp file
+//
+// The atlas is treated as a quadtree: a tile is split into four equal children when a smaller one is needed,
+// and four free siblings are merged back into their parent when the last of them is freed. Tiles are
+// power-of-two sized and aligned to their size, so any free tile of the requested size fits exactly.
+// Only the free tiles are stored, one list per level. No graphics API is used here.
+
+#pragma once
+
+#include <vector>
+
+
+// Position and size of a tile in texels
+struct AtlasTile
+{
+	unsigned int x;
+	unsigned int y;
+	unsigned int size;
+};
+
+
+class CAtlasAllocator
+{
+public:
+	// size is the width and height of the atlas, minTileSize the smallest tile handed out. Both are rounded up to powers of two
+	CAtlasAllocator(unsigned int size, unsigned int minTileSize);
+
+	// Find a free tile of at least size x size texels, the size rounded up to a power of two and clamped to the atlas
+	// size. If there is no room for one that big, smaller tiles are tried down to the minimum, so a full atlas gives
+	// lower resolution rather than nothing. Returns false if there is no free tile at all
+	bool Allocate(unsigned int size, AtlasTile& tile);
+
+	// Return a tile from Allocate
+	void Free(const AtlasTile& tile);
+
+	// Free every tile
+	void Clear();
+
+	// Size of the tile Allocate hands out for size when there is room for it
+	unsigned int TileSizeFor(unsigned int size) const { return TileSize(LevelOf(size)); }
+
+	unsigned int Size()        const { return mSize; }
+	unsigned int MinTileSize() const { return mSize >> mMaxLevel; }
+
+	// Texels not in any allocated tile
+	unsigned long long FreeArea() const;
+
+
+//-------------------------------------
+// Private members
+//-------------------------------------
+private:
+	// Level 0 is the whole atlas, each level below has tiles half the size
+	unsigned int LevelOf(unsigned int size) const;
+	unsigned int TileSize(unsigned int level) const { return mSize >> level; }
+
+	// Remove a tile from a level's free list if it is there
+	bool TakeFree(unsigned int level, unsigned int x, unsigned int y);
+
+	unsigned int mSize;
+	unsigned int mMaxLevel;
+
+	std::vector<std::vector<AtlasTile>> mFreeTiles; // Indexed by level
+};
@@ -81,3 +81,21 @@ void CCamera::UpdateMatrices()
     mViewProjectionMatrix = mViewMatrix * mProjectionMatrix;
 }
 
+
+// World space ray from the camera through the given pixel of a viewport
+CRay CCamera::PickRay(int pixelX, int pixelY, int viewportWidth, int viewportHeight)
+{
+	UpdateMatrices();
+
+	// Pixel centre to -1 -> 1 range (y is up in projection space, down in pixels)
+	const auto projX = 2.0f * (pixelX + 0.5f) / viewportWidth - 1.0f;
+	const auto projY = 1.0f - 2.0f * (pixelY + 0.5f) / viewportHeight;
+
+	// Undo the projection scaling (see UpdateMatrices) to get a camera space direction at distance 1
+	const auto tanFOVx = std::tan(mFOVx * 0.5f);
+	const auto cameraX = projX * tanFOVx;
+	const auto cameraY = projY * tanFOVx / mAspectRatio;
+
+	const auto direction = mWorldMatrix.GetXAxis() * cameraX + mWorldMatrix.GetYAxis() * cameraY + mWorldMatrix.GetZAxis();
+	return { mPosition, Normalise(direction) };
+}
@@ -8,6 +8,7 @@
 #include "CVector3.h"
 #include "CMatrix4x4.h"
 #include "MathHelpers.h"
+#include "BoundingVolumes.h"
 #include "Input.h"
 
 
@@ -55,6 +56,9 @@ public:
 	CMatrix4x4 ViewMatrix()            { UpdateMatrices(); return mViewMatrix;           }
 	CMatrix4x4 ProjectionMatrix()      { UpdateMatrices(); return mProjectionMatrix;     }
 	CMatrix4x4 ViewProjectionMatrix()  { UpdateMatrices(); return mViewProjectionMatrix; }
+
+	// World space ray from the camera through the given pixel of a viewport (direction is normalised). Used for picking
+	CRay PickRay(int pixelX, int pixelY, int viewportWidth, int viewportHeight);
 	
 	
 //-------------------------------------
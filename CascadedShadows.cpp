@@ -0,0 +1,124 @@
+//--------------------------------------------------------------------------------------
+// Cascaded shadow maps - fitting a directional light's shadow maps to the camera
+//--------------------------------------------------------------------------------------
+
+#include "CascadedShadows.h"
+
+#include <algorithm>
+#include <cmath>
+
+
+CShadowCascades::CShadowCascades(unsigned int count, float splitLambda)
+	: mCount(1), mSplitLambda(0.0f), mCascades{}
+{
+	SetCount(count);
+	SetSplitLambda(splitLambda);
+}
+
+void CShadowCascades::SetCount(unsigned int count)
+{
+	mCount = std::min(std::max(count, 1u), static_cast<unsigned int>(MaxCascades));
+}
+
+void CShadowCascades::SetSplitLambda(float lambda)
+{
+	mSplitLambda = std::min(std::max(lambda, 0.0f), 1.0f);
+}
+
+
+/*-----------------------------------------------------------------------------------------
+    Splits
+-----------------------------------------------------------------------------------------*/
+
+void CShadowCascades::CalculateSplits(float nearClip, float farClip, unsigned int count, float lambda, float* splits)
+{
+	splits[0] = nearClip;
+	for (unsigned int i = 1; i < count; ++i)
+	{
+		const auto fraction = static_cast<float>(i) / static_cast<float>(count);
+		const auto logSplit = nearClip * std::pow(farClip / nearClip, fraction);
+		const auto uniformSplit = nearClip + (farClip - nearClip) * fraction;
+		splits[i] = lambda * logSplit + (1.0f - lambda) * uniformSplit;
+	}
+	splits[count] = farClip;
+}
+
+
+/*-----------------------------------------------------------------------------------------
+    Fitting
+-----------------------------------------------------------------------------------------*/
+
+void CShadowCascades::Fit(const CMatrix4x4& cameraMatrix, const CMatrix4x4& projectionMatrix, float nearClip, float shadowDistance,
+                          const CVector3& lightDirection, unsigned int shadowMapSize, float backDistance)
+{
+	float splits[MaxCascades + 1];
+	CalculateSplits(nearClip, std::max(shadowDistance, nearClip * 2.0f), mCount, mSplitLambda, splits);
+
+	// Frustum half width and height at depth 1, squared and added together: the squared distance of a frustum
+	// corner from the view axis at depth d is d * d * cornerSlope
+	const auto tanHalfX = 1.0f / projectionMatrix.e00;
+	const auto tanHalfY = 1.0f / projectionMatrix.e11;
+	const auto cornerSlope = tanHalfX * tanHalfX + tanHalfY * tanHalfY;
+
+	const auto cameraPosition = cameraMatrix.GetPosition();
+	const auto cameraForward = Normalise(cameraMatrix.GetZAxis());
+
+	// Light space axes. They only depend on the light direction, so the texel grid stays still as the camera moves
+	const auto lightZ = Normalise(lightDirection);
+	const auto up = std::abs(lightZ.y) < 0.99f ? CVector3{ 0.0f, 1.0f, 0.0f } : CVector3{ 1.0f, 0.0f, 0.0f };
+	const auto lightX = Normalise(Cross(up, lightZ));
+	const auto lightY = Cross(lightZ, lightX);
+
+	for (unsigned int i = 0; i < mCount; ++i)
+	{
+		auto& cascade = mCascades[i];
+		const auto n = splits[i];
+		const auto f = splits[i + 1];
+		cascade.nearDistance = n;
+		cascade.farDistance = f;
+
+		// Smallest sphere around the slice, centred on the view axis. The far corners and the near corners are
+		// equally distant from it, unless that puts it beyond the far plane, when the far corners alone decide it
+		auto centreDepth = 0.5f * (n + f) * (1.0f + cornerSlope);
+		if (centreDepth >= f)
+		{
+			centreDepth = f;
+			cascade.radius = f * std::sqrt(cornerSlope);
+		}
+		else
+		{
+			cascade.radius = std::sqrt((f - centreDepth) * (f - centreDepth) + f * f * cornerSlope);
+		}
+
+		// Move the centre to a whole number of texels across the light's view, so the shadow map texels
+		// always land in the same place in the world. The sphere is padded by a texel to still cover the slice
+		// after the move
+		auto centre = cameraPosition + cameraForward * centreDepth;
+		const auto texelSize = 2.0f * cascade.radius / static_cast<float>(std::max(shadowMapSize, 4u) - 2);
+		cascade.radius += texelSize;
+		const auto x = Dot(centre, lightX);
+		const auto y = Dot(centre, lightY);
+		centre = centre + lightX * (std::floor(x / texelSize) * texelSize - x) + lightY * (std::floor(y / texelSize) * texelSize - y);
+		cascade.centre = centre;
+
+		// View from behind the sphere, far enough back to take in casters between it and the light
+		const auto depthRange = 2.0f * cascade.radius + backDistance;
+		cascade.lightPosition = centre - lightZ * (cascade.radius + backDistance);
+
+		CMatrix4x4 lightMatrix = MatrixIdentity();
+		lightMatrix.SetRow(0, lightX);
+		lightMatrix.SetRow(1, lightY);
+		lightMatrix.SetRow(2, lightZ);
+		lightMatrix.SetRow(3, cascade.lightPosition);
+		cascade.viewMatrix = InverseAffine(lightMatrix);
+
+		// Orthographic projection of the sphere's square, depths 0 to depthRange mapped to 0 to 1
+		const auto scale = 1.0f / cascade.radius;
+		cascade.projectionMatrix = CMatrix4x4{ scale, 0.0f,  0.0f,                0.0f,
+		                                       0.0f,  scale, 0.0f,                0.0f,
+		                                       0.0f,  0.0f,  1.0f / depthRange,   0.0f,
+		                                       0.0f,  0.0f,  0.0f,                1.0f };
+
+		cascade.viewProjectionMatrix = cascade.viewMatrix * cascade.projectionMatrix;
+	}
+}
@@ -0,0 +1,82 @@
+//--------------------------------------------------------------------------------------
+// Cascaded shadow maps - fitting a directional light's shadow maps to the camera
+//--------------------------------------------------------------------------------------
+// Code in .cpp file
+//
+// The camera's view out to the shadow distance is split into slices by depth, and each slice (cascade) gets
+// its own orthographic shadow map. Near slices are short, so they get many texels per metre where shadows are
+// seen up close, far slices cover more ground at the same resolution.
+//
+// Splits blend a logarithmic scheme (even texel density, but tiny near slices) with a uniform one, using a
+// lambda from 0 (uniform) to 1 (logarithmic). Each cascade's shadow map covers the bounding sphere of its
+// slice, which doesn't change size as the camera turns, and its centre is snapped to whole shadow map texels,
+// so shadow edges don't shimmer as the camera moves. No graphics API is used here.
+
+#pragma once
+
+#include "CVector3.h"
+#include "CMatrix4x4.h"
+
+
+struct ShadowCascade
+{
+	float nearDistance; // Range of camera view depths covered
+	float farDistance;
+
+	CVector3 centre;    // World space bounding sphere of the camera frustum slice
+	float    radius;
+
+	CVector3   lightPosition; // Where the shadow map is rendered from, behind the sphere along the light direction
+	CMatrix4x4 viewMatrix;
+	CMatrix4x4 projectionMatrix;
+	CMatrix4x4 viewProjectionMatrix;
+};
+
+
+class CShadowCascades
+{
+public:
+	// Cascades are sent to the shaders in fixed size arrays, must match MAX_CASCADES in Common.hlsli
+	static const unsigned int MaxCascades = 4;
+
+	CShadowCascades(unsigned int count = MaxCascades, float splitLambda = 0.75f);
+
+	//-------------------------------------
+	// Settings
+	//-------------------------------------
+
+	// Clamped to 1 - MaxCascades
+	void SetCount(unsigned int count);
+	unsigned int Count() const { return mCount; }
+
+	// 0 for uniform splits, 1 for logarithmic splits, in between blends the two
+	void SetSplitLambda(float lambda);
+	float SplitLambda() const { return mSplitLambda; }
+
+	// Split the depth range [nearClip, farClip] into count slices. Writes count + 1 distances to splits, the first
+	// is nearClip and the last farClip
+	static void CalculateSplits(float nearClip, float farClip, unsigned int count, float lambda, float* splits);
+
+	//-------------------------------------
+	// Fitting
+	//-------------------------------------
+
+	// Fit the cascades to a camera, given its world matrix and perspective projection (such as the one made by
+	// CCamera), for a light shining along lightDirection. The cascades cover view depths from nearClip to
+	// shadowDistance. shadowMapSize is the resolution of each cascade, used for the texel snapping. Casters up
+	// to backDistance beyond a cascade's sphere toward the light are inside its shadow map depth range
+	void Fit(const CMatrix4x4& cameraMatrix, const CMatrix4x4& projectionMatrix, float nearClip, float shadowDistance,
+	         const CVector3& lightDirection, unsigned int shadowMapSize, float backDistance);
+
+	const ShadowCascade& Cascade(unsigned int index) const { return mCascades[index]; }
+
+
+//-------------------------------------
+// Private members
+//-------------------------------------
+private:
+	unsigned int mCount;
+	float        mSplitLambda;
+
+	ShadowCascade mCascades[MaxCascades];
+};
@@ -0,0 +1,294 @@
+//--------------------------------------------------------------------------------------
+// Clustered light assignment - which lights reach each cell of the view frustum
+//--------------------------------------------------------------------------------------
+
+#include "ClusteredLighting.h"
+
+#include "JobSystem.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstring>
+#include <xmmintrin.h>
+
+
+namespace
+{
+	// Groups of four lights per job when moving lights to view space
+	const unsigned int TransformGroupsPerJob = 256;
+}
+
+
+CLightClusters::CLightClusters(unsigned int tilesX, unsigned int tilesY, unsigned int slices)
+	: mTilesX(tilesX), mTilesY(tilesY), mSlices(slices), mNumPointLights(0), mNumLights(0)
+{
+	mSliceLights.resize(mSlices);
+	mSliceIndices.resize(mSlices);
+	mSliceCursors.resize(mSlices);
+	mClusters.resize(mTilesX * mTilesY * mSlices, { 0, 0 });
+
+	SetCamera(MatrixIdentity(), MatrixIdentity(), 0.1f, 1000.0f);
+}
+
+
+/*-----------------------------------------------------------------------------------------
+    Building
+-----------------------------------------------------------------------------------------*/
+
+void CLightClusters::SetCamera(const CMatrix4x4& viewMatrix, const CMatrix4x4& projectionMatrix, float nearClip, float farClip)
+{
+	mViewMatrix = viewMatrix;
+
+	// The projection scales x and y by 1 / tan(half the field of view)
+	mTanHalfX = 1.0f / projectionMatrix.e00;
+	mTanHalfY = 1.0f / projectionMatrix.e11;
+
+	mNearClip = nearClip;
+	mFarClip = farClip;
+	mDepthScale = mSlices / std::log(farClip / nearClip);
+	mDepthBias = -std::log(nearClip) * mDepthScale;
+
+	mSliceDepths.resize(mSlices + 1);
+	for (unsigned int slice = 0; slice < mSlices; ++slice)
+	{
+		mSliceDepths[slice] = nearClip * std::pow(farClip / nearClip, static_cast<float>(slice) / mSlices);
+	}
+	mSliceDepths[mSlices] = farClip;
+}
+
+void CLightClusters::Build(const std::vector<LightSphere>& pointLights, const std::vector<LightSphere>& spotLights)
+{
+	mNumPointLights = std::min(static_cast<unsigned int>(pointLights.size()), static_cast<unsigned int>(MaxLightsPerType));
+	const auto numSpotLights = std::min(static_cast<unsigned int>(spotLights.size()), static_cast<unsigned int>(MaxLightsPerType));
+	mNumLights = mNumPointLights + numSpotLights;
+
+	const auto padded = (mNumLights + 3) & ~3u;
+	mLightX.resize(padded); mLightY.resize(padded); mLightZ.resize(padded); mLightRadius.resize(padded);
+
+	for (unsigned int i = 0; i < mNumLights; ++i)
+	{
+		const auto& light = i < mNumPointLights ? pointLights[i] : spotLights[i - mNumPointLights];
+		mLightX[i] = light.centre.x;
+		mLightY[i] = light.centre.y;
+		mLightZ[i] = light.centre.z;
+		mLightRadius[i] = light.radius;
+	}
+
+	const auto numGroups = padded / 4;
+	ParallelFor(numGroups, TransformGroupsPerJob, [&](unsigned int begin, unsigned int end)
+	{
+		TransformLights(begin * 4, end * 4);
+	});
+
+	// Padding entries are placed behind the camera so they never overlap a slice
+	for (auto i = mNumLights; i < padded; ++i)
+	{
+		mLightZ[i] = -FLT_MAX;
+		mLightRadius[i] = 0.0f;
+	}
+
+	// Each slice is binned separately, giving cluster offsets relative to the slice's own index list
+	ParallelFor(mSlices, 1, [&](unsigned int begin, unsigned int end)
+	{
+		for (auto slice = begin; slice < end; ++slice) BuildSlice(slice);
+	});
+
+	// Then the slice lists are joined in order
+	std::vector<uint32_t> sliceBase(mSlices);
+	uint32_t total = 0;
+	for (unsigned int slice = 0; slice < mSlices; ++slice)
+	{
+		sliceBase[slice] = total;
+		total += static_cast<uint32_t>(mSliceIndices[slice].size());
+	}
+	mLightIndices.resize(total);
+
+	const auto clustersPerSlice = mTilesX * mTilesY;
+	ParallelFor(mSlices, 1, [&](unsigned int begin, unsigned int end)
+	{
+		for (auto slice = begin; slice < end; ++slice)
+		{
+			const auto& indices = mSliceIndices[slice];
+			if (!indices.empty())
+			{
+				std::memcpy(&mLightIndices[sliceBase[slice]], indices.data(), indices.size() * sizeof(uint32_t));
+			}
+
+			auto cluster = &mClusters[slice * clustersPerSlice];
+			for (unsigned int i = 0; i < clustersPerSlice; ++i)
+			{
+				cluster[i].offset += sliceBase[slice];
+			}
+		}
+	});
+}
+
+// View space x, y, z for four lights at once (row vector times matrix, as CVector3 * CMatrix4x4)
+void CLightClusters::TransformLights(unsigned int first, unsigned int last)
+{
+	const auto& m = mViewMatrix;
+	const auto m00 = _mm_set1_ps(m.e00), m01 = _mm_set1_ps(m.e01), m02 = _mm_set1_ps(m.e02);
+	const auto m10 = _mm_set1_ps(m.e10), m11 = _mm_set1_ps(m.e11), m12 = _mm_set1_ps(m.e12);
+	const auto m20 = _mm_set1_ps(m.e20), m21 = _mm_set1_ps(m.e21), m22 = _mm_set1_ps(m.e22);
+	const auto m30 = _mm_set1_ps(m.e30), m31 = _mm_set1_ps(m.e31), m32 = _mm_set1_ps(m.e32);
+
+	for (auto i = first; i < last; i += 4)
+	{
+		const auto x = _mm_loadu_ps(&mLightX[i]);
+		const auto y = _mm_loadu_ps(&mLightY[i]);
+		const auto z = _mm_loadu_ps(&mLightZ[i]);
+
+		const auto viewX = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, m00), _mm_mul_ps(y, m10)), _mm_add_ps(_mm_mul_ps(z, m20), m30));
+		const auto viewY = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, m01), _mm_mul_ps(y, m11)), _mm_add_ps(_mm_mul_ps(z, m21), m31));
+		const auto viewZ = _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, m02), _mm_mul_ps(y, m12)), _mm_add_ps(_mm_mul_ps(z, m22), m32));
+
+		_mm_storeu_ps(&mLightX[i], viewX);
+		_mm_storeu_ps(&mLightY[i], viewY);
+		_mm_storeu_ps(&mLightZ[i], viewZ);
+	}
+}
+
+void CLightClusters::BuildSlice(unsigned int slice)
+{
+	const auto zNear = mSliceDepths[slice];
+	const auto zFar = mSliceDepths[slice + 1];
+
+	// Find the lights whose depth range overlaps the slice, four at a time, and the tiles each one covers
+	auto& lights = mSliceLights[slice];
+	lights.clear();
+
+	const auto sliceNear = _mm_set1_ps(zNear);
+	const auto sliceFar = _mm_set1_ps(zFar);
+	const auto padded = static_cast<unsigned int>(mLightZ.size());
+	for (unsigned int i = 0; i < padded; i += 4)
+	{
+		const auto z = _mm_loadu_ps(&mLightZ[i]);
+		const auto r = _mm_loadu_ps(&mLightRadius[i]);
+		const auto overlap = _mm_and_ps(_mm_cmplt_ps(_mm_sub_ps(z, r), sliceFar), _mm_cmpgt_ps(_mm_add_ps(z, r), sliceNear));
+
+		for (int mask = _mm_movemask_ps(overlap), lane = 0; mask; ++lane, mask >>= 1)
+		{
+			if (!(mask & 1)) continue;
+
+			const auto light = i + lane;
+			const auto cx = mLightX[light];
+			const auto cy = mLightY[light];
+			const auto cz = mLightZ[light];
+			const auto radius = mLightRadius[light];
+
+			// Radius of the sphere where it is cut by the nearest plane of the slice, the part inside the slice is no wider
+			const auto distance = std::max(0.0f, std::max(zNear - cz, cz - zFar));
+			const auto sliceRadiusSquared = radius * radius - distance * distance;
+			if (sliceRadiusSquared <= 0.0f) continue;
+			const auto sliceRadius = std::sqrt(sliceRadiusSquared);
+
+			// Steepest and shallowest slopes of a box around that part of the sphere. Depths are positive, as the slice is
+			// beyond the near clip
+			const auto nearZ = std::max(zNear, cz - radius);
+			const auto farZ = std::min(zFar, cz + radius);
+			const auto minX = cx - sliceRadius, maxX = cx + sliceRadius;
+			const auto minY = cy - sliceRadius, maxY = cy + sliceRadius;
+
+			SliceLight sliceLight;
+			sliceLight.light = light;
+			if (!TileRangeX(minX / (minX < 0.0f ? nearZ : farZ), maxX / (maxX > 0.0f ? nearZ : farZ), sliceLight.x0, sliceLight.x1) ||
+				!TileRangeY(minY / (minY < 0.0f ? nearZ : farZ), maxY / (maxY > 0.0f ? nearZ : farZ), sliceLight.y0, sliceLight.y1))
+			{
+				continue;
+			}
+			lights.push_back(sliceLight);
+		}
+	}
+
+	// Count the lights in each cluster of the slice, then turn the counts into offsets and fill in the indices.
+	// Points come before spots in the lights found, so each cluster gets its point lights first
+	const auto clustersPerSlice = mTilesX * mTilesY;
+	auto clusters = &mClusters[slice * clustersPerSlice];
+	for (unsigned int i = 0; i < clustersPerSlice; ++i) clusters[i] = { 0, 0 };
+
+	for (const auto& sliceLight : lights)
+	{
+		const auto increment = sliceLight.light < mNumPointLights ? 1u : 0x10000u;
+		for (unsigned int y = sliceLight.y0; y <= sliceLight.y1; ++y)
+		{
+			for (unsigned int x = sliceLight.x0; x <= sliceLight.x1; ++x)
+			{
+				clusters[y * mTilesX + x].counts += increment;
+			}
+		}
+	}
+
+	auto& cursors = mSliceCursors[slice];
+	cursors.resize(clustersPerSlice);
+	uint32_t total = 0;
+	for (unsigned int i = 0; i < clustersPerSlice; ++i)
+	{
+		clusters[i].offset = total;
+		cursors[i] = total;
+		total += (clusters[i].counts & 0xFFFF) + (clusters[i].counts >> 16);
+	}
+
+	auto& indices = mSliceIndices[slice];
+	indices.resize(total);
+	for (const auto& sliceLight : lights)
+	{
+		const auto index = sliceLight.light < mNumPointLights ? sliceLight.light : sliceLight.light - mNumPointLights;
+		for (unsigned int y = sliceLight.y0; y <= sliceLight.y1; ++y)
+		{
+			for (unsigned int x = sliceLight.x0; x <= sliceLight.x1; ++x)
+			{
+				indices[cursors[y * mTilesX + x]++] = index;
+			}
+		}
+	}
+}
+
+
+/*-----------------------------------------------------------------------------------------
+    Cluster coordinates
+-----------------------------------------------------------------------------------------*/
+
+unsigned int CLightClusters::SliceOf(float depth) const
+{
+	const auto slice = std::floor(std::log(depth) * mDepthScale + mDepthBias);
+	return static_cast<unsigned int>(std::min(std::max(slice, 0.0f), static_cast<float>(mSlices - 1)));
+}
+
+// Slopes are converted to the -1 -> 1 range across the screen, then to tiles
+bool CLightClusters::TileRangeX(float minSlope, float maxSlope, uint16_t& first, uint16_t& last) const
+{
+	if (maxSlope < -mTanHalfX || minSlope > mTanHalfX) return false;
+
+	const auto scale = 0.5f * mTilesX;
+	const auto maxTile = static_cast<float>(mTilesX - 1);
+	first = static_cast<uint16_t>(std::min(std::max(std::floor((minSlope / mTanHalfX + 1.0f) * scale), 0.0f), maxTile));
+	last  = static_cast<uint16_t>(std::min(std::max(std::floor((maxSlope / mTanHalfX + 1.0f) * scale), 0.0f), maxTile));
+	return true;
+}
+
+// Tiles are numbered from the top of the screen, the opposite way to y
+bool CLightClusters::TileRangeY(float minSlope, float maxSlope, uint16_t& first, uint16_t& last) const
+{
+	if (maxSlope < -mTanHalfY || minSlope > mTanHalfY) return false;
+
+	const auto scale = 0.5f * mTilesY;
+	const auto maxTile = static_cast<float>(mTilesY - 1);
+	first = static_cast<uint16_t>(std::min(std::max(std::floor((1.0f - maxSlope / mTanHalfY) * scale), 0.0f), maxTile));
+	last  = static_cast<uint16_t>(std::min(std::max(std::floor((1.0f - minSlope / mTanHalfY) * scale), 0.0f), maxTile));
+	return true;
+}
+
+int CLightClusters::FindCluster(const CVector3& viewPosition) const
+{
+	if (viewPosition.z < mNearClip || viewPosition.z > mFarClip) return -1;
+
+	const auto slopeX = viewPosition.x / viewPosition.z;
+	const auto slopeY = viewPosition.y / viewPosition.z;
+	if (std::abs(slopeX) > mTanHalfX || std::abs(slopeY) > mTanHalfY) return -1;
+
+	uint16_t x, y, unused;
+	TileRangeX(slopeX, slopeX, x, unused);
+	TileRangeY(slopeY, slopeY, y, unused);
+	return static_cast<int>(ClusterIndex(x, y, SliceOf(viewPosition.z)));
+}
@@ -0,0 +1,126 @@
+//--------------------------------------------------------------------------------------
+// Clustered light assignment - which lights reach each cell of the view frustum
+//--------------------------------------------------------------------------------------
+// Code in .cpp file
+//
+// The view frustum is split into a grid of clusters: tiles across the screen and slices in depth,
+// the slices spaced exponentially so near clusters aren't stretched along the view direction. Each
+// light's bounding sphere is binned into the clusters it overlaps, giving every cluster a compact
+// list of light indices. A pixel shader finds its cluster from its screen position and depth, then
+// only loops over the lights in that list instead of every light in the scene.
+//
+// Output layout, uploaded as is to structured buffers:
+//   Clusters()     - one entry per cluster, x fastest then y (tiles from the top of the screen) then slice:
+//                    offset of the cluster's first index, and the point and spot light counts packed
+//   LightIndices() - each cluster's point light indices followed by its spot light indices
+//
+// Light positions are moved to view space four at a time with SSE, and the slices are binned on
+// the job system threads. No graphics API is used here.
+
+#pragma once
+
+#include "CVector3.h"
+#include "CMatrix4x4.h"
+
+#include <cstdint>
+#include <vector>
+
+
+// World space bounds of a light's influence
+struct LightSphere
+{
+	CVector3 centre;
+	float    radius;
+};
+
+
+class CLightClusters
+{
+public:
+	struct Cluster
+	{
+		uint32_t offset; // Index of the first light in LightIndices
+		uint32_t counts; // Point light count in the low 16 bits, spot light count in the high 16 bits
+	};
+
+	// Lights of each type beyond this are ignored, the counts must fit in 16 bits
+	static const unsigned int MaxLightsPerType = 0xFFFF;
+
+	CLightClusters(unsigned int tilesX = 16, unsigned int tilesY = 9, unsigned int slices = 24);
+
+	//-------------------------------------
+	// Building
+	//-------------------------------------
+
+	// Camera the clusters are built for. The projection must be a perspective projection such as the one made by CCamera
+	void SetCamera(const CMatrix4x4& viewMatrix, const CMatrix4x4& projectionMatrix, float nearClip, float farClip);
+
+	// Assign the lights to the clusters. Light indices in the output are positions in these arrays
+	void Build(const std::vector<LightSphere>& pointLights, const std::vector<LightSphere>& spotLights);
+
+	//-------------------------------------
+	// Results
+	//-------------------------------------
+
+	const std::vector<Cluster>&  Clusters()     const { return mClusters; }
+	const std::vector<uint32_t>& LightIndices() const { return mLightIndices; }
+
+	unsigned int TilesX() const { return mTilesX; }
+	unsigned int TilesY() const { return mTilesY; }
+	unsigned int Slices() const { return mSlices; }
+
+	unsigned int ClusterIndex(unsigned int x, unsigned int y, unsigned int slice) const { return (slice * mTilesY + y) * mTilesX + x; }
+
+	// The slice holding a view space depth is floor(log(depth) * DepthScale() + DepthBias()), as the shaders calculate it
+	float DepthScale() const { return mDepthScale; }
+	float DepthBias()  const { return mDepthBias; }
+
+	// Index of the cluster holding a view space point, or -1 if it is outside the frustum
+	int FindCluster(const CVector3& viewPosition) const;
+
+
+//-------------------------------------
+// Private members
+//-------------------------------------
+private:
+	// Light in a slice with the tiles it covers
+	struct SliceLight
+	{
+		uint32_t light; // Index into the combined point + spot arrays below
+		uint16_t x0, x1, y0, y1;
+	};
+
+	// Move the light centres into view space, [first, last) must start on a multiple of 4
+	void TransformLights(unsigned int first, unsigned int last);
+
+	// Find the lights overlapping a slice and fill in its clusters with slice relative offsets
+	void BuildSlice(unsigned int slice);
+
+	unsigned int SliceOf(float depth) const;
+
+	// Range of tiles covered by slopes (x / z or y / z) between min and max. False if they are all off screen
+	bool TileRangeX(float minSlope, float maxSlope, uint16_t& first, uint16_t& last) const;
+	bool TileRangeY(float minSlope, float maxSlope, uint16_t& first, uint16_t& last) const;
+
+	unsigned int mTilesX, mTilesY, mSlices;
+
+	CMatrix4x4 mViewMatrix;
+	float mTanHalfX, mTanHalfY; // Frustum half width / height at depth 1
+	float mNearClip, mFarClip;
+	float mDepthScale, mDepthBias;
+	std::vector<float> mSliceDepths; // Near depth of each slice, plus the far clip at the end
+
+	// Lights being binned, points then spots, in structure-of-arrays form padded to a multiple of 4.
+	// Positions are world space from Build, then view space
+	unsigned int mNumPointLights;
+	unsigned int mNumLights;
+	std::vector<float> mLightX, mLightY, mLightZ, mLightRadius;
+
+	// Per slice working data, kept between builds to reuse the memory
+	std::vector<std::vector<SliceLight>> mSliceLights;
+	std::vector<std::vector<uint32_t>>   mSliceIndices;
+	std::vector<std::vector<uint32_t>>   mSliceCursors;
+
+	std::vector<Cluster>  mClusters;
+	std::vector<uint32_t> mLightIndices;
+};
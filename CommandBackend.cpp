@@ -0,0 +1,32 @@
+//--------------------------------------------------------------------------------------
+// Command backends - replay command lists
+//--------------------------------------------------------------------------------------
+
+#include "CommandBackend.h"
+
+
+void CNullCommandBackend::Execute(const CCommandList& list)
+{
+	for (const auto& command : list.Commands())
+	{
+		++mStats.commands;
+		switch (command.type)
+		{
+		case ECommand::SetPipeline:     ++mStats.pipelineChanges; break;
+		case ECommand::SetTexture:      ++mStats.textureBinds;    break;
+		case ECommand::SetVertexBuffer:
+		case ECommand::SetIndexBuffer:  ++mStats.bufferBinds;     break;
+
+		case ECommand::UpdateConstants:
+			++mStats.constantUpdates;
+			mStats.constantBytes += command.constants.size;
+			break;
+
+		case ECommand::DrawIndexed:
+			++mStats.draws;
+			mStats.instances += command.draw.instanceCount;
+			mStats.indices += static_cast<size_t>(command.draw.indexCount) * command.draw.instanceCount;
+			break;
+		}
+	}
+}
@@ -0,0 +1,50 @@
+//--------------------------------------------------------------------------------------
+// Command backends - replay command lists
+//--------------------------------------------------------------------------------------
+// Code in .cpp file
+//
+// A backend takes lists recorded by CCommandList and carries them out. Lists must be executed on
+// one thread, in the order their draws should happen. The D3D11 backend is in D3D11CommandBackend.h,
+// the null backend here only gathers statistics, so recording can be checked without a GPU.
+
+#pragma once
+
+#include "CommandList.h"
+
+
+class ICommandBackend
+{
+public:
+	virtual ~ICommandBackend() = default;
+
+	virtual void Execute(const CCommandList& list) = 0;
+};
+
+
+// Does no rendering, counts what would have been submitted
+class CNullCommandBackend : public ICommandBackend
+{
+public:
+	struct Stats
+	{
+		unsigned int commands;
+		unsigned int pipelineChanges;
+		unsigned int textureBinds;
+		unsigned int bufferBinds;   // Vertex and index
+		unsigned int constantUpdates;
+		size_t       constantBytes;
+		unsigned int draws;
+		unsigned int instances;     // Objects drawn, one per draw unless instanced
+		size_t       indices;
+	};
+
+	CNullCommandBackend() { ResetStats(); }
+
+	void Execute(const CCommandList& list) override;
+
+	void ResetStats() { mStats = {}; }
+	const Stats& GetStats() const { return mStats; }
+
+private:
+	Stats mStats;
+};
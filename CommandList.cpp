@@ -0,0 +1,114 @@
+//--------------------------------------------------------------------------------------
+// Command list - draw submission recorded in a graphics API neutral form
+//--------------------------------------------------------------------------------------
+
+#include "CommandList.h"
+
+#include <cstring>
+
+
+void CCommandList::Reset()
+{
+	mCommands.clear();
+	mConstantData.clear();
+	mInstanceMatrices.clear();
+
+	mHasPipeline = false;
+	mPipeline = {};
+	for (unsigned int i = 0; i < NumTrackedTextures; ++i)
+	{
+		mTextures[i] = nullptr;
+		mTexturesSet[i] = false;
+	}
+	mVertexBuffer = nullptr;
+	mIndexBuffer = nullptr;
+}
+
+
+/*-----------------------------------------------------------------------------------------
+    Recording
+-----------------------------------------------------------------------------------------*/
+
+void CCommandList::SetPipeline(const PipelineState& pipeline)
+{
+	if (mHasPipeline && pipeline == mPipeline) return;
+	mHasPipeline = true;
+	mPipeline = pipeline;
+
+	Command command;
+	command.type = ECommand::SetPipeline;
+	command.pipeline = pipeline;
+	mCommands.push_back(command);
+}
+
+void CCommandList::SetTexture(unsigned int slot, GpuHandle view)
+{
+	if (slot < NumTrackedTextures)
+	{
+		if (mTexturesSet[slot] && mTextures[slot] == view) return;
+		mTexturesSet[slot] = true;
+		mTextures[slot] = view;
+	}
+
+	Command command;
+	command.type = ECommand::SetTexture;
+	command.texture = { slot, view };
+	mCommands.push_back(command);
+}
+
+void CCommandList::SetVertexBuffer(GpuHandle buffer, GpuHandle layout, unsigned int stride)
+{
+	if (buffer == mVertexBuffer && buffer != nullptr) return;
+	mVertexBuffer = buffer;
+
+	Command command;
+	command.type = ECommand::SetVertexBuffer;
+	command.vertexBuffer = { buffer, layout, stride };
+	mCommands.push_back(command);
+}
+
+void CCommandList::SetIndexBuffer(GpuHandle buffer, unsigned int indexSize)
+{
+	if (buffer == mIndexBuffer && buffer != nullptr) return;
+	mIndexBuffer = buffer;
+
+	Command command;
+	command.type = ECommand::SetIndexBuffer;
+	command.indexBuffer = { buffer, indexSize };
+	mCommands.push_back(command);
+}
+
+void CCommandList::UpdateConstants(GpuHandle buffer, unsigned int slot, const void* data, unsigned int size)
+{
+	const auto offset = static_cast<unsigned int>((mConstantData.size() + 15) & ~size_t(15));
+	mConstantData.resize(offset + size);
+	std::memcpy(&mConstantData[offset], data, size);
+
+	Command command;
+	command.type = ECommand::UpdateConstants;
+	command.constants = { buffer, slot, offset, size };
+	mCommands.push_back(command);
+}
+
+void CCommandList::DrawIndexed(unsigned int indexCount, unsigned int startIndex, int baseVertex)
+{
+	Command command;
+	command.type = ECommand::DrawIndexed;
+	command.draw = { indexCount, startIndex, baseVertex, 1 };
+	mCommands.push_back(command);
+}
+
+unsigned int CCommandList::AddInstanceMatrices(const CMatrix4x4* matrices, unsigned int count)
+{
+	const auto first = static_cast<unsigned int>(mInstanceMatrices.size());
+	mInstanceMatrices.insert(mInstanceMatrices.end(), matrices, matrices + count);
+	return first;
+}
+
+void CCommandList::DrawIndexedInstanced(unsigned int indexCount, unsigned int instanceCount, unsigned int startIndex, int baseVertex)
+{
+	Command command;
+	command.type = ECommand::DrawIndexed;
+	command.draw = { indexCount, startIndex, baseVertex, instanceCount };
+	mCommands.push_back(command);
+}
@@ -0,0 +1,148 @@
+//--------------------------------------------------------------------------------------
+// Command list - draw submission recorded in a graphics API neutral form
+//--------------------------------------------------------------------------------------
+// Code in .cpp file
+//
+// Objects record the work needed to draw them (pipeline, textures, buffers, constants, draws) into a
+// command list instead of calling the device context directly. Lists use no global state, so several
+// threads can each record a slice of the visible objects into their own list at the same time. A
+// backend (see CommandBackend.h) then replays the lists in order on the GPU, or just inspects them.
+// GPU objects are referred to with opaque handles, the backend knows what they really are.
+// Recording drops binds that repeat the last value set earlier in the same list.
+// Instanced draws take their world matrices from the list's instance data, which the backend uploads
+// when the list is executed, so offsets into it are only meaningful within the list.
+
+#pragma once
+
+#include "CMatrix4x4.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+
+// Opaque handle to a backend object (shader, state, buffer, texture view...). nullptr means none
+using GpuHandle = const void*;
+
+// Shaders and fixed function states used by a draw
+struct PipelineState
+{
+	GpuHandle vertexShader;
+	GpuHandle geometryShader;
+	GpuHandle pixelShader;
+	GpuHandle blendState;
+	GpuHandle depthStencilState;
+	GpuHandle rasterizerState;
+
+	bool operator==(const PipelineState& other) const
+	{
+		return vertexShader == other.vertexShader && geometryShader == other.geometryShader && pixelShader == other.pixelShader &&
+		       blendState == other.blendState && depthStencilState == other.depthStencilState && rasterizerState == other.rasterizerState;
+	}
+	bool operator!=(const PipelineState& other) const { return !(*this == other); }
+};
+
+
+enum class ECommand : uint8_t
+{
+	SetPipeline,
+	SetTexture,
+	SetVertexBuffer,
+	SetIndexBuffer,
+	UpdateConstants,
+	DrawIndexed,
+};
+
+struct Command
+{
+	struct Texture      { unsigned int slot; GpuHandle view; };
+	struct VertexBuffer { GpuHandle buffer; GpuHandle layout; unsigned int stride; };
+	struct IndexBuffer  { GpuHandle buffer; unsigned int indexSize; };
+	struct Constants    { GpuHandle buffer; unsigned int slot; unsigned int dataOffset; unsigned int size; };
+	struct Draw         { unsigned int indexCount; unsigned int startIndex; int baseVertex; unsigned int instanceCount; };
+
+	ECommand type;
+	union
+	{
+		PipelineState pipeline;
+		Texture       texture;
+		VertexBuffer  vertexBuffer;
+		IndexBuffer   indexBuffer;
+		Constants     constants;
+		Draw          draw;
+	};
+};
+
+
+class CCommandList
+{
+public:
+	// Maximum texture slot tracked for redundant binds, higher slots are always recorded
+	static const unsigned int NumTrackedTextures = 16;
+
+	CCommandList() { Reset(); }
+
+	// Empty the list, keeping its memory for the next recording
+	void Reset();
+
+	//-------------------------------------
+	// Recording
+	//-------------------------------------
+
+	void SetPipeline(const PipelineState& pipeline);
+
+	// Pixel shader texture
+	void SetTexture(unsigned int slot, GpuHandle view);
+
+	// Vertex buffer in slot 0 with its input layout
+	void SetVertexBuffer(GpuHandle buffer, GpuHandle layout, unsigned int stride);
+
+	// Index buffer of 16 or 32-bit indices (indexSize 2 or 4), triangle lists
+	void SetIndexBuffer(GpuHandle buffer, unsigned int indexSize = 4);
+
+	// Copy size bytes of data into the list, replayed as a write of the whole constant buffer, which is then bound
+	// to the given slot for all shader stages. Only the bytes given are defined, the rest of the buffer is not
+	void UpdateConstants(GpuHandle buffer, unsigned int slot, const void* data, unsigned int size);
+
+	void DrawIndexed(unsigned int indexCount, unsigned int startIndex = 0, int baseVertex = 0);
+
+	// Append world matrices to the list's instance data, returns the index of the first one
+	unsigned int AddInstanceMatrices(const CMatrix4x4* matrices, unsigned int count);
+
+	// Draw instanceCount instances, the shader finds their matrices with an offset sent in the constants
+	void DrawIndexedInstanced(unsigned int indexCount, unsigned int instanceCount, unsigned int startIndex = 0, int baseVertex = 0);
+
+	//-------------------------------------
+	// Reading
+	//-------------------------------------
+
+	const std::vector<Command>& Commands() const { return mCommands; }
+
+	// Data recorded by an UpdateConstants command
+	const void* ConstantData(const Command& command) const { return &mConstantData[command.constants.dataOffset]; }
+
+	// Total bytes of constant data recorded
+	size_t ConstantDataSize() const { return mConstantData.size(); }
+
+	// Matrices added with AddInstanceMatrices
+	const std::vector<CMatrix4x4>& InstanceMatrices() const { return mInstanceMatrices; }
+
+	bool Empty() const { return mCommands.empty(); }
+
+
+//-------------------------------------
+// Private members
+//-------------------------------------
+private:
+	std::vector<Command> mCommands;
+	std::vector<uint8_t> mConstantData; // Constants are 16-byte aligned in here
+	std::vector<CMatrix4x4> mInstanceMatrices;
+
+	// Last values recorded, to skip repeats
+	bool          mHasPipeline;
+	PipelineState mPipeline;
+	GpuHandle     mTextures[NumTrackedTextures];
+	bool          mTexturesSet[NumTrackedTextures];
+	GpuHandle     mVertexBuffer;
+	GpuHandle     mIndexBuffer;
+};
@@ -72,16 +72,23 @@ struct sSpotLight
     float cosHalfAngle;       //pre calculate this in the c++ side, for performance reasons
     CMatrix4x4 viewMatrix;    //the light view matrix (as it was a camera)
     CMatrix4x4 projMatrix;    //--"--
+    float shadowRect[4];      //where the shadow map is in the shadow atlas, see CShadowAtlas::GetTileRect
 };
 
+// Shadow cascades per directional light, must match CShadowCascades::MaxCascades and Common.hlsli
+const int MAX_CASCADES = 4;
+
 struct sDirLights
 {
     CVector3 colour;
     float pad;
     CVector3 facing;
     uint32_t numLights;
-    CMatrix4x4 viewMatrix;    //the light view matrix (as it was a camera)
-    CMatrix4x4 projMatrix;    //--"--
+    CMatrix4x4 cascadeMatrices[MAX_CASCADES]; //view * projection of each shadow cascade (see CascadedShadows.h)
+    float cascadeRects[MAX_CASCADES][4];      //where each cascade's shadow map is in the shadow atlas, see CShadowAtlas::GetTileRect
+    float cascadeSplits[MAX_CASCADES];        //the camera view depth each cascade reaches to
+    uint32_t numCascades;
+    uint32_t cascadePadding[3];
 };
 
 //--------------------------------------------------------------------------------------
@@ -89,6 +96,7 @@ struct sDirLights
 //--------------------------------------------------------------------------------------
 // Variables sent over to the GPU each frame
 
+// Limit for spot and directional lights, which have a shadow map each (a tile of the shadow atlas). Point lights have no fixed limit
 const int MAX_LIGHTS = 64;
 
 // Data that remains constant for an entire frame, updated from C++ to the GPU shaders *once per frame*
@@ -113,13 +121,29 @@ struct PerFrameConstants
 extern PerFrameConstants gPerFrameConstants;      // This variable holds the CPU-side constant buffer described above
 extern ID3D11Buffer*     gPerFrameConstantBuffer; // This variable controls the GPU-side constant buffer matching to the above structure
 
-struct PerFrameLights
+// Point lights are in a structured buffer of sLight owned by the game object manager, so their number isn't limited
+// by the size of a constant buffer. Shaders only visit the point and spot lights listed for their cluster (see
+// ClusteredLighting.h), this structure tells them how to find the cluster of a pixel
+struct PerFrameClusters
 {
-    sLight lights[MAX_LIGHTS];
+	float        tileScaleX;  // Tiles per pixel
+	float        tileScaleY;
+	float        depthScale;  // Slice = log(view depth) * depthScale + depthBias
+	float        depthBias;
+	unsigned int tilesX;
+	unsigned int tilesY;
+	unsigned int slices;
+	unsigned int padding;
 };
 
-extern PerFrameLights gPerFrameLightsConstants;
-extern ID3D11Buffer* gPerFrameLightsConstBuffer;
+extern PerFrameClusters gPerFrameClusters;
+extern ID3D11Buffer*    gPerFrameClustersConstBuffer;
+
+// Pixel shader resource slots for the clustered lighting buffers, must match Common.hlsli. The shadow atlas is in slot 5,
+// these are kept at the top of the range
+const unsigned int PointLightsSlot         = 125;
+const unsigned int ClustersSlot            = 126;
+const unsigned int ClusterLightIndicesSlot = 127;
 
 struct PerFrameSpotLights
 {
@@ -148,10 +172,25 @@ struct PerModelConstants
     CVector3   objectColour;  // Allows each light model to be tinted to match the light colour they cast
 	float      parallaxDepth; // Used in the geometry shader to control how much the polygons are exploded outwards
 
-	CMatrix4x4 boneMatrices[MAX_BONES];
+	uint32_t   instanceOffset; // Instanced draws only: index of the first instance's matrix in the instance buffer
+	uint32_t   octahedralNormals = 0; // Mesh has compressed vertices: normals and tangents are octahedral encoded (see VertexCompression.h)
+	float      padding[2];
+
+	CVector3   positionScale  = { 1, 1, 1 }; // Vertex positions are decoded as position * scale + offset
+	float      padding2;
+	CVector3   positionOffset = { 0, 0, 0 };
+	float      padding3;
 };
 extern PerModelConstants gPerModelConstants;      // This variable holds the CPU-side constant buffer described above
 extern ID3D11Buffer*     gPerModelConstantBuffer; // This variable controls the GPU-side constant buffer related to the above structure
 
+// Bone matrices for skinned meshes. Kept apart from the structure above so rigid meshes, which are most draws,
+// only send the few values they use. Only the matrices for the mesh's nodes are sent
+struct PerModelBones
+{
+	CMatrix4x4 boneMatrices[MAX_BONES];
+};
+extern ID3D11Buffer* gPerModelBonesBuffer;
+
 
 #endif //_COMMON_H_INCLUDED_
@@ -0,0 +1,243 @@
+//--------------------------------------------------------------------------------------
+// Command backend replaying command lists on the D3D11 immediate context
+//--------------------------------------------------------------------------------------
+
+#include "D3D11CommandBackend.h"
+
+#include "Common.h"
+#include "StateCache.h"
+
+#include <cstring>
+#include <stdexcept>
+
+
+namespace
+{
+	template <typename T>
+	T* As(GpuHandle handle)
+	{
+		return static_cast<T*>(const_cast<void*>(handle));
+	}
+
+	// Constant buffer ranges must start on a 256 byte boundary and be a multiple of 256 bytes long
+	const UINT ConstantAlignment = 256;
+
+	UINT AlignConstants(UINT size)
+	{
+		return (size + ConstantAlignment - 1) & ~(ConstantAlignment - 1);
+	}
+}
+
+
+CD3D11CommandBackend::CD3D11CommandBackend()
+	: mInstances(sizeof(CMatrix4x4), true),
+	  mRingChecked(false), mContext1(nullptr), mConstantRing(nullptr), mRingSize(0), mRingPosition(0),
+	  mConstantBytes(0)
+{
+}
+
+CD3D11CommandBackend::~CD3D11CommandBackend()
+{
+	if (mConstantRing)   mConstantRing->Release();
+	if (mContext1)       mContext1->Release();
+}
+
+
+void CD3D11CommandBackend::Execute(const CCommandList& list)
+{
+	for (auto& buffer : mBoundConstants) buffer = nullptr;
+
+	if (!list.InstanceMatrices().empty())
+	{
+		UploadInstances(list.InstanceMatrices());
+	}
+
+	if (!mRingChecked) InitialiseConstantRing();
+	if (mConstantRing) UploadConstants(list);
+
+	unsigned int constantIndex = 0;
+	for (const auto& command : list.Commands())
+	{
+		switch (command.type)
+		{
+		case ECommand::SetPipeline:
+		{
+			const auto& pipeline = command.pipeline;
+			gStateCache.SetVertexShader(As<ID3D11VertexShader>(pipeline.vertexShader));
+			gStateCache.SetGeometryShader(As<ID3D11GeometryShader>(pipeline.geometryShader));
+			gStateCache.SetPixelShader(As<ID3D11PixelShader>(pipeline.pixelShader));
+			gStateCache.SetBlendState(As<ID3D11BlendState>(pipeline.blendState));
+			gStateCache.SetDepthStencilState(As<ID3D11DepthStencilState>(pipeline.depthStencilState));
+			gStateCache.SetRasterizerState(As<ID3D11RasterizerState>(pipeline.rasterizerState));
+			break;
+		}
+
+		case ECommand::SetTexture:
+			gStateCache.SetPSShaderResource(command.texture.slot, As<ID3D11ShaderResourceView>(command.texture.view));
+			break;
+
+		case ECommand::SetVertexBuffer:
+			gStateCache.SetVertexBuffer(As<ID3D11Buffer>(command.vertexBuffer.buffer), command.vertexBuffer.stride);
+			gStateCache.SetInputLayout(As<ID3D11InputLayout>(command.vertexBuffer.layout));
+			break;
+
+		case ECommand::SetIndexBuffer:
+			gStateCache.SetIndexBuffer(As<ID3D11Buffer>(command.indexBuffer.buffer),
+			                           command.indexBuffer.indexSize == 2 ? DXGI_FORMAT_R16_UINT : DXGI_FORMAT_R32_UINT);
+			gStateCache.SetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+			break;
+
+		case ECommand::UpdateConstants:
+			if (mConstantRing)
+			{
+				BindConstantRange(command.constants.slot, mConstantRanges[constantIndex++], AlignConstants(command.constants.size) / 16);
+			}
+			else
+			{
+				UpdateConstants(command.constants, list.ConstantData(command));
+			}
+			break;
+
+		case ECommand::DrawIndexed:
+			if (command.draw.instanceCount == 1)
+			{
+				gD3DContext->DrawIndexed(command.draw.indexCount, command.draw.startIndex, command.draw.baseVertex);
+			}
+			else
+			{
+				gD3DContext->DrawIndexedInstanced(command.draw.indexCount, command.draw.instanceCount, command.draw.startIndex,
+				                                  command.draw.baseVertex, 0);
+			}
+			break;
+		}
+	}
+}
+
+void CD3D11CommandBackend::UpdateConstants(const Command::Constants& constants, const void* data)
+{
+	auto buffer = As<ID3D11Buffer>(constants.buffer);
+
+	D3D11_MAPPED_SUBRESOURCE cb;
+	if (FAILED(gD3DContext->Map(buffer, 0, D3D11_MAP_WRITE_DISCARD, 0, &cb))) return;
+	std::memcpy(cb.pData, data, constants.size);
+	gD3DContext->Unmap(buffer, 0);
+	mConstantBytes += constants.size;
+
+	if (constants.slot >= NumConstantSlots || mBoundConstants[constants.slot] != buffer)
+	{
+		gD3DContext->VSSetConstantBuffers(constants.slot, 1, &buffer);
+		gD3DContext->GSSetConstantBuffers(constants.slot, 1, &buffer);
+		gD3DContext->PSSetConstantBuffers(constants.slot, 1, &buffer);
+		if (constants.slot < NumConstantSlots) mBoundConstants[constants.slot] = buffer;
+	}
+}
+
+void CD3D11CommandBackend::UploadInstances(const std::vector<CMatrix4x4>& matrices)
+{
+	mInstances.Write(matrices.data(), static_cast<unsigned int>(matrices.size()));
+
+	auto view = mInstances.View();
+	gD3DContext->VSSetShaderResources(InstanceBufferSlot, 1, &view);
+}
+
+
+/*-----------------------------------------------------------------------------------------
+    Constant ring
+-----------------------------------------------------------------------------------------*/
+
+void CD3D11CommandBackend::InitialiseConstantRing()
+{
+	mRingChecked = true;
+
+	// Binding ranges of a buffer and mapping constant buffers without discarding both need Direct3D 11.1
+	D3D11_FEATURE_DATA_D3D11_OPTIONS options = {};
+	if (FAILED(gD3DDevice->CheckFeatureSupport(D3D11_FEATURE_D3D11_OPTIONS, &options, sizeof(options))) ||
+		!options.ConstantBufferOffsetting || !options.MapNoOverwriteOnDynamicConstantBuffer)
+	{
+		return;
+	}
+	if (FAILED(gD3DContext->QueryInterface(__uuidof(ID3D11DeviceContext1), reinterpret_cast<void**>(&mContext1))))
+	{
+		mContext1 = nullptr;
+		return;
+	}
+
+	CreateConstantRing(DefaultRingSize);
+}
+
+void CD3D11CommandBackend::CreateConstantRing(UINT size)
+{
+	if (mConstantRing) mConstantRing->Release();
+	mConstantRing = nullptr;
+
+	D3D11_BUFFER_DESC bufferDesc = {};
+	bufferDesc.ByteWidth = size;
+	bufferDesc.Usage = D3D11_USAGE_DYNAMIC;
+	bufferDesc.BindFlags = D3D11_BIND_CONSTANT_BUFFER;
+	bufferDesc.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
+	if (FAILED(gD3DDevice->CreateBuffer(&bufferDesc, nullptr, &mConstantRing)))
+	{
+		mRingSize = 0;
+		throw std::runtime_error("Error creating constant ring buffer");
+	}
+
+	mRingSize = size;
+	mRingPosition = size; // Forces a discard on the first map
+}
+
+void CD3D11CommandBackend::UploadConstants(const CCommandList& list)
+{
+	mConstantRanges.clear();
+
+	UINT listSize = 0;
+	for (const auto& command : list.Commands())
+	{
+		if (command.type == ECommand::UpdateConstants) listSize += AlignConstants(command.constants.size);
+	}
+	if (listSize == 0) return;
+
+	if (listSize > mRingSize)
+	{
+		auto size = mRingSize;
+		while (size < listSize) size *= 2;
+		CreateConstantRing(size);
+	}
+
+	// Append to the part of the ring the GPU may still be reading, or start again from the beginning with a fresh buffer
+	auto mapType = D3D11_MAP_WRITE_NO_OVERWRITE;
+	if (mRingPosition + listSize > mRingSize)
+	{
+		mapType = D3D11_MAP_WRITE_DISCARD;
+		mRingPosition = 0;
+	}
+
+	D3D11_MAPPED_SUBRESOURCE mapped;
+	if (FAILED(gD3DContext->Map(mConstantRing, 0, mapType, 0, &mapped)))
+	{
+		throw std::runtime_error("Error mapping constant ring buffer");
+	}
+
+	auto ring = static_cast<uint8_t*>(mapped.pData);
+	for (const auto& command : list.Commands())
+	{
+		if (command.type != ECommand::UpdateConstants) continue;
+
+		// Only the bytes recorded are copied, the rest of the range is never read by the shaders
+		std::memcpy(ring + mRingPosition, list.ConstantData(command), command.constants.size);
+		mConstantRanges.push_back(mRingPosition / 16);
+		mRingPosition += AlignConstants(command.constants.size);
+		mConstantBytes += command.constants.size;
+	}
+
+	gD3DContext->Unmap(mConstantRing, 0);
+}
+
+void CD3D11CommandBackend::BindConstantRange(UINT slot, UINT firstConstant, UINT numConstants)
+{
+	mContext1->VSSetConstantBuffers1(slot, 1, &mConstantRing, &firstConstant, &numConstants);
+	mContext1->GSSetConstantBuffers1(slot, 1, &mConstantRing, &firstConstant, &numConstants);
+	mContext1->PSSetConstantBuffers1(slot, 1, &mConstantRing, &firstConstant, &numConstants);
+
+	// The slot no longer holds the buffer the update was recorded with
+	if (slot < NumConstantSlots) mBoundConstants[slot] = nullptr;
+}
@@ -0,0 +1,73 @@
+//--------------------------------------------------------------------------------------
+// Command backend replaying command lists on the D3D11 immediate context
+//--------------------------------------------------------------------------------------
+// Code in .cpp file
+//
+// Handles in the lists are the D3D11 interface pointers. Binds go through the state cache so
+// state left by a previous list (or set before the lists) is not set again.
+// A list's instance matrices are uploaded to a dynamic structured buffer bound to vertex shader slot t0.
+// Where the device supports constant buffer offsets (Direct3D 11.1), all the constants recorded in a list
+// are copied into one large ring buffer with a single map, and each update becomes a bind of its range of
+// the ring. Otherwise each update maps the buffer it was recorded with.
+
+#pragma once
+
+#include "CommandBackend.h"
+#include "StructuredBuffer.h"
+
+#include <d3d11_1.h>
+#include <vector>
+
+
+class CD3D11CommandBackend : public ICommandBackend
+{
+public:
+	// Vertex shader slot for the instance matrices, must match gInstanceMatrices in Common.hlsli
+	static const UINT InstanceBufferSlot = 0;
+
+	// Starting size of the constant ring, it grows if a single list needs more
+	static const UINT DefaultRingSize = 4 * 1024 * 1024;
+
+	CD3D11CommandBackend();
+	~CD3D11CommandBackend();
+
+	void Execute(const CCommandList& list) override;
+
+	// Bytes of constants copied to the GPU since the last reset, to compare the two upload paths
+	size_t ConstantBytesUploaded() const { return mConstantBytes; }
+	void ResetStats() { mConstantBytes = 0; }
+
+private:
+	void UpdateConstants(const Command::Constants& constants, const void* data);
+
+	// Check for constant buffer offset support on first use, creating the ring if it is there
+	void InitialiseConstantRing();
+
+	// (Re)create the ring with at least the given size. Throws a std::runtime_error on failure
+	void CreateConstantRing(UINT size);
+
+	// Copy all the constants in the list into the ring, filling mConstantRanges with the first constant of each
+	void UploadConstants(const CCommandList& list);
+
+	// Bind a range of the ring, given in 16-byte constants, to the slot for all shader stages
+	void BindConstantRange(UINT slot, UINT firstConstant, UINT numConstants);
+
+	// Copy the list's instance matrices to the GPU, growing the buffer if needed. Throws a std::runtime_error on failure
+	void UploadInstances(const std::vector<CMatrix4x4>& matrices);
+
+	CStructuredBuffer mInstances;
+
+	// Constant buffers bound by the current Execute, to avoid binding again after each update
+	static const unsigned int NumConstantSlots = 6;
+	ID3D11Buffer* mBoundConstants[NumConstantSlots];
+
+	// Constant ring, null if the device can't bind buffer ranges
+	bool                  mRingChecked;
+	ID3D11DeviceContext1* mContext1;
+	ID3D11Buffer*         mConstantRing;
+	UINT                  mRingSize;
+	UINT                  mRingPosition;
+	std::vector<UINT>     mConstantRanges; // First constant in the ring of each UpdateConstants in the list being executed
+
+	size_t mConstantBytes;
+};
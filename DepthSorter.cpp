@@ -0,0 +1,157 @@
+//--------------------------------------------------------------------------------------
+// Depth sorter - orders blended items (particles, transparent draws) back to front
+//--------------------------------------------------------------------------------------
+
+#include "DepthSorter.h"
+#include "JobSystem.h"
+
+#include <algorithm>
+#include <cfloat>
+
+
+const std::vector<uint32_t>& CDepthSorter::Sort(const float* depths, unsigned int count)
+{
+	// Start from the last order. It held every index below the old count, so dropping those past the new count and
+	// adding any new ones leaves every index below the new count
+	if (mOrder.size() != count)
+	{
+		const auto previousCount = static_cast<unsigned int>(mOrder.size());
+		mOrder.erase(std::remove_if(mOrder.begin(), mOrder.end(), [count](uint32_t i) { return i >= count; }), mOrder.end());
+		for (auto i = previousCount; i < count; ++i)  mOrder.push_back(i);
+	}
+
+	mAlreadySorted = true;
+	if (count < 2)  return mOrder;
+
+	mItems.resize(count);
+	mScratch.resize(count);
+
+	const auto numBlocks = std::max(1u, std::min(JobSystemThreadCount(), count / MinBlockSize));
+	const auto blockSize = (count + numBlocks - 1) / numBlocks;
+	mBlockBuckets.resize(numBlocks * NumBuckets);
+	mBlocks.resize(numBlocks);
+
+	// Range of the depths, read in item order as that's faster than the last order
+	ParallelFor(numBlocks, 1, [&](unsigned int begin, unsigned int end)
+	{
+		for (auto block = begin; block < end; ++block)
+		{
+			auto nearest = FLT_MAX, farthest = -FLT_MAX;
+			const auto last = std::min(count, (block + 1) * blockSize);
+			for (auto i = block * blockSize; i < last; ++i)
+			{
+				nearest = std::min(nearest, depths[i]);
+				farthest = std::max(farthest, depths[i]);
+			}
+			mBlocks[block].nearest = nearest;
+			mBlocks[block].farthest = farthest;
+		}
+	});
+
+	auto nearest = FLT_MAX, farthest = -FLT_MAX;
+	for (auto& block : mBlocks)
+	{
+		nearest = std::min(nearest, block.nearest);
+		farthest = std::max(farthest, block.farthest);
+	}
+	if (farthest <= nearest)  return mOrder; // All the same depth, the last order stands
+
+	// Keys count up from the farthest depth
+	const auto scale = static_cast<float>((1u << KeyBits) - 1) / (farthest - nearest);
+	const auto maxKey = (1u << KeyBits) - 1;
+
+	// Build the keys in the last order, noting whether they are still sorted
+	ParallelFor(numBlocks, 1, [&](unsigned int begin, unsigned int end)
+	{
+		for (auto block = begin; block < end; ++block)
+		{
+			const auto first = block * blockSize;
+			const auto last = std::min(count, first + blockSize);
+
+			bool sorted = true;
+			uint32_t previousKey = 0;
+			for (auto i = first; i < last; ++i)
+			{
+				const auto index = mOrder[i];
+				const auto key = std::min(static_cast<uint32_t>((farthest - depths[index]) * scale), maxKey);
+				mItems[i] = static_cast<uint64_t>(key) << 32 | index;
+				sorted &= key >= previousKey;
+				previousKey = key;
+			}
+			mBlocks[block].sorted = sorted;
+			mBlocks[block].first = static_cast<uint32_t>(mItems[first] >> 32);
+			mBlocks[block].last = previousKey;
+		}
+	});
+
+	for (unsigned int block = 0; block < numBlocks && mAlreadySorted; ++block)
+	{
+		mAlreadySorted = mBlocks[block].sorted && (block == 0 || mBlocks[block - 1].last <= mBlocks[block].first);
+	}
+	if (mAlreadySorted)  return mOrder;
+
+
+	auto* source = &mItems;
+	auto* destination = &mScratch;
+	for (unsigned int pass = 0; pass < NumPasses; ++pass)
+	{
+		const auto shift = 32 + pass * DigitBits;
+		const auto digit = [shift](uint64_t item) { return static_cast<uint32_t>(item >> shift) & (NumBuckets - 1); };
+
+		// Count the digits in each block
+		ParallelFor(numBlocks, 1, [&](unsigned int begin, unsigned int end)
+		{
+			for (auto block = begin; block < end; ++block)
+			{
+				auto buckets = &mBlockBuckets[block * NumBuckets];
+				std::fill(buckets, buckets + NumBuckets, 0u);
+
+				const auto last = std::min(count, (block + 1) * blockSize);
+				for (auto i = block * blockSize; i < last; ++i)  ++buckets[digit((*source)[i])];
+			}
+		});
+
+		// Nothing to do if every item has the same digit
+		const auto firstDigit = digit((*source)[0]);
+		unsigned int sameDigit = 0;
+		for (unsigned int block = 0; block < numBlocks; ++block)  sameDigit += mBlockBuckets[block * NumBuckets + firstDigit];
+		if (sameDigit == count)  continue;
+
+		// Counts to where each block's items of each digit start: all the 0s of block 0, then the 0s of block 1...
+		uint32_t offset = 0;
+		for (unsigned int bucket = 0; bucket < NumBuckets; ++bucket)
+		{
+			for (unsigned int block = 0; block < numBlocks; ++block)
+			{
+				auto& entry = mBlockBuckets[block * NumBuckets + bucket];
+				const auto bucketCount = entry;
+				entry = offset;
+				offset += bucketCount;
+			}
+		}
+
+		// Blocks scatter their items to their own ranges of the output
+		ParallelFor(numBlocks, 1, [&](unsigned int begin, unsigned int end)
+		{
+			for (auto block = begin; block < end; ++block)
+			{
+				auto buckets = &mBlockBuckets[block * NumBuckets];
+				auto output = destination->data();
+
+				const auto last = std::min(count, (block + 1) * blockSize);
+				for (auto i = block * blockSize; i < last; ++i)
+				{
+					const auto item = (*source)[i];
+					output[buckets[digit(item)]++] = item;
+				}
+			}
+		});
+		std::swap(source, destination);
+	}
+
+	ParallelFor(count, MinBlockSize, [&](unsigned int begin, unsigned int end)
+	{
+		for (auto i = begin; i < end; ++i)  mOrder[i] = static_cast<uint32_t>((*source)[i]);
+	});
+	return mOrder;
+}
@@ -0,0 +1,73 @@
+//--------------------------------------------------------------------------------------
+// Depth sorter - orders blended items (particles, transparent draws) back to front
+//--------------------------------------------------------------------------------------
+// Code in .cpp file
+//
+// Items are sorted by their view space depth, farthest first, with a parallel LSD radix sort. Each depth is turned
+// into a 22-bit key, its place between the nearest and farthest depths being sorted (a millionth of the range apart
+// is still told apart), and the keys are sorted 11 bits at a time in two passes, skipping a pass if every key has
+// the same digit. Each pass splits the items into one block per thread: the blocks count their digits at the same
+// time, the counts give each block where its items go, and the blocks then scatter their items at the same time.
+// The sort is stable, so items at the same depth don't swap.
+//
+// A sorter is kept from frame to frame and starts from the order it produced last time. Depths rarely change much
+// between frames, so the keys often come out already sorted, which is detected while they are built and the passes
+// skipped. Otherwise the nearly sorted input is scattered to few places at a time, which is kinder to the cache.
+// Sorts for different sets of items (e.g. one per particle emitter) each need their own sorter. No graphics API is
+// used here.
+
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+
+class CDepthSorter
+{
+public:
+	// Sort count items by depth, farthest first. depths[i] is the view space depth of item i, and must be finite.
+	// Returns the item indices in drawing order, valid until the next Sort. If the number of items has changed
+	// since the last sort, the old order is kept for the items that are still there, with new ones added at the end
+	const std::vector<uint32_t>& Sort(const float* depths, unsigned int count);
+
+	const std::vector<uint32_t>& Order() const { return mOrder; }
+
+	// Whether the last Sort found the items already in order, so no radix passes were needed
+	bool WasAlreadySorted() const { return mAlreadySorted; }
+
+	// Forget the previous order
+	void Reset() { mOrder.clear(); }
+
+
+//-------------------------------------
+// Private members
+//-------------------------------------
+private:
+	static const unsigned int DigitBits = 11;
+	static const unsigned int NumBuckets = 1 << DigitBits;
+	static const unsigned int NumPasses = 2;
+	static const unsigned int KeyBits = DigitBits * NumPasses;
+
+	// Fewest items per block, smaller sorts use fewer threads
+	static const unsigned int MinBlockSize = 16384;
+
+	// Items as key << 32 | index, and a buffer to scatter them to
+	std::vector<uint64_t> mItems;
+	std::vector<uint64_t> mScratch;
+
+	// Digit counts of each block, turned into where the block's items go
+	std::vector<uint32_t> mBlockBuckets;
+
+	// Range of depths in each block, then whether each block's keys are in order and its first and last keys, to check
+	// the whole set without a second read
+	struct Block
+	{
+		float    nearest, farthest;
+		bool     sorted;
+		uint32_t first, last;
+	};
+	std::vector<Block> mBlocks;
+
+	std::vector<uint32_t> mOrder;
+	bool mAlreadySorted = false;
+};
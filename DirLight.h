@@ -2,6 +2,7 @@
 
 #include "GameObjectManager.h"
 #include "Light.h"
+#include "CascadedShadows.h"
 
 class CDirLight :
 	public CLight
@@ -9,7 +10,7 @@ class CDirLight :
 
 public:
 
-	CDirLight(std::string mesh, std::string name,
+	CDirLight(const std::string& mesh, const std::string& name,
 		const std::string& diffuse, std::string& vertexShader, std::string& pixelShader,
 		CVector3 colour = { 0.0f, 0.0f, 0.0f }, float strength = 0.0f,
 		CVector3 position = { 0, 0, 0 }, CVector3 rotation = { 0, 0, 0 }, float scale = 1, CVector3 facing = { 0,0,1 });
@@ -21,18 +22,33 @@ public:
 	//}
 
 
-	ID3D11ShaderResourceView* RenderFromThis(CGameObjectManager* CGOM);
+	// Fit the shadow cascades to the camera (world and projection matrices) and render each into its tile of the atlas,
+	// skipping those that haven't changed since they were last rendered. Returns the number of cascades rendered
+	int RenderFromThis(CGameObjectManager* CGOM, CShadowAtlas& atlas, const CMatrix4x4& cameraMatrix,
+	                   const CMatrix4x4& projectionMatrix, float nearClip);
 
-	auto GetNearClip() { return mNearClip; }
-	auto GetFarClip() { return mFarClip; }
-	auto SetNearClip(float n) { mNearClip = n; }
-	auto SetFarClip(float n) { mFarClip = n; }
 	auto GetDirection() { return mDirection; }
-	auto SetDirection(CVector3& dir) { mDirection = dir; }
+	auto SetDirection(CVector3& dir) { mDirection = dir; LightChanged(); }
+	// Resolution of each cascade
 	void SetShadowMapSize(int s);
 	auto GetShadowMapSize() { return mShadowMapSize; }
 
-	~CDirLight();
+	// Distance from the camera that shadows are drawn to, split between the cascades
+	auto GetShadowDistance() { return mShadowDistance; }
+	void SetShadowDistance(float d) { mShadowDistance = d; }
+
+	// Casters up to this far beyond a cascade toward the light still cast shadows into it
+	auto GetBackDistance() { return mBackDistance; }
+	void SetBackDistance(float d) { mBackDistance = d; }
+
+	// See CShadowCascades
+	unsigned int GetCascadeCount() const { return mCascades.Count(); }
+	void SetCascadeCount(unsigned int count);
+	float GetSplitLambda() const { return mCascades.SplitLambda(); }
+	void SetSplitLambda(float lambda) { mCascades.SetSplitLambda(lambda); }
+
+	// Cascades fitted by the last RenderFromThis
+	const CShadowCascades& GetCascades() const { return mCascades; }
 
 
 private:
@@ -40,14 +56,8 @@ private:
 	int mShadowMapSize;
 
 	CVector3 mDirection;
-	float mWidth;
-	float mHeight;
-	float mNearClip;
-	float mFarClip;
-
-	ID3D11Texture2D* mShadowMap;
-	ID3D11DepthStencilView* mShadowMapDepthStencil;
-	ID3D11ShaderResourceView* mShadowMapSRV;
+	float mShadowDistance;
+	float mBackDistance;
 
+	CShadowCascades mCascades;
 };
-
@@ -1,6 +1,7 @@
 #include "Engine.h"
 
 #include "Direct3DSetup.h"
+#include "JobSystem.h"
 
 CDXEngine::CDXEngine(HINSTANCE hInstance, int nCmdShow)
 {
@@ -24,11 +25,15 @@ CDXEngine::CDXEngine(HINSTANCE hInstance, int nCmdShow)
 	// Prepare TL-Engine style input functions
 	InitInput();
 
+	// Worker threads for the parallel parts of the update (spatial queries, etc.)
+	InitJobSystem();
+
 	// Initialise Direct3D
 	if (!InitDirect3D())
 	{
 
 		ShutdownDirect3D();
+		ShutdownJobSystem();
 
 		throw std::runtime_error("Impossible initialize DirectX");
 	}
@@ -42,6 +47,7 @@ CDXEngine::CDXEngine(HINSTANCE hInstance, int nCmdShow)
 		delete mMainScene;
 
 		ShutdownDirect3D();
+		ShutdownJobSystem();
 
 		throw std::runtime_error(e.what());
 	}
@@ -84,6 +90,7 @@ bool CDXEngine::Update()
 	delete mMainScene;
 
 	ShutdownDirect3D();
+	ShutdownJobSystem();
 
 	return (int)msg.wParam;
 }
@@ -0,0 +1,146 @@
+//--------------------------------------------------------------------------------------
+// Frustum culling over a contiguous set of bounding boxes
+//--------------------------------------------------------------------------------------
+
+#include "FrustumCulling.h"
+
+#include "JobSystem.h"
+
+#include <algorithm>
+#include <cmath>
+#include <xmmintrin.h>
+
+
+namespace
+{
+	// Boxes per job when culling on several threads. Below this the whole set is culled on the calling thread
+	const int CullingChunkSize = 4096;
+}
+
+
+/*-----------------------------------------------------------------------------------------
+    Usage
+-----------------------------------------------------------------------------------------*/
+
+void CCullingBounds::Clear()
+{
+	mCentreX.clear(); mCentreY.clear(); mCentreZ.clear();
+	mExtentX.clear(); mExtentY.clear(); mExtentZ.clear();
+	mCount = 0;
+}
+
+void CCullingBounds::Reserve(int count)
+{
+	const auto padded = (count + 3) & ~3;
+	mCentreX.reserve(padded); mCentreY.reserve(padded); mCentreZ.reserve(padded);
+	mExtentX.reserve(padded); mExtentY.reserve(padded); mExtentZ.reserve(padded);
+}
+
+int CCullingBounds::Add(const CAABB& box)
+{
+	const auto index = mCount++;
+
+	// Grow by a whole group of four when needed, the padding entries are never reported as visible
+	if (index % 4 == 0)
+	{
+		const auto padded = static_cast<size_t>(index + 4);
+		mCentreX.resize(padded, 0.0f); mCentreY.resize(padded, 0.0f); mCentreZ.resize(padded, 0.0f);
+		mExtentX.resize(padded, 0.0f); mExtentY.resize(padded, 0.0f); mExtentZ.resize(padded, 0.0f);
+	}
+
+	Set(index, box);
+	return index;
+}
+
+void CCullingBounds::Set(int index, const CAABB& box)
+{
+	const auto c = box.Centre();
+	const auto e = box.Extents();
+	mCentreX[index] = c.x; mCentreY[index] = c.y; mCentreZ[index] = c.z;
+	mExtentX[index] = e.x; mExtentY[index] = e.y; mExtentZ[index] = e.z;
+}
+
+
+/*-----------------------------------------------------------------------------------------
+    Culling
+-----------------------------------------------------------------------------------------*/
+
+// Same test as CFrustum::Intersects(CAABB) on four boxes at once: a box is outside if, for any plane, the distance
+// from its centre plus its extents projected onto the plane normal is negative
+void CCullingBounds::CullRange(const CFrustum& frustum, int first, int last, std::vector<int>& visible) const
+{
+	__m128 planeX[CFrustum::NumPlanes], planeY[CFrustum::NumPlanes], planeZ[CFrustum::NumPlanes], planeD[CFrustum::NumPlanes];
+	__m128 absX[CFrustum::NumPlanes], absY[CFrustum::NumPlanes], absZ[CFrustum::NumPlanes];
+	for (int p = 0; p < CFrustum::NumPlanes; ++p)
+	{
+		const auto& plane = frustum.planes[p];
+		planeX[p] = _mm_set1_ps(plane.normal.x);
+		planeY[p] = _mm_set1_ps(plane.normal.y);
+		planeZ[p] = _mm_set1_ps(plane.normal.z);
+		planeD[p] = _mm_set1_ps(plane.distance);
+		absX[p] = _mm_set1_ps(std::abs(plane.normal.x));
+		absY[p] = _mm_set1_ps(std::abs(plane.normal.y));
+		absZ[p] = _mm_set1_ps(std::abs(plane.normal.z));
+	}
+
+	const auto zero = _mm_setzero_ps();
+
+	for (int i = first; i < last; i += 4)
+	{
+		const auto cx = _mm_loadu_ps(&mCentreX[i]);
+		const auto cy = _mm_loadu_ps(&mCentreY[i]);
+		const auto cz = _mm_loadu_ps(&mCentreZ[i]);
+		const auto ex = _mm_loadu_ps(&mExtentX[i]);
+		const auto ey = _mm_loadu_ps(&mExtentY[i]);
+		const auto ez = _mm_loadu_ps(&mExtentZ[i]);
+
+		auto outside = _mm_setzero_ps();
+		for (int p = 0; p < CFrustum::NumPlanes; ++p)
+		{
+			auto distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(cx, planeX[p]), _mm_mul_ps(cy, planeY[p])),
+			                           _mm_add_ps(_mm_mul_ps(cz, planeZ[p]), planeD[p]));
+			const auto radius = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ex, absX[p]), _mm_mul_ps(ey, absY[p])), _mm_mul_ps(ez, absZ[p]));
+			outside = _mm_or_ps(outside, _mm_cmplt_ps(_mm_add_ps(distance, radius), zero));
+		}
+
+		// One bit per box, set for boxes that are visible. Padding entries past the last box are ignored
+		auto mask = ~_mm_movemask_ps(outside) & 0xF;
+		if (last - i < 4) mask &= (1 << (last - i)) - 1;
+
+		for (int lane = 0; mask; ++lane, mask >>= 1)
+		{
+			if (mask & 1) visible.push_back(i + lane);
+		}
+	}
+}
+
+int CCullingBounds::Cull(const CFrustum& frustum, std::vector<int>& visible) const
+{
+	const auto firstVisible = visible.size();
+
+	if (mCount <= CullingChunkSize)
+	{
+		CullRange(frustum, 0, mCount, visible);
+		return static_cast<int>(visible.size() - firstVisible);
+	}
+
+	// Each chunk writes to its own list, then the lists are joined in order
+	const auto numChunks = (mCount + CullingChunkSize - 1) / CullingChunkSize;
+	std::vector<std::vector<int>> chunkVisible(numChunks);
+
+	ParallelFor(numChunks, 1, [&](unsigned int begin, unsigned int end)
+	{
+		for (auto chunk = begin; chunk < end; ++chunk)
+		{
+			const auto first = static_cast<int>(chunk) * CullingChunkSize;
+			const auto last = std::min(mCount, first + CullingChunkSize);
+			CullRange(frustum, first, last, chunkVisible[chunk]);
+		}
+	});
+
+	for (const auto& chunk : chunkVisible)
+	{
+		visible.insert(visible.end(), chunk.begin(), chunk.end());
+	}
+	return static_cast<int>(visible.size() - firstVisible);
+}
@@ -0,0 +1,56 @@
+//--------------------------------------------------------------------------------------
+// Frustum culling over a contiguous set of bounding boxes
+//--------------------------------------------------------------------------------------
+// Boxes are stored as centre / extents in structure-of-arrays form (all centre x's together, etc.)
+// so the test can run on four boxes at a time with SSE. Large sets are split across the job system.
+// Each box is identified by its index, the owner keeps whatever it needs to map indices to objects.
+
+#pragma once
+
+#include "BoundingVolumes.h"
+
+#include <vector>
+
+
+class CCullingBounds
+{
+public:
+	//-------------------------------------
+	// Usage
+	//-------------------------------------
+
+	void Clear();
+
+	void Reserve(int count);
+
+	// Add a box to the end of the set, returns its index
+	int Add(const CAABB& box);
+
+	// Replace the box at the given index
+	void Set(int index, const CAABB& box);
+
+	int Size() const { return mCount; }
+
+
+	//-------------------------------------
+	// Culling
+	//-------------------------------------
+
+	// Append the index of every box that is at least partially inside the frustum, in increasing order.
+	// Returns the number of visible boxes
+	int Cull(const CFrustum& frustum, std::vector<int>& visible) const;
+
+
+//-------------------------------------
+// Private members
+//-------------------------------------
+private:
+
+	// Test boxes [first, last) - first must be a multiple of 4
+	void CullRange(const CFrustum& frustum, int first, int last, std::vector<int>& visible) const;
+
+	// Arrays are padded to a multiple of 4 so the SIMD loop never needs a scalar tail
+	std::vector<float> mCentreX, mCentreY, mCentreZ;
+	std::vector<float> mExtentX, mExtentY, mExtentZ;
+	int mCount = 0;
+};
@@ -9,14 +9,46 @@
 #include <codecvt>
 #include "GraphicsHelpers.h"
 #include "Shader.h"
+#include "ResourceCache.h"
 #include <locale>
 #include <filesystem>
+#include <typeinfo>
 #include <utility>
+#include <algorithm>
+#include <cctype>
 
 #include "State.h"
+#include "D3D11CommandBackend.h"
 
 
-void GetSimilarFilesIn(std::string& dirPath, std::vector<std::string>& fileNames, std::string& fileToFind)
+// Name of the instanced version of a vertex shader, "Shaders\\PBR_vs" -> "Shaders\\PBR_Instanced_vs"
+std::string InstancedShaderName(const std::string& vertexShader)
+{
+	const std::string suffix = "_vs";
+	if (vertexShader.size() < suffix.size() || vertexShader.compare(vertexShader.size() - suffix.size(), suffix.size(), suffix) != 0)
+	{
+		return vertexShader + "_Instanced";
+	}
+	return vertexShader.substr(0, vertexShader.size() - suffix.size()) + "_Instanced" + suffix;
+}
+
+
+// Level number in a mesh file name, "abc_LOD2.fbx" -> 2. Files without one count as level 0
+unsigned int LodNumber(const std::string& fileName)
+{
+	const auto lodPos = fileName.rfind("LOD");
+	if (lodPos == std::string::npos) return 0;
+
+	unsigned int number = 0;
+	for (auto i = lodPos + 3; i < fileName.size() && std::isdigit(static_cast<unsigned char>(fileName[i])); ++i)
+	{
+		number = number * 10 + (fileName[i] - '0');
+	}
+	return number;
+}
+
+
+void GetSimilarFilesIn(const std::string& dirPath, std::vector<std::string>& fileNames, const std::string& fileToFind)
 {
 	//get the name of the file 
 	auto esPos = fileToFind.find_last_of('_');
@@ -64,19 +96,29 @@ void GetSimilarFilesIn(std::string& dirPath, std::vector<std::string>& fileNames
 	}
 }
 
-CGameObject::CGameObject(std::string mesh, std::string name, const std::string& diffuseMap, std::string&
+CGameObject::CGameObject(const std::string& mesh, const std::string& name, const std::string& diffuseMap, std::string&
 	vertexShader, std::string& pixelShader, CVector3 position /*= { 0,0,0 }*/, CVector3 rotation /*= { 0,0,0 }*/, float scale /*= 1*/)
 {
 
 	if (mesh.empty()) throw std::exception("Error Loading Object");
 
-	mName = std::move(name);
+	mName = CStringId(name);
 
 	//initialize graphics related components 
 
 	mEnabled = true;
 
+	mSpatialProxy = -1;
+	mGridItem = -1;
+	mLayers = Layer_Default;
+
+	mTransformVersion = 1;
+	mBoundsVersion = 0;
+
+	mLod = 0;
+
 	mVertexShader = nullptr;
+	mInstancedVertexShader = nullptr;
 	mGeometryShader = nullptr;
 	mPixelShader = nullptr;
 
@@ -147,7 +189,7 @@ CGameObject::CGameObject(std::string mesh, std::string name, const std::string&
 					if (fileName == "Albedo")
 					{
 						//found albedo map
-						if (!LoadTexture(originalFileName, &mPbrMaps.Albedo, &mPbrMaps.AlbedoSRV))
+						if (!LoadSharedTexture(originalFileName, &mPbrMaps.Albedo, &mPbrMaps.AlbedoSRV))
 						{
 							throw std::runtime_error("Error Loading: " + fileName);
 						}
@@ -155,7 +197,7 @@ CGameObject::CGameObject(std::string mesh, std::string name, const std::string&
 					else if (fileName == "AO")
 					{
 						//ambient occlusion map
-						if (!LoadTexture(originalFileName, &mPbrMaps.AO, &mPbrMaps.AoSRV))
+						if (!LoadSharedTexture(originalFileName, &mPbrMaps.AO, &mPbrMaps.AoSRV))
 						{
 							throw std::runtime_error("Error Loading: " + fileName);
 						}
@@ -164,7 +206,7 @@ CGameObject::CGameObject(std::string mesh, std::string name, const std::string&
 					{
 						//found displacement map
 						//TODO: THERE IS A .EXR FILE THAT I DUNNO WHAT IS IT
-						if (!LoadTexture(originalFileName, &mPbrMaps.Displacement, &mPbrMaps.DisplacementSRV))
+						if (!LoadSharedTexture(originalFileName, &mPbrMaps.Displacement, &mPbrMaps.DisplacementSRV))
 						{
 							throw std::runtime_error("Error Loading: " + fileName);
 						}
@@ -175,7 +217,7 @@ CGameObject::CGameObject(std::string mesh, std::string name, const std::string&
 						//TODO include LOD
 						//
 						//normal map
-						if (!LoadTexture(originalFileName, &mPbrMaps.Normal, &mPbrMaps.NormalSRV))
+						if (!LoadSharedTexture(originalFileName, &mPbrMaps.Normal, &mPbrMaps.NormalSRV))
 						{
 							throw std::runtime_error("Error Loading: " + fileName);
 						}
@@ -183,7 +225,7 @@ CGameObject::CGameObject(std::string mesh, std::string name, const std::string&
 					else if (fileName == "Roughness")
 					{
 						//roughness map
-						if (!LoadTexture(originalFileName, &mPbrMaps.Roughness, &mPbrMaps.RoughnessSRV))
+						if (!LoadSharedTexture(originalFileName, &mPbrMaps.Roughness, &mPbrMaps.RoughnessSRV))
 						{
 							throw std::runtime_error("Error Loading: " + fileName);
 						}
@@ -196,7 +238,7 @@ CGameObject::CGameObject(std::string mesh, std::string name, const std::string&
 
 				//push the all the meshes avaliable in this vector
 				//import it later
-				mMeshFiles.push_back(originalFileName);
+				mMeshFiles.push_back(CStringId(originalFileName));
 
 			}
 			else
@@ -207,13 +249,22 @@ CGameObject::CGameObject(std::string mesh, std::string name, const std::string&
 		}
 
 
+		// The directory order is arbitrary, put the levels in order so the most detailed mesh comes first
+		std::sort(mMeshFiles.begin(), mMeshFiles.end(), [](const CStringId& a, const CStringId& b)
+		{
+			return LodNumber(a.Str()) < LodNumber(b.Str());
+		});
+
+		// A model with a single mesh file gets levels of detail generated from it
+		const auto generateLods = mMeshFiles.size() == 1;
+
 		//if this model has a normal map
 		if (mPbrMaps.Normal)
 		{
 			try
 			{
 				//load the most detailed mesh with tangents required
-				mMesh = new CMesh(mMeshFiles.front(), true);
+				mMesh = LoadSharedMesh(mMeshFiles.front().Str(), true, generateLods);
 			}
 			catch (std::exception& e)
 			{
@@ -224,7 +275,7 @@ CGameObject::CGameObject(std::string mesh, std::string name, const std::string&
 		{
 			try
 			{
-				mMesh = new CMesh(mMeshFiles.front() /* TODO .front for best resolution*/);
+				mMesh = LoadSharedMesh(mMeshFiles.front().Str(), false, generateLods);
 			}
 			catch (std::exception& e)
 			{
@@ -232,7 +283,18 @@ CGameObject::CGameObject(std::string mesh, std::string name, const std::string&
 			}
 		}
 
-		// Set default matrices from mesh //TODO could set initially the less detailed one and then load the more complex ones according to the camera position
+		// The other levels are loaded the first time they are selected (see SelectLod)
+		if (generateLods)
+		{
+			for (unsigned int i = 0; i < mMesh->NumLods(); ++i) mLodLevels.push_back({ mMesh, i });
+		}
+		else
+		{
+			mLodLevels.resize(mMeshFiles.size());
+			mLodLevels[0] = { mMesh, 0 };
+		}
+
+		// Set default matrices from mesh
 		mWorldMatrices.resize(mMesh->NumberNodes());
 
 		for (auto i = 0; i < mWorldMatrices.size(); ++i)
@@ -248,7 +310,8 @@ CGameObject::CGameObject(std::string mesh, std::string name, const std::string&
 		//that could be light models or cube maps
 		try
 		{
-			mMesh = new CMesh(mesh);
+			mMesh = LoadSharedMesh(mesh, false, true);
+			for (unsigned int i = 0; i < mMesh->NumLods(); ++i) mLodLevels.push_back({ mMesh, i });
 
 			// Set default matrices from mesh
 			mWorldMatrices.resize(mMesh->NumberNodes());
@@ -262,51 +325,78 @@ CGameObject::CGameObject(std::string mesh, std::string name, const std::string&
 
 		//TODO
 
-		if (!(mVertexShader = LoadVertexShader(vertexShader)))
+		if (!(mVertexShader = LoadSharedVertexShader(vertexShader)))
 		{
 			throw std::runtime_error("error loading vertex shader");
 		}
 
-		mPixelShader = LoadPixelShader(pixelShader);
+		mPixelShader = LoadSharedPixelShader(pixelShader);
 
-		if (!(mPixelShader = LoadPixelShader(pixelShader)))
+		if (!(mPixelShader = LoadSharedPixelShader(pixelShader)))
 		{
 			throw std::runtime_error("error loading pixel shader");
 		}
 
-		if (!LoadTexture(diffuseMap, &mPbrMaps.Albedo, &mPbrMaps.AlbedoSRV))
+		if (!LoadSharedTexture(diffuseMap, &mPbrMaps.Albedo, &mPbrMaps.AlbedoSRV))
 		{
 			throw std::runtime_error("Error loading texture: " + diffuseMap);
 		}
 	}
 
 	//TODO remove
-	mVertexShader = LoadVertexShader(vertexShader);
+	mVertexShader = LoadSharedVertexShader(vertexShader);
 
 	if (!mVertexShader)
 	{
 		throw std::runtime_error("error loading vertex shader");
 	}
 
-	mPixelShader = LoadPixelShader(pixelShader);
+	mPixelShader = LoadSharedPixelShader(pixelShader);
 
 	if (!mPixelShader)
 	{
 		throw std::runtime_error("error loading pixel shader");
 	}
 
+	// Optional instanced variant of the vertex shader (X_vs -> X_Instanced_vs). Without one the object is never instanced
+	if (mMesh->CanInstance())
+	{
+		mInstancedVertexShader = LoadSharedVertexShader(InstancedShaderName(vertexShader));
+	}
+
 	//geometry loaded, set its position...
 
 	SetPosition(position);
 	SetRotation(rotation);
 	SetScale(scale);
+
+	// Animated meshes start playing their first animation from the default pose
+	if (mMesh->NumAnimations() > 0)
+	{
+		std::vector<CMatrix4x4> restMatrices(mMesh->NumberNodes());
+		for (unsigned int i = 0; i < restMatrices.size(); ++i)  restMatrices[i] = mMesh->GetNodeDefaultMatrix(i);
+		mAnimator = std::make_unique<CAnimator>(restMatrices);
+		mAnimator->Play(mMesh->GetAnimation(0), 0, 0.0f);
+	}
 }
 
 
 
-// The render function simply passes this model's matrices over to Mesh:Render.
-// All other per-frame constants must have been set already along with shaders, textures, samplers, states etc.
+// Render the object straight away on the immediate context, outside of the object manager's command lists
 void CGameObject::Render(bool basicGeometry)
+{
+	static CD3D11CommandBackend backend;
+
+	CCommandList list;
+	Record(list, basicGeometry);
+	backend.Execute(list);
+}
+
+
+// The record function sets up the shaders, textures and states and passes this model's matrices over to Mesh:Record.
+// Per-frame constants, samplers etc. must have been set already. Only reads the object, so objects can be recorded
+// on several threads at once
+void CGameObject::Record(CCommandList& list, bool basicGeometry, const MeshletView* view) const
 {
 
 	if (!mEnabled) return;
@@ -315,98 +405,170 @@ void CGameObject::Render(bool basicGeometry)
 
 	//gPerModelConstants.parallaxDepth = 0.006f; //TODO
 	//
+	const auto pipeline = RecordPipeline(list, basicGeometry, false);
+
+	// Back facing meshlets can only be skipped if the rasterizer would cull their triangles anyway
+	MeshletView objectView;
+	if (view)
+	{
+		objectView = *view;
+		objectView.coneCulling = view->coneCulling && pipeline.rasterizerState == gCullBackState;
+	}
+
+	// Start from the shared per-model values and add this object's own
+	PerModelConstants constants;
+	constants.parallaxDepth = gPerModelConstants.parallaxDepth;
+	constants.objectColour = ObjectColour();
+
+	// The level chosen by the last SelectLod
+	const auto& lod = mLodLevels[mLod];
+	lod.mesh->Record(list, mWorldMatrices, constants, lod.meshLod, view ? &objectView : nullptr);
+}
+
+// Record the shaders, states and textures used to draw this object
+PipelineState CGameObject::RecordPipeline(CCommandList& list, bool basicGeometry, bool instanced) const
+{
+	const auto vertexShader = instanced ? mInstancedVertexShader : mVertexShader;
+
 	//if the object is required rendered without effects or textures
+	PipelineState pipeline = {};
 	if (basicGeometry)
 	{
 		// Use special depth-only rendering shaders
-		gD3DContext->VSSetShader(mVertexShader, nullptr, 0);
+		pipeline.vertexShader = vertexShader;
 
 		//even thought we are not using normals we need to set the correct pixel shader 
 		if (mPbrMaps.Normal)
 		{
-			gD3DContext->PSSetShader(gPbrDepthOnlyPixelShader, nullptr, 0);
+			pipeline.pixelShader = gPbrDepthOnlyPixelShader;
 		}
 		else
 		{
-			gD3DContext->PSSetShader(gDepthOnlyPixelShader, nullptr, 0);
+			pipeline.pixelShader = gDepthOnlyPixelShader;
 		}
 
 		// States - no blending, normal depth buffer and culling
-		gD3DContext->OMSetBlendState(gNoBlendingState, nullptr, 0xffffff);
-		gD3DContext->OMSetDepthStencilState(gUseDepthBufferState, 0);
-		gD3DContext->RSSetState(gCullBackState);
+		pipeline.blendState = gNoBlendingState;
+		pipeline.depthStencilState = gUseDepthBufferState;
+		pipeline.rasterizerState = gCullBackState;
+
+		list.SetPipeline(pipeline);
 	}
 	else
 	{
-		//check if the current vertex shader is not already set 
+		pipeline.vertexShader = vertexShader;
+		pipeline.pixelShader = mPixelShader;
+		GetPipelineStates(pipeline);
 
-		ID3D11VertexShader* VS = nullptr;
+		list.SetPipeline(pipeline);
 
+		list.SetTexture(0, mPbrMaps.AlbedoSRV);
 
-		gD3DContext->VSGetShader(&VS, nullptr, 0);
+		//************************
+		// Send PBR Maps 
+		//************************
 
-		if (VS != mVertexShader)
+		if (mPbrMaps.AO)
 		{
-			gD3DContext->VSSetShader(mVertexShader, nullptr, 0);
+			list.SetTexture(1, mPbrMaps.AoSRV);
 		}
 
-		//same with the PS
+		if (mPbrMaps.Displacement)
+		{
+			list.SetTexture(2, mPbrMaps.DisplacementSRV);
+		}
 
-		ID3D11PixelShader* PS = nullptr;
+		//if this object has normals
+		if (mPbrMaps.Normal)
+		{
+			list.SetTexture(3, mPbrMaps.NormalSRV);
+		}
 
-		gD3DContext->PSGetShader(&PS, nullptr, 0);
 
-		if (PS != mPixelShader)
+		if (mPbrMaps.Roughness)
 		{
-			gD3DContext->PSSetShader(mPixelShader, nullptr, 0);
+			list.SetTexture(4, mPbrMaps.RoughnessSRV);
 		}
+	}
+
+	return pipeline;
+}
 
-		//same for the texture
+bool CGameObject::CanInstanceWith(const CGameObject& other) const
+{
+	// Everything the pipeline and textures are made from must match, only the matrices may differ
+	return mInstancedVertexShader && mEnabled && other.mEnabled && mLodLevels[mLod].mesh == other.mLodLevels[other.mLod].mesh &&
+	       mLodLevels[mLod].meshLod == other.mLodLevels[other.mLod].meshLod &&
+	       mInstancedVertexShader == other.mInstancedVertexShader && mPixelShader == other.mPixelShader &&
+	       mPbrMaps.AlbedoSRV == other.mPbrMaps.AlbedoSRV && mPbrMaps.AoSRV == other.mPbrMaps.AoSRV &&
+	       mPbrMaps.DisplacementSRV == other.mPbrMaps.DisplacementSRV && mPbrMaps.NormalSRV == other.mPbrMaps.NormalSRV &&
+	       mPbrMaps.RoughnessSRV == other.mPbrMaps.RoughnessSRV && typeid(*this) == typeid(other);
+}
 
-		ID3D11ShaderResourceView* PSSRV = nullptr;
+void CGameObject::RecordInstances(CCommandList& list, CGameObject* const* objects, unsigned int count, bool basicGeometry) const
+{
+	RecordPipeline(list, basicGeometry, true);
 
-		gD3DContext->PSGetShaderResources(0, 1, &PSSRV);
+	std::vector<const std::vector<CMatrix4x4>*> instanceMatrices(count);
+	for (unsigned int i = 0; i < count; ++i)
+	{
+		instanceMatrices[i] = &objects[i]->mWorldMatrices;
+	}
 
-		if (PSSRV != mPbrMaps.AlbedoSRV)
-		{
-			gD3DContext->PSSetShaderResources(0, 1, &mPbrMaps.AlbedoSRV);
-		}
+	PerModelConstants constants;
+	constants.parallaxDepth = gPerModelConstants.parallaxDepth;
+	constants.objectColour = ObjectColour();
 
-		//TODO remove 
-		if (!mPbrMaps.Albedo)
-		{
-			gD3DContext->PSSetShaderResources(0, 1, &mPbrMaps.AlbedoSRV);
-		}
+	const auto& lod = mLodLevels[mLod];
+	lod.mesh->RecordInstanced(list, instanceMatrices, constants, lod.meshLod);
+}
 
-		//************************
-		// Send PBR Maps 
-		//************************
+// States - no blending, normal depth buffer and back-face culling (standard set-up for opaque models)
+void CGameObject::GetPipelineStates(PipelineState& pipeline) const
+{
+	pipeline.blendState = gNoBlendingState;
+	pipeline.depthStencilState = gUseDepthBufferState;
+	pipeline.rasterizerState = gCullBackState;
+}
 
-		if (mPbrMaps.AO)
-		{
-			gD3DContext->PSSetShaderResources(1, 1, &mPbrMaps.AoSRV);
-		}
+uint64_t CGameObject::RenderSortKey(CRenderQueue& queue, float depth) const
+{
+	return CRenderQueue::MakeKey(RenderPass(), BlendMode(), queue.ResourceId(mPixelShader), queue.ResourceId(mPbrMaps.AlbedoSRV),
+	                             queue.ResourceId(mLodLevels[mLod].mesh.get()), depth);
+}
 
-		if (mPbrMaps.Displacement)
+void CGameObject::SelectLod(float screenSize, const LodSettings& settings)
+{
+	for (;;)
+	{
+		const auto level = ::SelectLod(screenSize, mLod, static_cast<unsigned int>(mLodLevels.size()), settings);
+		if (mLodLevels[level].mesh)
 		{
-			gD3DContext->PSSetShaderResources(2, 1, &mPbrMaps.DisplacementSRV);
+			mLod = level;
+			return;
 		}
 
-		//if this object has normals
-		if (mPbrMaps.Normal)
+		// First time this level is needed, load it now (only levels from LOD files start unloaded). A level that can't
+		// be loaded, or doesn't have the same node hierarchy as the main mesh (the world matrices are shared), is dropped
+		// and the selection done again
+		try
 		{
-			gD3DContext->PSSetShaderResources(3, 1, &mPbrMaps.NormalSRV);
+			auto mesh = LoadSharedMesh(mMeshFiles[level].Str(), mPbrMaps.Normal != nullptr);
+			if (mesh->NumberNodes() == mMesh->NumberNodes())
+			{
+				mLodLevels[level] = { std::move(mesh), 0 };
+				mLod = level;
+				return;
+			}
 		}
-
-
-		if (mPbrMaps.Roughness)
+		catch (const std::exception&)
 		{
-			gD3DContext->PSSetShaderResources(4, 1, &mPbrMaps.RoughnessSRV);
 		}
-	}
 
-	//TODO render the the correct mesh according to the camera distance
-	mMesh->Render(mWorldMatrices);
+		mMeshFiles.erase(mMeshFiles.begin() + level);
+		mLodLevels.erase(mLodLevels.begin() + level);
+		if (mLod > level) --mLod;
+	}
 }
 
 bool CGameObject::Update(float updateTime)
@@ -414,13 +576,21 @@ bool CGameObject::Update(float updateTime)
 	return true; //TODO WIP
 }
 
-CGameObject::~CGameObject()
+void CGameObject::Animate(float frameTime)
 {
+	if (!mAnimator) return;
+
+	mAnimator->Update(frameTime);
+	mAnimator->Evaluate(mWorldMatrices);
+	++mTransformVersion;
+}
 
-	delete mMesh;
+CGameObject::~CGameObject()
+{
 
 	if (mPixelShader)			mPixelShader->Release();			mPixelShader = nullptr;
 	if (mVertexShader)			mVertexShader->Release();			mVertexShader = nullptr;
+	if (mInstancedVertexShader)	mInstancedVertexShader->Release();	mInstancedVertexShader = nullptr;
 	if (mGeometryShader)		mGeometryShader->Release();			mGeometryShader = nullptr;
 
 	if (mPbrMaps.AO) mPbrMaps.AO->Release();
@@ -442,6 +612,7 @@ void CGameObject::Control(int node, float frameTime, KeyCode turnUp, KeyCode tur
 	KeyCode turnCW, KeyCode turnCCW, KeyCode moveForward, KeyCode moveBackward)
 {
 	auto& matrix = mWorldMatrices[node]; // Use reference to node matrix to make code below more readable
+	++mTransformVersion;
 
 	if (KeyHeld(turnUp))
 	{
@@ -500,8 +671,24 @@ inline CVector3 CGameObject::Scale(int node) {
 
 CMatrix4x4 CGameObject::WorldMatrix(int node) { return mWorldMatrices[node]; }
 
+const CAABB& CGameObject::WorldBoundingBox()
+{
+	if (mBoundsVersion != mTransformVersion)
+	{
+		mWorldBounds = mMesh->BoundingBox().Transform(mWorldMatrices[0]);
+		mBoundsVersion = mTransformVersion;
+	}
+	return mWorldBounds;
+}
+
+bool CGameObject::RayCast(const CRay& ray, float maxDistance, CMesh::RayHit& hit) const
+{
+	return mMesh->RayCast(ray, mWorldMatrices, maxDistance, hit);
+}
+
 float* CGameObject::DirectPosition()
 {
+	++mTransformVersion;
 	float* pos[] =
 	{
 		&mWorldMatrices[0].e30,
@@ -512,11 +699,36 @@ float* CGameObject::DirectPosition()
 }
 
 
-CMesh* CGameObject::GetMesh() const { return mMesh; }
+CMesh* CGameObject::GetMesh() const { return mMesh.get(); }
+
+void CGameObject::GetOccluderTriangles(std::vector<CVector3>& positions, std::vector<uint32_t>& indices) const
+{
+	if (!mOccluderMesh) return;
+
+	// A proxy mesh has its own hierarchy, place it with the root matrix and its default node matrices
+	if (mOccluderMesh == mMesh)
+	{
+		mOccluderMesh->GetTriangles(mWorldMatrices, positions, indices);
+	}
+	else
+	{
+		std::vector<CMatrix4x4> matrices(mOccluderMesh->NumberNodes());
+		for (unsigned int i = 0; i < matrices.size(); ++i)
+		{
+			matrices[i] = mOccluderMesh->GetNodeDefaultMatrix(i);
+		}
+		matrices[0] = mWorldMatrices[0];
+		mOccluderMesh->GetTriangles(matrices, positions, indices);
+	}
+}
 
 // Setters - model only stores matricies , so if user sets position, rotation or scale, just update those aspects of the matrix
 
-void CGameObject::SetPosition(CVector3 position, int node) { mWorldMatrices[node].SetRow(3, position); }
+void CGameObject::SetPosition(CVector3 position, int node)
+{
+	mWorldMatrices[node].SetRow(3, position);
+	++mTransformVersion;
+}
 
 void CGameObject::SetRotation(CVector3 rotation, int node)
 {
@@ -524,6 +736,7 @@ void CGameObject::SetRotation(CVector3 rotation, int node)
 	mWorldMatrices[node] = MatrixScaling(Scale(node)) *
 		MatrixRotationZ(rotation.z) * MatrixRotationX(rotation.x) * MatrixRotationY(rotation.y) *
 		MatrixTranslation(Position(node));
+	++mTransformVersion;
 }
 
 // Two ways to set scale: x,y,z separately, or all to the same value
@@ -534,8 +747,13 @@ void CGameObject::SetScale(CVector3 scale, int node)
 	mWorldMatrices[node].SetRow(0, Normalise(mWorldMatrices[node].GetRow(0)) * scale.x);
 	mWorldMatrices[node].SetRow(1, Normalise(mWorldMatrices[node].GetRow(1)) * scale.y);
 	mWorldMatrices[node].SetRow(2, Normalise(mWorldMatrices[node].GetRow(2)) * scale.z);
+	++mTransformVersion;
 }
 
 void CGameObject::SetScale(float scale) { SetScale({ scale, scale, scale }); }
 
-void CGameObject::SetWorldMatrix(CMatrix4x4 matrix, int node) { mWorldMatrices[node] = matrix; }
+void CGameObject::SetWorldMatrix(CMatrix4x4 matrix, int node)
+{
+	mWorldMatrices[node] = matrix;
+	++mTransformVersion;
+}
@@ -9,14 +9,27 @@
 #include "CVector3.h"
 #include "CMatrix4x4.h"
 #include "Input.h"
+#include "StringId.h"
+#include <memory>
 #include <string>
 #include <vector>
 #include "Mesh.h"
+#include "RenderQueue.h"
 #include <stdexcept>
 #include "Material.h"
+#include "LevelOfDetail.h"
 
 class CMesh;
 
+// Layers an object can belong to, as bit flags. Queries take a mask of the layers they are interested in
+enum ELayer : unsigned int
+{
+	Layer_Default = 1 << 0,
+	Layer_Lights  = 1 << 1,
+	Layer_Sky     = 1 << 2,
+	Layer_All     = 0xFFFFFFFF,
+};
+
 class CGameObject
 {
 public:
@@ -24,12 +37,33 @@ public:
 	// Construction / Usage
 	//-------------------------------------
 
-	CGameObject(std::string mesh,std::string name, std::string& diffuseMap, std::string& vertexShader,
+	CGameObject(const std::string& mesh, const std::string& name, std::string& diffuseMap, std::string& vertexShader,
 	            std::string& pixelShader, CVector3 position = { 0,0,0 }, CVector3 rotation = { 0,0,0 }, float scale = 1);
 
 	CGameObject(std::string id, std::string name, std::string vs, std::string ps, CVector3 position, CVector3 rotation, float scale);
 
-	virtual void Render(bool basicGeometry = false);
+	// Draw the object immediately. basicGeometry draws depth only (e.g. for shadow maps)
+	void Render(bool basicGeometry = false);
+
+	// Record the commands to draw the object into a command list. Does not change the object or any global state,
+	// so different objects can be recorded on different threads at the same time. Given a world space view, only
+	// the parts of the mesh that may be visible from it are drawn (see Meshlets.h)
+	void Record(CCommandList& list, bool basicGeometry = false, const MeshletView* view = nullptr) const;
+
+	// Whether this object and the other can be drawn with one instanced draw: same class, mesh, shaders and textures,
+	// and an instanced vertex shader is available
+	bool CanInstanceWith(const CGameObject& other) const;
+
+	// Record one instanced draw for count objects (which must all pass CanInstanceWith this one), using this
+	// object's pipeline and textures and each object's own matrices
+	void RecordInstances(CCommandList& list, CGameObject* const* objects, unsigned int count, bool basicGeometry = false) const;
+
+	// How the render queue orders this object - the pass it is drawn in and its blend mode
+	virtual ERenderPass RenderPass() const { return RenderPass_Opaque; }
+	virtual EBlendMode  BlendMode()  const { return Blend_None; }
+
+	// Sort key for this object in the queue, depth is its normalised distance from the camera
+	uint64_t RenderSortKey(CRenderQueue& queue, float depth) const;
 
 	void Control(int node, float frameTime, KeyCode turnUp, KeyCode turnDown, KeyCode turnLeft, KeyCode turnRight,
 		KeyCode turnCW, KeyCode turnCCW, KeyCode moveForward, KeyCode moveBackward);
@@ -48,15 +82,61 @@ public:
 	CVector3 Scale(int node = 0); // Scale is length of rows 0-2 in matrix
 	CMatrix4x4 WorldMatrix(int node = 0);
 
+	// World space bounding box of the whole model, from the mesh bounds and the root world matrix. Cached and only
+	// recalculated when the transform has changed
+	const CAABB& WorldBoundingBox();
+
+	// Incremented whenever the object's matrices may have changed. Lets other systems skip work for static objects
+	unsigned int GetTransformVersion() const { return mTransformVersion; }
+
+	// Exact test of a world space ray against the model's triangles, closest hit within maxDistance
+	bool RayCast(const CRay& ray, float maxDistance, CMesh::RayHit& hit) const;
+
 	//get the directs access to the position of the model
+	//the caller may change the position through the pointer, so this counts as a transform change
 	float* DirectPosition();
 
 	CMesh* GetMesh() const;
 
-	auto GetName() { return mName; }
+	// Plays the mesh's animations on the model (see Animation.h), starting with the first one. nullptr if the mesh
+	// has no animations
+	CAnimator* GetAnimator() const { return mAnimator.get(); }
+
+	// Low detail mesh drawn into the occlusion buffer to hide the objects behind this one (see OcclusionCulling.h).
+	// nullptr (the default) if the object is not an occluder. May be the object's own mesh or a simpler proxy
+	CMesh* GetOccluderMesh() const { return mOccluderMesh.get(); }
+	void SetOccluderMesh(std::shared_ptr<CMesh> mesh) { mOccluderMesh = std::move(mesh); }
+
+	// Append the occluder mesh's triangles in world space
+	void GetOccluderTriangles(std::vector<CVector3>& positions, std::vector<uint32_t>& indices) const;
+
+	// Levels of detail, from the model's *_LOD* files or generated from its mesh when there is a single file (see
+	// MeshSimplifier.h). Level 0 (GetMesh) is the most detailed and always loaded
+	unsigned int NumLods() const { return static_cast<unsigned int>(mLodLevels.size()); }
+	unsigned int GetLod() const { return mLod; }
+
+	// Choose the level drawn by Record from the model's size on screen (see LevelOfDetail.h), loading it if this is the first
+	// time it is used. The current level is kept near the switching sizes, so call once per frame for the same view
+	void SelectLod(float screenSize, const LodSettings& settings);
+
+	const std::string& GetName() const { return mName.Str(); }
+
+	CStringId GetNameId() const { return mName; }
 
 	auto Enabled() { return &mEnabled; }
 
+	// Id of this object's leaf in the object manager's spatial tree (-1 when not in a tree)
+	int  GetSpatialProxy() const { return mSpatialProxy; }
+	void SetSpatialProxy(int proxy) { mSpatialProxy = proxy; }
+
+	// Id of this object's item in the object manager's proximity grid (-1 when not in a grid)
+	int  GetGridItem() const { return mGridItem; }
+	void SetGridItem(int item) { mGridItem = item; }
+
+	// Layers this object belongs to (combination of ELayer flags)
+	unsigned int GetLayers() const { return mLayers; }
+	void SetLayers(unsigned int layers) { mLayers = layers; }
+
 	auto GetTextureSRV() { return mMaterial->GetTextureSRV(); }
 	
 	auto GetTexture() { return mMaterial->GetTexture();}
@@ -76,6 +156,10 @@ public:
 
 	bool Update(float updateTime);
 
+	// Move the model's animation on by the frame time and write the animated node matrices. Does nothing if the
+	// mesh has no animations. Only changes this object, so different objects can be animated on different threads
+	void Animate(float frameTime);
+
 	virtual ~CGameObject();
 
 	//-------------------------------------
@@ -85,18 +169,51 @@ public:
 
 protected:
 
+	// Blend, depth and rasterizer states for a normal (not basic geometry) draw. Derived classes that need
+	// different states (blending, culling...) override this
+	virtual void GetPipelineStates(PipelineState& pipeline) const;
+
+	// Tint sent to the shaders with the model
+	virtual CVector3 ObjectColour() const { return { 1, 1, 1 }; }
+
+	// Returns the pipeline recorded
+	PipelineState RecordPipeline(CCommandList& list, bool basicGeometry, bool instanced) const;
+
+
+	// Vertex shader variant taking the world matrices from an instance buffer, nullptr if there is none
+	ID3D11VertexShader* mInstancedVertexShader;
+
 	
 	//the material
 	CMaterial* mMaterial;
 
 	//the meshes that a model has (all the LODS that a model has)
-	std::vector<std::string> mMeshFiles;
-
-	CMesh* mMesh;
+	std::vector<CStringId> mMeshFiles;
+
+	// Shared with every other object using the same mesh file (see ResourceCache.h)
+	std::shared_ptr<CMesh> mMesh;
+
+	// A mesh and which of its own (generated) levels to draw. One per file in mMeshFiles, with the mesh nullptr until
+	// first selected, or one per generated level of mMesh
+	struct LodLevel
+	{
+		std::shared_ptr<CMesh> mesh;
+		unsigned int           meshLod;
+	};
+	std::vector<LodLevel> mLodLevels;
+	unsigned int mLod;
+
+	std::shared_ptr<CMesh> mOccluderMesh;
 	
-	std::string mName;
+	CStringId mName;
 
 	bool mEnabled;
+
+	int mSpatialProxy;
+
+	int mGridItem;
+
+	unsigned int mLayers;
 	
 
 	// World matrices for the model
@@ -104,5 +221,13 @@ protected:
 	// for the entire model. The remaining matrices are relative to their parent part. The hierarchy is defined in the mesh (nodes)
 	std::vector<CMatrix4x4> mWorldMatrices;
 
+	// Writes the animated matrices of the nodes below the root
+	std::unique_ptr<CAnimator> mAnimator;
+
+	// Version of the matrices above, and the version the cached world bounds were calculated for
+	unsigned int mTransformVersion;
+	unsigned int mBoundsVersion;
+	CAABB        mWorldBounds;
+
 };
 
@@ -4,13 +4,56 @@
 #include "DirLight.h"
 #include "GraphicsHelpers.h"
 #include "MathHelpers.h"
+#include "StateCache.h"
+#include "D3D11CommandBackend.h"
+#include "JobSystem.h"
+#include "ParticleSystem.h"
 #include "External\imgui\imgui.h"
 
+#include <algorithm>
+#include <limits>
+
+namespace
+{
+	// Fewest objects (or instanced groups) recorded into a command list by one job
+	const unsigned int MinObjectsPerSlice = 64;
+
+	// Fewest matching objects worth an instanced draw
+	const unsigned int MinInstances = 2;
+
+	// Light intensity at the edge of a light's cluster bounds. The shaders' attenuation never reaches zero, so this
+	// is the cut off, low enough not to be noticed
+	const float ClusterLightCutoff = 0.01f;
+
+	// z of a point in view space
+	float ViewDepth(const CVector3& p, const CMatrix4x4& viewMatrix)
+	{
+		return p.x * viewMatrix.e02 + p.y * viewMatrix.e12 + p.z * viewMatrix.e22 + viewMatrix.e32;
+	}
+
+	static_assert(CShadowCascades::MaxCascades == MAX_CASCADES, "Shadow cascade limit must match the light constants");
+}
+
 CGameObjectManager::CGameObjectManager()
+	: mPointLightBuffer(sizeof(sLight), false), mClusterBuffer(sizeof(CLightClusters::Cluster), true),
+	  mClusterIndexBuffer(sizeof(uint32_t), true)
 {
 	mMaxSize = 1000;
 	mCurrNumLights = 0;
 	mCurrNumSpotLights = 0;
+	mCurrNumDirLights = 0;
+
+	mShadowMapsRendered = 0;
+	mShadowMapsCached = 0;
+
+	mCullingDirty = true;
+	mVisibleCount = 0;
+	mCulledCount = 0;
+
+	mOcclusionCulling = true;
+	mOccludedCount = 0;
+
+	mCommandBackend = std::make_unique<CD3D11CommandBackend>();
 }
 
 void CGameObjectManager::AddObject(CGameObject* obj)
@@ -19,6 +62,8 @@ void CGameObjectManager::AddObject(CGameObject* obj)
 	if (mObjects.size() < mMaxSize)
 	{
 		mObjects.push_back(obj);
+		RegisterObject(obj);
+		AddToProximityGrid(obj);
 	}
 	else
 	{
@@ -33,6 +78,7 @@ void CGameObjectManager::AddLight(CLight* obj)
 	if (mLights.size() < mMaxSize)
 	{
 		mLights.push_back(obj);
+		RegisterObject(obj);
 		mCurrNumLights++;
 	}
 	else
@@ -46,6 +92,7 @@ void CGameObjectManager::AddSpotLight(CSpotLight* obj)
 	if (mSpotLights.size() < mMaxSize)
 	{
 		mSpotLights.push_back(obj);
+		RegisterObject(obj);
 		mCurrNumSpotLights++;
 	}
 	else
@@ -57,46 +104,123 @@ void CGameObjectManager::AddDirLight(CDirLight* obj)
 	if (mDirLights.size() < mMaxSize)
 	{
 		mDirLights.push_back(obj);
+		RegisterObject(obj);
 		mCurrNumDirLights++;
 	}
 }
 
 
-void CGameObjectManager::UpdateLightsConstBuffer(PerFrameLights* FCB)
+// The light counts are only stored in the first entry of each buffer, which is where the shaders read them
+
+void CGameObjectManager::UpdateLightsBuffer()
 {
+	// Always at least one entry to hold the count. A new buffer has lost its contents, so everything is sent again
+	const auto size = std::max(mCurrNumLights, 1);
+	if (mPointLightBuffer.Reserve(size)) mLightConstants.Invalidate();
+	mPointLightData.resize(size);
+
 	for (auto i = 0; i < mCurrNumLights; ++i)
 	{
-		FCB->lights[i].colour = mLights[i]->GetColour() * mLights[i]->GetStrength();
-		FCB->lights[i].padding = 1;
-		FCB->lights[i].position = mLights[i]->Position();
-		FCB->lights[i].numLights = mCurrNumLights;
+		const auto light = mLights[i];
+		if (!mLightConstants.NeedsUpdate(i, light, light->GetLightVersion())) continue;
+
+		mPointLightData[i].colour = light->GetColour() * light->GetStrength();
+		mPointLightData[i].padding = 1;
+		mPointLightData[i].position = light->Position();
 	}
+
+	if (mLightConstants.SetCount(mCurrNumLights)) mPointLightData[0].numLights = mCurrNumLights;
 }
 
 void CGameObjectManager::UpdateSpotLightsConstBuffer(PerFrameSpotLights* FLB)
 {
 	for (auto i = 0; i < mCurrNumSpotLights; ++i)
 	{
-		FLB->spotLights[i].colour = mSpotLights[i]->GetColour() * mSpotLights[i]->GetStrength();
-		FLB->spotLights[i].pos = mSpotLights[i]->Position();
-		FLB->spotLights[i].facing = mSpotLights[i]->GetFacing();
-		FLB->spotLights[i].cosHalfAngle = cos(ToRadians(mSpotLights[i]->GetConeAngle() / 2));
-		FLB->spotLights[i].viewMatrix = InverseAffine(mSpotLights[i]->WorldMatrix());
-		FLB->spotLights[i].projMatrix = MakeProjectionMatrix(1.0f, mSpotLights[i]->GetConeAngle());
-		FLB->spotLights[i].numLights = mCurrNumSpotLights;
+		const auto light = mSpotLights[i];
+		if (!mSpotLightConstants.NeedsUpdate(i, light, light->GetLightVersion())) continue;
+
+		FLB->spotLights[i].colour = light->GetColour() * light->GetStrength();
+		FLB->spotLights[i].pos = light->Position();
+		FLB->spotLights[i].facing = light->GetFacing();
+		FLB->spotLights[i].cosHalfAngle = cos(ToRadians(light->GetConeAngle() / 2));
+		FLB->spotLights[i].viewMatrix = InverseAffine(light->WorldMatrix());
+		FLB->spotLights[i].projMatrix = MakeProjectionMatrix(1.0f, ToRadians(light->GetConeAngle()));
+		std::copy(light->GetShadowRect(), light->GetShadowRect() + 4, FLB->spotLights[i].shadowRect);
 	}
+
+	if (mSpotLightConstants.SetCount(mCurrNumSpotLights)) FLB->spotLights[0].numLights = mCurrNumSpotLights;
 }
 
 void CGameObjectManager::UpdateDirLightsConstBuffer(PerFrameDirLights* FLB)
 {
 	for (auto i = 0; i < mCurrNumDirLights; ++i)
 	{
-		FLB->dirLights[i].colour = mDirLights[i]->GetColour() * mDirLights[i]->GetStrength();
-		FLB->dirLights[i].facing = mDirLights[i]->GetMesh()->GetNodeDefaultMatrix(0).GetRow(2);
-		FLB->dirLights[i].viewMatrix = InverseAffine(mDirLights[i]->WorldMatrix());
-		FLB->dirLights[i].projMatrix = MakeOrthogonalMatrix(1000.0f, 1000.0f, mDirLights[i]->GetNearClip(), mDirLights[i]->GetFarClip());
-		FLB->dirLights[i].numLights = mCurrNumDirLights;
+		const auto light = mDirLights[i];
+		if (!mDirLightConstants.NeedsUpdate(i, light, light->GetLightVersion())) continue;
+
+		FLB->dirLights[i].colour = light->GetColour() * light->GetStrength();
+		FLB->dirLights[i].facing = light->GetMesh()->GetNodeDefaultMatrix(0).GetRow(2);
+
+		const auto& cascades = light->GetCascades();
+		FLB->dirLights[i].numCascades = cascades.Count();
+		for (unsigned int c = 0; c < cascades.Count(); ++c)
+		{
+			FLB->dirLights[i].cascadeMatrices[c] = cascades.Cascade(c).viewProjectionMatrix;
+			FLB->dirLights[i].cascadeSplits[c] = cascades.Cascade(c).farDistance;
+			std::copy(light->GetShadowRect(c), light->GetShadowRect(c) + 4, FLB->dirLights[i].cascadeRects[c]);
+		}
+	}
+
+	if (mDirLightConstants.SetCount(mCurrNumDirLights)) FLB->dirLights[0].numLights = mCurrNumDirLights;
+}
+
+void CGameObjectManager::UploadLightConstBuffers()
+{
+	mLightConstants.Upload(mPointLightBuffer.Buffer(), mPointLightData.data(), sizeof(sLight));
+	mSpotLightConstants.Upload(gPerFrameSpotLightsConstBuffer, gPerFrameSpotLightsConstants.spotLights, sizeof(sSpotLight));
+	mDirLightConstants.Upload(gPerFrameDirLightsConstBuffer, gPerFrameDirLightsConstants.dirLights, sizeof(sDirLights));
+}
+
+void CGameObjectManager::UpdateLightClusters(const CMatrix4x4& viewMatrix, const CMatrix4x4& projectionMatrix, float nearClip, float farClip)
+{
+	// Light indices in the clusters are positions in the light buffers, so the spheres are in the same order
+	mPointLightSpheres.resize(mCurrNumLights);
+	for (auto i = 0; i < mCurrNumLights; ++i)
+	{
+		mPointLightSpheres[i] = { mLights[i]->Position(), mLights[i]->GetInfluenceRadius(ClusterLightCutoff) };
 	}
+	mSpotLightSpheres.resize(mCurrNumSpotLights);
+	for (auto i = 0; i < mCurrNumSpotLights; ++i)
+	{
+		mSpotLightSpheres[i] = { mSpotLights[i]->Position(), mSpotLights[i]->GetInfluenceRadius(ClusterLightCutoff) };
+	}
+
+	mLightClusters.SetCamera(viewMatrix, projectionMatrix, nearClip, farClip);
+	mLightClusters.Build(mPointLightSpheres, mSpotLightSpheres);
+
+	const auto& clusters = mLightClusters.Clusters();
+	const auto& indices = mLightClusters.LightIndices();
+	mClusterBuffer.Write(clusters.data(), static_cast<unsigned int>(clusters.size()));
+	mClusterIndexBuffer.Write(indices.data(), static_cast<unsigned int>(indices.size()));
+
+	gPerFrameClusters.tileScaleX = static_cast<float>(mLightClusters.TilesX()) / gViewportWidth;
+	gPerFrameClusters.tileScaleY = static_cast<float>(mLightClusters.TilesY()) / gViewportHeight;
+	gPerFrameClusters.depthScale = mLightClusters.DepthScale();
+	gPerFrameClusters.depthBias = mLightClusters.DepthBias();
+	gPerFrameClusters.tilesX = mLightClusters.TilesX();
+	gPerFrameClusters.tilesY = mLightClusters.TilesY();
+	gPerFrameClusters.slices = mLightClusters.Slices();
+
+	D3D11_MAPPED_SUBRESOURCE cb;
+	if (SUCCEEDED(gD3DContext->Map(gPerFrameClustersConstBuffer, 0, D3D11_MAP_WRITE_DISCARD, 0, &cb)))
+	{
+		memcpy(cb.pData, &gPerFrameClusters, sizeof(gPerFrameClusters));
+		gD3DContext->Unmap(gPerFrameClustersConstBuffer, 0);
+	}
+
+	gStateCache.SetPSShaderResource(PointLightsSlot, mPointLightBuffer.View());
+	gStateCache.SetPSShaderResource(ClustersSlot, mClusterBuffer.View());
+	gStateCache.SetPSShaderResource(ClusterLightIndicesSlot, mClusterIndexBuffer.View());
 }
 
 
@@ -105,6 +229,8 @@ bool CGameObjectManager::RemoveObject(int pos)
 
 	if (!mObjects.empty())
 	{
+		UnregisterObject(mObjects[pos]);
+		RemoveFromProximityGrid(mObjects[pos]);
 		mObjects.erase(mObjects.begin() + pos);
 		return true;
 	}
@@ -117,8 +243,13 @@ bool CGameObjectManager::RemoveLight(int pos)
 
 	if (!mLights.empty())
 	{
+		UnregisterObject(mLights[pos]);
 		mLights.erase(mLights.begin() + pos);
 		mCurrNumLights--;
+
+		// The lights after it move down an entry, and the removed light's memory may be reused by a new one
+		// at the same version, so rebuild all the entries
+		mLightConstants.Invalidate();
 		return true;
 	}
 
@@ -129,8 +260,11 @@ bool CGameObjectManager::RemoveSpotLight(int pos)
 {
 	if (!mSpotLights.empty())
 	{
+		UnregisterObject(mSpotLights[pos]);
+		mSpotLights[pos]->ReleaseShadowTiles();
 		mSpotLights.erase(mSpotLights.begin() + pos);
 		mCurrNumSpotLights--;
+		mSpotLightConstants.Invalidate();
 		return true;
 	}
 
@@ -141,8 +275,11 @@ bool CGameObjectManager::RemoveDirLight(int pos)
 {
 	if (!mDirLights.empty())
 	{
+		UnregisterObject(mDirLights[pos]);
+		mDirLights[pos]->ReleaseShadowTiles();
 		mDirLights.erase(mDirLights.begin() + pos);
 		mCurrNumDirLights--;
+		mDirLightConstants.Invalidate();
 		return true;
 	}
 	return false;
@@ -152,46 +289,281 @@ extern void DisplayShadowMaps();
 
 bool CGameObjectManager::RenderAllObjects()
 {
-	for (auto it : mObjects)
+	std::vector<CGameObject*> objects;
+	objects.insert(objects.end(), mObjects.begin(), mObjects.end());
+	objects.insert(objects.end(), mLights.begin(), mLights.end());
+	objects.insert(objects.end(), mSpotLights.begin(), mSpotLights.end());
+	objects.insert(objects.end(), mDirLights.begin(), mDirLights.end());
+
+	return RenderObjects(objects);
+}
+
+bool CGameObjectManager::RenderObjects(const std::vector<CGameObject*>& objects, const MeshletView* view, CParticleSystem* particles)
+{
+	const auto count = static_cast<unsigned int>(objects.size());
+	if (particles == nullptr)
+	{
+		SubmitObjects(objects.data(), count, false, view);
+	}
+	else
 	{
-		it->Render();
+		// The transparent objects come last, back to front. Whenever an emitter is further away than the next of them,
+		// submit the objects before it and draw the emitters, so the objects in between are still submitted together
+		unsigned int submitted = 0;
+		for (unsigned int i = 0; i < count; ++i)
+		{
+			if (objects[i]->RenderPass() != RenderPass_Transparent)  continue;
+
+			const auto depth = ViewDepth(objects[i]->WorldBoundingBox().Centre(), gPerFrameConstants.viewMatrix);
+			if (particles->NextDepth() > depth)
+			{
+				SubmitObjects(objects.data() + submitted, i - submitted, false, view);
+				submitted = i;
+				particles->RenderBehind(depth);
+			}
+		}
+		SubmitObjects(objects.data() + submitted, count - submitted, false, view);
+		particles->RenderBehind(std::numeric_limits<float>::lowest());
 	}
 
-	for (auto it : mLights)
+	ImGui::Begin("ShadowMaps");
+
+	ImGui::Text("Rendered: %d  Cached: %d", mShadowMapsRendered, mShadowMapsCached);
+
+	if (mShadowAtlas)
 	{
-		it->Render();
+		ImGui::Text("Atlas free: %.0f%%", 100.0 * mShadowAtlas->Allocator().FreeArea() / (static_cast<double>(mShadowAtlas->Size()) * mShadowAtlas->Size()));
+
+		ImTextureID texId = mShadowAtlas->GetSRV();
+
+		ImGui::Image((void*)texId, { 512, 512 });
 	}
 
-	for (auto it : mSpotLights)
+	ImGui::End();
+
+	// Unbind the shadow atlas from shaders - prevents warnings from DirectX when we try to render to it again next frame
+	gStateCache.SetPSShaderResource(5, nullptr);
+
+	return true;
+}
+
+void CGameObjectManager::SubmitObjects(CGameObject* const* objects, unsigned int count, bool basicGeometry, const MeshletView* view)
+{
+	if (count == 0) return;
+
+	// Group consecutive objects that can be drawn with one instanced draw (same mesh, shaders and textures). Sorting
+	// with SortForRendering first puts such objects next to each other
+	std::vector<std::pair<unsigned int, unsigned int>> runs;
+	for (unsigned int first = 0; first < count; )
 	{
-		it->Render();
+		auto last = first + 1;
+		while (last < count && objects[first]->CanInstanceWith(*objects[last])) ++last;
+		runs.emplace_back(first, last);
+		first = last;
 	}
 
-	for (auto it : mDirLights)
+	// Each slice must be worth the overhead of a job, but there should be enough to keep every thread busy
+	const auto numRuns = static_cast<unsigned int>(runs.size());
+	const auto numSlices = std::max(1u, std::min(JobSystemThreadCount(), numRuns / MinObjectsPerSlice));
+	const auto sliceSize = (numRuns + numSlices - 1) / numSlices;
+
+	if (mCommandLists.size() < numSlices) mCommandLists.resize(numSlices);
+
+	ParallelFor(numSlices, 1, [&](unsigned int begin, unsigned int end)
 	{
-		it->Render();
+		for (auto slice = begin; slice < end; ++slice)
+		{
+			auto& list = mCommandLists[slice];
+			list.Reset();
+
+			const auto lastRun = std::min(numRuns, (slice + 1) * sliceSize);
+			for (auto run = slice * sliceSize; run < lastRun; ++run)
+			{
+				const auto first = runs[run].first;
+				const auto instances = runs[run].second - first;
+				if (instances >= MinInstances)
+				{
+					objects[first]->RecordInstances(list, &objects[first], instances, basicGeometry);
+				}
+				else
+				{
+					for (auto i = first; i < runs[run].second; ++i)
+					{
+						objects[i]->Record(list, basicGeometry, view);
+					}
+				}
+			}
+		}
+	});
+
+	// Lists must be executed on this thread, in order so the draw order is kept
+	for (unsigned int slice = 0; slice < numSlices; ++slice)
+	{
+		mCommandBackend->Execute(mCommandLists[slice]);
 	}
+}
 
-	ImGui::Begin("ShadowMaps");
+void CGameObjectManager::SortForRendering(std::vector<CGameObject*>& objects, const CMatrix4x4& viewMatrix, float maxDepth)
+{
+	mRenderQueue.Clear();
+	for (auto obj : objects)
+	{
+		const auto depth = ViewDepth(obj->WorldBoundingBox().Centre(), viewMatrix) / maxDepth;
+		mRenderQueue.Add(obj->RenderSortKey(mRenderQueue, depth), obj);
+	}
+
+	mRenderQueue.Sort();
+
+	objects.clear();
+	for (const auto& item : mRenderQueue.Items())
+	{
+		objects.push_back(item.object);
+	}
+}
+
+void CGameObjectManager::SelectLods(const CVector3& viewPosition, const CMatrix4x4& projectionMatrix)
+{
+	for (auto obj : mObjects)
+	{
+		if (obj->NumLods() <= 1) continue;
+
+		const auto& bounds = obj->WorldBoundingBox();
+		const auto radius = Length(bounds.Extents());
+		const auto distance = Length(bounds.Centre() - viewPosition);
+		obj->SelectLod(LodScreenSize(radius, distance, projectionMatrix.e11), mLodSettings);
+	}
+}
+
+void CGameObjectManager::CullObjects(const CFrustum& frustum, std::vector<CGameObject*>& visible)
+{
+	UpdateCullingBounds();
+
+	std::vector<int> visibleIndices;
+	mVisibleCount = mCullingBounds.Cull(frustum, visibleIndices);
+	mCulledCount = mCullingBounds.Size() - mVisibleCount;
 
-	for (auto tx : mShadowsMaps)
+	visible.reserve(visible.size() + visibleIndices.size());
+	for (auto index : visibleIndices)
 	{
-		ImGui::NewLine();
+		visible.push_back(mCullingObjects[index]);
+	}
+}
 
-		ImTextureID texId = tx;
+void CGameObjectManager::CullOccludedObjects(const CMatrix4x4& viewProjectionMatrix, std::vector<CGameObject*>& visible)
+{
+	mOccludedCount = 0;
+	if (!mOcclusionCulling) return;
 
-		ImGui::Image((void*)texId, { 256, 256 });
+	// Occluder triangles are kept in world space and only rebuilt when the occluder moves
+	mOcclusionBuffer.Begin(viewProjectionMatrix);
+	for (auto obj : mObjects)
+	{
+		if (!*obj->Enabled() || !obj->GetOccluderMesh()) continue;
+
+		auto& geometry = mOccluderGeometry[obj];
+		if (geometry.version != obj->GetTransformVersion() || geometry.positions.empty())
+		{
+			geometry.positions.clear();
+			geometry.indices.clear();
+			obj->GetOccluderTriangles(geometry.positions, geometry.indices);
+			geometry.version = obj->GetTransformVersion();
+		}
+		mOcclusionBuffer.AddOccluder(geometry.positions, geometry.indices);
 	}
+	mOcclusionBuffer.Rasterise();
 
-	ImGui::End();
+	// The occluders themselves are always kept. Each object only touches its own flag, so the tests can run in parallel
+	const auto count = static_cast<unsigned int>(visible.size());
+	std::vector<char> keep(count);
+	ParallelFor(count, 64, [&](unsigned int begin, unsigned int end)
+	{
+		for (auto i = begin; i < end; ++i)
+		{
+			keep[i] = visible[i]->GetOccluderMesh() || mOcclusionBuffer.IsVisible(visible[i]->WorldBoundingBox());
+		}
+	});
+
+	unsigned int kept = 0;
+	for (unsigned int i = 0; i < count; ++i)
+	{
+		if (keep[i]) visible[kept++] = visible[i];
+	}
+	mOccludedCount = static_cast<int>(count - kept);
+	visible.resize(kept);
+}
 
-	mShadowsMaps.clear();
+void CGameObjectManager::CullShadowCasters(const CFrustum& volume, const CVector3& lightPosition, float maxDistance, int maxCasters,
+                                           std::vector<CGameObject*>& casters)
+{
+	UpdateCullingBounds();
 
-	// Unbind shadow maps from shaders - prevents warnings from DirectX when we try to render to the shadow maps again next frame
-	ID3D11ShaderResourceView* nullView = nullptr;
-	gD3DContext->PSSetShaderResources(5, 1, &nullView);
+	std::vector<int> visibleIndices;
+	mCullingBounds.Cull(volume, visibleIndices);
 
-	return true;
+	// The models come first in the culling set, the light models after them don't cast shadows
+	const CSphere lightSphere = { lightPosition, maxDistance };
+	std::vector<std::pair<float, CGameObject*>> candidates;
+	for (auto index : visibleIndices)
+	{
+		if (index >= static_cast<int>(mObjects.size())) break;
+
+		// A disabled model draws nothing, it mustn't take the place of a real caster
+		const auto obj = mCullingObjects[index];
+		if (!*obj->Enabled()) continue;
+		if (maxDistance > 0.0f && !lightSphere.Overlaps(obj->WorldBoundingBox())) continue;
+
+		candidates.emplace_back(Length(obj->WorldBoundingBox().Centre() - lightPosition), obj);
+	}
+
+	// Too many casters - keep the nearest ones
+	if (maxCasters > 0 && static_cast<int>(candidates.size()) > maxCasters)
+	{
+		std::nth_element(candidates.begin(), candidates.begin() + maxCasters, candidates.end(),
+		                 [](const std::pair<float, CGameObject*>& a, const std::pair<float, CGameObject*>& b) { return a.first < b.first; });
+		candidates.resize(maxCasters);
+	}
+
+	casters.reserve(casters.size() + candidates.size());
+	for (const auto& candidate : candidates)
+	{
+		casters.push_back(candidate.second);
+	}
+}
+
+void CGameObjectManager::UpdateCullingBounds()
+{
+	// Objects added or removed - lay the bounds out again, in the same order RenderAllObjects draws in
+	if (mCullingDirty)
+	{
+		mCullingObjects.clear();
+		mCullingObjects.insert(mCullingObjects.end(), mObjects.begin(), mObjects.end());
+		mCullingObjects.insert(mCullingObjects.end(), mLights.begin(), mLights.end());
+		mCullingObjects.insert(mCullingObjects.end(), mSpotLights.begin(), mSpotLights.end());
+		mCullingObjects.insert(mCullingObjects.end(), mDirLights.begin(), mDirLights.end());
+
+		mCullingBounds.Clear();
+		mCullingBounds.Reserve(static_cast<int>(mCullingObjects.size()));
+		mCullingVersions.clear();
+		for (auto obj : mCullingObjects)
+		{
+			mCullingBounds.Add(obj->WorldBoundingBox());
+			mCullingVersions.push_back(obj->GetTransformVersion());
+		}
+
+		mCullingDirty = false;
+		return;
+	}
+
+	// Otherwise only refresh the bounds of objects that have moved
+	for (size_t i = 0; i < mCullingObjects.size(); ++i)
+	{
+		const auto version = mCullingObjects[i]->GetTransformVersion();
+		if (version != mCullingVersions[i])
+		{
+			mCullingBounds.Set(static_cast<int>(i), mCullingObjects[i]->WorldBoundingBox());
+			mCullingVersions[i] = version;
+		}
+	}
 }
 
 void CGameObjectManager::RenderFromSpotLights()
@@ -200,73 +572,255 @@ void CGameObjectManager::RenderFromSpotLights()
 	{
 		if (*it->Enabled())
 		{
-			//render from its prospective into a texture
-			auto temp = it->RenderFromThis(this);
-
-			//put this texture in the texture array that will be passed to the shader	
-			mShadowsMaps.push_back(temp);
+			//render from its prospective into its tile of the shadow atlas
+			if (it->RenderFromThis(this, *mShadowAtlas)) ++mShadowMapsRendered;
+			else ++mShadowMapsCached;
 		}
 	}
 }
 
-void CGameObjectManager::RenderFromDirLights()
+void CGameObjectManager::RenderFromDirLights(const CMatrix4x4& cameraMatrix, const CMatrix4x4& projectionMatrix, float nearClip)
 {
 	for (auto it : mDirLights)
 	{
 		if (*it->Enabled())
 		{
-			auto tmp = it->RenderFromThis(this);
-
-			mShadowsMaps.push_back(tmp);
+			const auto rendered = it->RenderFromThis(this, *mShadowAtlas, cameraMatrix, projectionMatrix, nearClip);
+			mShadowMapsRendered += rendered;
+			mShadowMapsCached += static_cast<int>(it->GetCascadeCount()) - rendered;
 		}
 	}
 }
 
-void CGameObjectManager::RenderFromAllLights()
+void CGameObjectManager::RenderFromAllLights(const CMatrix4x4& cameraMatrix, const CMatrix4x4& projectionMatrix, float nearClip)
 {
+	// Created on first use, the device may not exist yet when the manager is constructed
+	if (!mShadowAtlas) mShadowAtlas = std::make_unique<CShadowAtlas>();
+
+	mShadowMapsRendered = 0;
+	mShadowMapsCached = 0;
+
+	// The atlas is about to be a depth buffer, it can't be bound to the shaders at the same time
+	gStateCache.SetPSShaderResource(5, nullptr);
+
 	RenderFromSpotLights();
-	RenderFromDirLights();
+	RenderFromDirLights(cameraMatrix, projectionMatrix, nearClip);
 }
 
 void CGameObjectManager::UpdateObjects(float updateTime)
 {
-	auto pos = 0;
+	// Each object's animation only writes its own matrices, so animate them in parallel before anything reads them
+	const auto count = static_cast<unsigned int>(mObjects.size());
+	ParallelFor(count, 8, [&](unsigned int begin, unsigned int end)
+	{
+		for (auto i = begin; i < end; ++i)  mObjects[i]->Animate(updateTime);
+	});
 
-	for (auto it : mObjects)
+	// Objects that are finished are removed as they are found, so the index only moves on past the ones that stay
+	for (size_t pos = 0; pos < mObjects.size();)
 	{
-		if (!it->Update(updateTime))
+		const auto obj = mObjects[pos];
+		if (obj->Update(updateTime))
 		{
-			mObjects.erase(mObjects.begin() + pos);
+			++pos;
+			continue;
 		}
-		pos++;
+		UnregisterObject(obj);
+		RemoveFromProximityGrid(obj);
+		mObjects.erase(mObjects.begin() + pos);
 	}
+
+	UpdateSpatialTree();
+	UpdateProximityGrid();
 }
 
-CGameObjectManager::~CGameObjectManager()
+CGameObject* CGameObjectManager::FindObject(uint64_t nameHash) const
+{
+	const auto it = mNameIndex.find(nameHash);
+	return it != mNameIndex.end() ? it->second : nullptr;
+}
+
+void CGameObjectManager::RegisterObject(CGameObject* obj)
+{
+	mCullingDirty = true;
+	AddToSpatialTree(obj);
+	mNameIndex.emplace(obj->GetNameId().Hash(), obj);
+}
+
+void CGameObjectManager::UnregisterObject(CGameObject* obj)
+{
+	mCullingDirty = true;
+	RemoveFromSpatialTree(obj);
+	mOccluderGeometry.erase(obj);
+
+	// Several objects may share a name, only remove this one
+	const auto range = mNameIndex.equal_range(obj->GetNameId().Hash());
+	for (auto it = range.first; it != range.second; ++it)
+	{
+		if (it->second == obj)
+		{
+			mNameIndex.erase(it);
+			break;
+		}
+	}
+}
+
+void CGameObjectManager::AddToSpatialTree(CGameObject* obj)
+{
+	obj->SetSpatialProxy(mSpatialTree.CreateProxy(obj->WorldBoundingBox(), obj));
+}
+
+void CGameObjectManager::RemoveFromSpatialTree(CGameObject* obj)
+{
+	if (obj->GetSpatialProxy() != CAABBTree::NullNode)
+	{
+		mSpatialTree.DestroyProxy(obj->GetSpatialProxy());
+		obj->SetSpatialProxy(CAABBTree::NullNode);
+	}
+}
+
+void CGameObjectManager::UpdateSpatialTree()
+{
+	auto refit = [&](CGameObject* obj)
+	{
+		const auto box = obj->WorldBoundingBox();
+
+		// Use the movement of the box centre since the last refit to stretch the fat box in the direction of travel
+		const auto& fatBox = mSpatialTree.GetFatAABB(obj->GetSpatialProxy());
+		mSpatialTree.MoveProxy(obj->GetSpatialProxy(), box, box.Centre() - fatBox.Centre());
+	};
+
+	for (auto it : mObjects)    refit(it);
+	for (auto it : mLights)     refit(it);
+	for (auto it : mSpotLights) refit(it);
+	for (auto it : mDirLights)  refit(it);
+}
+
+void CGameObjectManager::RebuildSpatialTree()
+{
+	UpdateSpatialTree();
+	mSpatialTree.Rebuild();
+}
+
+void CGameObjectManager::AddToProximityGrid(CGameObject* obj)
+{
+	obj->SetGridItem(mProximityGrid.Insert(obj->WorldBoundingBox(), obj));
+}
+
+void CGameObjectManager::RemoveFromProximityGrid(CGameObject* obj)
+{
+	if (obj->GetGridItem() != CSpatialHashGrid::NullItem)
+	{
+		mProximityGrid.Remove(obj->GetGridItem());
+		obj->SetGridItem(CSpatialHashGrid::NullItem);
+	}
+}
+
+void CGameObjectManager::UpdateProximityGrid()
 {
 	for (auto it : mObjects)
 	{
-		delete it;
+		mProximityGrid.Update(it->GetGridItem(), it->WorldBoundingBox());
 	}
+}
 
+void CGameObjectManager::QueryLightInfluences(std::vector<std::vector<CGameObject*>>& influences) const
+{
+	std::vector<CSphere> spheres;
+	spheres.reserve(mLights.size());
 	for (auto it : mLights)
 	{
-		delete it;
+		spheres.push_back({ it->Position(), it->GetInfluenceRadius(ClusterLightCutoff) });
 	}
 
-	for (auto it : mSpotLights)
+	std::vector<std::vector<int>> items;
+	mProximityGrid.QueryRadiusBatch(spheres, items);
+
+	influences.resize(mLights.size());
+	for (size_t i = 0; i < items.size(); ++i)
 	{
-		delete it;
+		influences[i].clear();
+		for (auto item : items[i])
+		{
+			influences[i].push_back(static_cast<CGameObject*>(mProximityGrid.GetUserData(item)));
+		}
+	}
+}
+
+void CGameObjectManager::QueryObjectsInRadius(const CVector3& centre, float radius, std::vector<CGameObject*>& result) const
+{
+	std::vector<int> items;
+	mProximityGrid.QueryRadius({ centre, radius }, items);
+	for (auto item : items)
+	{
+		result.push_back(static_cast<CGameObject*>(mProximityGrid.GetUserData(item)));
+	}
+}
+
+void CGameObjectManager::QueryNearestObjects(const CVector3& point, int k, std::vector<CGameObject*>& result) const
+{
+	std::vector<int> items;
+	mProximityGrid.QueryNearest(point, k, items);
+	for (auto item : items)
+	{
+		result.push_back(static_cast<CGameObject*>(mProximityGrid.GetUserData(item)));
 	}
+}
+
+bool CGameObjectManager::RayCast(const CRay& ray, SceneRayHit& hit, float maxDistance /*= FLT_MAX*/, unsigned int layerMask /*= Layer_All*/) const
+{
+	auto found = false;
 
-	for (auto it : mShadowsMaps)
+	mSpatialTree.RayCast(ray, maxDistance, [&](int proxy, const CRay& treeRay, float maxT)
 	{
-		if (it)
+		auto obj = static_cast<CGameObject*>(mSpatialTree.GetUserData(proxy));
+		if (!(obj->GetLayers() & layerMask) || !*obj->Enabled()) return maxT;
+
+		CMesh::RayHit meshHit;
+		if (!obj->RayCast(treeRay, maxT, meshHit)) return maxT;
+
+		hit = { obj, meshHit.distance, treeRay.At(meshHit.distance), meshHit.normal, meshHit.subMesh, meshHit.triangle };
+		found = true;
+		return meshHit.distance; // Clip the ray so further objects are skipped by the tree
+	});
+
+	return found;
+}
+
+void CGameObjectManager::RayCastAll(const CRay& ray, std::vector<SceneRayHit>& hits, float maxDistance /*= FLT_MAX*/, unsigned int layerMask /*= Layer_All*/) const
+{
+	const auto firstHit = hits.size();
+
+	mSpatialTree.RayCast(ray, maxDistance, [&](int proxy, const CRay& treeRay, float maxT)
+	{
+		auto obj = static_cast<CGameObject*>(mSpatialTree.GetUserData(proxy));
+		if (!(obj->GetLayers() & layerMask) || !*obj->Enabled()) return maxT;
+
+		CMesh::RayHit meshHit;
+		if (obj->RayCast(treeRay, maxT, meshHit))
 		{
-			it->Release();
-			delete it;
+			hits.push_back({ obj, meshHit.distance, treeRay.At(meshHit.distance), meshHit.normal, meshHit.subMesh, meshHit.triangle });
 		}
+		return maxT;
+	});
+
+	std::sort(hits.begin() + firstHit, hits.end(), [](const SceneRayHit& a, const SceneRayHit& b) { return a.distance < b.distance; });
+}
+
+CGameObjectManager::~CGameObjectManager()
+{
+	for (auto it : mObjects)
+	{
+		delete it;
+	}
+
+	for (auto it : mLights)
+	{
+		delete it;
 	}
 
-	mShadowsMaps.clear();
+	for (auto it : mSpotLights)
+	{
+		delete it;
+	}
 }
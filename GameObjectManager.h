@@ -3,13 +3,38 @@
 
 #include "GameObject.h"
 #include "Light.h"
+#include "AABBTree.h"
+#include "SpatialHashGrid.h"
+#include "FrustumCulling.h"
+#include "OcclusionCulling.h"
+#include "RenderQueue.h"
+#include "CommandBackend.h"
+#include "LightConstants.h"
+#include "ClusteredLighting.h"
+#include "StructuredBuffer.h"
+#include "ShadowAtlas.h"
+#include <cfloat>
 #include <deque>
 #include <memory>
+#include <unordered_map>
+#include <vector>
 
 #include "Common.h"
 
 class CSpotLight;
 class CDirLight;
+class CParticleSystem;
+
+// Result of a ray cast against the scene
+struct SceneRayHit
+{
+	CGameObject* object;
+	float        distance; // Along the ray
+	CVector3     position; // World space point hit
+	CVector3     normal;   // World space face normal of the triangle hit
+	unsigned int subMesh;
+	unsigned int triangle;
+};
 
 class CGameObjectManager
 {
@@ -25,12 +50,24 @@ public:
 
 	void AddDirLight(CDirLight* obj);
 
-	void UpdateLightsConstBuffer(PerFrameLights* FCB);
+	// Rebuild the light buffer entries of the lights that have changed since the last call. Point lights go in a
+	// structured buffer with no fixed size, spot and directional lights in constant buffers
+	void UpdateLightsBuffer();
 	
 	void UpdateSpotLightsConstBuffer(PerFrameSpotLights* FLB);
 
 	void UpdateDirLightsConstBuffer(PerFrameDirLights* FLB);
 
+	// Send the entries rebuilt by the functions above to the GPU light buffers. Nothing is sent if no light has changed
+	void UploadLightConstBuffers();
+
+	// Assign the point and spot lights to the clusters of a camera's view, then upload and bind the cluster buffers and
+	// gPerFrameClusters for the pixel shaders. Lights are bounded by their influence radius
+	void UpdateLightClusters(const CMatrix4x4& viewMatrix, const CMatrix4x4& projectionMatrix, float nearClip, float farClip);
+
+	// Results of the last UpdateLightClusters
+	const CLightClusters& GetLightClusters() const { return mLightClusters; }
+
 	bool RemoveObject(int pos);
 
 	bool RemoveLight(int pos);
@@ -38,17 +75,128 @@ public:
 	bool RemoveSpotLight(int pos);
 
 	bool RemoveDirLight(int pos);
+
+	// Find an object (model or light) by name in constant time. Returns nullptr if there is none. If several
+	// objects share the name any one of them may be returned. Use "Name"_sid for names known at compile time
+	CGameObject* FindObject(uint64_t nameHash) const;
+	CGameObject* FindObject(CStringId name) const { return FindObject(name.Hash()); }
+	CGameObject* FindObject(const std::string& name) const { return FindObject(HashString(name)); }
 	
 	bool RenderAllObjects();
 
+	// Render the given objects (e.g. the visible list from CullObjects), then show and unbind the shadow maps.
+	// Pass the camera's view to draw only the meshlets it may see. The objects must be in SortForRendering order for
+	// the camera in the per-frame constants. Particle emitters prepared for it (CParticleSystem::Prepare) are drawn
+	// in among the transparent objects, each before the first transparent object in front of it
+	bool RenderObjects(const std::vector<CGameObject*>& objects, const MeshletView* view = nullptr, CParticleSystem* particles = nullptr);
+
+	// Record the commands to draw the objects, spread over the job system threads in consecutive slices, then
+	// execute them in order on the command backend. Neighbouring objects that share a mesh, shaders and textures
+	// are drawn with a single instanced draw. basicGeometry draws depth only (shadow maps). With a world space view,
+	// objects drawn on their own only draw the meshlets that may be visible from it (see Meshlets.h)
+	void SubmitObjects(CGameObject* const* objects, unsigned int count, bool basicGeometry = false, const MeshletView* view = nullptr);
+	void SubmitObjects(const std::vector<CGameObject*>& objects, bool basicGeometry = false, const MeshletView* view = nullptr)
+	{
+		SubmitObjects(objects.data(), static_cast<unsigned int>(objects.size()), basicGeometry, view);
+	}
+
+	// Replace the backend the command lists are executed on (D3D11 by default), e.g. a CNullCommandBackend to
+	// measure the recording side without rendering
+	void SetCommandBackend(std::unique_ptr<ICommandBackend> backend) { mCommandBackend = std::move(backend); }
+
+	// Reorder the objects into render queue order: by pass, then grouped by shader / texture / mesh with opaque objects
+	// front to back, and blended objects back to front. Depth is the view space depth of the centre of each object's
+	// bounds, so objects side by side at the same distance ahead sort together. maxDepth is the camera's far clip distance
+	void SortForRendering(std::vector<CGameObject*>& objects, const CMatrix4x4& viewMatrix, float maxDepth);
+
+	// Collect the objects (models and lights) whose bounds are at least partially inside the frustum, in the order
+	// RenderAllObjects would draw them. Uses SIMD tests over a contiguous copy of the world bounds, which is only
+	// updated for objects whose transform has changed
+	void CullObjects(const CFrustum& frustum, std::vector<CGameObject*>& visible);
+
+	// Remove the objects hidden behind the occluders (models with an occluder mesh) from a list of objects in view, e.g. the
+	// result of CullObjects. The occluders are drawn into a CPU depth buffer for the view first (see OcclusionCulling.h)
+	void CullOccludedObjects(const CMatrix4x4& viewProjectionMatrix, std::vector<CGameObject*>& visible);
+
+	// Occlusion culling can be switched off, CullOccludedObjects then keeps every object
+	bool* OcclusionCullingEnabled() { return &mOcclusionCulling; }
+
+	// Results of the last CullOccludedObjects
+	int GetOccludedCount() const { return mOccludedCount; }
+	const COcclusionBuffer& GetOcclusionBuffer() const { return mOcclusionBuffer; }
+
+	// Collect the enabled models (shadow casters) at least partially inside a light's volume. Optionally skip casters further than
+	// maxDistance from the light position and keep only the nearest maxCasters (0 for no limit on either)
+	void CullShadowCasters(const CFrustum& volume, const CVector3& lightPosition, float maxDistance, int maxCasters,
+	                       std::vector<CGameObject*>& casters);
+
+	// Choose the level of detail of every model for a view, from its size on screen. The chosen levels are also used for
+	// the shadow maps, so a model always casts the shadow of the mesh that is drawn. Call once per frame before rendering
+	void SelectLods(const CVector3& viewPosition, const CMatrix4x4& projectionMatrix);
+
+	// Bias, switching sizes and hysteresis used by SelectLods (see LevelOfDetail.h)
+	LodSettings& GetLodSettings() { return mLodSettings; }
+
+	// Results of the last CullObjects
+	int GetVisibleCount() const { return mVisibleCount; }
+	int GetCulledCount() const { return mCulledCount; }
+
+	// Render the shadow maps of the enabled spot and directional lights into the shadow atlas. Shadow maps whose tile is
+	// still up to date from an earlier frame are skipped (see CLight::RenderShadowMap). The directional lights' shadow
+	// cascades are fitted to the camera given by its world and projection matrices and near clip
 	void RenderFromSpotLights();
 
-	void RenderFromDirLights();
+	void RenderFromDirLights(const CMatrix4x4& cameraMatrix, const CMatrix4x4& projectionMatrix, float nearClip);
 
-	void RenderFromAllLights();
+	void RenderFromAllLights(const CMatrix4x4& cameraMatrix, const CMatrix4x4& projectionMatrix, float nearClip);
+
+	// The atlas holding every light's shadow map, nullptr until the first RenderFromAllLights
+	CShadowAtlas* GetShadowAtlas() const { return mShadowAtlas.get(); }
+
+	// Shadow maps rendered and kept from earlier frames by the last RenderFromAllLights
+	int GetShadowMapsRendered() const { return mShadowMapsRendered; }
+	int GetShadowMapsCached() const { return mShadowMapsCached; }
 
 	void UpdateObjects(float updateTime);
 
+	// Refit the spatial tree to the current object transforms. Cheap for objects that have not moved
+	void UpdateSpatialTree();
+
+	// Full SAH rebuild of the spatial tree, call after loading or large changes to the scene
+	void RebuildSpatialTree();
+
+	// Collect every object (models and lights) whose bounds overlap the given shape (CAABB, CSphere or CFrustum)
+	template <typename Shape>
+	void QueryObjects(const Shape& shape, std::vector<CGameObject*>& result) const
+	{
+		mSpatialTree.Query(shape, [&](int proxy)
+		{
+			result.push_back(static_cast<CGameObject*>(mSpatialTree.GetUserData(proxy)));
+			return true;
+		});
+	}
+
+	// Move the models' proximity grid items to their current bounds. Only objects that crossed a cell boundary touch the grid
+	void UpdateProximityGrid();
+
+	// Find the models each point light can reach, influences[i] for mLights[i]. Uses the same radius as the light
+	// clusters, so these are the models the light actually shades. The lights are processed in parallel. Done on
+	// request, not every frame
+	void QueryLightInfluences(std::vector<std::vector<CGameObject*>>& influences) const;
+
+	// Proximity queries over the models, cost depends on the number of objects nearby rather than the scene size
+	void QueryObjectsInRadius(const CVector3& centre, float radius, std::vector<CGameObject*>& result) const;
+
+	// The k models nearest to the point, closest first
+	void QueryNearestObjects(const CVector3& point, int k, std::vector<CGameObject*>& result) const;
+
+	// Closest object whose triangles are hit by the ray within maxDistance. Only enabled objects on one of the layers in
+	// layerMask are considered. The spatial tree finds candidate objects, then each is tested exactly against its mesh
+	bool RayCast(const CRay& ray, SceneRayHit& hit, float maxDistance = FLT_MAX, unsigned int layerMask = Layer_All) const;
+
+	// Every object hit by the ray within maxDistance (closest hit on each), sorted nearest first
+	void RayCastAll(const CRay& ray, std::vector<SceneRayHit>& hits, float maxDistance = FLT_MAX, unsigned int layerMask = Layer_All) const;
+
 	~CGameObjectManager();
 
 	std::deque<CGameObject*> mObjects;
@@ -59,11 +207,82 @@ public:
 
 	std::deque<CDirLight*> mDirLights;
 
-	std::deque<ID3D11ShaderResourceView*> mShadowsMaps;
+	// Bounding volume hierarchy over everything in the containers above, keeps queries sub-linear in scene size
+	CAABBTree mSpatialTree;
+
+	// Uniform hashed grid over the models in mObjects for radius / nearest neighbour queries
+	CSpatialHashGrid mProximityGrid;
 	
 
 private:
 
+	// Add / remove an object to the spatial tree and name index, used by all the Add / Remove functions
+	void RegisterObject(CGameObject* obj);
+
+	void UnregisterObject(CGameObject* obj);
+
+	void AddToSpatialTree(CGameObject* obj);
+
+	void RemoveFromSpatialTree(CGameObject* obj);
+
+	void AddToProximityGrid(CGameObject* obj);
+
+	void RemoveFromProximityGrid(CGameObject* obj);
+
+	std::unique_ptr<CShadowAtlas> mShadowAtlas;
+	int mShadowMapsRendered;
+	int mShadowMapsCached;
+
+	// Which light buffer entries are up to date
+	CLightConstants mLightConstants;
+	CLightConstants mSpotLightConstants;
+	CLightConstants mDirLightConstants;
+
+	// Point lights for the shaders
+	std::vector<sLight> mPointLightData;
+	CStructuredBuffer   mPointLightBuffer;
+
+	// Lights in each cluster of the view
+	CLightClusters           mLightClusters;
+	std::vector<LightSphere> mPointLightSpheres;
+	std::vector<LightSphere> mSpotLightSpheres;
+	CStructuredBuffer        mClusterBuffer;
+	CStructuredBuffer        mClusterIndexBuffer;
+
+	void UpdateCullingBounds();
+
+	// Bounds of every object for culling, and the object / transform version each entry was taken from
+	CCullingBounds mCullingBounds;
+	std::vector<CGameObject*>  mCullingObjects;
+	std::vector<unsigned int>  mCullingVersions;
+	bool mCullingDirty;
+	int  mVisibleCount;
+	int  mCulledCount;
+
+	// World space triangles of an occluder and the transform version they were taken at
+	struct OccluderGeometry
+	{
+		unsigned int          version = 0;
+		std::vector<CVector3> positions;
+		std::vector<uint32_t> indices;
+	};
+
+	COcclusionBuffer mOcclusionBuffer;
+	std::unordered_map<CGameObject*, OccluderGeometry> mOccluderGeometry;
+	bool mOcclusionCulling;
+	int  mOccludedCount;
+
+	CRenderQueue mRenderQueue;
+
+	LodSettings mLodSettings;
+
+	// One command list per recording slice, kept between frames to reuse their memory
+	std::vector<CCommandList> mCommandLists;
+	std::unique_ptr<ICommandBackend> mCommandBackend;
+
+	// Name hash -> object, for all objects in the containers above
+	std::unordered_multimap<uint64_t, CGameObject*> mNameIndex;
+
 	int mMaxSize;
 	int mCurrNumSpotLights;
 	int mCurrNumLights;
@@ -0,0 +1,209 @@
+//--------------------------------------------------------------------------------------
+// Geometry allocator - vertices and indices of all meshes in a few large shared buffers
+//--------------------------------------------------------------------------------------
+
+#include "GeometryAllocator.h"
+
+#include "Common.h"
+#include "Shader.h" // Needed for helper function CreateSignatureForVertexLayout
+
+#include <algorithm>
+#include <stdexcept>
+
+
+CGeometryAllocator gGeometryAllocator;
+
+
+/*-----------------------------------------------------------------------------------------
+    Allocation
+-----------------------------------------------------------------------------------------*/
+
+VertexAllocation CGeometryAllocator::AllocateVertices(const std::vector<D3D11_INPUT_ELEMENT_DESC>& elements, unsigned int vertexSize,
+                                                      const void* vertices, unsigned int numVertices)
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+
+	VertexAllocation allocation;
+	allocation.pool = FindVertexPool(elements, vertexSize);
+	auto& pool = mVertexPools[allocation.pool];
+
+	allocation.page = AllocateFromPages(pool.pages, D3D11_BIND_VERTEX_BUFFER, vertexSize, VertexPageBytes, numVertices, allocation.baseVertex);
+	allocation.buffer = pool.pages[allocation.page].buffer;
+	allocation.layout = pool.layout;
+	allocation.vertexSize = vertexSize;
+	allocation.numVertices = numVertices;
+
+	if (numVertices > 0)
+	{
+		const D3D11_BOX box = { allocation.baseVertex * vertexSize, 0, 0, (allocation.baseVertex + numVertices) * vertexSize, 1, 1 };
+		gD3DContext->UpdateSubresource(allocation.buffer, 0, &box, vertices, 0, 0);
+	}
+	return allocation;
+}
+
+IndexAllocation CGeometryAllocator::AllocateIndices(const void* indices, unsigned int indexSize, unsigned int numIndices)
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+
+	IndexAllocation allocation;
+	auto& pages = mIndexPages[indexSize == 2 ? 0 : 1];
+	allocation.page = AllocateFromPages(pages, D3D11_BIND_INDEX_BUFFER, indexSize, IndexPageBytes, numIndices, allocation.startIndex);
+	allocation.buffer = pages[allocation.page].buffer;
+	allocation.indexSize = indexSize;
+	allocation.numIndices = numIndices;
+
+	if (numIndices > 0)
+	{
+		const D3D11_BOX box = { allocation.startIndex * indexSize, 0, 0, (allocation.startIndex + numIndices) * indexSize, 1, 1 };
+		gD3DContext->UpdateSubresource(allocation.buffer, 0, &box, indices, 0, 0);
+	}
+	return allocation;
+}
+
+
+void CGeometryAllocator::Free(const VertexAllocation& allocation)
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+	if (allocation.buffer == nullptr || allocation.pool >= mVertexPools.size()) return;
+
+	FreeFromPages(mVertexPools[allocation.pool].pages, allocation.page, allocation.baseVertex, allocation.numVertices);
+}
+
+void CGeometryAllocator::Free(const IndexAllocation& allocation)
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+	if (allocation.buffer == nullptr) return;
+
+	FreeFromPages(mIndexPages[allocation.indexSize == 2 ? 0 : 1], allocation.page, allocation.startIndex, allocation.numIndices);
+}
+
+
+void CGeometryAllocator::Release()
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+
+	for (auto& pool : mVertexPools)
+	{
+		for (auto& page : pool.pages)  if (page.buffer)  page.buffer->Release();
+		if (pool.layout)  pool.layout->Release();
+	}
+	for (auto& pages : mIndexPages)
+	{
+		for (auto& page : pages)  if (page.buffer)  page.buffer->Release();
+		pages.clear();
+	}
+	mVertexPools.clear();
+}
+
+
+CGeometryAllocator::Stats CGeometryAllocator::GetStats() const
+{
+	std::lock_guard<std::mutex> lock(mMutex);
+
+	Stats stats = { 0, static_cast<unsigned int>(mVertexPools.size()), 0, 0 };
+	auto addPages = [&](const std::vector<Page>& pages, unsigned int elementSize)
+	{
+		for (const auto& page : pages)
+		{
+			if (page.buffer == nullptr) continue;
+			++stats.buffers;
+			stats.bytesReserved += static_cast<unsigned long long>(page.ranges.Size()) * elementSize;
+			stats.bytesUsed += static_cast<unsigned long long>(page.ranges.Size() - page.ranges.FreeSpace()) * elementSize;
+		}
+	};
+	for (const auto& pool : mVertexPools)  addPages(pool.pages, pool.vertexSize);
+	addPages(mIndexPages[0], 2);
+	addPages(mIndexPages[1], 4);
+	return stats;
+}
+
+
+/*-----------------------------------------------------------------------------------------
+    Pools and pages
+-----------------------------------------------------------------------------------------*/
+
+unsigned int CGeometryAllocator::FindVertexPool(const std::vector<D3D11_INPUT_ELEMENT_DESC>& elements, unsigned int vertexSize)
+{
+	for (unsigned int p = 0; p < mVertexPools.size(); ++p)
+	{
+		const auto& pool = mVertexPools[p];
+		if (pool.vertexSize != vertexSize || pool.elements.size() != elements.size()) continue;
+
+		auto same = true;
+		for (unsigned int e = 0; e < elements.size() && same; ++e)
+		{
+			same = pool.semanticNames[e] == elements[e].SemanticName &&
+			       pool.elements[e].SemanticIndex == elements[e].SemanticIndex &&
+			       pool.elements[e].Format == elements[e].Format &&
+			       pool.elements[e].AlignedByteOffset == elements[e].AlignedByteOffset;
+		}
+		if (same) return p;
+	}
+
+	// A new layout
+	auto shaderSignature = CreateSignatureForVertexLayout(elements.data(), static_cast<int>(elements.size()));
+	if (shaderSignature == nullptr)  throw std::runtime_error("Unsupported vertex layout");
+
+	VertexPool pool;
+	const auto hr = gD3DDevice->CreateInputLayout(elements.data(), static_cast<UINT>(elements.size()),
+	                                              shaderSignature->GetBufferPointer(), shaderSignature->GetBufferSize(), &pool.layout);
+	shaderSignature->Release();
+	if (FAILED(hr))  throw std::runtime_error("Failure creating input layout");
+
+	// Keep copies of the names, the caller's may not last
+	pool.vertexSize = vertexSize;
+	pool.elements = elements;
+	for (auto& element : pool.elements)
+	{
+		pool.semanticNames.push_back(element.SemanticName);
+		element.SemanticName = nullptr;
+	}
+
+	mVertexPools.push_back(std::move(pool));
+	return static_cast<unsigned int>(mVertexPools.size() - 1);
+}
+
+
+unsigned int CGeometryAllocator::AllocateFromPages(std::vector<Page>& pages, UINT bindFlags, unsigned int elementSize,
+                                                   unsigned int pageBytes, unsigned int count, unsigned int& start)
+{
+	for (unsigned int p = 0; p < pages.size(); ++p)
+	{
+		if (pages[p].buffer && pages[p].ranges.Allocate(count, start)) return p;
+	}
+
+	// No room, add a page. Reuse a released slot if there is one
+	unsigned int p = 0;
+	while (p < pages.size() && pages[p].buffer) ++p;
+	if (p == pages.size())  pages.emplace_back();
+	auto& page = pages[p];
+
+	const auto pageCount = std::max(pageBytes / elementSize, count);
+	D3D11_BUFFER_DESC bufferDesc;
+	bufferDesc.BindFlags = bindFlags;
+	bufferDesc.Usage = D3D11_USAGE_DEFAULT;
+	bufferDesc.ByteWidth = pageCount * elementSize;
+	bufferDesc.CPUAccessFlags = 0;
+	bufferDesc.MiscFlags = 0;
+	if (FAILED(gD3DDevice->CreateBuffer(&bufferDesc, nullptr, &page.buffer)))
+	{
+		page.buffer = nullptr;
+		throw std::runtime_error("Failure creating shared geometry buffer");
+	}
+
+	page.ranges = CRangeAllocator(pageCount);
+	page.ranges.Allocate(count, start);
+	return p;
+}
+
+void CGeometryAllocator::FreeFromPages(std::vector<Page>& pages, unsigned int page, unsigned int start, unsigned int count)
+{
+	if (page >= pages.size() || pages[page].buffer == nullptr) return;
+
+	pages[page].ranges.Free(start, count);
+	if (page > 0 && pages[page].ranges.Empty())
+	{
+		pages[page].buffer->Release();
+		pages[page].buffer = nullptr;
+	}
+}
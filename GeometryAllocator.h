@@ -0,0 +1,128 @@
+//--------------------------------------------------------------------------------------
+// Geometry allocator - vertices and indices of all meshes in a few large shared buffers
+//--------------------------------------------------------------------------------------
+// Code in .cpp file
+//
+// Vertices are grouped by their layout: each different layout has one input layout and a list of large
+// vertex buffers ("pages"), and meshes get a range of vertices in one of them. Indices go in pages shared
+// by every layout, one list for 16-bit and one for 32-bit indices. Draws use the base vertex and start
+// index of their ranges, so consecutive draws from the same pages bind nothing new (the command list
+// drops the repeated binds). Ranges are handed out by CRangeAllocator, freed ranges are reused, and a
+// page that becomes empty is released, so meshes can be streamed in and out.
+// Data is copied into the pages with the immediate context: allocate from the thread that renders.
+
+#pragma once
+
+#include "RangeAllocator.h"
+
+#ifndef NOMINMAX
+#define NOMINMAX // Use this to stop Windows headers defining "min" and "max"
+#endif
+#include <d3d11.h>
+#include <mutex>
+#include <string>
+#include <vector>
+
+
+// A range of vertices in a shared vertex buffer
+struct VertexAllocation
+{
+	ID3D11Buffer*      buffer = nullptr;
+	ID3D11InputLayout* layout = nullptr;
+	unsigned int       vertexSize = 0;
+	unsigned int       baseVertex = 0;
+	unsigned int       numVertices = 0;
+
+	unsigned int pool = 0; // Where it came from, for Free
+	unsigned int page = 0;
+};
+
+// A range of indices in a shared index buffer. The index values are relative to the base vertex of the vertices they use
+struct IndexAllocation
+{
+	ID3D11Buffer* buffer = nullptr;
+	unsigned int  indexSize = 0; // 2 or 4 bytes
+	unsigned int  startIndex = 0;
+	unsigned int  numIndices = 0;
+
+	unsigned int page = 0;
+};
+
+
+class CGeometryAllocator
+{
+public:
+	// Size of newly created pages. Anything bigger gets a page to itself
+	static const unsigned int VertexPageBytes = 16 * 1024 * 1024;
+	static const unsigned int IndexPageBytes  =  8 * 1024 * 1024;
+
+	struct Stats
+	{
+		unsigned int       buffers;       // Vertex and index pages
+		unsigned int       inputLayouts;  // Different vertex layouts
+		unsigned long long bytesUsed;
+		unsigned long long bytesReserved; // Total size of the pages
+	};
+
+	//-------------------------------------
+	// Allocation
+	//-------------------------------------
+
+	// Copy vertices of the given layout into a shared buffer. Throws a std::runtime_error if a buffer or input layout
+	// can't be created
+	VertexAllocation AllocateVertices(const std::vector<D3D11_INPUT_ELEMENT_DESC>& elements, unsigned int vertexSize,
+	                                  const void* vertices, unsigned int numVertices);
+
+	// Copy indices of the given size (2 or 4 bytes) into a shared buffer. Throws a std::runtime_error on failure
+	IndexAllocation AllocateIndices(const void* indices, unsigned int indexSize, unsigned int numIndices);
+
+	// Return allocations. Allowed after Release, when they are ignored
+	void Free(const VertexAllocation& allocation);
+	void Free(const IndexAllocation& allocation);
+
+	// Release all buffers and input layouts, call before shutting down Direct3D once all meshes are gone
+	void Release();
+
+	Stats GetStats() const;
+
+
+//-------------------------------------
+// Private members
+//-------------------------------------
+private:
+	struct Page
+	{
+		ID3D11Buffer*   buffer = nullptr; // nullptr once released, the slot is kept so allocations keep their page number
+		CRangeAllocator ranges{ 0 };
+	};
+
+	// Vertices of one layout, which is kept to find the pool again. The element descriptions only point to their
+	// semantic names, so the names are kept separately (the pointers are cleared)
+	struct VertexPool
+	{
+		std::vector<std::string>              semanticNames;
+		std::vector<D3D11_INPUT_ELEMENT_DESC> elements;
+		unsigned int                          vertexSize = 0;
+		ID3D11InputLayout*                    layout = nullptr;
+		std::vector<Page>                     pages;
+	};
+
+	// Find or create the pool for a layout
+	unsigned int FindVertexPool(const std::vector<D3D11_INPUT_ELEMENT_DESC>& elements, unsigned int vertexSize);
+
+	// Allocate count elements of elementSize bytes from one of the pages, creating a new page if none has room.
+	// Returns the page number
+	unsigned int AllocateFromPages(std::vector<Page>& pages, UINT bindFlags, unsigned int elementSize, unsigned int pageBytes,
+	                               unsigned int count, unsigned int& start);
+
+	// Free a range, releasing the page if it is left empty (the first page is kept for the next allocation)
+	void FreeFromPages(std::vector<Page>& pages, unsigned int page, unsigned int start, unsigned int count);
+
+	std::vector<VertexPool> mVertexPools;
+	std::vector<Page>       mIndexPages[2]; // 16-bit and 32-bit indices
+
+	mutable std::mutex mMutex;
+};
+
+// The allocator used by CMesh
+extern CGeometryAllocator gGeometryAllocator;
@@ -0,0 +1,39 @@
+//--------------------------------------------------------------------------------------
+// Level of detail selection - which of a model's meshes to draw from its size on screen
+//--------------------------------------------------------------------------------------
+
+#include "LevelOfDetail.h"
+
+#include <cfloat>
+#include <cmath>
+
+
+namespace
+{
+	// Screen size below which level is used (level >= 1)
+	float SwitchSize(unsigned int level, const LodSettings& settings)
+	{
+		return settings.lod1ScreenSize * std::pow(settings.levelRatio, static_cast<float>(level - 1));
+	}
+}
+
+
+float LodScreenSize(float radius, float distance, float projectionScaleY)
+{
+	if (distance <= radius) return FLT_MAX;
+	return radius * projectionScaleY / distance;
+}
+
+unsigned int SelectLod(float screenSize, unsigned int currentLevel, unsigned int numLevels, const LodSettings& settings)
+{
+	if (numLevels <= 1) return 0;
+
+	const auto size = screenSize * settings.bias;
+	auto level = currentLevel < numLevels ? currentLevel : numLevels - 1;
+
+	// Finer while clearly above the size this level starts at, otherwise coarser while clearly below the next level's
+	while (level > 0 && size >= SwitchSize(level, settings) * (1.0f + settings.hysteresis)) --level;
+	while (level + 1 < numLevels && size < SwitchSize(level + 1, settings) * (1.0f - settings.hysteresis)) ++level;
+
+	return level;
+}
@@ -0,0 +1,31 @@
+//--------------------------------------------------------------------------------------
+// Level of detail selection - which of a model's meshes to draw from its size on screen
+//--------------------------------------------------------------------------------------
+// Code in .cpp file
+//
+// A model's size on screen is the height of its bounding sphere as a fraction of the screen height. Level 0 (the
+// full mesh) is drawn while the model is at least lod1ScreenSize, and each following level takes over when the size
+// falls by levelRatio again. The bias scales every size before the test, above 1 keeps detail further away.
+//
+// A model near a switching size would flicker between two levels as the camera moves, so the selection has
+// hysteresis: a model only changes to a coarser level once it is a fraction smaller than the switching size, and
+// only back to a finer one once it is the same fraction larger. No graphics API is used here.
+
+#pragma once
+
+
+struct LodSettings
+{
+	float bias           = 1.0f;  // Multiplies every screen size, 2 switches at twice the distance
+	float lod1ScreenSize = 0.5f;  // Screen size below which level 1 is used
+	float levelRatio     = 0.5f;  // Each following level switches at this fraction of the previous level's size
+	float hysteresis     = 0.1f;  // Fraction either side of a switching size where the current level is kept
+};
+
+
+// Height of a bounding sphere on screen as a fraction of the screen height, for a perspective projection
+// whose e11 is projectionScaleY. Very large when the viewer is inside the sphere
+float LodScreenSize(float radius, float distance, float projectionScaleY);
+
+// Level to use, from 0 to numLevels - 1, for a model of the given screen size that currently uses currentLevel
+unsigned int SelectLod(float screenSize, unsigned int currentLevel, unsigned int numLevels, const LodSettings& settings);
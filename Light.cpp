@@ -1,37 +1,145 @@
 #include "Light.h"
+#include "GameObjectManager.h"
+#include "ShadowAtlas.h"
+#include "GraphicsHelpers.h"
 
-void CLight::Render(bool basicGeometry)
+void CLight::GetPipelineStates(PipelineState& pipeline) const
 {
-	if (basicGeometry)
+	// States - additive blending, read-only depth buffer and no culling (standard set-up for blending)
+	pipeline.blendState = gAdditiveBlendingState;
+	pipeline.depthStencilState = gDepthReadOnlyState;
+	pipeline.rasterizerState = gCullNoneState;
+}
+
+CLight::~CLight()
+{
+	ReleaseShadowTiles();
+}
+
+
+/*-----------------------------------------------------------------------------------------
+    Shadow maps
+-----------------------------------------------------------------------------------------*/
+
+namespace
+{
+	// FNV-1a style mixing of 64-bit values into a hash
+	void HashCombine(uint64_t& hash, uint64_t value)
 	{
-		//render object
-		CGameObject::Render();
+		hash ^= value;
+		hash *= 0x100000001B3ull;
 	}
-	else
+
+	const float NoShadowRect[4] = {};
+}
+
+const float* CLight::GetShadowRect(unsigned int index) const
+{
+	return index < mShadowMaps.size() ? mShadowMaps[index].rect : NoShadowRect;
+}
+
+void CLight::ReleaseShadowTile(ShadowMap& shadowMap)
+{
+	// Without a tile the rectangle is already empty, so the light constants only change if there was one
+	if (shadowMap.atlas)
 	{
-		gPerModelConstants.objectColour = mColour;
+		shadowMap.atlas->Free(shadowMap.tile);
+		LightChanged();
+	}
+	shadowMap = {};
+}
 
-		//store previous states
+void CLight::ReleaseShadowTiles()
+{
+	SetShadowMapCount(0);
+}
 
-		ID3D11BlendState* pBlendState = nullptr;
-		ID3D11DepthStencilState* pBPSState = nullptr;
-		ID3D11RasterizerState* pRSState = nullptr;
+void CLight::SetShadowMapCount(unsigned int count)
+{
+	for (auto i = count; i < mShadowMaps.size(); ++i)
+	{
+		ReleaseShadowTile(mShadowMaps[i]);
+	}
+	if (count < mShadowMaps.size()) mShadowMaps.resize(count);
+}
 
-		gD3DContext->OMGetBlendState(&pBlendState, nullptr, nullptr);
-		gD3DContext->OMGetDepthStencilState(&pBPSState, 0);
-		gD3DContext->RSGetState(&pRSState);
+bool CLight::RenderShadowMap(CGameObjectManager* CGOM, CShadowAtlas& atlas, unsigned int index, unsigned int shadowMapSize,
+                             const CVector3& viewPosition, const CFrustum& volume, float maxDepth)
+{
+	if (index >= mShadowMaps.size()) mShadowMaps.resize(index + 1, ShadowMap{});
+	auto& shadowMap = mShadowMaps[index];
 
-		// States - additive blending, read-only depth buffer and no culling (standard set-up for blending)
-		gD3DContext->OMSetBlendState(gAdditiveBlendingState, nullptr, 0xffffff);
-		gD3DContext->OMSetDepthStencilState(gDepthReadOnlyState, 0);
-		gD3DContext->RSSetState(gCullNoneState);
+	// A new tile when there is none (or there was no room last time) or a smaller one is wanted. The rectangle the
+	// shaders use moves with it
+	const auto wanted = atlas.Allocator().TileSizeFor(shadowMapSize);
+	if (shadowMap.atlas != &atlas || shadowMap.tile.size > wanted)
+	{
+		ReleaseShadowTile(shadowMap);
+		if (atlas.Allocate(shadowMapSize, shadowMap.tile))
+		{
+			shadowMap.atlas = &atlas;
+			atlas.GetTileRect(shadowMap.tile, shadowMap.rect);
+			LightChanged();
+		}
+	}
+	// The atlas was filling up when the tile was handed out, so it is smaller than wanted. Try for a bigger one whenever
+	// there could be room (at least the area of a tile twice the size), keeping the old tile if none is found
+	else if (shadowMap.tile.size < wanted && atlas.Allocator().FreeArea() >= 4ull * shadowMap.tile.size * shadowMap.tile.size)
+	{
+		AtlasTile larger;
+		if (atlas.Allocate(shadowMapSize, larger))
+		{
+			if (larger.size > shadowMap.tile.size)
+			{
+				atlas.Free(shadowMap.tile);
+				shadowMap.tile = larger;
+				atlas.GetTileRect(shadowMap.tile, shadowMap.rect);
+				shadowMap.cacheKey = 0;
+				LightChanged();
+			}
+			else
+			{
+				atlas.Free(larger);
+			}
+		}
+	}
+	if (!shadowMap.atlas) return false;
 
-		//render object
-		CGameObject::Render();
+	// Only the objects inside the volume can cast shadows into the shadow map
+	std::vector<CGameObject*> casters;
+	CGOM->CullShadowCasters(volume, viewPosition, GetMaxShadowCasterDistance(), GetMaxShadowCasters(), casters);
 
-		//set previous states
-		gD3DContext->OMSetBlendState(pBlendState, nullptr, 0xffffff);
-		gD3DContext->OMSetDepthStencilState(pBPSState, 0);
-		gD3DContext->RSSetState(pRSState);
+	// The tile is still right if the view / projection matrix is the same and the same casters (by pointer) are in it, each
+	// with the transform version and level of detail it had when it was drawn. Disabled models are never casters, so
+	// enabling or disabling one changes the set. The culling order follows the scene order, so the same casters always
+	// come out in the same order
+	uint64_t key = 0xCBF29CE484222325ull;
+	const auto matrix = reinterpret_cast<const uint32_t*>(&gPerFrameConstants.viewProjectionMatrix);
+	for (auto i = 0u; i < sizeof(CMatrix4x4) / sizeof(uint32_t); ++i)
+	{
+		HashCombine(key, matrix[i]);
 	}
+	HashCombine(key, casters.size());
+	for (auto caster : casters)
+	{
+		HashCombine(key, reinterpret_cast<uintptr_t>(caster));
+		HashCombine(key, caster->GetTransformVersion());
+		HashCombine(key, caster->GetLod());
+	}
+	if (key == shadowMap.cacheKey) return false;
+	shadowMap.cacheKey = key;
+
+	UpdateFrameConstantBuffer(gPerFrameConstantBuffer, gPerFrameConstants);
+	gD3DContext->VSSetConstantBuffers(1, 1, &gPerFrameConstantBuffer);
+
+	atlas.BeginTile(shadowMap.tile);
+
+	// Grouped by mesh and material, so casters using the same mesh are drawn instanced
+	CGOM->SortForRendering(casters, gPerFrameConstants.viewMatrix, maxDepth);
+
+	//render just the objects that can cast shadows
+	//basic geometry rendered, that means just render the model's geometry, leaving all the fancy shaders
+	CGOM->SubmitObjects(casters, true);
+
+	return true;
 }
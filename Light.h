@@ -1,8 +1,13 @@
 #pragma once
+#include <algorithm>
 #include <utility>
 #include "Common.h"
 #include "GameObject.h"
 #include "State.h"
+#include "AtlasAllocator.h"
+
+class CGameObjectManager;
+class CShadowAtlas;
 
 /*
 
@@ -16,30 +21,108 @@ class CLight : public CGameObject
 {
 public:
 
-	CLight(std::string mesh, std::string name,
+	CLight(const std::string& mesh, const std::string& name,
 		const std::string& diffuse, std::string& vertexShader, std::string& pixelShader,
 		CVector3 colour = { 0.0f,0.0f,0.0f }, float strength = 0.0f, CVector3 position = { 0,0,0 }, CVector3 rotation = { 0,0,0 }, float scale = 1)
-		: mColour(colour), mStrength(strength), CGameObject(std::move(mesh), std::move(name), diffuse, vertexShader, pixelShader, position, rotation, scale) {}
+		: mColour(colour), mStrength(strength), mMaxShadowCasterDistance(0.0f), mMaxShadowCasters(0), mLightVersion(0),
+		  CGameObject(mesh, name, diffuse, vertexShader, pixelShader, position, rotation, scale)
+	{
+		mLayers = Layer_Lights;
+	}
+
+	~CLight();
 
-	void Render(bool basicGeometry = false);
+	// Light models are drawn with additive blending after the opaque objects
+	ERenderPass RenderPass() const override { return RenderPass_Transparent; }
+	EBlendMode  BlendMode()  const override { return Blend_Additive; }
 
 	void SetColour(CVector3 colour)
 	{
 		mColour = colour;
+		LightChanged();
 	}
 
 	void SetStrength(float strength)
 	{
 		mStrength = strength;
+		LightChanged();
 	}
 
 	CVector3 GetColour() const { return mColour; }
 
 	float GetStrength() const { return mStrength; }
 
+	// Limits on which objects are drawn into the shadow map, used by the shadow casting lights (spot and directional).
+	// Objects further than maxDistance from the light are skipped, and only the nearest maxCount objects are kept.
+	// 0 means no limit
+	void SetShadowCasterLimits(float maxDistance, int maxCount)
+	{
+		mMaxShadowCasterDistance = maxDistance;
+		mMaxShadowCasters = maxCount;
+	}
+
+	float GetMaxShadowCasterDistance() const { return mMaxShadowCasterDistance; }
+
+	int GetMaxShadowCasters() const { return mMaxShadowCasters; }
+
+	// The shaders attenuate point lights by 1/distance, so the light never reaches zero. Return the distance
+	// at which the brightest colour channel falls below the given intensity, used to limit which objects it lights
+	float GetInfluenceRadius(float minIntensity = 0.05f) const
+	{
+		return std::max({ mColour.x, mColour.y, mColour.z }) * mStrength / minIntensity;
+	}
+
+	// Changes whenever anything sent to the shaders for this light changes (transform, colour, cone...), so the
+	// light constant buffers are only rebuilt for lights that have changed
+	unsigned int GetLightVersion() const { return mLightVersion + GetTransformVersion(); }
+
+	// Where the shaders find one of this light's shadow maps in the shadow atlas, see CShadowAtlas::GetTileRect. All zero
+	// if it has no tile (not rendered yet, or no room in the atlas), in which case it casts no shadows
+	const float* GetShadowRect(unsigned int index = 0) const;
+
+	// Give the light's tiles back to the shadow atlas, e.g. when the light is removed from the scene
+	void ReleaseShadowTiles();
+
+
+protected:
+	// Call from any setter of a value used in the light constant buffers, other than the transform
+	void LightChanged() { ++mLightVersion; }
+
+	// Shadow casting lights only, which may have several shadow maps (index), each in its own tile of the shadow atlas.
+	// Draw the casters found in the volume into the tile, using the view / projection matrices already set in
+	// gPerFrameConstants, seen from viewPosition. The tile is (re)allocated when the shadow map size has changed, and a
+	// tile smaller than asked for (the atlas was full) is swapped for a bigger one once there is room. It is kept from
+	// earlier frames, and only drawn again when the view / projection matrix has changed, a different set of casters is
+	// in the volume, or any of them has moved or changed level of detail. Returns false if the tile was kept as it was
+	bool RenderShadowMap(CGameObjectManager* CGOM, CShadowAtlas& atlas, unsigned int index, unsigned int shadowMapSize,
+	                     const CVector3& viewPosition, const CFrustum& volume, float maxDepth);
+
+	// Free the tiles of the shadow maps from count upwards, when the light needs fewer than before
+	void SetShadowMapCount(unsigned int count);
+
+	void GetPipelineStates(PipelineState& pipeline) const override;
+
+	// The model is tinted with the light colour
+	CVector3 ObjectColour() const override { return mColour; }
 
 private:
 	CVector3 mColour;
 	float mStrength;
+
+	float mMaxShadowCasterDistance;
+	int   mMaxShadowCasters;
+
+	unsigned int mLightVersion;
+
+	struct ShadowMap
+	{
+		CShadowAtlas* atlas;    // nullptr if it has no tile
+		AtlasTile     tile;
+		float         rect[4];  // Sent to the shaders
+		uint64_t      cacheKey; // Hash of everything the tile contents depend on when it was last drawn
+	};
+	std::vector<ShadowMap> mShadowMaps;
+
+	void ReleaseShadowTile(ShadowMap& shadowMap);
 };
 
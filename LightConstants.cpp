@@ -0,0 +1,99 @@
+//--------------------------------------------------------------------------------------
+// Change tracking for the light buffers
+//--------------------------------------------------------------------------------------
+
+#include "LightConstants.h"
+
+#include "Common.h"
+
+#include <d3d11_1.h>
+#include <algorithm>
+#include <climits>
+#include <cstdint>
+
+
+void CLightConstants::Invalidate()
+{
+	mSources.clear();
+	mCount = UINT_MAX;
+	mDirtyFirst = UINT_MAX;
+	mDirtyEnd = 0;
+}
+
+
+/*-----------------------------------------------------------------------------------------
+    Tracking changes
+-----------------------------------------------------------------------------------------*/
+
+bool CLightConstants::NeedsUpdate(unsigned int index, const CLight* light, unsigned int version)
+{
+	if (index >= mSources.size()) mSources.resize(index + 1, { nullptr, 0 });
+
+	auto& source = mSources[index];
+	if (source.light == light && source.version == version) return false;
+
+	source = { light, version };
+	MarkDirty(index);
+	return true;
+}
+
+bool CLightConstants::SetCount(unsigned int count)
+{
+	if (count == mCount) return false;
+
+	mCount = count;
+	MarkDirty(0);
+	return true;
+}
+
+void CLightConstants::MarkDirty(unsigned int index)
+{
+	mDirtyFirst = std::min(mDirtyFirst, index);
+	mDirtyEnd = std::max(mDirtyEnd, index + 1);
+}
+
+
+/*-----------------------------------------------------------------------------------------
+    Upload
+-----------------------------------------------------------------------------------------*/
+
+void CLightConstants::Upload(ID3D11Buffer* buffer, const void* entries, unsigned int stride)
+{
+	if (!IsDirty()) return;
+
+	// Other buffers (point lights are in a structured buffer) can always be partly updated
+	D3D11_BUFFER_DESC desc;
+	buffer->GetDesc(&desc);
+	if (!(desc.BindFlags & D3D11_BIND_CONSTANT_BUFFER))
+	{
+		const D3D11_BOX box = { mDirtyFirst * stride, 0, 0, mDirtyEnd * stride, 1, 1 };
+		gD3DContext->UpdateSubresource(buffer, 0, &box, static_cast<const uint8_t*>(entries) + box.left, 0, 0);
+		mUploadedBytes += box.right - box.left;
+		mDirtyFirst = UINT_MAX;
+		mDirtyEnd = 0;
+		return;
+	}
+
+	// Updating part of a constant buffer needs Direct3D 11.1, without it the whole buffer is replaced.
+	// Only checked when something has changed, which is rare
+	D3D11_FEATURE_DATA_D3D11_OPTIONS options = {};
+	ID3D11DeviceContext1* context1 = nullptr;
+	if (SUCCEEDED(gD3DDevice->CheckFeatureSupport(D3D11_FEATURE_D3D11_OPTIONS, &options, sizeof(options))) &&
+		options.ConstantBufferPartialUpdate &&
+		SUCCEEDED(gD3DContext->QueryInterface(__uuidof(ID3D11DeviceContext1), reinterpret_cast<void**>(&context1))))
+	{
+		// Entry sizes are multiples of 16 bytes, as the box must be for a constant buffer
+		const D3D11_BOX box = { mDirtyFirst * stride, 0, 0, mDirtyEnd * stride, 1, 1 };
+		context1->UpdateSubresource1(buffer, 0, &box, static_cast<const uint8_t*>(entries) + box.left, 0, 0, 0);
+		context1->Release();
+		mUploadedBytes += box.right - box.left;
+	}
+	else
+	{
+		gD3DContext->UpdateSubresource(buffer, 0, nullptr, entries, 0, 0);
+		mUploadedBytes += desc.ByteWidth;
+	}
+
+	mDirtyFirst = UINT_MAX;
+	mDirtyEnd = 0;
+}
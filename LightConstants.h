@@ -0,0 +1,65 @@
+//--------------------------------------------------------------------------------------
+// Change tracking for the light buffers
+//--------------------------------------------------------------------------------------
+// Code in .cpp file
+//
+// Each light buffer (constant or structured) is an array of entries, one per light. A tracker remembers which light
+// and which version of it (see CLight::GetLightVersion) each entry was built from, so only entries for
+// lights that were added, removed, moved or edited are rebuilt, and only the range of entries that
+// changed is copied to the GPU. A scene whose lights don't change uploads nothing.
+// The buffers must be created with default usage (not dynamic) so they can be partially updated.
+// A constant buffer is only partially updated where Direct3D 11.1 allows it.
+
+#pragma once
+
+#include <d3d11.h>
+#include <vector>
+
+class CLight;
+
+
+class CLightConstants
+{
+public:
+	CLightConstants() { Invalidate(); }
+
+	// Forget what the entries were built from, so they are all rebuilt and uploaded
+	void Invalidate();
+
+	// Whether the entry at index must be rebuilt: it held a different light or an older version of this one.
+	// Returning true also marks the entry for upload
+	bool NeedsUpdate(unsigned int index, const CLight* light, unsigned int version);
+
+	// Set the number of lights in use. The shaders read it from the first entry, so returns true (and marks
+	// that entry for upload) if it has changed and must be written there
+	bool SetCount(unsigned int count);
+
+	bool IsDirty() const { return mDirtyFirst < mDirtyEnd; }
+
+	// Copy the changed entries (stride bytes each) to the GPU buffer. Does nothing if no entry has changed
+	void Upload(ID3D11Buffer* buffer, const void* entries, unsigned int stride);
+
+	// Bytes copied to the GPU since the last reset
+	size_t UploadedBytes() const { return mUploadedBytes; }
+	void ResetStats() { mUploadedBytes = 0; }
+
+
+//-------------------------------------
+// Private members
+//-------------------------------------
+private:
+	void MarkDirty(unsigned int index);
+
+	struct Source
+	{
+		const CLight* light;
+		unsigned int  version;
+	};
+	std::vector<Source> mSources; // What each entry was built from
+
+	unsigned int mCount;
+	unsigned int mDirtyFirst; // Range of entries changed since the last upload
+	unsigned int mDirtyEnd;
+
+	size_t mUploadedBytes = 0;
+};
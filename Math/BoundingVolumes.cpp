@@ -0,0 +1,197 @@
+//--------------------------------------------------------------------------------------
+// Bounding volumes used for spatial queries (culling, picking, light assignment)
+//--------------------------------------------------------------------------------------
+
+#include "BoundingVolumes.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+
+/*-----------------------------------------------------------------------------------------
+    CAABB
+-----------------------------------------------------------------------------------------*/
+
+CAABB CAABB::Empty()
+{
+	return { { FLT_MAX, FLT_MAX, FLT_MAX }, { -FLT_MAX, -FLT_MAX, -FLT_MAX } };
+}
+
+float CAABB::SurfaceArea() const
+{
+	const auto dx = max.x - min.x;
+	const auto dy = max.y - min.y;
+	const auto dz = max.z - min.z;
+	return 2.0f * (dx * dy + dy * dz + dz * dx);
+}
+
+void CAABB::Encapsulate(const CVector3& p)
+{
+	min.x = std::min(min.x, p.x); max.x = std::max(max.x, p.x);
+	min.y = std::min(min.y, p.y); max.y = std::max(max.y, p.y);
+	min.z = std::min(min.z, p.z); max.z = std::max(max.z, p.z);
+}
+
+void CAABB::Encapsulate(const CAABB& b)
+{
+	min.x = std::min(min.x, b.min.x); max.x = std::max(max.x, b.max.x);
+	min.y = std::min(min.y, b.min.y); max.y = std::max(max.y, b.max.y);
+	min.z = std::min(min.z, b.min.z); max.z = std::max(max.z, b.max.z);
+}
+
+void CAABB::Inflate(float amount)
+{
+	min.x -= amount; min.y -= amount; min.z -= amount;
+	max.x += amount; max.y += amount; max.z += amount;
+}
+
+bool CAABB::Contains(const CAABB& b) const
+{
+	return min.x <= b.min.x && min.y <= b.min.y && min.z <= b.min.z &&
+	       max.x >= b.max.x && max.y >= b.max.y && max.z >= b.max.z;
+}
+
+bool CAABB::Overlaps(const CAABB& b) const
+{
+	return min.x <= b.max.x && max.x >= b.min.x &&
+	       min.y <= b.max.y && max.y >= b.min.y &&
+	       min.z <= b.max.z && max.z >= b.min.z;
+}
+
+// Transform the centre as a point and the extents by the absolute rotation/scale part of the matrix (Arvo's method)
+CAABB CAABB::Transform(const CMatrix4x4& m) const
+{
+	const auto c = Centre();
+	const auto e = Extents();
+
+	const CVector3 centre = { c.x * m.e00 + c.y * m.e10 + c.z * m.e20 + m.e30,
+	                          c.x * m.e01 + c.y * m.e11 + c.z * m.e21 + m.e31,
+	                          c.x * m.e02 + c.y * m.e12 + c.z * m.e22 + m.e32 };
+
+	const CVector3 extents = { e.x * std::abs(m.e00) + e.y * std::abs(m.e10) + e.z * std::abs(m.e20),
+	                           e.x * std::abs(m.e01) + e.y * std::abs(m.e11) + e.z * std::abs(m.e21),
+	                           e.x * std::abs(m.e02) + e.y * std::abs(m.e12) + e.z * std::abs(m.e22) };
+
+	return { centre - extents, centre + extents };
+}
+
+CAABB Merge(const CAABB& a, const CAABB& b)
+{
+	auto result = a;
+	result.Encapsulate(b);
+	return result;
+}
+
+
+/*-----------------------------------------------------------------------------------------
+    CSphere
+-----------------------------------------------------------------------------------------*/
+
+bool CSphere::Overlaps(const CAABB& b) const
+{
+	// Distance from the centre to the closest point on the box
+	const auto dx = std::max({ b.min.x - centre.x, 0.0f, centre.x - b.max.x });
+	const auto dy = std::max({ b.min.y - centre.y, 0.0f, centre.y - b.max.y });
+	const auto dz = std::max({ b.min.z - centre.z, 0.0f, centre.z - b.max.z });
+	return dx * dx + dy * dy + dz * dz <= radius * radius;
+}
+
+
+/*-----------------------------------------------------------------------------------------
+    CRay
+-----------------------------------------------------------------------------------------*/
+
+bool CRay::Intersects(const CAABB& b, float tMin, float tMax, float& tHit) const
+{
+	const float* o = &origin.x;
+	const float* d = &direction.x;
+	const float* bMin = &b.min.x;
+	const float* bMax = &b.max.x;
+
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		if (std::abs(d[axis]) < 1e-12f)
+		{
+			// Parallel to the slab - miss unless the origin is between the planes
+			if (o[axis] < bMin[axis] || o[axis] > bMax[axis]) return false;
+			continue;
+		}
+
+		const auto invD = 1.0f / d[axis];
+		auto t0 = (bMin[axis] - o[axis]) * invD;
+		auto t1 = (bMax[axis] - o[axis]) * invD;
+		if (t0 > t1) std::swap(t0, t1);
+
+		tMin = std::max(tMin, t0);
+		tMax = std::min(tMax, t1);
+		if (tMin > tMax) return false;
+	}
+
+	tHit = tMin;
+	return true;
+}
+
+CRay CRay::Transform(const CMatrix4x4& m) const
+{
+	const auto& o = origin;
+	const auto& d = direction;
+	return { { o.x * m.e00 + o.y * m.e10 + o.z * m.e20 + m.e30,
+	           o.x * m.e01 + o.y * m.e11 + o.z * m.e21 + m.e31,
+	           o.x * m.e02 + o.y * m.e12 + o.z * m.e22 + m.e32 },
+	         { d.x * m.e00 + d.y * m.e10 + d.z * m.e20,
+	           d.x * m.e01 + d.y * m.e11 + d.z * m.e21,
+	           d.x * m.e02 + d.y * m.e12 + d.z * m.e22 } };
+}
+
+
+/*-----------------------------------------------------------------------------------------
+    CFrustum
+-----------------------------------------------------------------------------------------*/
+
+// This app uses row vectors (clip = position * viewProjection) so each clip coordinate is the dot product
+// of the position with a *column* of the matrix. The planes are sums / differences of those columns
+CFrustum::CFrustum(const CMatrix4x4& m)
+{
+	const float col[4][4] = { { m.e00, m.e10, m.e20, m.e30 },
+	                          { m.e01, m.e11, m.e21, m.e31 },
+	                          { m.e02, m.e12, m.e22, m.e32 },
+	                          { m.e03, m.e13, m.e23, m.e33 } };
+
+	auto setPlane = [&](EPlane plane, float a, float b, float c, float d)
+	{
+		const auto invLength = 1.0f / std::sqrt(a * a + b * b + c * c);
+		planes[plane].normal   = { a * invLength, b * invLength, c * invLength };
+		planes[plane].distance = d * invLength;
+	};
+
+	setPlane(Left,   col[3][0] + col[0][0], col[3][1] + col[0][1], col[3][2] + col[0][2], col[3][3] + col[0][3]);
+	setPlane(Right,  col[3][0] - col[0][0], col[3][1] - col[0][1], col[3][2] - col[0][2], col[3][3] - col[0][3]);
+	setPlane(Bottom, col[3][0] + col[1][0], col[3][1] + col[1][1], col[3][2] + col[1][2], col[3][3] + col[1][3]);
+	setPlane(Top,    col[3][0] - col[1][0], col[3][1] - col[1][1], col[3][2] - col[1][2], col[3][3] - col[1][3]);
+	setPlane(Near,   col[2][0],             col[2][1],             col[2][2],             col[2][3]);
+	setPlane(Far,    col[3][0] - col[2][0], col[3][1] - col[2][1], col[3][2] - col[2][2], col[3][3] - col[2][3]);
+}
+
+bool CFrustum::Intersects(const CAABB& b) const
+{
+	const auto c = b.Centre();
+	const auto e = b.Extents();
+
+	for (const auto& plane : planes)
+	{
+		// Projected radius of the box onto the plane normal
+		const auto r = e.x * std::abs(plane.normal.x) + e.y * std::abs(plane.normal.y) + e.z * std::abs(plane.normal.z);
+		if (plane.SignedDistance(c) + r < 0.0f) return false;
+	}
+	return true;
+}
+
+bool CFrustum::Intersects(const CSphere& s) const
+{
+	for (const auto& plane : planes)
+	{
+		if (plane.SignedDistance(s.centre) + s.radius < 0.0f) return false;
+	}
+	return true;
+}
@@ -0,0 +1,136 @@
+//--------------------------------------------------------------------------------------
+// Bounding volumes used for spatial queries (culling, picking, light assignment)
+//--------------------------------------------------------------------------------------
+// Code in .cpp file
+
+#ifndef _BOUNDING_VOLUMES_H_DEFINED_
+#define _BOUNDING_VOLUMES_H_DEFINED_
+
+#include "CVector3.h"
+#include "CMatrix4x4.h"
+
+
+// Axis aligned bounding box, stored as its minimum and maximum corners
+class CAABB
+{
+// Concrete class - public access
+public:
+	CVector3 min;
+	CVector3 max;
+
+	/*-----------------------------------------------------------------------------------------
+		Constructors
+	-----------------------------------------------------------------------------------------*/
+
+	// Default constructor - leaves values uninitialised (for performance)
+	CAABB() {}
+
+	CAABB(const CVector3& minIn, const CVector3& maxIn) : min(minIn), max(maxIn) {}
+
+	// An "empty" box that any point or box will grow. Use before accumulating points with Encapsulate
+	static CAABB Empty();
+
+	/*-----------------------------------------------------------------------------------------
+		Member functions
+	-----------------------------------------------------------------------------------------*/
+
+	CVector3 Centre() const  { return { (min.x + max.x) * 0.5f, (min.y + max.y) * 0.5f, (min.z + max.z) * 0.5f }; }
+	CVector3 Extents() const { return { (max.x - min.x) * 0.5f, (max.y - min.y) * 0.5f, (max.z - min.z) * 0.5f }; }
+
+	bool IsValid() const { return min.x <= max.x && min.y <= max.y && min.z <= max.z; }
+
+	// Surface area of the box, the cost measure used by the AABB tree (SAH)
+	float SurfaceArea() const;
+
+	// Grow this box to include the given point / box
+	void Encapsulate(const CVector3& p);
+	void Encapsulate(const CAABB& b);
+
+	// Grow the box by the given amount in every direction
+	void Inflate(float amount);
+
+	// True if this box completely contains the given one
+	bool Contains(const CAABB& b) const;
+
+	// True if the two boxes touch or overlap
+	bool Overlaps(const CAABB& b) const;
+
+	// Return the box that bounds this box after it has been transformed by the given matrix
+	// (the result is axis aligned again, so it may be larger than the transformed box)
+	CAABB Transform(const CMatrix4x4& m) const;
+};
+
+// Box that contains both given boxes
+CAABB Merge(const CAABB& a, const CAABB& b);
+
+
+// Sphere given by centre and radius
+class CSphere
+{
+public:
+	CVector3 centre;
+	float    radius;
+
+	CSphere() {}
+	CSphere(const CVector3& centreIn, float radiusIn) : centre(centreIn), radius(radiusIn) {}
+
+	bool Overlaps(const CAABB& b) const;
+};
+
+
+// Ray given by an origin and a direction. The direction does not need to be normalised, distances
+// returned from ray queries are measured in multiples of the direction length
+class CRay
+{
+public:
+	CVector3 origin;
+	CVector3 direction;
+
+	CRay() {}
+	CRay(const CVector3& originIn, const CVector3& directionIn) : origin(originIn), direction(directionIn) {}
+
+	// Point at distance t along the ray
+	CVector3 At(float t) const { return origin + direction * t; }
+
+	// Slab test against a box. Returns true if the ray hits the box between tMin and tMax and
+	// outputs the entry distance (clamped to tMin if the origin is inside the box)
+	bool Intersects(const CAABB& b, float tMin, float tMax, float& tHit) const;
+
+	// Return this ray transformed by the given matrix (direction is transformed as a vector)
+	CRay Transform(const CMatrix4x4& m) const;
+};
+
+
+// Plane stored as normal and distance, points p with Dot(normal, p) + distance >= 0 are in front
+class CPlane
+{
+public:
+	CVector3 normal;
+	float    distance;
+
+	float SignedDistance(const CVector3& p) const { return Dot(normal, p) + distance; }
+};
+
+
+// View frustum as six inward facing planes, extracted from a view-projection matrix
+class CFrustum
+{
+public:
+	enum EPlane { Left, Right, Bottom, Top, Near, Far, NumPlanes };
+
+	CPlane planes[NumPlanes];
+
+	CFrustum() {}
+
+	// Extract the planes from a combined view-projection matrix (D3D clip space conventions, 0 <= z <= w)
+	explicit CFrustum(const CMatrix4x4& viewProjection);
+
+	// True if the box is at least partially inside the frustum. Conservative: boxes near the corners of
+	// the frustum may be reported as visible even if they are not
+	bool Intersects(const CAABB& b) const;
+
+	bool Intersects(const CSphere& s) const;
+};
+
+
+#endif // _BOUNDING_VOLUMES_H_DEFINED_
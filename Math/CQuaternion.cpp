@@ -0,0 +1,147 @@
+//--------------------------------------------------------------------------------------
+// Quaternion class (cut down version), to hold rotations for animation
+//--------------------------------------------------------------------------------------
+
+#include "CQuaternion.h"
+
+#include <cmath>
+
+
+/*-----------------------------------------------------------------------------------------
+    Operators
+-----------------------------------------------------------------------------------------*/
+
+CQuaternion operator* (const CQuaternion& q1, const CQuaternion& q2)
+{
+	return { q1.w * q2.x + q1.x * q2.w + q1.y * q2.z - q1.z * q2.y,
+	         q1.w * q2.y - q1.x * q2.z + q1.y * q2.w + q1.z * q2.x,
+	         q1.w * q2.z + q1.x * q2.y - q1.y * q2.x + q1.z * q2.w,
+	         q1.w * q2.w - q1.x * q2.x - q1.y * q2.y - q1.z * q2.z };
+}
+
+
+/*-----------------------------------------------------------------------------------------
+    Non-member functions
+-----------------------------------------------------------------------------------------*/
+
+float Dot(const CQuaternion& q1, const CQuaternion& q2)
+{
+	return q1.x * q2.x + q1.y * q2.y + q1.z * q2.z + q1.w * q2.w;
+}
+
+CQuaternion Conjugate(const CQuaternion& q)
+{
+	return { -q.x, -q.y, -q.z, q.w };
+}
+
+CQuaternion Normalise(const CQuaternion& q)
+{
+	const auto length = std::sqrt(Dot(q, q));
+	if (length == 0.0f)  return CQuaternion::Identity();
+
+	const auto invLength = 1.0f / length;
+	return { q.x * invLength, q.y * invLength, q.z * invLength, q.w * invLength };
+}
+
+
+CQuaternion Nlerp(const CQuaternion& q1, const CQuaternion& q2, float t)
+{
+	// q and -q are the same rotation, pick the one nearer q1
+	const auto t2 = Dot(q1, q2) < 0.0f ? -t : t;
+	const auto t1 = 1.0f - t;
+	return Normalise({ q1.x * t1 + q2.x * t2, q1.y * t1 + q2.y * t2, q1.z * t1 + q2.z * t2, q1.w * t1 + q2.w * t2 });
+}
+
+CQuaternion Slerp(const CQuaternion& q1, const CQuaternion& q2, float t)
+{
+	auto cosAngle = Dot(q1, q2);
+	const auto sign = cosAngle < 0.0f ? -1.0f : 1.0f;
+	cosAngle *= sign;
+
+	// Nearly the same rotation, the sines below would lose all precision
+	if (cosAngle > 0.9995f)  return Nlerp(q1, q2, t);
+
+	const auto angle = std::acos(cosAngle);
+	const auto invSin = 1.0f / std::sin(angle);
+	const auto t1 = std::sin((1.0f - t) * angle) * invSin;
+	const auto t2 = std::sin(t * angle) * invSin * sign;
+	return { q1.x * t1 + q2.x * t2, q1.y * t1 + q2.y * t2, q1.z * t1 + q2.z * t2, q1.w * t1 + q2.w * t2 };
+}
+
+
+CQuaternion QuaternionRotationAxis(const CVector3& axis, float angle)
+{
+	const auto s = std::sin(angle * 0.5f);
+	return { axis.x * s, axis.y * s, axis.z * s, std::cos(angle * 0.5f) };
+}
+
+
+CQuaternion QuaternionFromMatrix(const CMatrix4x4& m)
+{
+	// Work on the unscaled rotation
+	const auto x = Normalise(m.GetRow(0));
+	const auto y = Normalise(m.GetRow(1));
+	const auto z = Normalise(m.GetRow(2));
+
+	// Standard method choosing the largest component to divide by, written for row vectors
+	const auto trace = x.x + y.y + z.z;
+	CQuaternion q;
+	if (trace > 0.0f)
+	{
+		const auto s = 0.5f / std::sqrt(trace + 1.0f);
+		q = { (y.z - z.y) * s, (z.x - x.z) * s, (x.y - y.x) * s, 0.25f / s };
+	}
+	else if (x.x > y.y && x.x > z.z)
+	{
+		const auto s = 2.0f * std::sqrt(1.0f + x.x - y.y - z.z);
+		q = { 0.25f * s, (x.y + y.x) / s, (x.z + z.x) / s, (y.z - z.y) / s };
+	}
+	else if (y.y > z.z)
+	{
+		const auto s = 2.0f * std::sqrt(1.0f + y.y - x.x - z.z);
+		q = { (x.y + y.x) / s, 0.25f * s, (y.z + z.y) / s, (z.x - x.z) / s };
+	}
+	else
+	{
+		const auto s = 2.0f * std::sqrt(1.0f + z.z - x.x - y.y);
+		q = { (x.z + z.x) / s, (y.z + z.y) / s, 0.25f * s, (x.y - y.x) / s };
+	}
+	return Normalise(q);
+}
+
+
+CMatrix4x4 MatrixRotation(const CQuaternion& q)
+{
+	return MatrixFromTransform({ 0, 0, 0 }, q, { 1, 1, 1 });
+}
+
+CMatrix4x4 MatrixFromTransform(const CVector3& position, const CQuaternion& rotation, const CVector3& scale)
+{
+	const auto& q = rotation;
+	const auto xx = q.x * q.x, yy = q.y * q.y, zz = q.z * q.z;
+	const auto xy = q.x * q.y, xz = q.x * q.z, yz = q.y * q.z;
+	const auto wx = q.w * q.x, wy = q.w * q.y, wz = q.w * q.z;
+
+	CMatrix4x4 m;
+	m.e00 = (1.0f - 2.0f * (yy + zz)) * scale.x;  m.e01 = 2.0f * (xy + wz) * scale.x;           m.e02 = 2.0f * (xz - wy) * scale.x;           m.e03 = 0.0f;
+	m.e10 = 2.0f * (xy - wz) * scale.y;           m.e11 = (1.0f - 2.0f * (xx + zz)) * scale.y;  m.e12 = 2.0f * (yz + wx) * scale.y;           m.e13 = 0.0f;
+	m.e20 = 2.0f * (xz + wy) * scale.z;           m.e21 = 2.0f * (yz - wx) * scale.z;           m.e22 = (1.0f - 2.0f * (xx + yy)) * scale.z;  m.e23 = 0.0f;
+	m.e30 = position.x;                           m.e31 = position.y;                           m.e32 = position.z;                           m.e33 = 1.0f;
+	return m;
+}
+
+
+void DecomposeMatrix(const CMatrix4x4& m, CVector3& position, CQuaternion& rotation, CVector3& scale)
+{
+	position = m.GetRow(3);
+	scale = { Length(m.GetRow(0)), Length(m.GetRow(1)), Length(m.GetRow(2)) };
+
+	// A mirror can't be a rotation, put it in the scale
+	auto unmirrored = m;
+	if (Dot(Cross(m.GetRow(0), m.GetRow(1)), m.GetRow(2)) < 0.0f)
+	{
+		scale.x = -scale.x;
+		unmirrored.SetRow(0, m.GetRow(0) * -1.0f);
+	}
+	rotation = QuaternionFromMatrix(unmirrored);
+}
@@ -0,0 +1,83 @@
+//--------------------------------------------------------------------------------------
+// Quaternion class (cut down version), to hold rotations for animation
+//--------------------------------------------------------------------------------------
+// Code in .cpp file
+//
+// Rotations are unit quaternions (x, y, z, w). The matrices made from them follow the rest of the maths
+// classes: row vectors, so a matrix transforms a point with point * matrix
+
+#ifndef _CQUATERNION_H_DEFINED_
+#define _CQUATERNION_H_DEFINED_
+
+#include "CVector3.h"
+#include "CMatrix4x4.h"
+
+
+class CQuaternion
+{
+// Concrete class - public access
+public:
+	// Quaternion components, w is the real part
+	float x;
+	float y;
+	float z;
+	float w;
+
+    /*-----------------------------------------------------------------------------------------
+        Constructors
+    -----------------------------------------------------------------------------------------*/
+
+	// Default constructor - leaves values uninitialised (for performance)
+	CQuaternion() {}
+
+	// Construct with 4 values
+	CQuaternion(const float xIn, const float yIn, const float zIn, const float wIn) : x(xIn), y(yIn), z(zIn), w(wIn) {}
+
+	// The rotation that does nothing
+	static CQuaternion Identity() { return { 0, 0, 0, 1 }; }
+};
+
+
+/*-----------------------------------------------------------------------------------------
+    Non-member operators
+-----------------------------------------------------------------------------------------*/
+
+// Quaternion product (Hamilton). Matrices made from the product are MatrixRotation(q2) * MatrixRotation(q1), i.e.
+// q1 * q2 rotates by q2 first
+CQuaternion operator* (const CQuaternion& q1, const CQuaternion& q2);
+
+
+/*-----------------------------------------------------------------------------------------
+    Non-member functions
+-----------------------------------------------------------------------------------------*/
+
+float Dot(const CQuaternion& q1, const CQuaternion& q2);
+
+// Inverse rotation of a unit quaternion
+CQuaternion Conjugate(const CQuaternion& q);
+
+// Return unit length quaternion, the identity if given a zero quaternion
+CQuaternion Normalise(const CQuaternion& q);
+
+// Interpolate two rotations by the shorter way round. Nlerp is a normalised linear interpolation, fast and accurate
+// for close rotations, Slerp turns at a constant speed
+CQuaternion Nlerp(const CQuaternion& q1, const CQuaternion& q2, float t);
+CQuaternion Slerp(const CQuaternion& q1, const CQuaternion& q2, float t);
+
+// Rotation of the given angle (in radians) around a unit axis
+CQuaternion QuaternionRotationAxis(const CVector3& axis, float angle);
+
+// Rotation of a matrix, which must be a rotation or a rotation with scaling (the scaling is removed first)
+CQuaternion QuaternionFromMatrix(const CMatrix4x4& m);
+
+// Return a rotation matrix for the quaternion
+CMatrix4x4 MatrixRotation(const CQuaternion& q);
+
+// Return the matrix that scales, then rotates, then translates
+CMatrix4x4 MatrixFromTransform(const CVector3& position, const CQuaternion& rotation, const CVector3& scale);
+
+// Split an affine matrix without shear into the parts given to MatrixFromTransform. A mirroring matrix gets a negative x scale
+void DecomposeMatrix(const CMatrix4x4& m, CVector3& position, CQuaternion& rotation, CVector3& scale);
+
+
+#endif // _CQUATERNION_H_DEFINED_
@@ -11,19 +11,165 @@
 #include "GraphicsHelpers.h" // Helper functions to unclutter the code here
 #include "CVector2.h" 
 #include "CVector3.h" 
+#include "JobSystem.h"
+#include "CommandList.h"
+#include "MeshSimplifier.h"
+#include "MeshOptimiser.h"
+#include "VertexCompression.h"
+#include "Meshlets.h"
+#include "StringId.h"
 
 #include <assimp/Importer.hpp>
 #include <assimp/scene.h>
 #include <assimp/postprocess.h>
 #include <assimp/DefaultLogger.hpp>
 
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <filesystem>
 #include <memory>
 
 
+const float CMesh::GeneratedLodRatios[CMesh::MaxGeneratedLods] = { 0.5f, 0.25f, 0.1f, 0.04f };
+
+bool gCompressMeshes = true;
+bool  gCompressAnimations = true;
+float gStreamAnimationTime = 20.0f;
+bool gMeshletCulling = true;
+
+
+namespace
+{
+	// Counted by RecordSubMesh on every recording thread (see CMesh::GetMeshletStats)
+	std::atomic<unsigned int> gMeshletTrianglesTested{ 0 };
+	std::atomic<unsigned int> gMeshletTrianglesDrawn{ 0 };
+
+	// Convert vertices from the full precision layout read from assimp to the compact one (see VertexCompression.h).
+	// elements describes the full layout on entry and the compact one on return. Positions are stored relative to the
+	// box given by positionOffset and positionScale (its minimum and size)
+	std::unique_ptr<unsigned char[]> CompressVertices(const unsigned char* vertices, unsigned int numVertices, unsigned int& vertexSize,
+	                                                  std::vector<D3D11_INPUT_ELEMENT_DESC>& elements,
+	                                                  const CVector3& positionOffset, const CVector3& positionScale)
+	{
+		// Work out the compact layout, element by element in the same order
+		auto compactElements = elements;
+		unsigned int compactSize = 0;
+		for (unsigned int e = 0; e < elements.size(); ++e)
+		{
+			auto& element = compactElements[e];
+			const std::string semantic = element.SemanticName;
+			element.AlignedByteOffset = compactSize;
+
+			if (semantic == "position")
+			{
+				element.Format = DXGI_FORMAT_R16G16B16A16_UNORM;
+				compactSize += 8;
+			}
+			else if (semantic == "normal" || semantic == "tangent")
+			{
+				element.Format = DXGI_FORMAT_R16G16_SNORM;
+				compactSize += 4;
+			}
+			else if (semantic == "UV")
+			{
+				// Normalised values are more precise but can't hold uvs outside [0,1] (tiled textures)
+				auto inRange = true;
+				for (unsigned int v = 0; v < numVertices && inRange; ++v)
+				{
+					const auto uv = reinterpret_cast<const float*>(vertices + v * vertexSize + elements[e].AlignedByteOffset);
+					inRange = uv[0] >= 0.0f && uv[0] <= 1.0f && uv[1] >= 0.0f && uv[1] <= 1.0f;
+				}
+				element.Format = inRange ? DXGI_FORMAT_R16G16_UNORM : DXGI_FORMAT_R16G16_FLOAT;
+				compactSize += 4;
+			}
+			else if (semantic == "weights")
+			{
+				element.Format = DXGI_FORMAT_R8G8B8A8_UNORM;
+				compactSize += 4;
+			}
+			else // Bone indices are already bytes
+			{
+				compactSize += 4;
+			}
+		}
+
+		// Positions are scaled to [0,1] across the box. A flat box has nothing to store in that direction
+		const CVector3 positionInvScale = { positionScale.x > 0.0f ? 1.0f / positionScale.x : 0.0f,
+		                                    positionScale.y > 0.0f ? 1.0f / positionScale.y : 0.0f,
+		                                    positionScale.z > 0.0f ? 1.0f / positionScale.z : 0.0f };
+
+		auto compact = std::make_unique<unsigned char[]>(numVertices * compactSize);
+		for (unsigned int v = 0; v < numVertices; ++v)
+		{
+			for (unsigned int e = 0; e < elements.size(); ++e)
+			{
+				const auto source = vertices + v * vertexSize + elements[e].AlignedByteOffset;
+				const auto dest = compact.get() + v * compactSize + compactElements[e].AlignedByteOffset;
+				const auto values = reinterpret_cast<const float*>(source);
+
+				switch (compactElements[e].Format)
+				{
+				case DXGI_FORMAT_R16G16B16A16_UNORM:
+				{
+					const uint16_t position[4] = { FloatToUnorm16((values[0] - positionOffset.x) * positionInvScale.x),
+					                               FloatToUnorm16((values[1] - positionOffset.y) * positionInvScale.y),
+					                               FloatToUnorm16((values[2] - positionOffset.z) * positionInvScale.z), 0 };
+					std::memcpy(dest, position, 8);
+					break;
+				}
+				case DXGI_FORMAT_R16G16_SNORM:
+				{
+					int16_t encoded[2];
+					OctahedralEncode(CVector3(values[0], values[1], values[2]), encoded);
+					std::memcpy(dest, encoded, 4);
+					break;
+				}
+				case DXGI_FORMAT_R16G16_UNORM:
+				{
+					const uint16_t uv[2] = { FloatToUnorm16(values[0]), FloatToUnorm16(values[1]) };
+					std::memcpy(dest, uv, 4);
+					break;
+				}
+				case DXGI_FORMAT_R16G16_FLOAT:
+				{
+					const uint16_t uv[2] = { FloatToHalf(values[0]), FloatToHalf(values[1]) };
+					std::memcpy(dest, uv, 4);
+					break;
+				}
+				case DXGI_FORMAT_R8G8B8A8_UNORM:
+					QuantiseWeights(values, dest);
+					break;
+				default:
+					std::memcpy(dest, source, 4);
+					break;
+				}
+			}
+		}
+
+		elements = compactElements;
+		vertexSize = compactSize;
+		return compact;
+	}
+
+
+	// Copy 16 or 32-bit indices (indexSize 2 or 4) into the shared index buffers
+	IndexAllocation AllocateIndices(const std::vector<uint32_t>& indices, unsigned int indexSize)
+	{
+		const auto numIndices = static_cast<unsigned int>(indices.size());
+		if (indexSize == 4)  return gGeometryAllocator.AllocateIndices(indices.data(), 4, numIndices);
+
+		std::vector<uint16_t> shortIndices(indices.begin(), indices.end());
+		return gGeometryAllocator.AllocateIndices(shortIndices.data(), 2, numIndices);
+	}
+}
+
+
 // Pass the name of the mesh file to load. Uses assimp (http://www.assimp.org/) to support many file types
 // Optionally request tangents to be calculated (for normal and parallax mapping - see later lab)
+// Optionally generate levels of detail with fewer triangles
 // Will throw a std::runtime_error exception on failure (since constructors can't return errors).
-CMesh::CMesh(const std::string& fileNameN, bool requireTangents /*= false*/)
+CMesh::CMesh(const std::string& fileNameN, bool requireTangents /*= false*/, bool generateLods /*= false*/)
 {
 	auto fileName = gMediaFolder + fileNameN;
 
@@ -40,7 +186,6 @@ CMesh::CMesh(const std::string& fileNameN, bool requireTangents /*= false*/)
 		aiProcess_FlipWindingOrder |
 		aiProcess_Triangulate |
 		aiProcess_JoinIdenticalVertices |
-		aiProcess_ImproveCacheLocality |
 		aiProcess_SortByPType |
 		aiProcess_FindInvalidData |
 		aiProcess_OptimizeMeshes |
@@ -54,7 +199,7 @@ CMesh::CMesh(const std::string& fileNameN, bool requireTangents /*= false*/)
 
 	// Flags to specify what mesh data to ignore
 	auto removeComponents = aiComponent_LIGHTS | aiComponent_CAMERAS | aiComponent_TEXTURES | aiComponent_COLORS |
-		aiComponent_ANIMATIONS | aiComponent_MATERIALS;
+		aiComponent_MATERIALS;
 
 	// Add / remove tangents as required by user
 	if (requireTangents)
@@ -97,6 +242,9 @@ CMesh::CMesh(const std::string& fileNameN, bool requireTangents /*= false*/)
 	mNodes.resize(CountNodes(scene->mRootNode));
 	ReadNodes(scene->mRootNode, 0, 0);
 
+	// Animations of the nodes, if any
+	ReadAnimations(scene, fileName);
+
 
 
 	//******************************************//
@@ -108,8 +256,23 @@ CMesh::CMesh(const std::string& fileNameN, bool requireTangents /*= false*/)
 
 
 	// A mesh is made of sub-meshes, each one can have a different material (texture)
-	// Import each sub-mesh in the file to seperate index / vertex buffer (could share buffers between sub-meshes but that would make things more complex)
+	// Import each sub-mesh in the file to its own range of the shared index / vertex buffers (see GeometryAllocator.h)
 	mSubMeshes.resize(scene->mNumMeshes);
+
+	// CPU-side vertices of each sub-mesh and their layout, kept until they have been reordered (see MeshOptimiser.h)
+	// and compressed
+	std::vector<std::unique_ptr<unsigned char[]>> subMeshVertices(scene->mNumMeshes);
+	std::vector<std::vector<D3D11_INPUT_ELEMENT_DESC>> subMeshElements(scene->mNumMeshes);
+
+	// CPU-side copy of each sub-mesh's triangles, used to build the ray cast hierarchies once all sub-meshes are read
+	std::vector<std::vector<CVector3>> collisionPositions(scene->mNumMeshes);
+	std::vector<std::vector<uint32_t>> collisionIndices(scene->mNumMeshes);
+
+	// Normals, tangents and uvs of each sub-mesh's vertices for the simplifier, and how much each one counts
+	generateLods = generateLods && !mHasBones;
+	std::vector<std::vector<float>> lodAttributes(scene->mNumMeshes);
+	std::vector<std::vector<float>> lodAttributeWeights(scene->mNumMeshes);
+
 	for (unsigned int m = 0; m < scene->mNumMeshes; ++m)
 	{
 		auto assimpMesh = scene->mMeshes[m];
@@ -159,15 +322,7 @@ CMesh::CMesh(const std::string& fileNameN, bool requireTangents /*= false*/)
 		}
 
 		subMesh.vertexSize = offset;
-
-
-		// Create a "vertex layout" to describe to DirectX what is data in each vertex of this mesh
-		auto shaderSignature = CreateSignatureForVertexLayout(vertexElements.data(), static_cast<int>(vertexElements.size()));
-		auto hr = gD3DDevice->CreateInputLayout(vertexElements.data(), static_cast<UINT>(vertexElements.size()),
-		                                        shaderSignature->GetBufferPointer(), shaderSignature->GetBufferSize(),
-		                                        &subMesh.vertexLayout);
-		if (shaderSignature)  shaderSignature->Release();
-		if (FAILED(hr))  throw std::runtime_error("Failure creating input layout for " + fileName);
+		subMeshElements[m] = vertexElements; // The input layout is created with the vertex buffer, after compression
 
 
 
@@ -177,8 +332,8 @@ CMesh::CMesh(const std::string& fileNameN, bool requireTangents /*= false*/)
 		// Note: for large arrays a unique_ptr is better than a vector because vectors default-initialise all the values which is a waste of time.
 		subMesh.numVertices = assimpMesh->mNumVertices;
 		subMesh.numIndices = assimpMesh->mNumFaces * 3;
-		auto vertices = std::make_unique<unsigned char[]>(subMesh.numVertices * subMesh.vertexSize);
-		auto indices  = std::make_unique<unsigned char[]>(subMesh.numIndices * 4); // Using 32 bit indexes (4 bytes) for each indeex
+		auto& vertices = subMeshVertices[m];
+		vertices = std::make_unique<unsigned char[]>(subMesh.numVertices * subMesh.vertexSize);
 
 
 		//-----------------------------------
@@ -188,9 +343,11 @@ CMesh::CMesh(const std::string& fileNameN, bool requireTangents /*= false*/)
 		auto assimpPosition = reinterpret_cast<CVector3*>(assimpMesh->mVertices);
 		auto position = vertices.get() + positionOffset;
 		auto positionEnd = position + subMesh.numVertices * subMesh.vertexSize;
+		subMesh.bounds = CAABB::Empty();
 		while (position != positionEnd)
 		{
 			*(CVector3*)position = *assimpPosition;
+			subMesh.bounds.Encapsulate(*assimpPosition);
 			position += subMesh.vertexSize;
 			++assimpPosition;
 		}
@@ -321,7 +478,10 @@ CMesh::CMesh(const std::string& fileNameN, bool requireTangents /*= false*/)
 		// Copy face data from assimp to our CPU-side index buffer
 		if (!assimpMesh->HasFaces())  throw std::runtime_error("No face data in " + subMeshName + " in " + fileName);
 
-		auto index = reinterpret_cast<DWORD*>(indices.get());
+		// Using 32 bit indexes. The same indices are used for ray casts and, after reordering, for the index buffer
+		auto& indices = collisionIndices[m];
+		indices.resize(subMesh.numIndices);
+		auto index = indices.data();
 		for (unsigned int face = 0; face < assimpMesh->mNumFaces; ++face)
 		{
 			*index++ = assimpMesh->mFaces[face].mIndices[0];
@@ -329,34 +489,210 @@ CMesh::CMesh(const std::string& fileNameN, bool requireTangents /*= false*/)
 			*index++ = assimpMesh->mFaces[face].mIndices[2];
 		}
 
+		auto assimpVertices = reinterpret_cast<CVector3*>(assimpMesh->mVertices);
+		collisionPositions[m].assign(assimpVertices, assimpVertices + subMesh.numVertices);
 
-		//-----------------------------------
+		if (generateLods)
+		{
+			const auto hasUVs = assimpMesh->GetNumUVChannels() > 0 && assimpMesh->HasTextureCoords(0);
+			auto& weights = lodAttributeWeights[m];
+			weights = { 0.5f, 0.5f, 0.5f };
+			if (requireTangents) weights.insert(weights.end(), { 0.25f, 0.25f, 0.25f });
+			if (hasUVs) weights.insert(weights.end(), { 1.0f, 1.0f });
+
+			auto& values = lodAttributes[m];
+			values.reserve(subMesh.numVertices * weights.size());
+			for (unsigned int v = 0; v < subMesh.numVertices; ++v)
+			{
+				const auto& n = assimpMesh->mNormals[v];
+				values.insert(values.end(), { n.x, n.y, n.z });
+				if (requireTangents)
+				{
+					const auto& t = assimpMesh->mTangents[v];
+					values.insert(values.end(), { t.x, t.y, t.z });
+				}
+				if (hasUVs)
+				{
+					const auto& uv = assimpMesh->mTextureCoords[0][v];
+					values.insert(values.end(), { uv.x, uv.y });
+				}
+			}
+		}
+	}
 
-		D3D11_BUFFER_DESC bufferDesc;
-		D3D11_SUBRESOURCE_DATA initData;
 
-		// Create GPU-side vertex buffer and copy the vertices imported by assimp into it
-		bufferDesc.BindFlags = D3D11_BIND_VERTEX_BUFFER; // Indicate it is a vertex buffer
-		bufferDesc.Usage = D3D11_USAGE_DEFAULT;          // Default usage for this buffer - we'll see other usages later
-		bufferDesc.ByteWidth = subMesh.numVertices * subMesh.vertexSize; // Size of the buffer in bytes
-		bufferDesc.CPUAccessFlags = 0;
-		bufferDesc.MiscFlags = 0;
-		initData.pSysMem = vertices.get(); // Fill the new vertex buffer with data loaded by assimp
+	//-----------------------------------
 
-		hr = gD3DDevice->CreateBuffer(&bufferDesc, &initData, &subMesh.vertexBuffer);
-		if (FAILED(hr))  throw std::runtime_error("Failure creating vertex buffer for " + fileName);
+	// Compressed positions are stored across the box holding every sub-mesh, so the whole mesh needs only one scale and
+	// offset in the shader constants. The box is in the space of the vertices, whichever node they belong to
+	mCompressed = gCompressMeshes;
+	mPositionOffset = { 0, 0, 0 };
+	mPositionScale  = { 1, 1, 1 };
+	if (mCompressed)
+	{
+		auto vertexBounds = CAABB::Empty();
+		for (const auto& subMesh : mSubMeshes)  vertexBounds.Encapsulate(subMesh.bounds);
+		mPositionOffset = vertexBounds.min;
+		mPositionScale  = vertexBounds.max - vertexBounds.min;
+	}
+
+	// Reorder the triangles for the vertex cache and to reduce overdraw, then the vertices in the order they are used
+	// (see MeshOptimiser.h). Replaces assimp's aiProcess_ImproveCacheLocality, which only does the first of these.
+	// Rigid meshes are split into meshlets in between, which groups the triangles into patches (see Meshlets.h).
+	// Then compress the vertices, and use 16-bit indices where they are enough.
+	// Sub-meshes are independent so spread them over the worker threads
+	ParallelFor(static_cast<unsigned int>(mSubMeshes.size()), 1, [&](unsigned int begin, unsigned int end)
+	{
+		for (auto m = begin; m < end; ++m)
+		{
+			auto& subMesh = mSubMeshes[m];
+			auto& indices = collisionIndices[m];
+			subMesh.importedCacheStats = AnalyseVertexCache(indices, subMesh.numVertices);
+
+			OptimiseVertexCache(indices, subMesh.numVertices);
+			OptimiseOverdraw(indices, collisionPositions[m]);
+			if (!mHasBones)  BuildMeshlets(indices, collisionPositions[m], subMesh.meshlets);
+
+			std::vector<uint32_t> remap;
+			OptimiseVertexFetch(indices, subMeshVertices[m].get(), subMesh.numVertices, subMesh.vertexSize, remap);
+			subMesh.optimisedCacheStats = AnalyseVertexCache(indices, subMesh.numVertices);
+
+			// Data kept per vertex for ray casts and simplification follows the vertices to their new places
+			std::vector<CVector3> positions(subMesh.numVertices);
+			for (unsigned int v = 0; v < subMesh.numVertices; ++v) positions[remap[v]] = collisionPositions[m][v];
+			collisionPositions[m].swap(positions);
+
+			auto& attributes = lodAttributes[m];
+			if (!attributes.empty())
+			{
+				const auto stride = lodAttributeWeights[m].size();
+				std::vector<float> reordered(attributes.size());
+				for (unsigned int v = 0; v < subMesh.numVertices; ++v)
+				{
+					std::copy_n(&attributes[v * stride], stride, &reordered[remap[v] * stride]);
+				}
+				attributes.swap(reordered);
+			}
+
+			if (mCompressed)
+			{
+				subMeshVertices[m] = CompressVertices(subMeshVertices[m].get(), subMesh.numVertices, subMesh.vertexSize, subMeshElements[m],
+				                                      mPositionOffset, mPositionScale);
+				if (subMesh.numVertices <= 65536)  subMesh.indexSize = 2;
+			}
+		}
+	});
+
+	for (unsigned int m = 0; m < mSubMeshes.size(); ++m)
+	{
+		auto& subMesh = mSubMeshes[m];
+
+		// Copy the vertices and indices imported by assimp into the GPU-side buffers shared by all meshes with this
+		// vertex layout (see GeometryAllocator.h). Throws a std::runtime_error on failure
+		subMesh.vertices = gGeometryAllocator.AllocateVertices(subMeshElements[m], subMesh.vertexSize, subMeshVertices[m].get(), subMesh.numVertices);
+		subMeshVertices[m].reset();
+
+		subMesh.indices = AllocateIndices(collisionIndices[m], subMesh.indexSize);
+	}
+
+
+	//-----------------------------------
+
+	// Generate the levels of detail, each one simplified from the one before. Sub-meshes are independent so spread
+	// them over the worker threads
+	mNumLods = 1;
+	if (generateLods)
+	{
+		std::vector<std::vector<std::vector<uint32_t>>> lodIndices(mSubMeshes.size(), std::vector<std::vector<uint32_t>>(MaxGeneratedLods));
+		std::vector<std::vector<std::vector<Meshlet>>>  lodMeshlets(mSubMeshes.size(), std::vector<std::vector<Meshlet>>(MaxGeneratedLods));
+		ParallelFor(static_cast<unsigned int>(mSubMeshes.size()), 1, [&](unsigned int begin, unsigned int end)
+		{
+			for (auto m = begin; m < end; ++m)
+			{
+				SimplifyOptions options;
+				options.attributeWeights = lodAttributeWeights[m];
+
+				const auto numTriangles = collisionIndices[m].size() / 3;
+				auto source = &collisionIndices[m];
+				for (unsigned int level = 0; level < MaxGeneratedLods; ++level)
+				{
+					const auto target = static_cast<unsigned int>(numTriangles * GeneratedLodRatios[level]) * 3;
+					SimplifyMesh(collisionPositions[m], lodAttributes[m], *source, target, options, lodIndices[m][level]);
+					source = &lodIndices[m][level];
+				}
 
+				// Simplification leaves the triangles in the order of the level above, which no longer suits the cache.
+				// The vertex order is shared with level 0 so is left alone
+				for (unsigned int level = 0; level < MaxGeneratedLods; ++level)
+				{
+					auto& levelIndices = lodIndices[m][level];
+					OptimiseVertexCache(levelIndices, mSubMeshes[m].numVertices);
+					OptimiseOverdraw(levelIndices, collisionPositions[m]);
+					BuildMeshlets(levelIndices, collisionPositions[m], lodMeshlets[m][level]);
+				}
+			}
+		});
+
+		// Only keep levels that are worth switching to, with at least a fifth fewer triangles than the level before
+		size_t previousIndices = 0;
+		for (auto& subMesh : mSubMeshes) previousIndices += subMesh.numIndices;
+		for (unsigned int level = 0; level < MaxGeneratedLods; ++level)
+		{
+			size_t levelIndices = 0;
+			for (const auto& subMeshIndices : lodIndices) levelIndices += subMeshIndices[level].size();
+			if (levelIndices == 0 || levelIndices > previousIndices * 4 / 5) break;
+			previousIndices = levelIndices;
+			++mNumLods;
+		}
+
+		for (unsigned int m = 0; m < mSubMeshes.size(); ++m)
+		{
+			auto& subMesh = mSubMeshes[m];
+			subMesh.lods.resize(mNumLods - 1);
+			for (unsigned int level = 0; level + 1 < mNumLods; ++level)
+			{
+				const auto& levelIndices = lodIndices[m][level];
+				auto& lod = subMesh.lods[level];
+				lod.numIndices = static_cast<unsigned int>(levelIndices.size());
+				if (lod.numIndices == 0) continue;
+
+				lod.indices = AllocateIndices(levelIndices, subMesh.indexSize);
+				lod.meshlets = std::move(lodMeshlets[m][level]);
+			}
+		}
+	}
+
+
+	//-----------------------------------
 
-		// Create GPU-side index buffer and copy the vertices imported by assimp into it
-		bufferDesc.BindFlags = D3D11_BIND_INDEX_BUFFER; // Indicate it is an index buffer
-		bufferDesc.Usage = D3D11_USAGE_DEFAULT;         // Default usage for this buffer - we'll see other usages later
-		bufferDesc.ByteWidth = subMesh.numIndices * sizeof(DWORD); // Size of the buffer in bytes
-		bufferDesc.CPUAccessFlags = 0;
-		bufferDesc.MiscFlags = 0;
-		initData.pSysMem = indices.get(); // Fill the new index buffer with data loaded by assimp
+	// Build the triangle hierarchies for ray casts. Sub-meshes are independent so spread them over the worker threads
+	ParallelFor(static_cast<unsigned int>(mSubMeshes.size()), 1, [&](unsigned int begin, unsigned int end)
+	{
+		for (auto m = begin; m < end; ++m)
+		{
+			mSubMeshes[m].collision.Build(std::move(collisionPositions[m]), std::move(collisionIndices[m]));
+		}
+	});
+
+
+	//-----------------------------------
+
+	// Calculate the bounds of the whole mesh in its default pose. Models replace the root matrix with their own world
+	// matrix, so the root is treated as identity here and the other nodes are placed using their default matrices
+	std::vector<CMatrix4x4> absoluteMatrices(mNodes.size());
+	absoluteMatrices[0] = MatrixIdentity();
+	for (unsigned int nodeIndex = 1; nodeIndex < mNodes.size(); ++nodeIndex)
+	{
+		absoluteMatrices[nodeIndex] = mNodes[nodeIndex].defaultMatrix * absoluteMatrices[mNodes[nodeIndex].parentIndex];
+	}
 
-		hr = gD3DDevice->CreateBuffer(&bufferDesc, &initData, &subMesh.indexBuffer);
-		if (FAILED(hr))  throw std::runtime_error("Failure creating index buffer for " + fileName);
+	mBoundingBox = CAABB::Empty();
+	for (unsigned int nodeIndex = 0; nodeIndex < mNodes.size(); ++nodeIndex)
+	{
+		for (auto subMeshIndex : mNodes[nodeIndex].subMeshes)
+		{
+			mBoundingBox.Encapsulate(mSubMeshes[subMeshIndex].bounds.Transform(absoluteMatrices[nodeIndex]));
+		}
 	}
 }
 
@@ -365,42 +701,130 @@ CMesh::~CMesh()
 {
 	for (auto& subMesh : mSubMeshes)
 	{
-		if (subMesh.indexBuffer)   subMesh.indexBuffer ->Release();
-		if (subMesh.vertexBuffer)  subMesh.vertexBuffer->Release();
-		if (subMesh.vertexLayout)  subMesh.vertexLayout->Release();
+		for (auto& lod : subMesh.lods)
+		{
+			gGeometryAllocator.Free(lod.indices);
+		}
+		gGeometryAllocator.Free(subMesh.indices);
+		gGeometryAllocator.Free(subMesh.vertices);
 	}
 }
 
 
+// Bytes of GPU memory used by the vertex and index buffers, including generated levels of detail
+size_t CMesh::GpuBytes() const
+{
+	size_t bytes = 0;
+	for (const auto& subMesh : mSubMeshes)
+	{
+		bytes += subMesh.numVertices * subMesh.vertexSize + subMesh.numIndices * subMesh.indexSize;
+		for (const auto& lod : subMesh.lods)  bytes += lod.numIndices * subMesh.indexSize;
+	}
+	return bytes;
+}
+
+// How the vertex shaders should decode this mesh's vertices (see VertexCompression.h)
+void CMesh::SetDecodeConstants(PerModelConstants& constants) const
+{
+	constants.octahedralNormals = mCompressed ? 1 : 0;
+	constants.positionScale = mPositionScale;
+	constants.positionOffset = mPositionOffset;
+}
+
+
+// Combine the sub-mesh statistics, weighted by how many triangles / vertices each has
+VertexCacheStats CMesh::CacheStats(bool optimised) const
+{
+	float misses = 0, triangles = 0, vertices = 0;
+	for (const auto& subMesh : mSubMeshes)
+	{
+		const auto& stats = optimised ? subMesh.optimisedCacheStats : subMesh.importedCacheStats;
+		const auto subMeshMisses = stats.acmr * (subMesh.numIndices / 3);
+		misses += subMeshMisses;
+		triangles += subMesh.numIndices / 3;
+		if (stats.atvr > 0)  vertices += subMeshMisses / stats.atvr;
+	}
+	return { triangles > 0 ? misses / triangles : 0.0f, vertices > 0 ? misses / vertices : 0.0f };
+}
+
+
 //--------------------------------------------------------------------------------------
 
-// Helper function for Render function - renders a given sub-mesh. World matrices / textures / states etc. must already be set
-void CMesh::RenderSubMesh(const SubMesh& subMesh)
+// Helper function for Record function - draws a given sub-mesh. World matrices / textures / states etc. must already be recorded
+void CMesh::RecordSubMesh(CCommandList& list, const SubMesh& subMesh, unsigned int lod, const MeshletView* view) const
+{
+	const auto& indices = GetLodIndices(subMesh, lod);
+	if (indices.numIndices == 0) return;
+
+	// With a view, find the ranges of the index list that may be visible from it. Each list records on one thread only
+	thread_local std::vector<MeshletRange> ranges;
+	ranges.clear();
+	const auto& meshlets = GetLodMeshlets(subMesh, lod);
+	const auto cullMeshlets = view && gMeshletCulling && !meshlets.empty();
+	if (cullMeshlets)
+	{
+		const auto numTriangles = indices.numIndices / 3;
+		gMeshletTrianglesTested += numTriangles;
+
+		// Whole sub-meshes off screen need no meshlet tests
+		if (!view->frustum.Intersects(subMesh.bounds)) return;
+
+		const auto visibleTriangles = CullMeshlets(meshlets, *view, ranges);
+		gMeshletTrianglesDrawn += visibleTriangles;
+		if (visibleTriangles == 0) return;
+	}
+	else
+	{
+		ranges.push_back({ 0, indices.numIndices });
+	}
+
+	// Set vertex buffer (and the layout of its vertices) as next data source for GPU. The buffers are shared with other
+	// meshes, so are often already set
+	list.SetVertexBuffer(subMesh.vertices.buffer, subMesh.vertices.layout, subMesh.vertexSize);
+
+	// Set index buffer as next data source for GPU, 16 or 32-bit integers, triangle lists only in this class
+	list.SetIndexBuffer(indices.buffer, indices.indexSize);
+
+	// Render mesh, from where its indices and vertices are in the shared buffers. Neighbouring visible meshlets have been
+	// merged, so there is one draw for each run of them
+	for (const auto& range : ranges)
+	{
+		list.DrawIndexed(range.numIndices, indices.startIndex + range.firstIndex, static_cast<int>(subMesh.vertices.baseVertex));
+	}
+}
+
+// Generated levels of detail share the vertex buffer, only the indices differ
+const IndexAllocation& CMesh::GetLodIndices(const SubMesh& subMesh, unsigned int lod) const
 {
-	// Set vertex buffer as next data source for GPU
-	auto stride = subMesh.vertexSize;
-	UINT offset = 0;
-	gD3DContext->IASetVertexBuffers(0, 1, &subMesh.vertexBuffer, &stride, &offset);
+	if (lod == 0 || lod > subMesh.lods.size())  return subMesh.indices;
+	return subMesh.lods[lod - 1].indices;
+}
 
-	// Indicate the layout of vertex buffer
-	gD3DContext->IASetInputLayout(subMesh.vertexLayout);
+const std::vector<Meshlet>& CMesh::GetLodMeshlets(const SubMesh& subMesh, unsigned int lod) const
+{
+	if (lod == 0 || lod > subMesh.lods.size())  return subMesh.meshlets;
+	return subMesh.lods[lod - 1].meshlets;
+}
 
-	// Set index buffer as next data source for GPU, indicate it uses 32-bit integers
-	gD3DContext->IASetIndexBuffer(subMesh.indexBuffer, DXGI_FORMAT_R32_UINT, 0);
 
-	// Using triangle lists only in this class
-	gD3DContext->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+CMesh::MeshletStats CMesh::GetMeshletStats()
+{
+	return { gMeshletTrianglesTested.load(), gMeshletTrianglesDrawn.load() };
+}
 
-	// Render mesh
-	gD3DContext->DrawIndexed(subMesh.numIndices, 0, 0);
+void CMesh::ResetMeshletStats()
+{
+	gMeshletTrianglesTested = 0;
+	gMeshletTrianglesDrawn = 0;
 }
 
 
 
-// Render the mesh with the given matrices
+// Record the mesh with the given matrices
 // Handles rigid body meshes (including single part meshes) as well as skinned meshes
 // LIMITATION: The mesh must use a single texture throughout
-void CMesh::Render(std::vector<CMatrix4x4>& modelMatrices)
+void CMesh::Record(CCommandList& list, const std::vector<CMatrix4x4>& modelMatrices, PerModelConstants& constants, unsigned int lod,
+                   const MeshletView* view) const
 {
 	// Skinning needs all matrices available in the shader at the same time, so first calculate all the absolute
 	// matrices before rendering anything
@@ -413,6 +837,9 @@ void CMesh::Render(std::vector<CMatrix4x4>& modelMatrices)
 		absoluteMatrices[nodeIndex] = modelMatrices[nodeIndex] * absoluteMatrices[mNodes[nodeIndex].parentIndex];
 	}
 
+	constants.instanceOffset = 0;
+	SetDecodeConstants(constants);
+
 	if (mHasBones) // Render a mesh that uses skinning
 	{
 		// Advanced point: the above loop will get the absolute world matrices **of the bones**. However, they are
@@ -421,30 +848,22 @@ void CMesh::Render(std::vector<CMatrix4x4>& modelMatrices)
 		// skinned mesh is. We need to apply that offset to each of the bone matrices calculated in the last loop to make
 		// the bone influences work on the skinned mesh.
 		// These offset matrices are fixed for the model and have been calculated when the mesh was imported
+		PerModelBones bones;
 		for (unsigned int nodeIndex = 0; nodeIndex < mNodes.size(); ++nodeIndex)
 		{
-			absoluteMatrices[nodeIndex] = mNodes[nodeIndex].offsetMatrix * absoluteMatrices[nodeIndex];
+			bones.boneMatrices[nodeIndex] = mNodes[nodeIndex].offsetMatrix * absoluteMatrices[nodeIndex];
 		}
 
 		// Send all matrices over to the GPU for skinning via a constant buffer - each matrix can represent a bone which influences nearby vertices
-		// MISSING - code to fill the gPerModelConstants.boneMatrices array with the contents of the absoluteMatrices vector
-		for (unsigned int nodeIndex = 0; nodeIndex < mNodes.size(); ++nodeIndex)
-		{
-			gPerModelConstants.boneMatrices[nodeIndex] = absoluteMatrices[nodeIndex];
-		}
-
-		UpdateModelConstantBuffer(gPerModelConstantBuffer, gPerModelConstants); // Send to GPU
-
-		// Indicate that the constant buffer we just updated is for use in the vertex shader (VS), geometry shader (GS) and pixel shader (PS)
-		gD3DContext->VSSetConstantBuffers(0, 1, &gPerModelConstantBuffer); // First parameter must match constant buffer number in the shader
-		gD3DContext->GSSetConstantBuffers(0, 1, &gPerModelConstantBuffer); // First parameter must match constant buffer number in the shader
-		gD3DContext->PSSetConstantBuffers(0, 1, &gPerModelConstantBuffer);
+		// Only the matrices for this mesh's nodes are sent
+		list.UpdateConstants(gPerModelConstantBuffer, 0, &constants, sizeof(PerModelConstants)); // Second parameter must match constant buffer number in the shader
+		list.UpdateConstants(gPerModelBonesBuffer, 5, &bones, static_cast<unsigned int>(sizeof(CMatrix4x4) * mNodes.size()));
 
 		// Already sent over all the absolute matrices for the entire mesh so we can render sub-meshes directly
 		// rather than iterating through the nodes. 
 		for (auto& subMesh : mSubMeshes)
 		{
-			RenderSubMesh(subMesh);
+			RecordSubMesh(list, subMesh, lod);
 		}
 	}
 	else
@@ -454,19 +873,145 @@ void CMesh::Render(std::vector<CMatrix4x4>& modelMatrices)
 		// Iterate through each node
 		for (unsigned int nodeIndex = 0; nodeIndex < mNodes.size(); ++nodeIndex)
 		{
+			// Nodes without geometry need no constants
+			if (mNodes[nodeIndex].subMeshes.empty()) continue;
+
 			// Send this node's matrix to the GPU via a constant buffer
-			gPerModelConstants.worldMatrix = absoluteMatrices[nodeIndex];
-			UpdateModelConstantBuffer(gPerModelConstantBuffer, gPerModelConstants); // Send to GPU
+			constants.worldMatrix = absoluteMatrices[nodeIndex];
+			list.UpdateConstants(gPerModelConstantBuffer, 0, &constants, sizeof(PerModelConstants));
 
-			// Indicate that the constant buffer we just updated is for use in the vertex shader (VS) and pixel shader (PS)
-			gD3DContext->VSSetConstantBuffers(0, 1, &gPerModelConstantBuffer); // First parameter must match constant buffer number in the shader
-			gD3DContext->GSSetConstantBuffers(0, 1, &gPerModelConstantBuffer);
-			gD3DContext->PSSetConstantBuffers(0, 1, &gPerModelConstantBuffer);
+			// Meshlets are culled in the node's space, move the view there rather than moving all the meshlets
+			MeshletView nodeView;
+			if (view)  nodeView = TransformMeshletView(*view, absoluteMatrices[nodeIndex]);
 
 			// Render the sub-meshes attached to this node (no bones - rigid movement)
 			for (auto& subMeshIndex : mNodes[nodeIndex].subMeshes)
 			{
-				RenderSubMesh(mSubMeshes[subMeshIndex]);
+				RecordSubMesh(list, mSubMeshes[subMeshIndex], lod, view ? &nodeView : nullptr);
+			}
+		}
+	}
+}
+
+
+// Record instanced draws of the mesh, one per sub-mesh for all the copies
+void CMesh::RecordInstanced(CCommandList& list, const std::vector<const std::vector<CMatrix4x4>*>& instanceMatrices,
+                            PerModelConstants& constants, unsigned int lod) const
+{
+	const auto numInstances = static_cast<unsigned int>(instanceMatrices.size());
+	if (numInstances == 0) return;
+
+	// Absolute matrices of every copy, grouped by node so each node's matrices are consecutive in the instance data
+	std::vector<CMatrix4x4> absoluteMatrices(mNodes.size() * numInstances);
+	for (unsigned int instance = 0; instance < numInstances; ++instance)
+	{
+		const auto& modelMatrices = *instanceMatrices[instance];
+		absoluteMatrices[instance] = modelMatrices[0];
+		for (unsigned int nodeIndex = 1; nodeIndex < mNodes.size(); ++nodeIndex)
+		{
+			absoluteMatrices[nodeIndex * numInstances + instance] =
+				modelMatrices[nodeIndex] * absoluteMatrices[mNodes[nodeIndex].parentIndex * numInstances + instance];
+		}
+	}
+
+	// The instanced vertex shaders read the world matrix from the instance data, the one in the constants is left as
+	// the identity for the pixel shaders that transform normals with it
+	constants.worldMatrix = MatrixIdentity();
+	SetDecodeConstants(constants);
+
+	for (unsigned int nodeIndex = 0; nodeIndex < mNodes.size(); ++nodeIndex)
+	{
+		if (mNodes[nodeIndex].subMeshes.empty()) continue;
+
+		constants.instanceOffset = list.AddInstanceMatrices(&absoluteMatrices[nodeIndex * numInstances], numInstances);
+		list.UpdateConstants(gPerModelConstantBuffer, 0, &constants, sizeof(PerModelConstants));
+
+		for (auto& subMeshIndex : mNodes[nodeIndex].subMeshes)
+		{
+			const auto& subMesh = mSubMeshes[subMeshIndex];
+			const auto& indices = GetLodIndices(subMesh, lod);
+			if (indices.numIndices == 0) continue;
+
+			list.SetVertexBuffer(subMesh.vertices.buffer, subMesh.vertices.layout, subMesh.vertexSize);
+			list.SetIndexBuffer(indices.buffer, indices.indexSize);
+			list.DrawIndexedInstanced(indices.numIndices, numInstances, indices.startIndex, static_cast<int>(subMesh.vertices.baseVertex));
+		}
+	}
+}
+
+
+// Find the closest triangle hit by a world space ray, given the model's matrices (as passed to Record)
+bool CMesh::RayCast(const CRay& ray, const std::vector<CMatrix4x4>& modelMatrices, float maxDistance, RayHit& hit) const
+{
+	// Same absolute matrices as used for rendering
+	std::vector<CMatrix4x4> absoluteMatrices(mNodes.size());
+	absoluteMatrices[0] = modelMatrices[0];
+	for (unsigned int nodeIndex = 1; nodeIndex < mNodes.size(); ++nodeIndex)
+	{
+		absoluteMatrices[nodeIndex] = modelMatrices[nodeIndex] * absoluteMatrices[mNodes[nodeIndex].parentIndex];
+	}
+
+	auto found = false;
+	for (unsigned int nodeIndex = 0; nodeIndex < mNodes.size(); ++nodeIndex)
+	{
+		if (mNodes[nodeIndex].subMeshes.empty()) continue;
+
+		// Moving the ray into node space with an affine matrix keeps distances along it the same, so hits
+		// from different nodes can be compared directly
+		const auto invMatrix = InverseAffine(absoluteMatrices[nodeIndex]);
+		const auto localRay = ray.Transform(invMatrix);
+
+		for (auto subMeshIndex : mNodes[nodeIndex].subMeshes)
+		{
+			const auto& subMesh = mSubMeshes[subMeshIndex];
+
+			float tEnter;
+			if (!localRay.Intersects(subMesh.bounds, 0.0f, maxDistance, tEnter)) continue;
+
+			CMeshBVH::Hit triangleHit;
+			if (!subMesh.collision.RayCast(localRay, maxDistance, triangleHit)) continue;
+
+			// Normals transform by the inverse transpose of the matrix, which copes with non-uniform scaling
+			const auto n = subMesh.collision.TriangleNormal(triangleHit.triangle);
+			const CVector3 worldNormal = { invMatrix.e00 * n.x + invMatrix.e01 * n.y + invMatrix.e02 * n.z,
+			                               invMatrix.e10 * n.x + invMatrix.e11 * n.y + invMatrix.e12 * n.z,
+			                               invMatrix.e20 * n.x + invMatrix.e21 * n.y + invMatrix.e22 * n.z };
+
+			maxDistance = triangleHit.distance;
+			hit = { triangleHit.distance, subMeshIndex, triangleHit.triangle, Normalise(worldNormal) };
+			found = true;
+		}
+	}
+
+	return found;
+}
+
+void CMesh::GetTriangles(const std::vector<CMatrix4x4>& modelMatrices, std::vector<CVector3>& positions, std::vector<uint32_t>& indices) const
+{
+	std::vector<CMatrix4x4> absoluteMatrices(mNodes.size());
+	absoluteMatrices[0] = modelMatrices[0];
+	for (unsigned int nodeIndex = 1; nodeIndex < mNodes.size(); ++nodeIndex)
+	{
+		absoluteMatrices[nodeIndex] = modelMatrices[nodeIndex] * absoluteMatrices[mNodes[nodeIndex].parentIndex];
+	}
+
+	for (unsigned int nodeIndex = 0; nodeIndex < mNodes.size(); ++nodeIndex)
+	{
+		const auto& matrix = absoluteMatrices[nodeIndex];
+		for (auto subMeshIndex : mNodes[nodeIndex].subMeshes)
+		{
+			const auto& collision = mSubMeshes[subMeshIndex].collision;
+			const auto firstVertex = static_cast<uint32_t>(positions.size());
+
+			for (const auto& p : collision.Positions())
+			{
+				positions.push_back({ p.x * matrix.e00 + p.y * matrix.e10 + p.z * matrix.e20 + matrix.e30,
+				                      p.x * matrix.e01 + p.y * matrix.e11 + p.z * matrix.e21 + matrix.e31,
+				                      p.x * matrix.e02 + p.y * matrix.e12 + p.z * matrix.e22 + matrix.e32 });
+			}
+			for (auto index : collision.Indices())
+			{
+				indices.push_back(firstVertex + index);
 			}
 		}
 	}
@@ -515,3 +1060,80 @@ unsigned int CMesh::ReadNodes(aiNode* assimpNode, unsigned int nodeIndex, unsign
 
 	return nodeIndex;
 }
+
+
+// Resample the file's animations into clips for the node hierarchy
+void CMesh::ReadAnimations(const aiScene* scene, const std::string& fileName)
+{
+	std::vector<CMatrix4x4> restMatrices(mNodes.size());
+	for (unsigned int node = 0; node < mNodes.size(); ++node)  restMatrices[node] = mNodes[node].defaultMatrix;
+
+	for (unsigned int a = 0; a < scene->mNumAnimations; ++a)
+	{
+		const auto assimpAnimation = scene->mAnimations[a];
+
+		// Assimp times are in ticks, files that don't give a rate are usually 25 ticks per second
+		const auto ticksPerSecond = assimpAnimation->mTicksPerSecond > 0.0 ? static_cast<float>(assimpAnimation->mTicksPerSecond) : 25.0f;
+
+		// Keys for each node, the nodes without a channel stay at their default matrix
+		std::vector<AnimationKeys> keys(mNodes.size());
+		for (unsigned int c = 0; c < assimpAnimation->mNumChannels; ++c)
+		{
+			const auto channel = assimpAnimation->mChannels[c];
+			const std::string nodeName = channel->mNodeName.C_Str();
+			const auto node = std::find_if(mNodes.begin(), mNodes.end(), [&](const Node& n) { return n.name == nodeName; });
+			if (node == mNodes.end()) continue;
+
+			auto& nodeKeys = keys[node - mNodes.begin()];
+			for (unsigned int k = 0; k < channel->mNumPositionKeys; ++k)
+			{
+				const auto& key = channel->mPositionKeys[k];
+				nodeKeys.positions.push_back({ static_cast<float>(key.mTime) / ticksPerSecond, { key.mValue.x, key.mValue.y, key.mValue.z } });
+			}
+			for (unsigned int k = 0; k < channel->mNumRotationKeys; ++k)
+			{
+				const auto& key = channel->mRotationKeys[k];
+				nodeKeys.rotations.push_back({ static_cast<float>(key.mTime) / ticksPerSecond, { key.mValue.x, key.mValue.y, key.mValue.z, key.mValue.w } });
+			}
+			for (unsigned int k = 0; k < channel->mNumScalingKeys; ++k)
+			{
+				const auto& key = channel->mScalingKeys[k];
+				nodeKeys.scales.push_back({ static_cast<float>(key.mTime) / ticksPerSecond, { key.mValue.x, key.mValue.y, key.mValue.z } });
+			}
+		}
+
+		std::string name = assimpAnimation->mName.C_Str();
+		if (name.empty())  name = "Animation " + std::to_string(a);
+		const auto duration = static_cast<float>(assimpAnimation->mDuration) / ticksPerSecond;
+		auto clip = std::make_shared<CAnimationClip>(name, duration, restMatrices, keys);
+
+		if (gCompressAnimations)
+		{
+			clip->Compress();
+
+			// Long animations (e.g. cut scenes) are saved to the cache folder and played from there
+			if (duration > gStreamAnimationTime)
+			{
+				const auto cacheFolder = std::filesystem::temp_directory_path() / "AnimationCache";
+				std::filesystem::create_directories(cacheFolder);
+				// Named by a hash of the full path as well, so meshes with the same name in different folders don't share a file
+				const auto fullPath = std::filesystem::absolute(fileName).lexically_normal().string();
+				const auto cacheFile = (cacheFolder / (std::filesystem::path(fileName).stem().string() + "_" + std::to_string(HashString(fullPath)) +
+				                                       "_" + std::to_string(a) + ".anim")).string();
+				clip->Save(cacheFile);
+				clip = CAnimationClip::Load(cacheFile, true);
+			}
+		}
+		mAnimations.push_back(std::move(clip));
+	}
+}
+
+
+std::shared_ptr<const CAnimationClip> CMesh::FindAnimation(const std::string& name) const
+{
+	for (const auto& animation : mAnimations)
+	{
+		if (animation->Name() == name)  return animation;
+	}
+	return nullptr;
+}
@@ -8,15 +8,37 @@
 #pragma once
 
 #include "CMatrix4x4.h"
+#include "BoundingVolumes.h"
+#include "MeshBVH.h"
+#include "MeshOptimiser.h"
+#include "Meshlets.h"
+#include "Animation.h"
+#include "GeometryAllocator.h"
+#include "CommandList.h"
 #define NOMINMAX // Use this to stop Windows headers defining "min" and "max", which breaks some libraries (e.g. assimp)
 #include <d3d11.h>
 #include <assimp/scene.h>
+#include <memory>
 #include <string>
 #include <vector>
 
 #ifndef _MESH_H_INCLUDED_
 #define _MESH_H_INCLUDED_
 
+struct PerModelConstants;
+
+// Store meshes loaded from now on with compact vertex formats and 16-bit indices where possible (see VertexCompression.h).
+// On by default, turn off before loading to compare memory use or quality
+extern bool gCompressMeshes;
+
+// Compress the animations of meshes loaded from now on (see Animation.h). Those longer than gStreamAnimationTime
+// seconds are written to a cache file and streamed from it rather than kept in memory
+extern bool  gCompressAnimations;
+extern float gStreamAnimationTime;
+
+// Cull the meshlets of meshes drawn with a view (see Meshlets.h), drawing only the triangles that may be visible
+extern bool gMeshletCulling;
+
 class CMesh
 {
 //--------------------------------------------------------------------------------------
@@ -25,18 +47,37 @@ class CMesh
 private:
 
 	// A mesh is made of multiple sub-meshes. Each one uses a single material (texture).
-	// Each sub-mesh has a vertex / index buffer on the GPU. Could share buffers for performance but that would be complex.
+	// Each sub-mesh has a range of vertices and indices in buffers on the GPU shared with all other meshes (see GeometryAllocator.h)
 	struct SubMesh
 	{
 		unsigned int       vertexSize = 0;         // Size in bytes of a single vertex (depends on what it contains, uvs, tangents etc.)
-		ID3D11InputLayout* vertexLayout = nullptr; // DirectX specification of data held in a single vertex
 
-		// GPU-side vertex and index buffers
+		// GPU-side vertices and indices, with the input layout of the vertices
 		unsigned int       numVertices = 0;
-		ID3D11Buffer*      vertexBuffer = nullptr;
+		VertexAllocation   vertices;
 
 		unsigned int       numIndices = 0;
-		ID3D11Buffer*      indexBuffer  = nullptr;
+		unsigned int       indexSize = 4; // Bytes per index, 2 if the vertices are compressed and there are few enough
+		IndexAllocation    indices;
+
+		CAABB              bounds; // Bounding box of the vertices, in the space of the node that owns the sub-mesh
+
+		CMeshBVH           collision; // CPU-side copy of the triangles for ray casts, in the same space as bounds
+
+		std::vector<Meshlet> meshlets; // Clusters of the triangles for culling, in the same space as bounds
+
+		// Indices and meshlets of the generated levels of detail (level 1 onwards), using the same vertices
+		struct Lod
+		{
+			unsigned int         numIndices = 0;
+			IndexAllocation      indices;
+			std::vector<Meshlet> meshlets;
+		};
+		std::vector<Lod>   lods;
+
+		// Vertex cache behaviour of the triangles as imported and after reordering (see MeshOptimiser.h)
+		VertexCacheStats   importedCacheStats = {};
+		VertexCacheStats   optimisedCacheStats = {};
 	};
 
 
@@ -67,8 +108,9 @@ public:
 	
 	// Pass the name of the mesh file to load. Uses assimp (http://www.assimp.org/) to support many file types
     // Optionally request tangents to be calculated (for normal and parallax mapping - see later lab)
+    // Optionally generate levels of detail with fewer triangles (see MeshSimplifier.h), not for skinned meshes
     // Will throw a std::runtime_error exception on failure (since constructors can't return errors).
-    CMesh(const std::string& fileName, bool requireTangents = false);
+    CMesh(const std::string& fileName, bool requireTangents = false, bool generateLods = false);
     ~CMesh();
 
 
@@ -79,11 +121,78 @@ public:
     // The default matrix for a given node - used to set the initial position for a new model
     CMatrix4x4 GetNodeDefaultMatrix(unsigned int node) { return mNodes[node].defaultMatrix; }
 
+	// Animations in the mesh file, resampled for playback by a CAnimator (see Animation.h). Clips are shared by every
+	// model using the mesh
+	unsigned int NumAnimations() const { return static_cast<unsigned int>(mAnimations.size()); }
+	const std::shared_ptr<const CAnimationClip>& GetAnimation(unsigned int animation) const { return mAnimations[animation]; }
+
+	// Animation with the given name, nullptr if there isn't one
+	std::shared_ptr<const CAnimationClip> FindAnimation(const std::string& name) const;
+
+	// Bounding box of the whole mesh in its default pose, relative to the root node (i.e. in model space)
+	const CAABB& BoundingBox() const { return mBoundingBox; }
+
+	// Levels of detail, 1 unless generated by the constructor. Level 0 is the full mesh
+	unsigned int NumLods() const { return mNumLods; }
+
+	// Fractions of the full mesh's triangles aimed for by the generated levels
+	static const unsigned int MaxGeneratedLods = 4;
+	static const float GeneratedLodRatios[MaxGeneratedLods];
+
+	// Vertex cache behaviour of the whole mesh as imported, or after the triangles and vertices were reordered
+	VertexCacheStats CacheStats(bool optimised) const;
+
+	// Whether the vertices are stored in the compact formats (see gCompressMeshes), and the GPU memory used by the
+	// vertex and index buffers
+	bool   IsCompressed() const { return mCompressed; }
+	size_t GpuBytes() const;
+
+
+	// Result of a ray cast against the mesh triangles
+	struct RayHit
+	{
+		float        distance; // Along the ray, in units of the ray direction
+		unsigned int subMesh;
+		unsigned int triangle;
+		CVector3     normal;   // World space face normal (normalised)
+	};
+
+	// Find the closest triangle hit by a world space ray in the range [0, maxDistance], given the model's
+	// matrices (as passed to Record). The ray is moved into each node's space rather than transforming vertices.
+	// Skinned meshes are tested in their bind pose
+	bool RayCast(const CRay& ray, const std::vector<CMatrix4x4>& modelMatrices, float maxDistance, RayHit& hit) const;
+
+	// Append the mesh triangles in world space given the model's matrices (as passed to Record), as a triangle list
+	// indexing into positions. Taken from the CPU-side copy kept for ray casts, skinned meshes are in their bind pose
+	void GetTriangles(const std::vector<CMatrix4x4>& modelMatrices, std::vector<CVector3>& positions, std::vector<uint32_t>& indices) const;
+
 
-	// Render the mesh with the given matrices
-	// Handles rigid body meshes (including single part meshes) as well as skinned meshes
+	// Record the commands to draw the mesh with the given matrices into a command list
+	// Handles rigid body meshes (including single part meshes) as well as skinned meshes. constants holds the other
+	// per-model values (colour etc.), the matrices are filled in here. Safe to call for several lists at once
+	// Given a world space view, only the meshlets that may be visible from it are drawn (not for skinned meshes,
+	// whose meshlets move with the bones)
 	// LIMITATION: The mesh must use a single texture throughout
-	void Render(std::vector<CMatrix4x4>& modelMatrices);
+	void Record(CCommandList& list, const std::vector<CMatrix4x4>& modelMatrices, PerModelConstants& constants, unsigned int lod = 0,
+	            const MeshletView* view = nullptr) const;
+
+	// Rigid meshes can be drawn instanced, skinned meshes need their bone matrices in the constants
+	bool CanInstance() const { return !mHasBones; }
+
+	// Record instanced draws of several copies of the mesh, each with its own model matrices (as passed to Record).
+	// One draw per sub-mesh covers every copy. The world matrices go in the list's instance data
+	void RecordInstanced(CCommandList& list, const std::vector<const std::vector<CMatrix4x4>*>& instanceMatrices,
+	                     PerModelConstants& constants, unsigned int lod = 0) const;
+
+	// Triangles of meshes recorded with a view, and how many of them were in meshlets that passed culling. Counted
+	// from all threads since the last reset
+	struct MeshletStats
+	{
+		unsigned int trianglesTested;
+		unsigned int trianglesDrawn;
+	};
+	static MeshletStats GetMeshletStats();
+	static void ResetMeshletStats();
 
 
 
@@ -98,8 +207,19 @@ private:
 	// Help build the arrays of submeshes and nodes from the assimp data - recursive
 	unsigned int ReadNodes(aiNode* assimpNode, unsigned int nodeIndex, unsigned int parentIndex);
 
-	// Helper function for Render function - renders a given sub-mesh. World matrices / textures / states etc. must already be set
-	void RenderSubMesh(const SubMesh& subMesh);
+	// Convert the file's animations into clips for the node hierarchy, which must already be read
+	void ReadAnimations(const aiScene* scene, const std::string& fileName);
+
+	// Helper function for Record function - draws a given sub-mesh. World matrices / textures / states etc. must already be recorded
+	// If a view is given (in the space of the sub-mesh) only its visible meshlets are drawn
+	void RecordSubMesh(CCommandList& list, const SubMesh& subMesh, unsigned int lod, const MeshletView* view = nullptr) const;
+
+	// Indices and meshlets of a sub-mesh at a level of detail
+	const IndexAllocation& GetLodIndices(const SubMesh& subMesh, unsigned int lod) const;
+	const std::vector<Meshlet>& GetLodMeshlets(const SubMesh& subMesh, unsigned int lod) const;
+
+	// Fill in the constants the vertex shaders use to decode compressed vertices
+	void SetDecodeConstants(PerModelConstants& constants) const;
 
 
 
@@ -111,6 +231,17 @@ private:
     std::vector<SubMesh> mSubMeshes; // The mesh geometry. Nodes refer to sub-meshes in this vector
     std::vector<Node>    mNodes;     // The mesh hierarchy. First entry is root. remainder aree stored in depth-first order
 
+	std::vector<std::shared_ptr<const CAnimationClip>> mAnimations;
+
+	CAABB mBoundingBox; // Model space bounds of all sub-meshes in the default pose
+
+	unsigned int mNumLods;
+
+	// Compressed vertices store positions across a box, decoded as position * scale + offset
+	bool     mCompressed;
+	CVector3 mPositionScale;
+	CVector3 mPositionOffset;
+
 	bool mHasBones; // If any submesh has bones, then all submeshes are given bones - makes rendering easier (one shader for the whole mesh)
 };
 
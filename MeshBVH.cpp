@@ -0,0 +1,273 @@
+//--------------------------------------------------------------------------------------
+// Bounding volume hierarchy over the triangles of a mesh, for exact ray queries
+//--------------------------------------------------------------------------------------
+
+#include "MeshBVH.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <utility>
+
+
+namespace
+{
+	const uint32_t MaxLeafTriangles = 4;
+	const int      NumBins = 12;
+
+	float Axis(const CVector3& v, int axis)
+	{
+		return axis == 0 ? v.x : (axis == 1 ? v.y : v.z);
+	}
+}
+
+
+/*-----------------------------------------------------------------------------------------
+    Construction
+-----------------------------------------------------------------------------------------*/
+
+void CMeshBVH::Build(std::vector<CVector3> positions, std::vector<uint32_t> indices)
+{
+	mPositions = std::move(positions);
+	mIndices = std::move(indices);
+	mNodes.clear();
+	mTriangles.clear();
+	mMaxDepth = 0;
+
+	const auto numTriangles = NumTriangles();
+	if (numTriangles == 0) return;
+
+	std::vector<CAABB>    triBounds(numTriangles);
+	std::vector<CVector3> centroids(numTriangles);
+	mTriangles.resize(numTriangles);
+	for (uint32_t t = 0; t < numTriangles; ++t)
+	{
+		auto& box = triBounds[t];
+		box = CAABB::Empty();
+		box.Encapsulate(mPositions[mIndices[t * 3 + 0]]);
+		box.Encapsulate(mPositions[mIndices[t * 3 + 1]]);
+		box.Encapsulate(mPositions[mIndices[t * 3 + 2]]);
+		centroids[t] = box.Centre();
+		mTriangles[t] = t;
+	}
+
+	// A binary tree with leaves of at least one triangle has fewer than 2n nodes
+	mNodes.reserve(numTriangles * 2);
+	mNodes.push_back({ CAABB::Empty(), 0, numTriangles });
+
+	// Split nodes from a list rather than recursively. The surface area heuristic can peel a few triangles off at each
+	// level of unevenly spaced geometry, so the depth can grow with the number of triangles
+	std::vector<std::pair<uint32_t, uint32_t>> toSplit = { { 0, 0 } }; // Node and its depth
+	while (!toSplit.empty())
+	{
+		const auto node = toSplit.back();
+		toSplit.pop_back();
+		mMaxDepth = std::max(mMaxDepth, node.second);
+		if (Subdivide(node.first, triBounds, centroids))
+		{
+			const auto leftChild = mNodes[node.first].first;
+			toSplit.push_back({ leftChild + 1, node.second + 1 });
+			toSplit.push_back({ leftChild, node.second + 1 });
+		}
+	}
+}
+
+bool CMeshBVH::Subdivide(uint32_t nodeIndex, const std::vector<CAABB>& triBounds, const std::vector<CVector3>& centroids)
+{
+	const auto first = mNodes[nodeIndex].first;
+	const auto count = mNodes[nodeIndex].count;
+
+	auto box = CAABB::Empty();
+	auto centroidBox = CAABB::Empty();
+	for (auto i = first; i < first + count; ++i)
+	{
+		box.Encapsulate(triBounds[mTriangles[i]]);
+		centroidBox.Encapsulate(centroids[mTriangles[i]]);
+	}
+	mNodes[nodeIndex].box = box;
+
+	if (count <= MaxLeafTriangles) return false;
+
+	// Find the best split plane by binning triangle centroids along each axis
+	auto bestCost = FLT_MAX;
+	auto bestAxis = -1;
+	auto bestSplit = 0;
+
+	for (int axis = 0; axis < 3; ++axis)
+	{
+		const auto axisMin = Axis(centroidBox.min, axis);
+		const auto axisExtent = Axis(centroidBox.max, axis) - axisMin;
+		if (axisExtent <= 0.0f) continue;
+
+		CAABB    binBounds[NumBins];
+		uint32_t binCounts[NumBins] = {};
+		for (auto& b : binBounds) b = CAABB::Empty();
+
+		const auto scale = NumBins / axisExtent;
+		for (auto i = first; i < first + count; ++i)
+		{
+			const auto t = mTriangles[i];
+			const auto bin = std::min(NumBins - 1, static_cast<int>((Axis(centroids[t], axis) - axisMin) * scale));
+			binBounds[bin].Encapsulate(triBounds[t]);
+			++binCounts[bin];
+		}
+
+		// Sweep from the right to get the area / count of everything right of each split, then from the left
+		float    rightArea[NumBins];
+		uint32_t rightCount[NumBins];
+		auto accumulated = CAABB::Empty();
+		uint32_t accumulatedCount = 0;
+		for (int bin = NumBins - 1; bin > 0; --bin)
+		{
+			accumulated.Encapsulate(binBounds[bin]);
+			accumulatedCount += binCounts[bin];
+			rightArea[bin] = accumulatedCount ? accumulated.SurfaceArea() : 0.0f;
+			rightCount[bin] = accumulatedCount;
+		}
+
+		accumulated = CAABB::Empty();
+		accumulatedCount = 0;
+		for (int split = 1; split < NumBins; ++split)
+		{
+			accumulated.Encapsulate(binBounds[split - 1]);
+			accumulatedCount += binCounts[split - 1];
+			if (accumulatedCount == 0 || rightCount[split] == 0) continue;
+
+			const auto cost = accumulated.SurfaceArea() * accumulatedCount + rightArea[split] * rightCount[split];
+			if (cost < bestCost)
+			{
+				bestCost = cost;
+				bestAxis = axis;
+				bestSplit = split;
+			}
+		}
+	}
+
+	auto begin = mTriangles.begin() + first;
+	auto end = begin + count;
+	decltype(begin) middle;
+
+	if (bestAxis >= 0)
+	{
+		// Stop if splitting is no better than testing every triangle in one leaf
+		if (bestCost >= box.SurfaceArea() * count && count <= MaxLeafTriangles * 4) return false;
+
+		const auto axisMin = Axis(centroidBox.min, bestAxis);
+		const auto scale = NumBins / (Axis(centroidBox.max, bestAxis) - axisMin);
+		middle = std::partition(begin, end, [&](uint32_t t)
+		{
+			return std::min(NumBins - 1, static_cast<int>((Axis(centroids[t], bestAxis) - axisMin) * scale)) < bestSplit;
+		});
+	}
+	else
+	{
+		// All centroids at the same point (e.g. many copies of one triangle) - just split the list in half
+		middle = begin + count / 2;
+	}
+
+	const auto leftCount = static_cast<uint32_t>(middle - begin);
+
+	const auto leftChild = static_cast<uint32_t>(mNodes.size());
+	mNodes.push_back({ CAABB::Empty(), first, leftCount });
+	mNodes.push_back({ CAABB::Empty(), first + leftCount, count - leftCount });
+	mNodes[nodeIndex].first = leftChild;
+	mNodes[nodeIndex].count = 0;
+	return true;
+}
+
+
+/*-----------------------------------------------------------------------------------------
+    Queries
+-----------------------------------------------------------------------------------------*/
+
+CVector3 CMeshBVH::TriangleNormal(unsigned int triangle) const
+{
+	const auto& p0 = mPositions[mIndices[triangle * 3 + 0]];
+	const auto& p1 = mPositions[mIndices[triangle * 3 + 1]];
+	const auto& p2 = mPositions[mIndices[triangle * 3 + 2]];
+	return Cross(p1 - p0, p2 - p0);
+}
+
+// Moller-Trumbore ray / triangle intersection
+bool CMeshBVH::IntersectTriangle(const CRay& ray, unsigned int triangle, float maxT, Hit& hit) const
+{
+	const auto& p0 = mPositions[mIndices[triangle * 3 + 0]];
+	const auto& p1 = mPositions[mIndices[triangle * 3 + 1]];
+	const auto& p2 = mPositions[mIndices[triangle * 3 + 2]];
+
+	const auto edge1 = p1 - p0;
+	const auto edge2 = p2 - p0;
+	const auto p = Cross(ray.direction, edge2);
+	const auto det = Dot(edge1, p);
+	if (std::abs(det) < 1e-12f) return false; // Ray parallel to triangle
+
+	const auto invDet = 1.0f / det;
+	const auto s = ray.origin - p0;
+	const auto u = Dot(s, p) * invDet;
+	if (u < 0.0f || u > 1.0f) return false;
+
+	const auto q = Cross(s, edge1);
+	const auto v = Dot(ray.direction, q) * invDet;
+	if (v < 0.0f || u + v > 1.0f) return false;
+
+	const auto t = Dot(edge2, q) * invDet;
+	if (t < 0.0f || t > maxT) return false;
+
+	hit = { t, triangle, u, v };
+	return true;
+}
+
+bool CMeshBVH::RayCast(const CRay& ray, float maxT, Hit& hit) const
+{
+	if (mNodes.empty()) return false;
+
+	auto found = false;
+
+	// Each node popped leaves at most one node waiting for each level above it, so the stack never holds more than
+	// the depth + 2 nodes. Only unusually deep trees need more than the local array
+	uint32_t localStack[64];
+	std::vector<uint32_t> deepStack;
+	auto stack = localStack;
+	if (mMaxDepth + 2 > 64)
+	{
+		deepStack.resize(mMaxDepth + 2);
+		stack = deepStack.data();
+	}
+	int stackSize = 0;
+
+	float tEnter;
+	if (!ray.Intersects(mNodes[0].box, 0.0f, maxT, tEnter)) return false;
+	stack[stackSize++] = 0;
+
+	while (stackSize > 0)
+	{
+		const auto& node = mNodes[stack[--stackSize]];
+
+		if (node.count > 0)
+		{
+			for (auto i = node.first; i < node.first + node.count; ++i)
+			{
+				if (IntersectTriangle(ray, mTriangles[i], maxT, hit))
+				{
+					maxT = hit.distance;
+					found = true;
+				}
+			}
+			continue;
+		}
+
+		// Push the further child first so the nearer one is processed next and clips the ray early
+		float t1, t2;
+		const auto hit1 = ray.Intersects(mNodes[node.first].box, 0.0f, maxT, t1);
+		const auto hit2 = ray.Intersects(mNodes[node.first + 1].box, 0.0f, maxT, t2);
+		if (hit1 && hit2)
+		{
+			if (t1 < t2) { stack[stackSize++] = node.first + 1; stack[stackSize++] = node.first; }
+			else         { stack[stackSize++] = node.first;     stack[stackSize++] = node.first + 1; }
+		}
+		else if (hit1) stack[stackSize++] = node.first;
+		else if (hit2) stack[stackSize++] = node.first + 1;
+	}
+
+	return found;
+}
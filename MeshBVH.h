@@ -0,0 +1,79 @@
+//--------------------------------------------------------------------------------------
+// Bounding volume hierarchy over the triangles of a mesh, for exact ray queries
+//--------------------------------------------------------------------------------------
+// Holds a CPU-side copy of a sub-mesh's positions and indices (the GPU buffers can't be read back
+// cheaply) and a flattened BVH built with the binned surface area heuristic. Used for picking and
+// gameplay ray casts once the scene's broadphase has found which objects a ray might hit.
+
+#pragma once
+
+#include "BoundingVolumes.h"
+
+#include <cstdint>
+#include <vector>
+
+
+class CMeshBVH
+{
+public:
+	// Result of a ray cast. Barycentric coordinates u, v are for the 2nd and 3rd vertex of the triangle
+	struct Hit
+	{
+		float        distance;
+		unsigned int triangle;
+		float        u, v;
+	};
+
+	//-------------------------------------
+	// Construction / Usage
+	//-------------------------------------
+
+	// Take a copy of the geometry and build the hierarchy. Indices are a triangle list
+	void Build(std::vector<CVector3> positions, std::vector<uint32_t> indices);
+
+	// Find the closest triangle hit by the ray in the range [0, maxT]. Triangles are two-sided.
+	// The ray is in the same space as the positions, its direction need not be normalised (distance is in units of it)
+	bool RayCast(const CRay& ray, float maxT, Hit& hit) const;
+
+
+	//-------------------------------------
+	// Data access
+	//-------------------------------------
+
+	const std::vector<CVector3>& Positions() const { return mPositions; }
+	const std::vector<uint32_t>& Indices() const { return mIndices; }
+
+	unsigned int NumTriangles() const { return static_cast<unsigned int>(mIndices.size() / 3); }
+
+	// Face normal of a triangle (not normalised)
+	CVector3 TriangleNormal(unsigned int triangle) const;
+
+
+//-------------------------------------
+// Private members
+//-------------------------------------
+private:
+
+	// Interior nodes have count 0 and their children at first and first + 1. Leaves hold count triangles
+	// from mTriangles starting at first
+	struct Node
+	{
+		CAABB    box;
+		uint32_t first;
+		uint32_t count;
+	};
+
+	// Fit a node's box over mTriangles[first, first + count) and split it into two new child nodes, unless it is
+	// better as a leaf. Returns whether it was split
+	bool Subdivide(uint32_t nodeIndex, const std::vector<CAABB>& triBounds, const std::vector<CVector3>& centroids);
+
+	bool IntersectTriangle(const CRay& ray, unsigned int triangle, float maxT, Hit& hit) const;
+
+
+	std::vector<CVector3> mPositions;
+	std::vector<uint32_t> mIndices;
+
+	std::vector<Node>     mNodes;
+	std::vector<uint32_t> mTriangles; // Triangle numbers, reordered so each leaf's triangles are contiguous
+	uint32_t              mMaxDepth = 0; // Levels below the root, sizes the ray cast stack
+};
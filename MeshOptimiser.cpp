@@ -0,0 +1,311 @@
+//--------------------------------------------------------------------------------------
+// Mesh optimisation - triangle and vertex order for faster drawing
+//--------------------------------------------------------------------------------------
+
+#include "MeshOptimiser.h"
+
+#include <algorithm>
+#include <cstring>
+
+
+namespace
+{
+	// FIFO cache simulation with timestamps: a vertex is in the cache if it was added less than cacheSize additions ago
+	class CCacheSimulator
+	{
+	public:
+		CCacheSimulator(unsigned int numVertices, unsigned int cacheSize)
+			: mCacheSize(cacheSize), mTime(cacheSize + 1), mAdded(numVertices, 0) {}
+
+		// Returns the number of misses (0 - 3) for a triangle and adds its missed vertices
+		unsigned int Triangle(const uint32_t* triangle)
+		{
+			unsigned int misses = 0;
+			for (int corner = 0; corner < 3; ++corner)
+			{
+				auto& added = mAdded[triangle[corner]];
+				if (mTime - added > mCacheSize)
+				{
+					added = mTime++;
+					++misses;
+				}
+			}
+			return misses;
+		}
+
+		// Empty the cache
+		void Flush() { mTime += mCacheSize + 1; }
+
+	private:
+		unsigned int mCacheSize;
+		unsigned int mTime;
+		std::vector<unsigned int> mAdded;
+	};
+}
+
+
+/*-----------------------------------------------------------------------------------------
+    Analysis
+-----------------------------------------------------------------------------------------*/
+
+VertexCacheStats AnalyseVertexCache(const std::vector<uint32_t>& indices, unsigned int numVertices, unsigned int cacheSize)
+{
+	CCacheSimulator cache(numVertices, cacheSize);
+	std::vector<unsigned char> used(numVertices, 0);
+
+	unsigned int misses = 0;
+	unsigned int usedVertices = 0;
+	for (size_t i = 0; i + 2 < indices.size(); i += 3)
+	{
+		misses += cache.Triangle(&indices[i]);
+		for (int corner = 0; corner < 3; ++corner)
+		{
+			if (!used[indices[i + corner]])
+			{
+				used[indices[i + corner]] = 1;
+				++usedVertices;
+			}
+		}
+	}
+
+	const auto numTriangles = indices.size() / 3;
+	return { numTriangles ? static_cast<float>(misses) / numTriangles : 0.0f,
+	         usedVertices ? static_cast<float>(misses) / usedVertices : 0.0f };
+}
+
+
+/*-----------------------------------------------------------------------------------------
+    Vertex cache
+-----------------------------------------------------------------------------------------*/
+
+void OptimiseVertexCache(std::vector<uint32_t>& indices, unsigned int numVertices, unsigned int cacheSize)
+{
+	const auto numTriangles = static_cast<uint32_t>(indices.size() / 3);
+	if (numTriangles == 0) return;
+
+	// Triangles using each vertex, and how many of them are still to be output
+	std::vector<uint32_t> firstTriangle(numVertices + 1, 0);
+	for (uint32_t i = 0; i < numTriangles * 3; ++i) ++firstTriangle[indices[i] + 1];
+	for (uint32_t v = 0; v < numVertices; ++v) firstTriangle[v + 1] += firstTriangle[v];
+
+	std::vector<uint32_t> vertexTriangles(numTriangles * 3);
+	{
+		auto fill = firstTriangle;
+		for (uint32_t i = 0; i < numTriangles * 3; ++i) vertexTriangles[fill[indices[i]]++] = i / 3;
+	}
+
+	std::vector<uint32_t> live(numVertices);
+	for (uint32_t v = 0; v < numVertices; ++v) live[v] = firstTriangle[v + 1] - firstTriangle[v];
+
+	std::vector<unsigned int>  cacheTime(numVertices, 0);
+	std::vector<unsigned char> emitted(numTriangles, 0);
+	std::vector<uint32_t> deadEnds;   // Recently used vertices, to restart from when the fan runs out
+	std::vector<uint32_t> candidates;
+
+	std::vector<uint32_t> result;
+	result.reserve(numTriangles * 3);
+
+	unsigned int time = cacheSize + 1;
+	uint32_t nextVertex = 0; // Scan position for restarting when the dead ends are used up
+
+	// Start from the first vertex that is used
+	int fan = -1;
+	for (uint32_t v = 0; v < numVertices && fan < 0; ++v)
+	{
+		if (live[v] > 0) fan = static_cast<int>(v);
+	}
+
+	while (fan >= 0)
+	{
+		// Output every remaining triangle around the fanning vertex
+		candidates.clear();
+		for (auto t = firstTriangle[fan]; t < firstTriangle[fan + 1]; ++t)
+		{
+			const auto triangle = vertexTriangles[t];
+			if (emitted[triangle]) continue;
+			emitted[triangle] = 1;
+
+			for (int corner = 0; corner < 3; ++corner)
+			{
+				const auto v = indices[triangle * 3 + corner];
+				result.push_back(v);
+				deadEnds.push_back(v);
+				candidates.push_back(v);
+				--live[v];
+				if (time - cacheTime[v] > cacheSize) cacheTime[v] = time++;
+			}
+		}
+
+		// Next fan from a vertex still in the cache, preferring the oldest that will stay there after its own triangles
+		fan = -1;
+		int bestPriority = -1;
+		for (auto v : candidates)
+		{
+			if (live[v] == 0) continue;
+
+			int priority = 0;
+			if (time - cacheTime[v] + 2 * live[v] <= cacheSize) priority = static_cast<int>(time - cacheTime[v]);
+			if (priority > bestPriority)
+			{
+				bestPriority = priority;
+				fan = static_cast<int>(v);
+			}
+		}
+
+		if (fan < 0)
+		{
+			while (!deadEnds.empty() && fan < 0)
+			{
+				const auto v = deadEnds.back();
+				deadEnds.pop_back();
+				if (live[v] > 0) fan = static_cast<int>(v);
+			}
+			while (nextVertex < numVertices && fan < 0)
+			{
+				if (live[nextVertex] > 0) fan = static_cast<int>(nextVertex);
+				++nextVertex;
+			}
+		}
+	}
+
+	indices.swap(result);
+}
+
+
+/*-----------------------------------------------------------------------------------------
+    Overdraw
+-----------------------------------------------------------------------------------------*/
+
+void OptimiseOverdraw(std::vector<uint32_t>& indices, const std::vector<CVector3>& positions, float threshold, unsigned int cacheSize)
+{
+	const auto numTriangles = static_cast<uint32_t>(indices.size() / 3);
+	const auto numVertices = static_cast<unsigned int>(positions.size());
+	if (numTriangles < 2) return;
+
+	// Hard boundaries where the cache order restarts somewhere new (every vertex of the triangle missed)
+	std::vector<uint32_t> hardStarts;
+	std::vector<unsigned char> misses(numTriangles);
+	{
+		CCacheSimulator cache(numVertices, cacheSize);
+		for (uint32_t t = 0; t < numTriangles; ++t)
+		{
+			misses[t] = static_cast<unsigned char>(cache.Triangle(&indices[t * 3]));
+			if (t == 0 || misses[t] == 3) hardStarts.push_back(t);
+		}
+	}
+	hardStarts.push_back(numTriangles);
+
+	// Soft boundaries inside those, wherever the cluster so far is already within the threshold of the whole cluster's
+	// ACMR. Starting a cluster empties the cache, so each can be drawn in any order for about the same cost
+	std::vector<uint32_t> clusterStarts;
+	{
+		CCacheSimulator cache(numVertices, cacheSize);
+		for (size_t h = 0; h + 1 < hardStarts.size(); ++h)
+		{
+			const auto start = hardStarts[h];
+			const auto end = hardStarts[h + 1];
+
+			unsigned int hardMisses = 0;
+			for (auto t = start; t < end; ++t) hardMisses += misses[t];
+			const auto clusterThreshold = threshold * static_cast<float>(hardMisses) / static_cast<float>(end - start);
+
+			cache.Flush();
+			clusterStarts.push_back(start);
+			unsigned int runningMisses = 0;
+			unsigned int runningTriangles = 0;
+			for (auto t = start; t < end; ++t)
+			{
+				runningMisses += cache.Triangle(&indices[t * 3]);
+				++runningTriangles;
+
+				if (t + 1 < end && static_cast<float>(runningMisses) / runningTriangles <= clusterThreshold)
+				{
+					cache.Flush();
+					clusterStarts.push_back(t + 1);
+					runningMisses = 0;
+					runningTriangles = 0;
+				}
+			}
+		}
+	}
+	clusterStarts.push_back(numTriangles);
+	const auto numClusters = static_cast<uint32_t>(clusterStarts.size() - 1);
+
+	// Centre of the mesh, area weighted
+	CVector3 meshCentre = { 0, 0, 0 };
+	float meshArea = 0.0f;
+	for (uint32_t t = 0; t < numTriangles; ++t)
+	{
+		const auto& p0 = positions[indices[t * 3]];
+		const auto& p1 = positions[indices[t * 3 + 1]];
+		const auto& p2 = positions[indices[t * 3 + 2]];
+		const auto area = Length(Cross(p1 - p0, p2 - p0));
+		meshCentre = meshCentre + (p0 + p1 + p2) * (area / 3.0f);
+		meshArea += area;
+	}
+	if (meshArea > 0.0f) meshCentre = meshCentre * (1.0f / meshArea);
+
+	// Clusters facing away from the centre are on the outside of the mesh, and are drawn first
+	std::vector<std::pair<float, uint32_t>> order(numClusters);
+	for (uint32_t c = 0; c < numClusters; ++c)
+	{
+		CVector3 centre = { 0, 0, 0 };
+		CVector3 normal = { 0, 0, 0 };
+		float area = 0.0f;
+		for (auto t = clusterStarts[c]; t < clusterStarts[c + 1]; ++t)
+		{
+			const auto& p0 = positions[indices[t * 3]];
+			const auto& p1 = positions[indices[t * 3 + 1]];
+			const auto& p2 = positions[indices[t * 3 + 2]];
+			const auto n = Cross(p1 - p0, p2 - p0);
+			const auto triangleArea = Length(n);
+			centre = centre + (p0 + p1 + p2) * (triangleArea / 3.0f);
+			normal = normal + n;
+			area += triangleArea;
+		}
+		if (area > 0.0f) centre = centre * (1.0f / area);
+
+		const auto normalLength = Length(normal);
+		const auto facing = normalLength > 0.0f ? Dot(centre - meshCentre, normal) / normalLength : 0.0f;
+		order[c] = { -facing, c };
+	}
+	std::sort(order.begin(), order.end());
+
+	std::vector<uint32_t> result;
+	result.reserve(indices.size());
+	for (const auto& cluster : order)
+	{
+		result.insert(result.end(), indices.begin() + clusterStarts[cluster.second] * 3, indices.begin() + clusterStarts[cluster.second + 1] * 3);
+	}
+	indices.swap(result);
+}
+
+
+/*-----------------------------------------------------------------------------------------
+    Vertex fetch
+-----------------------------------------------------------------------------------------*/
+
+void OptimiseVertexFetch(std::vector<uint32_t>& indices, unsigned char* vertices, unsigned int numVertices, unsigned int vertexSize,
+                         std::vector<uint32_t>& remap)
+{
+	const auto unused = ~0u;
+	remap.assign(numVertices, unused);
+
+	uint32_t next = 0;
+	for (auto& index : indices)
+	{
+		if (remap[index] == unused) remap[index] = next++;
+		index = remap[index];
+	}
+	for (auto& newIndex : remap)
+	{
+		if (newIndex == unused) newIndex = next++;
+	}
+
+	std::vector<unsigned char> reordered(static_cast<size_t>(numVertices) * vertexSize);
+	for (uint32_t v = 0; v < numVertices; ++v)
+	{
+		std::memcpy(&reordered[static_cast<size_t>(remap[v]) * vertexSize], vertices + static_cast<size_t>(v) * vertexSize, vertexSize);
+	}
+	std::memcpy(vertices, reordered.data(), reordered.size());
+}
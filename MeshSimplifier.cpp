@@ -0,0 +1,426 @@
+//--------------------------------------------------------------------------------------
+// Mesh simplification - fewer triangles with the same look, for generated levels of detail
+//--------------------------------------------------------------------------------------
+
+#include "MeshSimplifier.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <unordered_map>
+
+
+namespace
+{
+	// Border edges are held in place by planes through them at right angles to their triangle, weighted this many times
+	// more than the triangle planes so sliding along the border is much cheaper than moving away from it
+	const double BorderWeight = 10.0;
+
+	// Sum of weighted squared distances to planes, error(p) = p.A.p + 2 b.p + c. w is the total triangle area, the weight
+	// of the attribute errors
+	struct Quadric
+	{
+		double a00, a11, a22, a01, a02, a12;
+		double b0, b1, b2;
+		double c;
+		double w;
+	};
+
+	// Sum of the weighted attribute gradients, for one attribute
+	struct QuadricGradient
+	{
+		double gx, gy, gz, gw;
+	};
+
+	enum EVertexKind
+	{
+		Vertex_Manifold, // Can collapse onto any neighbour
+		Vertex_Border,   // Can only collapse along a border edge
+		Vertex_Locked,   // Never moves
+	};
+
+	struct Collapse
+	{
+		uint32_t from;
+		uint32_t to;
+		double   error;
+	};
+
+
+	void AddQuadric(Quadric& q, const Quadric& r)
+	{
+		q.a00 += r.a00; q.a11 += r.a11; q.a22 += r.a22;
+		q.a01 += r.a01; q.a02 += r.a02; q.a12 += r.a12;
+		q.b0 += r.b0; q.b1 += r.b1; q.b2 += r.b2;
+		q.c += r.c;
+		q.w += r.w;
+	}
+
+	// Add the squared distance to a plane n.p + d = 0 (n normalised) or the square of a linear function g.p + d
+	void AddPlane(Quadric& q, double nx, double ny, double nz, double d, double weight)
+	{
+		q.a00 += weight * nx * nx; q.a11 += weight * ny * ny; q.a22 += weight * nz * nz;
+		q.a01 += weight * nx * ny; q.a02 += weight * nx * nz; q.a12 += weight * ny * nz;
+		q.b0 += weight * nx * d; q.b1 += weight * ny * d; q.b2 += weight * nz * d;
+		q.c += weight * d * d;
+	}
+
+	double Evaluate(const Quadric& q, const CVector3& p)
+	{
+		const double x = p.x, y = p.y, z = p.z;
+		return q.a00 * x * x + q.a11 * y * y + q.a22 * z * z +
+		       2.0 * (q.a01 * x * y + q.a02 * x * z + q.a12 * y * z) +
+		       2.0 * (q.b0 * x + q.b1 * y + q.b2 * z) + q.c;
+	}
+
+	// Hashable copy of a position, for finding the vertices split by seams
+	struct PositionKey
+	{
+		float x, y, z;
+		bool operator==(const PositionKey& other) const { return x == other.x && y == other.y && z == other.z; }
+	};
+
+	struct PositionKeyHash
+	{
+		size_t operator()(const PositionKey& key) const
+		{
+			uint32_t bits[3];
+			std::memcpy(bits, &key, sizeof(bits));
+			return (bits[0] * 73856093u) ^ (bits[1] * 19349663u) ^ (bits[2] * 83492791u);
+		}
+	};
+
+	uint64_t EdgeKey(uint32_t a, uint32_t b)
+	{
+		return a < b ? (static_cast<uint64_t>(a) << 32) | b : (static_cast<uint64_t>(b) << 32) | a;
+	}
+
+	CVector3 TriangleNormal(const CVector3& p0, const CVector3& p1, const CVector3& p2)
+	{
+		return Cross(p1 - p0, p2 - p0);
+	}
+}
+
+
+float SimplifyMesh(const std::vector<CVector3>& positions, const std::vector<float>& attributes, const std::vector<uint32_t>& indices,
+                   unsigned int targetIndexCount, const SimplifyOptions& options, std::vector<uint32_t>& result)
+{
+	result = indices;
+	const auto numVertices = static_cast<uint32_t>(positions.size());
+	if (numVertices == 0 || result.size() <= targetIndexCount) return 0.0f;
+
+	const auto numAttributes = static_cast<unsigned int>(options.attributeWeights.size());
+
+	// Work on the mesh scaled to 1 unit across, so the errors don't depend on its size
+	CVector3 minimum = positions[0], maximum = positions[0];
+	for (const auto& p : positions)
+	{
+		minimum = { std::min(minimum.x, p.x), std::min(minimum.y, p.y), std::min(minimum.z, p.z) };
+		maximum = { std::max(maximum.x, p.x), std::max(maximum.y, p.y), std::max(maximum.z, p.z) };
+	}
+	const auto extent = std::max({ maximum.x - minimum.x, maximum.y - minimum.y, maximum.z - minimum.z });
+	const auto scale = extent > 0.0f ? 1.0f / extent : 1.0f;
+
+	std::vector<CVector3> points(numVertices);
+	for (uint32_t v = 0; v < numVertices; ++v)
+	{
+		points[v] = (positions[v] - minimum) * scale;
+	}
+
+	std::vector<float> values(static_cast<size_t>(numVertices) * numAttributes);
+	for (uint32_t v = 0; v < numVertices; ++v)
+	{
+		for (unsigned int k = 0; k < numAttributes; ++k)
+		{
+			values[v * numAttributes + k] = attributes[v * numAttributes + k] * options.attributeWeights[k];
+		}
+	}
+
+
+	//-------------------------------------
+	// Topology
+	//-------------------------------------
+
+	// One id per distinct position. Edges are counted by position so vertices split by seams are seen as joined
+	std::vector<uint32_t> positionId(numVertices);
+	std::vector<uint32_t> copies;
+	{
+		std::unordered_map<PositionKey, uint32_t, PositionKeyHash> ids;
+		for (uint32_t v = 0; v < numVertices; ++v)
+		{
+			const auto entry = ids.emplace(PositionKey{ positions[v].x, positions[v].y, positions[v].z }, static_cast<uint32_t>(ids.size()));
+			positionId[v] = entry.first->second;
+			if (entry.second) copies.push_back(0);
+			++copies[positionId[v]];
+		}
+	}
+
+	auto countEdges = [&](const std::vector<uint32_t>& triangles, std::unordered_map<uint64_t, int>& edgeCounts)
+	{
+		edgeCounts.clear();
+		for (size_t i = 0; i < triangles.size(); i += 3)
+		{
+			for (int e = 0; e < 3; ++e)
+			{
+				++edgeCounts[EdgeKey(positionId[triangles[i + e]], positionId[triangles[i + (e + 1) % 3]])];
+			}
+		}
+	};
+
+	std::unordered_map<uint64_t, int> edgeCounts;
+	countEdges(result, edgeCounts);
+
+	std::vector<unsigned char> kind(numVertices, Vertex_Manifold);
+	for (uint32_t v = 0; v < numVertices; ++v)
+	{
+		if (copies[positionId[v]] > 1) kind[v] = Vertex_Locked;
+	}
+	for (size_t i = 0; i < result.size(); i += 3)
+	{
+		for (int e = 0; e < 3; ++e)
+		{
+			const auto a = result[i + e];
+			const auto b = result[i + (e + 1) % 3];
+			const auto count = edgeCounts[EdgeKey(positionId[a], positionId[b])];
+			if (count == 1)
+			{
+				const auto border = options.lockBorders ? Vertex_Locked : Vertex_Border;
+				kind[a] = std::max(kind[a], static_cast<unsigned char>(border));
+				kind[b] = std::max(kind[b], static_cast<unsigned char>(border));
+			}
+			else if (count > 2)
+			{
+				kind[a] = kind[b] = Vertex_Locked;
+			}
+		}
+	}
+
+
+	//-------------------------------------
+	// Quadrics
+	//-------------------------------------
+
+	std::vector<Quadric> quadrics(numVertices, Quadric{});
+	std::vector<QuadricGradient> gradients(static_cast<size_t>(numVertices) * numAttributes, QuadricGradient{});
+	std::vector<QuadricGradient> triangleGradients(numAttributes);
+
+	for (size_t i = 0; i < result.size(); i += 3)
+	{
+		const uint32_t v[3] = { result[i], result[i + 1], result[i + 2] };
+		const auto& p0 = points[v[0]];
+		const auto& p1 = points[v[1]];
+		const auto& p2 = points[v[2]];
+
+		const auto normal = TriangleNormal(p0, p1, p2);
+		const double length = Length(normal);
+		if (length <= 0.0) continue;
+
+		const auto area = 0.5 * length;
+		Quadric q = {};
+		q.w = area;
+		AddPlane(q, normal.x / length, normal.y / length, normal.z / length, -Dot(normal, p0) / length, area);
+
+		// Each attribute as a linear function over the triangle, a = g.p + d, with g in the plane of the triangle
+		const auto e1 = p1 - p0;
+		const auto e2 = p2 - p0;
+		const double d00 = Dot(e1, e1), d01 = Dot(e1, e2), d11 = Dot(e2, e2);
+		const auto denominator = d00 * d11 - d01 * d01;
+		std::fill(triangleGradients.begin(), triangleGradients.end(), QuadricGradient{});
+		for (unsigned int k = 0; k < numAttributes && denominator > 0.0; ++k)
+		{
+			const double a0 = values[v[0] * numAttributes + k];
+			const double da1 = values[v[1] * numAttributes + k] - a0;
+			const double da2 = values[v[2] * numAttributes + k] - a0;
+			const auto s = (da1 * d11 - da2 * d01) / denominator;
+			const auto t = (da2 * d00 - da1 * d01) / denominator;
+			const double gx = s * e1.x + t * e2.x, gy = s * e1.y + t * e2.y, gz = s * e1.z + t * e2.z;
+			const auto gw = a0 - (gx * p0.x + gy * p0.y + gz * p0.z);
+
+			AddPlane(q, gx, gy, gz, gw, area);
+			triangleGradients[k] = { gx * area, gy * area, gz * area, gw * area };
+		}
+
+		for (auto corner : v)
+		{
+			AddQuadric(quadrics[corner], q);
+			for (unsigned int k = 0; k < numAttributes; ++k)
+			{
+				auto& g = gradients[corner * numAttributes + k];
+				g.gx += triangleGradients[k].gx; g.gy += triangleGradients[k].gy;
+				g.gz += triangleGradients[k].gz; g.gw += triangleGradients[k].gw;
+			}
+		}
+
+		// Border edges get a plane at right angles to the triangle through them
+		if (!options.lockBorders)
+		{
+			for (int e = 0; e < 3; ++e)
+			{
+				const auto a = v[e];
+				const auto b = v[(e + 1) % 3];
+				if (edgeCounts[EdgeKey(positionId[a], positionId[b])] != 1) continue;
+
+				const auto edge = points[b] - points[a];
+				auto side = Cross(edge, normal);
+				const double sideLength = Length(side);
+				if (sideLength <= 0.0) continue;
+
+				const double nx = side.x / sideLength, ny = side.y / sideLength, nz = side.z / sideLength;
+				const auto d = -(nx * points[a].x + ny * points[a].y + nz * points[a].z);
+				const auto weight = BorderWeight * Dot(edge, edge);
+				Quadric border = {};
+				AddPlane(border, nx, ny, nz, d, weight);
+				AddQuadric(quadrics[a], border);
+				AddQuadric(quadrics[b], border);
+			}
+		}
+	}
+
+	// Error of moving from onto to, normalised by area to a squared distance
+	auto collapseError = [&](uint32_t from, uint32_t to)
+	{
+		auto q = quadrics[from];
+		AddQuadric(q, quadrics[to]);
+		const auto& p = points[to];
+		auto error = Evaluate(q, p);
+		for (unsigned int k = 0; k < numAttributes; ++k)
+		{
+			const auto& g0 = gradients[from * numAttributes + k];
+			const auto& g1 = gradients[to * numAttributes + k];
+			const double a = values[to * numAttributes + k];
+			const auto linear = (g0.gx + g1.gx) * p.x + (g0.gy + g1.gy) * p.y + (g0.gz + g1.gz) * p.z + g0.gw + g1.gw;
+			error += a * a * q.w - 2.0 * a * linear;
+		}
+		return q.w > 0.0 ? std::abs(error) / q.w : 0.0;
+	};
+
+
+	//-------------------------------------
+	// Collapses
+	//-------------------------------------
+
+	const auto maxError = static_cast<double>(options.maxError) * options.maxError;
+	double reachedError = 0.0;
+
+	std::vector<uint32_t> remap(numVertices);
+	std::vector<unsigned char> touched(numVertices);
+	std::vector<uint32_t> firstTriangle(numVertices + 1);
+	std::vector<uint32_t> vertexTriangles;
+	std::vector<Collapse> collapses;
+
+	while (result.size() > targetIndexCount)
+	{
+		const auto numTriangles = static_cast<uint32_t>(result.size() / 3);
+
+		// Triangles around each vertex
+		std::fill(firstTriangle.begin(), firstTriangle.end(), 0);
+		for (auto v : result) ++firstTriangle[v + 1];
+		for (uint32_t v = 0; v < numVertices; ++v) firstTriangle[v + 1] += firstTriangle[v];
+		vertexTriangles.resize(result.size());
+		{
+			auto fill = firstTriangle;
+			for (uint32_t i = 0; i < result.size(); ++i) vertexTriangles[fill[result[i]]++] = i / 3;
+		}
+
+		countEdges(result, edgeCounts);
+
+		// Cheapest allowed direction of every edge
+		collapses.clear();
+		for (uint32_t i = 0; i < result.size(); i += 3)
+		{
+			for (int e = 0; e < 3; ++e)
+			{
+				const auto a = result[i + e];
+				const auto b = result[i + (e + 1) % 3];
+				if (a > b && edgeCounts[EdgeKey(positionId[a], positionId[b])] == 2) continue; // Seen from the other triangle
+
+				const auto borderEdge = edgeCounts[EdgeKey(positionId[a], positionId[b])] == 1;
+				auto allowed = [&](uint32_t from) { return kind[from] == Vertex_Manifold || (kind[from] == Vertex_Border && borderEdge); };
+
+				Collapse best = { a, b, -1.0 };
+				if (allowed(a)) best = { a, b, collapseError(a, b) };
+				if (allowed(b))
+				{
+					const auto error = collapseError(b, a);
+					if (best.error < 0.0 || error < best.error) best = { b, a, error };
+				}
+				if (best.error >= 0.0) collapses.push_back(best);
+			}
+		}
+
+		std::sort(collapses.begin(), collapses.end(), [](const Collapse& x, const Collapse& y)
+		{
+			if (x.error != y.error) return x.error < y.error;
+			return x.from != y.from ? x.from < y.from : x.to < y.to;
+		});
+
+		// Each collapse removes about two triangles. Collapses in one pass must not share triangles, so the ones around a
+		// collapsed vertex are left for the next pass
+		const auto wanted = (numTriangles - targetIndexCount / 3) / 2 + 1;
+		for (uint32_t v = 0; v < numVertices; ++v) remap[v] = v;
+		std::fill(touched.begin(), touched.end(), 0);
+
+		uint32_t done = 0;
+		for (const auto& collapse : collapses)
+		{
+			if (done >= wanted || collapse.error > maxError) break;
+
+			const auto from = collapse.from;
+			const auto to = collapse.to;
+			if (touched[from] || touched[to]) continue;
+
+			// Don't turn any triangle over
+			auto flips = false;
+			for (auto t = firstTriangle[from]; t < firstTriangle[from + 1] && !flips; ++t)
+			{
+				const auto triangle = &result[vertexTriangles[t] * 3];
+				if (triangle[0] == to || triangle[1] == to || triangle[2] == to) continue;
+
+				CVector3 corners[3], moved[3];
+				for (int c = 0; c < 3; ++c)
+				{
+					corners[c] = points[triangle[c]];
+					moved[c] = triangle[c] == from ? points[to] : corners[c];
+				}
+				const auto before = TriangleNormal(corners[0], corners[1], corners[2]);
+				const auto after = TriangleNormal(moved[0], moved[1], moved[2]);
+				flips = Dot(before, after) <= 0.0f;
+			}
+			if (flips) continue;
+
+			remap[from] = to;
+			AddQuadric(quadrics[to], quadrics[from]);
+			for (unsigned int k = 0; k < numAttributes; ++k)
+			{
+				auto& g = gradients[to * numAttributes + k];
+				const auto& h = gradients[from * numAttributes + k];
+				g.gx += h.gx; g.gy += h.gy; g.gz += h.gz; g.gw += h.gw;
+			}
+
+			for (auto t = firstTriangle[from]; t < firstTriangle[from + 1]; ++t)
+			{
+				const auto triangle = &result[vertexTriangles[t] * 3];
+				touched[triangle[0]] = touched[triangle[1]] = touched[triangle[2]] = 1;
+			}
+			reachedError = std::max(reachedError, collapse.error);
+			++done;
+		}
+		if (done == 0) break;
+
+		// Apply the collapses and drop the triangles that have become lines
+		size_t kept = 0;
+		for (size_t i = 0; i < result.size(); i += 3)
+		{
+			const auto a = remap[result[i]];
+			const auto b = remap[result[i + 1]];
+			const auto c = remap[result[i + 2]];
+			if (a == b || b == c || a == c) continue;
+			result[kept++] = a;
+			result[kept++] = b;
+			result[kept++] = c;
+		}
+		result.resize(kept);
+	}
+
+	return static_cast<float>(std::sqrt(reachedError));
+}
@@ -0,0 +1,43 @@
+//--------------------------------------------------------------------------------------
+// Mesh simplification - fewer triangles with the same look, for generated levels of detail
+//--------------------------------------------------------------------------------------
+// Code in .cpp file
+//
+// Edge collapses ordered by quadric error (Garland & Heckbert): each vertex keeps the sum of the squared distances
+// to the planes of its original triangles, and an edge is collapsed by moving one end onto the other, so the
+// result indexes the same vertices as the input and can share its vertex buffer. Vertex attributes (normals, uvs,
+// tangents...) are part of the error, as linear gradients over each triangle, so seams in shading or texturing
+// are kept where they matter.
+//
+// Vertices split by an attribute seam (several vertices at one position) never move, nor do vertices on non-manifold
+// edges. Vertices on the open border of the mesh can only slide along it, or be locked completely. The work is done
+// in passes of independent collapses, in a fixed order, so the result only depends on the input. No graphics API is
+// used here.
+
+#pragma once
+
+#include "CVector3.h"
+
+#include <cstdint>
+#include <vector>
+
+
+struct SimplifyOptions
+{
+	// Floats per vertex in the attribute array and how much an error in each counts compared to a position error
+	// (positions are scaled so the mesh is 1 unit across). Empty for position only simplification
+	std::vector<float> attributeWeights;
+
+	// Stop once the error would exceed this fraction of the mesh size, even if the target has not been reached
+	float maxError = 0.05f;
+
+	// Keep the open border of the mesh exactly where it is (e.g. a terrain tile that must meet its neighbours)
+	bool lockBorders = false;
+};
+
+
+// Simplify a triangle list towards targetIndexCount indices. attributes holds attributeWeights.size() floats per
+// vertex (may be empty if there are no weights). The result indexes the same vertices. Returns the error reached,
+// as a fraction of the mesh size
+float SimplifyMesh(const std::vector<CVector3>& positions, const std::vector<float>& attributes, const std::vector<uint32_t>& indices,
+                   unsigned int targetIndexCount, const SimplifyOptions& options, std::vector<uint32_t>& result);
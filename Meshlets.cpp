@@ -0,0 +1,258 @@
+//--------------------------------------------------------------------------------------
+// Meshlets - small clusters of triangles that are culled separately on the CPU
+//--------------------------------------------------------------------------------------
+
+#include "Meshlets.h"
+
+#include <algorithm>
+#include <cmath>
+#include <utility>
+
+
+namespace
+{
+	// Cutoff stored for meshlets that can't be cone culled, no dot product of unit vectors reaches it
+	const float NoConeCutoff = 2.0f;
+
+	// Unit normal of a triangle, zero if it has no area. Normalise treats small vectors as zero, which would lose the
+	// triangles of finely detailed meshes
+	CVector3 TriangleNormal(const CVector3& p0, const CVector3& p1, const CVector3& p2)
+	{
+		const auto normal = Cross(p1 - p0, p2 - p0);
+		const auto length = Length(normal);
+		return length > 0.0f ? normal * (1.0f / length) : normal;
+	}
+
+	// Fill in the bounding sphere and normal cone of a meshlet from its triangles
+	void CalculateBounds(Meshlet& meshlet, const uint32_t* indices, const std::vector<CVector3>& positions)
+	{
+		// Sphere around the centre of the bounding box
+		auto box = CAABB::Empty();
+		for (uint32_t i = 0; i < meshlet.numTriangles * 3; ++i)  box.Encapsulate(positions[indices[i]]);
+		meshlet.centre = box.Centre();
+		meshlet.radius = 0.0f;
+		for (uint32_t i = 0; i < meshlet.numTriangles * 3; ++i)
+		{
+			meshlet.radius = std::max(meshlet.radius, Length(positions[indices[i]] - meshlet.centre));
+		}
+
+		// The cone axis is the average facing, ignoring triangles with no area. Keep a point and normal of each triangle
+		std::vector<std::pair<CVector3, CVector3>> planes;
+		planes.reserve(meshlet.numTriangles);
+		CVector3 axis = { 0, 0, 0 };
+		for (uint32_t t = 0; t < meshlet.numTriangles; ++t)
+		{
+			const auto& p0 = positions[indices[t * 3]];
+			const auto normal = TriangleNormal(p0, positions[indices[t * 3 + 1]], positions[indices[t * 3 + 2]]);
+			if (Dot(normal, normal) == 0.0f) continue;
+			planes.emplace_back(p0, normal);
+			axis += normal;
+		}
+		const auto axisLength = Length(axis);
+		meshlet.coneAxis = axisLength > 0.0f ? axis * (1.0f / axisLength) : axis;
+		meshlet.coneApex = meshlet.centre;
+		meshlet.coneCutoff = NoConeCutoff;
+		if (axisLength == 0.0f) return;
+
+		// The widest angle between the axis and a triangle's normal. Cones that are nearly a hemisphere or wider are
+		// hardly ever back facing, don't test them
+		auto minDot = 1.0f;
+		for (const auto& plane : planes)  minDot = std::min(minDot, Dot(meshlet.coneAxis, plane.second));
+		if (minDot <= 0.1f) return;
+
+		// Seen from a point p, every triangle faces away if the direction to it is within 90 degrees less the cone angle of
+		// the axis. That is only true of the triangles' own planes, so move the apex back along the axis until it is behind
+		// all of them, then directions are measured from the apex (Zeux, meshoptimizer)
+		auto maxT = 0.0f;
+		for (const auto& plane : planes)
+		{
+			maxT = std::max(maxT, Dot(meshlet.centre - plane.first, plane.second) / Dot(meshlet.coneAxis, plane.second));
+		}
+		meshlet.coneApex = meshlet.centre - meshlet.coneAxis * maxT;
+		meshlet.coneCutoff = std::sqrt(1.0f - minDot * minDot);
+	}
+}
+
+
+/*-----------------------------------------------------------------------------------------
+    Building
+-----------------------------------------------------------------------------------------*/
+
+void BuildMeshlets(std::vector<uint32_t>& indices, const std::vector<CVector3>& positions, std::vector<Meshlet>& meshlets,
+                   unsigned int maxVertices, unsigned int maxTriangles)
+{
+	meshlets.clear();
+	const auto numTriangles = static_cast<uint32_t>(indices.size() / 3);
+	const auto numVertices = static_cast<uint32_t>(positions.size());
+	if (numTriangles == 0) return;
+
+	// Triangles using each vertex
+	std::vector<uint32_t> firstTriangle(numVertices + 1, 0);
+	for (uint32_t i = 0; i < numTriangles * 3; ++i)  ++firstTriangle[indices[i] + 1];
+	for (uint32_t v = 0; v < numVertices; ++v)  firstTriangle[v + 1] += firstTriangle[v];
+	std::vector<uint32_t> vertexTriangles(numTriangles * 3);
+	{
+		auto next = firstTriangle;
+		for (uint32_t i = 0; i < numTriangles * 3; ++i)  vertexTriangles[next[indices[i]]++] = i / 3;
+	}
+
+	// Meshlet that last used each vertex / last listed each triangle as a candidate
+	const auto None = ~0u;
+	std::vector<uint32_t> vertexMeshlet(numVertices, None);
+	std::vector<uint32_t> candidateMeshlet(numTriangles, None);
+	std::vector<unsigned char> emitted(numTriangles, 0);
+
+	std::vector<uint32_t> ordered;
+	ordered.reserve(numTriangles * 3);
+
+	// Triangles sharing a vertex with the current meshlet
+	std::vector<uint32_t> candidates;
+
+	uint32_t meshletVertices = 0;
+	uint32_t nextSeed = 0;
+
+	auto newVertices = [&](uint32_t triangle)
+	{
+		uint32_t count = 0;
+		for (int corner = 0; corner < 3; ++corner)  count += vertexMeshlet[indices[triangle * 3 + corner]] != meshlets.size() - 1;
+		return count;
+	};
+
+	auto addTriangle = [&](uint32_t triangle)
+	{
+		const auto meshlet = static_cast<uint32_t>(meshlets.size() - 1);
+		emitted[triangle] = 1;
+		for (int corner = 0; corner < 3; ++corner)
+		{
+			const auto v = indices[triangle * 3 + corner];
+			ordered.push_back(v);
+			if (vertexMeshlet[v] == meshlet) continue;
+
+			vertexMeshlet[v] = meshlet;
+			++meshletVertices;
+			for (auto i = firstTriangle[v]; i < firstTriangle[v + 1]; ++i)
+			{
+				const auto neighbour = vertexTriangles[i];
+				if (emitted[neighbour] || candidateMeshlet[neighbour] == meshlet) continue;
+				candidateMeshlet[neighbour] = meshlet;
+				candidates.push_back(neighbour);
+			}
+		}
+		++meshlets.back().numTriangles;
+	};
+
+	while (ordered.size() < numTriangles * 3)
+	{
+		// Grow the current meshlet with the neighbour that adds the fewest vertices, the earliest in the original order
+		// on a tie. It is the only one that can fit, if it doesn't the meshlet is full
+		auto best = None;
+		auto bestNew = 4u;
+		if (!meshlets.empty())
+		{
+			auto kept = candidates.begin();
+			for (auto triangle : candidates)
+			{
+				if (emitted[triangle]) continue;
+				*kept++ = triangle;
+
+				const auto count = newVertices(triangle);
+				if (count < bestNew || (count == bestNew && triangle < best))
+				{
+					best = triangle;
+					bestNew = count;
+				}
+			}
+			candidates.erase(kept, candidates.end());
+		}
+
+		const auto full = meshlets.empty() || meshlets.back().numTriangles >= maxTriangles;
+		if (!full && best != None && meshletVertices + bestNew <= maxVertices)
+		{
+			addTriangle(best);
+			continue;
+		}
+
+		// No connected triangles left, keep filling the meshlet from the next triangle in order if it fits. Small
+		// separate pieces (e.g. leaves) end up together rather than in meshlets of their own
+		while (emitted[nextSeed]) ++nextSeed;
+		if (!full && best == None && meshletVertices + newVertices(nextSeed) <= maxVertices)
+		{
+			addTriangle(nextSeed);
+			continue;
+		}
+
+		// Start a new meshlet
+		Meshlet meshlet = {};
+		meshlet.firstIndex = static_cast<uint32_t>(ordered.size());
+		meshlets.push_back(meshlet);
+		meshletVertices = 0;
+		candidates.clear();
+		addTriangle(nextSeed);
+	}
+
+	indices.swap(ordered);
+	for (auto& meshlet : meshlets)  CalculateBounds(meshlet, &indices[meshlet.firstIndex], positions);
+}
+
+
+/*-----------------------------------------------------------------------------------------
+    Culling
+-----------------------------------------------------------------------------------------*/
+
+MeshletView TransformMeshletView(const MeshletView& view, const CMatrix4x4& worldMatrix)
+{
+	const auto& m = worldMatrix;
+	MeshletView result;
+
+	const auto inverse = InverseAffine(m);
+	const auto& p = view.position;
+	result.position = { p.x * inverse.e00 + p.y * inverse.e10 + p.z * inverse.e20 + inverse.e30,
+	                    p.x * inverse.e01 + p.y * inverse.e11 + p.z * inverse.e21 + inverse.e31,
+	                    p.x * inverse.e02 + p.y * inverse.e12 + p.z * inverse.e22 + inverse.e32 };
+
+	// A point p in the node is at p * m in the world, so substitute that into each plane equation
+	for (int plane = 0; plane < CFrustum::NumPlanes; ++plane)
+	{
+		const auto& n = view.frustum.planes[plane].normal;
+		const auto  d = view.frustum.planes[plane].distance;
+		const CVector3 normal = { n.x * m.e00 + n.y * m.e01 + n.z * m.e02,
+		                          n.x * m.e10 + n.y * m.e11 + n.z * m.e12,
+		                          n.x * m.e20 + n.y * m.e21 + n.z * m.e22 };
+
+		// Keep the planes normalised so sphere tests measure distances in the node's units
+		const auto length = Length(normal);
+		const auto invLength = length > 0.0f ? 1.0f / length : 0.0f;
+		result.frustum.planes[plane].normal   = normal * invLength;
+		result.frustum.planes[plane].distance = (n.x * m.e30 + n.y * m.e31 + n.z * m.e32 + d) * invLength;
+	}
+
+	const auto determinant = Dot(Cross(m.GetXAxis(), m.GetYAxis()), m.GetZAxis());
+	result.coneCulling = view.coneCulling && determinant > 0.0f;
+	return result;
+}
+
+
+unsigned int CullMeshlets(const std::vector<Meshlet>& meshlets, const MeshletView& view, std::vector<MeshletRange>& ranges)
+{
+	const auto firstRange = ranges.size();
+	unsigned int visibleTriangles = 0;
+
+	for (const auto& meshlet : meshlets)
+	{
+		if (!view.frustum.Intersects(CSphere(meshlet.centre, meshlet.radius))) continue;
+		const auto toApex = meshlet.coneApex - view.position;
+		if (view.coneCulling && Dot(toApex, meshlet.coneAxis) >= meshlet.coneCutoff * Length(toApex)) continue;
+
+		visibleTriangles += meshlet.numTriangles;
+		const auto numIndices = meshlet.numTriangles * 3;
+		if (ranges.size() > firstRange && ranges.back().firstIndex + ranges.back().numIndices == meshlet.firstIndex)
+		{
+			ranges.back().numIndices += numIndices;
+		}
+		else
+		{
+			ranges.push_back({ meshlet.firstIndex, numIndices });
+		}
+	}
+	return visibleTriangles;
+}
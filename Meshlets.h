@@ -0,0 +1,74 @@
+//--------------------------------------------------------------------------------------
+// Meshlets - small clusters of triangles that are culled separately on the CPU
+//--------------------------------------------------------------------------------------
+// Code in .cpp file
+//
+// BuildMeshlets splits a triangle list into meshlets of at most 64 vertices / 124 triangles, growing each one
+// from a triangle through its neighbours so meshlets are compact patches of surface. The triangles are
+// reordered so each meshlet is a contiguous range of the index list; run it after OptimiseOverdraw and
+// before OptimiseVertexFetch (see MeshOptimiser.h), the patches are seeded in the optimised order.
+// Each meshlet has a bounding sphere and a normal cone: all its triangles face away from any viewpoint
+// inside the cone behind the apex, so the whole meshlet can be skipped there if back faces are culled.
+//
+// CullMeshlets tests the meshlets against a view (frustum and viewpoint in the space of the meshlets) and
+// returns the index ranges of the ones that may be visible, with neighbouring ranges merged so they are
+// drawn with as few draws as possible. Direct3D 11 has no mesh shaders, so these ranges are drawn from the
+// ordinary index buffer. Both functions only read / write the arrays given, so any number may run on
+// different threads. No graphics API is used here.
+
+#pragma once
+
+#include "CVector3.h"
+#include "CMatrix4x4.h"
+#include "BoundingVolumes.h"
+
+#include <cstdint>
+#include <vector>
+
+
+// Limits used by the meshlet hardware of current GPUs, which also suit CPU culling well
+const unsigned int MeshletMaxVertices  = 64;
+const unsigned int MeshletMaxTriangles = 124;
+
+struct Meshlet
+{
+	uint32_t firstIndex;   // Range of the index list
+	uint32_t numTriangles;
+
+	CVector3 centre;       // Bounding sphere
+	float    radius;
+
+	// Normal cone. Back facing from every point p with Dot(Normalise(coneApex - p), coneAxis) >= coneCutoff.
+	// coneCutoff is above 1 if the triangles face too many ways for the test to ever pass
+	CVector3 coneAxis;
+	float    coneCutoff;
+	CVector3 coneApex;
+};
+
+// Viewpoint and frustum to cull meshlets against. Cone culling is only correct if back faces are culled
+struct MeshletView
+{
+	CVector3 position;
+	CFrustum frustum;
+	bool     coneCulling = true;
+};
+
+// A range of the index list to draw
+struct MeshletRange
+{
+	uint32_t firstIndex;
+	uint32_t numIndices;
+};
+
+
+// Split a triangle list indexing into positions into meshlets. The triangles are reordered into meshlet order
+void BuildMeshlets(std::vector<uint32_t>& indices, const std::vector<CVector3>& positions, std::vector<Meshlet>& meshlets,
+                   unsigned int maxVertices = MeshletMaxVertices, unsigned int maxTriangles = MeshletMaxTriangles);
+
+// Move a world space view into the space of a node with the given world matrix. Cone culling is turned off
+// if the matrix mirrors, which swaps front and back faces
+MeshletView TransformMeshletView(const MeshletView& view, const CMatrix4x4& worldMatrix);
+
+// Append the index ranges of the meshlets that may be visible from the view, in the order of the meshlets with
+// consecutive ranges merged. Returns the number of visible triangles
+unsigned int CullMeshlets(const std::vector<Meshlet>& meshlets, const MeshletView& view, std::vector<MeshletRange>& ranges);
@@ -0,0 +1,331 @@
+//--------------------------------------------------------------------------------------
+// Software occlusion culling - a small CPU depth buffer of the big occluders in view
+//--------------------------------------------------------------------------------------
+
+#include "OcclusionCulling.h"
+
+#include "JobSystem.h"
+
+#include <algorithm>
+#include <cmath>
+#include <xmmintrin.h>
+
+
+namespace
+{
+	const unsigned int PixelsPerTile = COcclusionBuffer::TileSize * COcclusionBuffer::TileSize;
+
+	// Tiles per job when rasterising
+	const unsigned int TilesPerJob = 8;
+
+	// Clip space position of a point, row vector times matrix
+	void TransformToClip(const CVector3& p, const CMatrix4x4& m, float clip[4])
+	{
+		clip[0] = p.x * m.e00 + p.y * m.e10 + p.z * m.e20 + m.e30;
+		clip[1] = p.x * m.e01 + p.y * m.e11 + p.z * m.e21 + m.e31;
+		clip[2] = p.x * m.e02 + p.y * m.e12 + p.z * m.e22 + m.e32;
+		clip[3] = p.x * m.e03 + p.y * m.e13 + p.z * m.e23 + m.e33;
+	}
+}
+
+
+COcclusionBuffer::COcclusionBuffer(unsigned int width, unsigned int height)
+	: mViewProjection(MatrixIdentity())
+{
+	mTilesX = std::max(1u, (width + TileSize - 1) / TileSize);
+	mTilesY = std::max(1u, (height + TileSize - 1) / TileSize);
+
+	mDepth.resize(mTilesX * mTilesY * PixelsPerTile);
+	mTileMin.resize(mTilesX * mTilesY);
+	mTileMax.resize(mTilesX * mTilesY);
+	mBins.resize(mTilesX * mTilesY);
+
+	Begin(mViewProjection);
+}
+
+
+/*-----------------------------------------------------------------------------------------
+    Rendering occluders
+-----------------------------------------------------------------------------------------*/
+
+void COcclusionBuffer::Begin(const CMatrix4x4& viewProjectionMatrix)
+{
+	mViewProjection = viewProjectionMatrix;
+
+	std::fill(mDepth.begin(), mDepth.end(), 1.0f);
+	std::fill(mTileMin.begin(), mTileMin.end(), 1.0f);
+	std::fill(mTileMax.begin(), mTileMax.end(), 1.0f);
+
+	mTriangles.clear();
+	for (auto& bin : mBins) bin.clear();
+}
+
+void COcclusionBuffer::AddOccluder(const std::vector<CVector3>& positions, const std::vector<uint32_t>& indices)
+{
+	std::vector<float> clip(positions.size() * 4);
+	for (size_t i = 0; i < positions.size(); ++i)
+	{
+		TransformToClip(positions[i], mViewProjection, &clip[i * 4]);
+	}
+
+	for (size_t i = 0; i + 2 < indices.size(); i += 3)
+	{
+		const float* v[3] = { &clip[indices[i] * 4], &clip[indices[i + 1] * 4], &clip[indices[i + 2] * 4] };
+
+		// Skip triangles entirely outside one of the frustum planes
+		auto outside = false;
+		for (int axis = 0; axis < 2 && !outside; ++axis)
+		{
+			outside = (v[0][axis] < -v[0][3] && v[1][axis] < -v[1][3] && v[2][axis] < -v[2][3]) ||
+			          (v[0][axis] >  v[0][3] && v[1][axis] >  v[1][3] && v[2][axis] >  v[2][3]);
+		}
+		if (outside || (v[0][2] < 0.0f && v[1][2] < 0.0f && v[2][2] < 0.0f) ||
+		               (v[0][2] > v[0][3] && v[1][2] > v[1][3] && v[2][2] > v[2][3])) continue;
+
+		// Clip to the near plane (z >= 0), which leaves a triangle or a quad
+		float polygon[4][4];
+		auto count = 0;
+		for (int edge = 0; edge < 3; ++edge)
+		{
+			const auto a = v[edge];
+			const auto b = v[(edge + 1) % 3];
+			if (a[2] >= 0.0f)
+			{
+				std::copy(a, a + 4, polygon[count++]);
+			}
+			if ((a[2] >= 0.0f) != (b[2] >= 0.0f))
+			{
+				const auto t = a[2] / (a[2] - b[2]);
+				for (int c = 0; c < 4; ++c) polygon[count][c] = a[c] + (b[c] - a[c]) * t;
+				++count;
+			}
+		}
+
+		for (auto corner = 2; corner < count; ++corner)
+		{
+			const float fan[3][4] = { { polygon[0][0], polygon[0][1], polygon[0][2], polygon[0][3] },
+			                          { polygon[corner - 1][0], polygon[corner - 1][1], polygon[corner - 1][2], polygon[corner - 1][3] },
+			                          { polygon[corner][0], polygon[corner][1], polygon[corner][2], polygon[corner][3] } };
+			AddScreenTriangle(fan);
+		}
+	}
+}
+
+void COcclusionBuffer::AddScreenTriangle(const float (*clip)[4])
+{
+	const auto width = static_cast<float>(Width());
+	const auto height = static_cast<float>(Height());
+
+	ScreenTriangle tri;
+	float z[3];
+	for (int i = 0; i < 3; ++i)
+	{
+		if (clip[i][3] <= 1e-6f) return;
+		const auto invW = 1.0f / clip[i][3];
+		tri.x[i] = (clip[i][0] * invW + 1.0f) * 0.5f * width;
+		tri.y[i] = (1.0f - clip[i][1] * invW) * 0.5f * height;
+		z[i] = clip[i][2] * invW;
+	}
+
+	// Wind every triangle the same way round, so the edge functions are positive inside
+	auto area = (tri.x[1] - tri.x[0]) * (tri.y[2] - tri.y[0]) - (tri.x[2] - tri.x[0]) * (tri.y[1] - tri.y[0]);
+	if (std::abs(area) < 1e-8f) return;
+	if (area < 0.0f)
+	{
+		std::swap(tri.x[1], tri.x[2]);
+		std::swap(tri.y[1], tri.y[2]);
+		std::swap(z[1], z[2]);
+		area = -area;
+	}
+
+	// Depth is linear in screen space after the perspective divide
+	tri.dzdx = ((z[1] - z[0]) * (tri.y[2] - tri.y[0]) - (z[2] - z[0]) * (tri.y[1] - tri.y[0])) / area;
+	tri.dzdy = ((tri.x[1] - tri.x[0]) * (z[2] - z[0]) - (tri.x[2] - tri.x[0]) * (z[1] - z[0])) / area;
+	tri.z0 = z[0] - tri.dzdx * tri.x[0] - tri.dzdy * tri.y[0];
+
+	// Pixels whose centres may be covered
+	const auto minX = std::min({ tri.x[0], tri.x[1], tri.x[2] });
+	const auto maxX = std::max({ tri.x[0], tri.x[1], tri.x[2] });
+	const auto minY = std::min({ tri.y[0], tri.y[1], tri.y[2] });
+	const auto maxY = std::max({ tri.y[0], tri.y[1], tri.y[2] });
+	const auto px0 = std::max(0, static_cast<int>(std::ceil(minX - 0.5f)));
+	const auto py0 = std::max(0, static_cast<int>(std::ceil(minY - 0.5f)));
+	const auto px1 = std::min(static_cast<int>(Width()) - 1, static_cast<int>(std::floor(maxX - 0.5f)));
+	const auto py1 = std::min(static_cast<int>(Height()) - 1, static_cast<int>(std::floor(maxY - 0.5f)));
+	if (px0 > px1 || py0 > py1) return;
+
+	const auto index = static_cast<uint32_t>(mTriangles.size());
+	mTriangles.push_back(tri);
+
+	for (auto ty = py0 / TileSize; ty <= py1 / TileSize; ++ty)
+	{
+		for (auto tx = px0 / TileSize; tx <= px1 / TileSize; ++tx)
+		{
+			mBins[ty * mTilesX + tx].push_back(index);
+		}
+	}
+}
+
+void COcclusionBuffer::Rasterise()
+{
+	// Each tile is only written by the job that owns it, and keeping the nearest depth doesn't depend on the order
+	// the triangles are drawn, so the result is the same however the tiles are shared out
+	ParallelFor(mTilesX * mTilesY, TilesPerJob, [&](unsigned int begin, unsigned int end)
+	{
+		for (auto tile = begin; tile < end; ++tile)
+		{
+			if (!mBins[tile].empty()) RasteriseTile(tile);
+		}
+	});
+}
+
+void COcclusionBuffer::RasteriseTile(unsigned int tile)
+{
+	const auto tileX = static_cast<float>((tile % mTilesX) * TileSize);
+	const auto tileY = static_cast<float>((tile / mTilesX) * TileSize);
+	const auto depth = &mDepth[tile * PixelsPerTile];
+
+	const auto columnOffsets = _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f);
+	const auto zero = _mm_setzero_ps();
+
+	for (auto index : mBins[tile])
+	{
+		const auto& tri = mTriangles[index];
+
+		// Edge functions e = a * x + b * y + c, positive inside
+		float a[3], b[3], c[3];
+		for (int i = 0; i < 3; ++i)
+		{
+			const auto j = (i + 1) % 3;
+			a[i] = tri.y[i] - tri.y[j];
+			b[i] = tri.x[j] - tri.x[i];
+			c[i] = -a[i] * tri.x[i] - b[i] * tri.y[i];
+		}
+
+		for (unsigned int row = 0; row < TileSize; ++row)
+		{
+			const auto y = tileY + static_cast<float>(row) + 0.5f;
+
+			for (unsigned int column = 0; column < TileSize; column += 4)
+			{
+				const auto x = _mm_add_ps(_mm_set1_ps(tileX + static_cast<float>(column)), columnOffsets);
+
+				auto inside = _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(a[0]), x), _mm_set1_ps(b[0] * y + c[0])), zero);
+				inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(a[1]), x), _mm_set1_ps(b[1] * y + c[1])), zero));
+				inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(a[2]), x), _mm_set1_ps(b[2] * y + c[2])), zero));
+				if (_mm_movemask_ps(inside) == 0) continue;
+
+				const auto z = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(tri.dzdx), x), _mm_set1_ps(tri.z0 + tri.dzdy * y));
+
+				const auto pixels = depth + row * TileSize + column;
+				const auto current = _mm_loadu_ps(pixels);
+				const auto nearest = _mm_min_ps(current, z);
+				_mm_storeu_ps(pixels, _mm_or_ps(_mm_and_ps(inside, nearest), _mm_andnot_ps(inside, current)));
+			}
+		}
+	}
+
+	auto minDepth = depth[0];
+	auto maxDepth = depth[0];
+	for (unsigned int i = 1; i < PixelsPerTile; ++i)
+	{
+		minDepth = std::min(minDepth, depth[i]);
+		maxDepth = std::max(maxDepth, depth[i]);
+	}
+	mTileMin[tile] = minDepth;
+	mTileMax[tile] = maxDepth;
+}
+
+
+/*-----------------------------------------------------------------------------------------
+    Testing
+-----------------------------------------------------------------------------------------*/
+
+bool COcclusionBuffer::IsVisible(const CAABB& box) const
+{
+	// Screen rectangle and nearest depth of the box's corners
+	auto minX = 1.0f, maxX = -1.0f, minY = 1.0f, maxY = -1.0f, minZ = 1.0f;
+	for (int corner = 0; corner < 8; ++corner)
+	{
+		const CVector3 p = { (corner & 1) ? box.max.x : box.min.x,
+		                     (corner & 2) ? box.max.y : box.min.y,
+		                     (corner & 4) ? box.max.z : box.min.z };
+		float clip[4];
+		TransformToClip(p, mViewProjection, clip);
+
+		// In front of the near plane, the box may cover the whole view
+		if (clip[2] < 0.0f || clip[3] <= 1e-6f) return true;
+
+		const auto invW = 1.0f / clip[3];
+		const auto x = clip[0] * invW;
+		const auto y = clip[1] * invW;
+		if (corner == 0)
+		{
+			minX = maxX = x;
+			minY = maxY = y;
+			minZ = clip[2] * invW;
+		}
+		else
+		{
+			minX = std::min(minX, x);
+			maxX = std::max(maxX, x);
+			minY = std::min(minY, y);
+			maxY = std::max(maxY, y);
+			minZ = std::min(minZ, clip[2] * invW);
+		}
+	}
+
+	// Every pixel the rectangle touches
+	const auto width = static_cast<float>(Width());
+	const auto height = static_cast<float>(Height());
+	const auto px0 = static_cast<int>(std::floor((minX + 1.0f) * 0.5f * width));
+	const auto px1 = static_cast<int>(std::floor((maxX + 1.0f) * 0.5f * width));
+	const auto py0 = static_cast<int>(std::floor((1.0f - maxY) * 0.5f * height));
+	const auto py1 = static_cast<int>(std::floor((1.0f - minY) * 0.5f * height));
+
+	// Off the buffer, leave it to frustum culling
+	if (px1 < 0 || py1 < 0 || px0 >= static_cast<int>(Width()) || py0 >= static_cast<int>(Height())) return true;
+
+	const auto x0 = static_cast<unsigned int>(std::max(px0, 0));
+	const auto y0 = static_cast<unsigned int>(std::max(py0, 0));
+	const auto x1 = static_cast<unsigned int>(std::min(px1, static_cast<int>(Width()) - 1));
+	const auto y1 = static_cast<unsigned int>(std::min(py1, static_cast<int>(Height()) - 1));
+
+	for (auto ty = y0 / TileSize; ty <= y1 / TileSize; ++ty)
+	{
+		for (auto tx = x0 / TileSize; tx <= x1 / TileSize; ++tx)
+		{
+			const auto tile = ty * mTilesX + tx;
+
+			// Behind everything in the tile, or in front of everything in it
+			if (minZ >= mTileMax[tile]) continue;
+			if (minZ < mTileMin[tile]) return true;
+
+			// Partly covered tile, look at the pixels under the rectangle
+			const auto depth = &mDepth[tile * PixelsPerTile];
+			const auto rowStart = std::max(y0, ty * TileSize) - ty * TileSize;
+			const auto rowEnd = std::min(y1, ty * TileSize + TileSize - 1) - ty * TileSize;
+			const auto columnStart = std::max(x0, tx * TileSize) - tx * TileSize;
+			const auto columnEnd = std::min(x1, tx * TileSize + TileSize - 1) - tx * TileSize;
+			for (auto row = rowStart; row <= rowEnd; ++row)
+			{
+				for (auto column = columnStart; column <= columnEnd; ++column)
+				{
+					if (minZ < depth[row * TileSize + column]) return true;
+				}
+			}
+		}
+	}
+	return false;
+}
+
+
+/*-----------------------------------------------------------------------------------------
+    Data access
+-----------------------------------------------------------------------------------------*/
+
+float COcclusionBuffer::Depth(unsigned int x, unsigned int y) const
+{
+	const auto tile = (y / TileSize) * mTilesX + x / TileSize;
+	return mDepth[tile * PixelsPerTile + (y % TileSize) * TileSize + x % TileSize];
+}
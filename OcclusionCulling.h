@@ -0,0 +1,104 @@
+//--------------------------------------------------------------------------------------
+// Software occlusion culling - a small CPU depth buffer of the big occluders in view
+//--------------------------------------------------------------------------------------
+// Code in .cpp file
+//
+// Each frame the occluders (low detail meshes of hills, cliffs, buildings...) are rasterised into a low
+// resolution depth buffer on the CPU, then the bounding boxes of other objects are tested against it. An
+// object whose box is behind the occluders everywhere it covers the screen is not drawn. Nothing is read
+// back from the GPU, so there is no query latency, and the result only depends on the input.
+//
+// The buffer is split into 8x8 pixel tiles. Triangles are binned to the tiles they overlap and the tiles
+// are rasterised in parallel on the job system, four pixels at a time with SSE. Each tile also keeps the
+// nearest and farthest depth in it, so most box tests are decided per tile without looking at pixels.
+// Depths are as in D3D, 0 at the near clip and 1 at the far clip. No graphics API is used here.
+
+#pragma once
+
+#include "BoundingVolumes.h"
+#include "CMatrix4x4.h"
+
+#include <cstdint>
+#include <vector>
+
+
+class COcclusionBuffer
+{
+public:
+	static const unsigned int TileSize = 8;
+
+	// Resolution of the buffer, rounded up to whole tiles
+	COcclusionBuffer(unsigned int width = 320, unsigned int height = 192);
+
+	//-------------------------------------
+	// Rendering occluders
+	//-------------------------------------
+
+	// Clear the buffer to the far distance and remove the occluders of the last frame. Occluders and tests use
+	// the given view-projection matrix (row vectors, D3D depth range)
+	void Begin(const CMatrix4x4& viewProjectionMatrix);
+
+	// Add world space triangles (a triangle list) to draw. They are clipped to the near plane and binned here, and
+	// drawn by Rasterise. Triangles are two sided
+	void AddOccluder(const std::vector<CVector3>& positions, const std::vector<uint32_t>& indices);
+
+	// Draw the occluders added since Begin, spread over the job system threads
+	void Rasterise();
+
+	//-------------------------------------
+	// Testing
+	//-------------------------------------
+
+	// False only if the box is certainly hidden behind the occluders. Boxes crossing the near plane are always visible.
+	// Safe to call from several threads at once after Rasterise
+	bool IsVisible(const CAABB& box) const;
+
+	//-------------------------------------
+	// Data access
+	//-------------------------------------
+
+	unsigned int Width()  const { return mTilesX * TileSize; }
+	unsigned int Height() const { return mTilesY * TileSize; }
+
+	// Depth at a pixel, (0, 0) is top left
+	float Depth(unsigned int x, unsigned int y) const;
+
+	// Nearest and farthest depth in a tile, as used by IsVisible
+	float TileMinDepth(unsigned int tileX, unsigned int tileY) const { return mTileMin[tileY * mTilesX + tileX]; }
+	float TileMaxDepth(unsigned int tileX, unsigned int tileY) const { return mTileMax[tileY * mTilesX + tileX]; }
+
+	// Triangles drawn by the last Rasterise, after near plane clipping
+	unsigned int NumTriangles() const { return static_cast<unsigned int>(mTriangles.size()); }
+
+
+//-------------------------------------
+// Private members
+//-------------------------------------
+private:
+
+	// Screen space triangle: pixel positions of the corners and the depth plane, depth = z0 + dzdx * x + dzdy * y
+	struct ScreenTriangle
+	{
+		float x[3], y[3];
+		float z0, dzdx, dzdy;
+	};
+
+	void AddScreenTriangle(const float (*clip)[4]);
+
+	void RasteriseTile(unsigned int tile);
+
+	unsigned int mTilesX;
+	unsigned int mTilesY;
+
+	CMatrix4x4 mViewProjection;
+
+	// Pixels are stored tile by tile, each tile's rows consecutively
+	std::vector<float> mDepth;
+
+	// Nearest and farthest depth in each tile
+	std::vector<float> mTileMin;
+	std::vector<float> mTileMax;
+
+	std::vector<ScreenTriangle>        mTriangles;
+	std::vector<std::vector<uint32_t>> mBins; // Triangles overlapping each tile
+};
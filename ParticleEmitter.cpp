@@ -0,0 +1,412 @@
+//--------------------------------------------------------------------------------------
+// Particle emitter - a pool of particles spawned from a shape and moved each frame
+//--------------------------------------------------------------------------------------
+
+#include "ParticleEmitter.h"
+
+#include "MathHelpers.h"
+#include "VertexCompression.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <stdexcept>
+#include <emmintrin.h>
+
+
+/*-----------------------------------------------------------------------------------------
+    Helpers
+-----------------------------------------------------------------------------------------*/
+
+namespace
+{
+	// Piecewise linear curve through sorted (age, value) keys, held flat outside them
+	template <typename T, typename Lerp>
+	T EvaluateCurve(const std::vector<std::pair<float, T>>& keys, float age, const T& none, Lerp lerp)
+	{
+		if (keys.empty())  return none;
+		if (age <= keys.front().first)  return keys.front().second;
+		if (age >= keys.back().first)   return keys.back().second;
+
+		unsigned int i = 1;
+		while (keys[i].first < age) ++i;
+		const auto& a = keys[i - 1];
+		const auto& b = keys[i];
+		const auto t = b.first > a.first ? (age - a.first) / (b.first - a.first) : 1.0f;
+		return lerp(a.second, b.second, t);
+	}
+
+	uint32_t PackColour(const ColourRGBA& colour)
+	{
+		const auto channel = [](float c) { return static_cast<uint32_t>(std::min(std::max(c, 0.0f), 1.0f) * 255.0f + 0.5f); };
+		return channel(colour.r) | channel(colour.g) << 8 | channel(colour.b) << 16 | channel(colour.a) << 24;
+	}
+
+	// Half floats for the GPU (f16tof32 in HLSL), four at a time, each half in the low 16 bits of its lane. Unlike
+	// FloatToHalf in VertexCompression.h, used for single values, values too small for a normal half become 0, values
+	// too large become the largest half (65504) rather than infinity, and ties round up rather than to even. That
+	// keeps it to a few instructions, and a difference of one unit in the last place doesn't show in a size or angle
+	__m128i FloatToHalf(__m128 value)
+	{
+		const auto bits = _mm_castps_si128(value);
+		const auto sign = _mm_and_si128(_mm_srli_epi32(bits, 16), _mm_set1_epi32(0x8000));
+		const auto magnitude = _mm_min_ps(_mm_andnot_ps(_mm_set1_ps(-0.0f), value), _mm_set1_ps(65504.0f));
+		const auto normal = _mm_castps_si128(_mm_cmpge_ps(magnitude, _mm_set1_ps(6.1035156e-5f)));
+
+		auto half = _mm_add_epi32(_mm_castps_si128(magnitude), _mm_set1_epi32(0x1000 - 0x38000000));
+		half = _mm_and_si128(_mm_srli_epi32(half, 13), normal);
+		return _mm_or_si128(sign, half);
+	}
+}
+
+
+/*-----------------------------------------------------------------------------------------
+    Construction
+-----------------------------------------------------------------------------------------*/
+
+CParticleEmitter::CParticleEmitter(const ParticleEmitterSettings& settings, const CVector3& position)
+	: mSettings(settings), mPosition(position), mBounds(CAABB::Empty())
+{
+	if (mSettings.maxParticles == 0)  throw std::runtime_error("Particle emitter has no room for particles");
+
+	// Any two axes at right angles to the direction will do
+	mSettings.direction = Length(mSettings.direction) > 0.0f ? Normalise(mSettings.direction) : CVector3{ 0, 1, 0 };
+	const auto other = std::abs(mSettings.direction.y) < 0.9f ? CVector3{ 0, 1, 0 } : CVector3{ 1, 0, 0 };
+	mTangent = Normalise(Cross(other, mSettings.direction));
+	mBitangent = Cross(mSettings.direction, mTangent);
+
+	BakeCurves();
+
+	mCapacity = (mSettings.maxParticles + 3) & ~3u;
+	for (auto array : { &mPositionX, &mPositionY, &mPositionZ, &mVelocityX, &mVelocityY, &mVelocityZ,
+	                    &mAge, &mInvLife, &mRotation, &mSpin, &mSize })
+	{
+		array->resize(mCapacity, 0.0f);
+	}
+	mColour.resize(mCapacity, 0);
+}
+
+
+void CParticleEmitter::BakeCurves()
+{
+	const auto lerpColour = [](const ColourRGBA& a, const ColourRGBA& b, float t)
+	{
+		return ColourRGBA(a.r + (b.r - a.r) * t, a.g + (b.g - a.g) * t, a.b + (b.b - a.b) * t, a.a + (b.a - a.a) * t);
+	};
+	const auto lerpSize = [](float a, float b, float t) { return a + (b - a) * t; };
+
+	mMaxSize = 0.0f;
+	for (unsigned int i = 0; i <= CurveTableSize; ++i)
+	{
+		const auto age = static_cast<float>(i) / CurveTableSize;
+
+		auto colour = EvaluateCurve(mSettings.colourKeys, age, ColourRGBA(1, 1, 1, 1), lerpColour);
+
+		// Additive blending adds the colour as it is, so fade it with the alpha here instead
+		if (mSettings.additive)
+		{
+			colour.r *= colour.a;
+			colour.g *= colour.a;
+			colour.b *= colour.a;
+		}
+		mColourTable[i] = PackColour(colour);
+
+		mSizeTable[i] = EvaluateCurve(mSettings.sizeKeys, age, 1.0f, lerpSize);
+		mMaxSize = std::max(mMaxSize, mSizeTable[i]);
+	}
+}
+
+
+float CParticleEmitter::Random()
+{
+	// xorshift, quick and good enough for scattering particles
+	mRandom ^= mRandom << 13;
+	mRandom ^= mRandom >> 17;
+	mRandom ^= mRandom << 5;
+	return (mRandom >> 8) * (1.0f / 16777216.0f);
+}
+
+
+/*-----------------------------------------------------------------------------------------
+    Update
+-----------------------------------------------------------------------------------------*/
+
+CAABB CParticleEmitter::Simulate(unsigned int begin, unsigned int end, float frameTime)
+{
+	const auto dt = _mm_set1_ps(frameTime);
+	const auto damping = _mm_set1_ps(std::max(1.0f - mSettings.drag * frameTime, 0.0f));
+	const auto accelerationX = _mm_set1_ps(mSettings.acceleration.x * frameTime);
+	const auto accelerationY = _mm_set1_ps(mSettings.acceleration.y * frameTime);
+	const auto accelerationZ = _mm_set1_ps(mSettings.acceleration.z * frameTime);
+	const auto one = _mm_set1_ps(1.0f);
+	const auto tableScale = _mm_set1_ps(static_cast<float>(CurveTableSize));
+	const auto twoPi = _mm_set1_ps(2.0f * PI);
+	const auto invTwoPi = _mm_set1_ps(1.0f / (2.0f * PI));
+
+	auto minX = _mm_set1_ps(FLT_MAX), minY = minX, minZ = minX;
+	auto maxX = _mm_set1_ps(-FLT_MAX), maxY = maxX, maxZ = maxX;
+
+	alignas(16) int32_t entries[4];
+	end = std::min(end, mNumParticles);
+	for (auto i = begin; i < end; i += 4)
+	{
+		// Velocity, then position with the new velocity (semi-implicit Euler)
+		const auto vx = _mm_mul_ps(_mm_add_ps(_mm_loadu_ps(&mVelocityX[i]), accelerationX), damping);
+		const auto vy = _mm_mul_ps(_mm_add_ps(_mm_loadu_ps(&mVelocityY[i]), accelerationY), damping);
+		const auto vz = _mm_mul_ps(_mm_add_ps(_mm_loadu_ps(&mVelocityZ[i]), accelerationZ), damping);
+		_mm_storeu_ps(&mVelocityX[i], vx);
+		_mm_storeu_ps(&mVelocityY[i], vy);
+		_mm_storeu_ps(&mVelocityZ[i], vz);
+
+		const auto x = _mm_add_ps(_mm_loadu_ps(&mPositionX[i]), _mm_mul_ps(vx, dt));
+		const auto y = _mm_add_ps(_mm_loadu_ps(&mPositionY[i]), _mm_mul_ps(vy, dt));
+		const auto z = _mm_add_ps(_mm_loadu_ps(&mPositionZ[i]), _mm_mul_ps(vz, dt));
+		_mm_storeu_ps(&mPositionX[i], x);
+		_mm_storeu_ps(&mPositionY[i], y);
+		_mm_storeu_ps(&mPositionZ[i], z);
+
+		// Keep the rotation within -pi to pi so it survives the trip to a half float
+		auto rotation = _mm_add_ps(_mm_loadu_ps(&mRotation[i]), _mm_mul_ps(_mm_loadu_ps(&mSpin[i]), dt));
+		rotation = _mm_sub_ps(rotation, _mm_mul_ps(twoPi, _mm_cvtepi32_ps(_mm_cvtps_epi32(_mm_mul_ps(rotation, invTwoPi)))));
+		_mm_storeu_ps(&mRotation[i], rotation);
+
+		const auto age = _mm_add_ps(_mm_loadu_ps(&mAge[i]), dt);
+		_mm_storeu_ps(&mAge[i], age);
+
+		// Colour and size from the curve tables
+		const auto t = _mm_min_ps(_mm_mul_ps(age, _mm_loadu_ps(&mInvLife[i])), one);
+		_mm_store_si128(reinterpret_cast<__m128i*>(entries), _mm_cvttps_epi32(_mm_mul_ps(t, tableScale)));
+		for (unsigned int lane = 0; lane < 4; ++lane)
+		{
+			mSize[i + lane] = mSizeTable[entries[lane]];
+			mColour[i + lane] = mColourTable[entries[lane]];
+		}
+
+		// The last group may run past the live particles, leave them out of the bounds
+		auto validMask = _mm_castsi128_ps(_mm_set1_epi32(-1));
+		if (i + 4 > end)
+		{
+			const auto lane = _mm_add_epi32(_mm_set1_epi32(static_cast<int>(i)), _mm_set_epi32(3, 2, 1, 0));
+			validMask = _mm_castsi128_ps(_mm_cmplt_epi32(lane, _mm_set1_epi32(static_cast<int>(end))));
+		}
+		const auto select = [&](__m128 value, __m128 otherwise)
+		{
+			return _mm_or_ps(_mm_and_ps(validMask, value), _mm_andnot_ps(validMask, otherwise));
+		};
+		minX = _mm_min_ps(minX, select(x, minX));  maxX = _mm_max_ps(maxX, select(x, maxX));
+		minY = _mm_min_ps(minY, select(y, minY));  maxY = _mm_max_ps(maxY, select(y, maxY));
+		minZ = _mm_min_ps(minZ, select(z, minZ));  maxZ = _mm_max_ps(maxZ, select(z, maxZ));
+	}
+
+	alignas(16) float lanes[6][4];
+	_mm_store_ps(lanes[0], minX);  _mm_store_ps(lanes[1], minY);  _mm_store_ps(lanes[2], minZ);
+	_mm_store_ps(lanes[3], maxX);  _mm_store_ps(lanes[4], maxY);  _mm_store_ps(lanes[5], maxZ);
+
+	auto bounds = CAABB::Empty();
+	for (unsigned int lane = 0; lane < 4; ++lane)
+	{
+		bounds.min.x = std::min(bounds.min.x, lanes[0][lane]);
+		bounds.min.y = std::min(bounds.min.y, lanes[1][lane]);
+		bounds.min.z = std::min(bounds.min.z, lanes[2][lane]);
+		bounds.max.x = std::max(bounds.max.x, lanes[3][lane]);
+		bounds.max.y = std::max(bounds.max.y, lanes[4][lane]);
+		bounds.max.z = std::max(bounds.max.z, lanes[5][lane]);
+	}
+	return bounds;
+}
+
+
+void CParticleEmitter::Emit(float frameTime, const CAABB& simulatedBounds)
+{
+	// Remove dead particles by moving the last one into their place
+	unsigned int i = 0;
+	while (i < mNumParticles)
+	{
+		if (mAge[i] * mInvLife[i] < 1.0f)
+		{
+			++i;
+			continue;
+		}
+
+		const auto last = --mNumParticles;
+		mPositionX[i] = mPositionX[last];  mPositionY[i] = mPositionY[last];  mPositionZ[i] = mPositionZ[last];
+		mVelocityX[i] = mVelocityX[last];  mVelocityY[i] = mVelocityY[last];  mVelocityZ[i] = mVelocityZ[last];
+		mAge[i] = mAge[last];
+		mInvLife[i] = mInvLife[last];
+		mRotation[i] = mRotation[last];
+		mSpin[i] = mSpin[last];
+		mSize[i] = mSize[last];
+		mColour[i] = mColour[last];
+	}
+
+	// Whole particles due this frame, carrying the fraction over to the next
+	unsigned int count = mBurst;
+	mBurst = 0;
+	if (mEmitting)
+	{
+		mSpawnDebt += mSettings.spawnRate * frameTime;
+		const auto due = std::floor(mSpawnDebt);
+		mSpawnDebt -= due;
+		count += static_cast<unsigned int>(due);
+	}
+
+	mBounds = simulatedBounds;
+	Spawn(std::min(count, mSettings.maxParticles - mNumParticles));
+	if (mNumParticles == 0)  mBounds = CAABB::Empty();
+}
+
+
+void CParticleEmitter::Update(float frameTime)
+{
+	Emit(frameTime, Simulate(0, mNumParticles, frameTime));
+}
+
+
+void CParticleEmitter::Spawn(unsigned int count)
+{
+	const auto& s = mSettings;
+	for (auto i = mNumParticles; i < mNumParticles + count; ++i)
+	{
+		// Start position and direction from the shape
+		auto position = mPosition;
+		auto direction = s.direction;
+		switch (s.shape)
+		{
+		case EmitterShape_Point:
+		case EmitterShape_Sphere:
+		{
+			// Even spread over the sphere of directions
+			const auto z = Random() * 2.0f - 1.0f;
+			const auto angle = Random() * 2.0f * PI;
+			const auto r = std::sqrt(1.0f - z * z);
+			direction = { r * std::cos(angle), r * std::sin(angle), z };
+
+			// Cube root so particles are spread evenly through the volume, not bunched in the middle
+			if (s.shape == EmitterShape_Sphere)  position += direction * (s.shapeSize.x * std::cbrt(Random()));
+			break;
+		}
+
+		case EmitterShape_Box:
+			position += CVector3{ (Random() * 2.0f - 1.0f) * s.shapeSize.x,
+			                      (Random() * 2.0f - 1.0f) * s.shapeSize.y,
+			                      (Random() * 2.0f - 1.0f) * s.shapeSize.z };
+			break;
+
+		case EmitterShape_Cone:
+		{
+			// Evenly across the base disc
+			const auto radius = s.shapeSize.x * std::sqrt(Random());
+			const auto baseAngle = Random() * 2.0f * PI;
+			position += (mTangent * std::cos(baseAngle) + mBitangent * std::sin(baseAngle)) * radius;
+
+			// Evenly over the cap of directions within the cone angle
+			const auto cosAngle = 1.0f - Random() * (1.0f - std::cos(s.shapeSize.y));
+			const auto sinAngle = std::sqrt(std::max(1.0f - cosAngle * cosAngle, 0.0f));
+			const auto around = Random() * 2.0f * PI;
+			direction = s.direction * cosAngle + (mTangent * std::cos(around) + mBitangent * std::sin(around)) * sinAngle;
+			break;
+		}
+		}
+
+		const auto velocity = direction * (s.minSpeed + (s.maxSpeed - s.minSpeed) * Random());
+		mPositionX[i] = position.x;  mPositionY[i] = position.y;  mPositionZ[i] = position.z;
+		mVelocityX[i] = velocity.x;  mVelocityY[i] = velocity.y;  mVelocityZ[i] = velocity.z;
+
+		mAge[i] = 0.0f;
+		mInvLife[i] = 1.0f / std::max(s.minLife + (s.maxLife - s.minLife) * Random(), 0.001f);
+		mRotation[i] = (Random() * 2.0f - 1.0f) * PI;
+		mSpin[i] = s.minSpin + (s.maxSpin - s.minSpin) * Random();
+		mSize[i] = mSizeTable[0];
+		mColour[i] = mColourTable[0];
+
+		mBounds.Encapsulate(position);
+	}
+	mNumParticles += count;
+}
+
+
+/*-----------------------------------------------------------------------------------------
+    Output
+-----------------------------------------------------------------------------------------*/
+
+void CParticleEmitter::ViewDepths(unsigned int begin, unsigned int end, const CVector3& cameraPosition,
+                                  const CVector3& cameraForward, float* depths) const
+{
+	const auto forwardX = _mm_set1_ps(cameraForward.x);
+	const auto forwardY = _mm_set1_ps(cameraForward.y);
+	const auto forwardZ = _mm_set1_ps(cameraForward.z);
+	const auto cameraDepth = Dot(cameraPosition, cameraForward);
+	const auto cameraDepths = _mm_set1_ps(cameraDepth);
+
+	end = std::min(end, mNumParticles);
+	auto i = begin;
+	for (; i + 4 <= end; i += 4)
+	{
+		auto depth = _mm_mul_ps(_mm_loadu_ps(&mPositionX[i]), forwardX);
+		depth = _mm_add_ps(depth, _mm_mul_ps(_mm_loadu_ps(&mPositionY[i]), forwardY));
+		depth = _mm_add_ps(depth, _mm_mul_ps(_mm_loadu_ps(&mPositionZ[i]), forwardZ));
+		_mm_storeu_ps(depths + i, _mm_sub_ps(depth, cameraDepths));
+	}
+
+	for (; i < end; ++i)
+	{
+		depths[i] = mPositionX[i] * cameraForward.x + mPositionY[i] * cameraForward.y + mPositionZ[i] * cameraForward.z - cameraDepth;
+	}
+}
+
+
+void CParticleEmitter::WriteInstances(unsigned int begin, unsigned int end, const uint32_t* order, ParticleInstance* instances) const
+{
+	static_assert(sizeof(ParticleInstance) == 5 * sizeof(float), "ParticleInstance must be five 32-bit values");
+
+	end = std::min(end, mNumParticles);
+	if (order)
+	{
+		// Sorted, only the values that go into an instance are gathered
+		for (auto i = begin; i < end; ++i)
+		{
+			const auto particle = order[i];
+			auto& instance = *instances++;
+			instance.x = mPositionX[particle];
+			instance.y = mPositionY[particle];
+			instance.z = mPositionZ[particle];
+			instance.sizeRotation = FloatToHalf(mSize[particle]) | static_cast<uint32_t>(FloatToHalf(mRotation[particle])) << 16;
+			instance.colour = mColour[particle];
+		}
+		return;
+	}
+
+	// Four particles at a time: transpose x, y, z and the halves into the first 16 bytes of each instance, then
+	// add the colours
+	auto i = begin;
+	for (; i + 4 <= end; i += 4)
+	{
+		auto x = _mm_loadu_ps(&mPositionX[i]);
+		auto y = _mm_loadu_ps(&mPositionY[i]);
+		auto z = _mm_loadu_ps(&mPositionZ[i]);
+		const auto halves = _mm_or_si128(FloatToHalf(_mm_loadu_ps(&mSize[i])), _mm_slli_epi32(FloatToHalf(_mm_loadu_ps(&mRotation[i])), 16));
+		auto sizeRotation = _mm_castsi128_ps(halves);
+		_MM_TRANSPOSE4_PS(x, y, z, sizeRotation);
+
+		auto out = reinterpret_cast<float*>(instances);
+		_mm_storeu_ps(out,      x);
+		_mm_storeu_ps(out + 5,  y);
+		_mm_storeu_ps(out + 10, z);
+		_mm_storeu_ps(out + 15, sizeRotation);
+		instances[0].colour = mColour[i];
+		instances[1].colour = mColour[i + 1];
+		instances[2].colour = mColour[i + 2];
+		instances[3].colour = mColour[i + 3];
+		instances += 4;
+	}
+
+	for (; i < end; ++i)
+	{
+		auto& instance = *instances++;
+		instance.x = mPositionX[i];
+		instance.y = mPositionY[i];
+		instance.z = mPositionZ[i];
+		instance.sizeRotation = FloatToHalf(mSize[i]) | static_cast<uint32_t>(FloatToHalf(mRotation[i])) << 16;
+		instance.colour = mColour[i];
+	}
+}
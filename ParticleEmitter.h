@@ -1,17 +1,170 @@
+//--------------------------------------------------------------------------------------
+// Particle emitter - a pool of particles spawned from a shape and moved each frame
+//--------------------------------------------------------------------------------------
+// Code in .cpp file
+//
+// Particles are not objects: an emitter holds all of its particles as structure-of-arrays (all the x positions,
+// then all the y positions...) in a pool of fixed capacity, so updating them works on four at a time with SSE.
+// The pool is allocated once. Spawning writes to the end of the arrays and a dead particle is replaced by the last
+// one, so nothing is allocated or freed while the emitter runs.
+//
+// Each frame particles are moved by their velocity, which is changed by a constant acceleration (e.g. gravity)
+// and slowed by drag. Their colour and size follow curves over their life, given as keys at ages from 0 (spawn)
+// to 1 (death) and baked into tables when the emitter is created. The update can be split into ranges of the pool
+// so that a large emitter is spread over several threads. The result is written out as compact instances, one per
+// billboard, for CParticleSystem to render. No graphics API is used here.
+
 #pragma once
-#include "GameObject.h"
-class CParticleEmitter :
-    public CGameObject
+
+#include "CVector3.h"
+#include "BoundingVolumes.h"
+#include "ColourRGBA.h"
+
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+
+// Where new particles appear and which way they go
+enum EEmitterShape
+{
+	EmitterShape_Point,  // From the emitter position in any direction
+	EmitterShape_Sphere, // Anywhere inside a sphere of radius shapeSize.x, moving outwards
+	EmitterShape_Box,    // Anywhere inside a box of half size shapeSize, moving along the emitter direction
+	EmitterShape_Cone,   // From a disc of radius shapeSize.x, within shapeSize.y radians of the emitter direction
+};
+
+struct ParticleEmitterSettings
+{
+	unsigned int  maxParticles = 1000; // Size of the pool, no more particles are spawned while it is full
+	float         spawnRate = 100.0f;  // Particles per second
+
+	EEmitterShape shape = EmitterShape_Point;
+	CVector3      shapeSize = { 1.0f, 0.5f, 1.0f };
+	CVector3      direction = { 0.0f, 1.0f, 0.0f }; // World space, normalised by the emitter
+
+	// Ranges that each new particle picks a random value from
+	float minLife = 1.0f,  maxLife = 2.0f;   // Seconds
+	float minSpeed = 1.0f, maxSpeed = 2.0f;  // Units per second
+	float minSpin = 0.0f,  maxSpin = 0.0f;   // Radians per second
+
+	CVector3 acceleration = { 0.0f, 0.0f, 0.0f }; // Units per second squared, e.g. gravity
+	float    drag = 0.0f;                         // Fraction of the velocity lost per second
+
+	// Keys of (age 0 - 1, value), sorted by age. Values are interpolated between keys and held before the first and
+	// after the last. No keys means white / size 1
+	std::vector<std::pair<float, ColourRGBA>> colourKeys;
+	std::vector<std::pair<float, float>>      sizeKeys; // Width of the billboard in world units
+
+	// Rendering, used by CParticleSystem
+	std::string texture;
+	bool        additive = false; // Added to the scene (fire, sparks) rather than alpha blended (smoke)
+};
+
+
+// One billboard as sent to the GPU, must match ParticleInstance in Particle_vs.hlsl
+struct ParticleInstance
+{
+	float    x, y, z;
+	uint32_t sizeRotation; // Half floats, size in the low 16 bits and rotation (radians) in the high 16 bits
+	uint32_t colour;       // RGBA 8 bits each, red in the low 8 bits
+};
+
+
+class CParticleEmitter
 {
 public:
+	// Throws a std::runtime_error if maxParticles is 0
+	CParticleEmitter(const ParticleEmitterSettings& settings, const CVector3& position);
+
+	const ParticleEmitterSettings& Settings() const { return mSettings; }
+
+	const CVector3& Position() const { return mPosition; }
+	void            SetPosition(const CVector3& position) { mPosition = position; }
+
+	// Stop or restart continuous spawning. Particles already alive carry on
+	bool IsEmitting() const { return mEmitting; }
+	void SetEmitting(bool emitting) { mEmitting = emitting; }
+
+	// Spawn a number of particles at the next update, as far as the pool has room
+	void Burst(unsigned int count) { mBurst += count; }
+
+	unsigned int NumParticles() const { return mNumParticles; }
+	unsigned int MaxParticles() const { return mSettings.maxParticles; }
+
+	// Box around the live particles' positions as of the last update, not including their size. Invalid if empty
+	const CAABB& Bounds() const { return mBounds; }
+
+	// Largest billboard size on the size curve, to grow the bounds by when culling
+	float MaxSize() const { return mMaxSize; }
+
+
+	//-------------------------------------
+	// Update
+	//-------------------------------------
 
+	// Move, age and colour the particles in [begin, end) of the pool. begin and end must be multiples of 4 (except that
+	// end may be NumParticles) so that ranges of the same emitter can be simulated on different threads at once.
+	// Returns the bounds of the range's particles after the move
+	CAABB Simulate(unsigned int begin, unsigned int end, float frameTime);
 
+	// Remove the particles that have reached the end of their life, then spawn new ones. Call after all ranges have been
+	// simulated, passing their combined bounds, which are grown by the new particles
+	void Emit(float frameTime, const CAABB& simulatedBounds);
+
+	// Simulate the whole pool and then emit, on the calling thread
+	void Update(float frameTime);
+
+	// View space depth (distance along the camera's forward axis) of particles [begin, end), for sorting. Safe to call
+	// for different ranges on different threads at once
+	void ViewDepths(unsigned int begin, unsigned int end, const CVector3& cameraPosition, const CVector3& cameraForward,
+	                float* depths) const;
+
+	// Write billboards [begin, end) in pool order, or if order isn't nullptr in that order (a permutation of
+	// [0, NumParticles) such as one from a depth sort, billboard i is particle order[i]). Safe to call for different
+	// ranges on different threads at once
+	void WriteInstances(unsigned int begin, unsigned int end, const uint32_t* order, ParticleInstance* instances) const;
+
+
+//-------------------------------------
+// Private members
+//-------------------------------------
 private:
+	// Entries in the colour and size tables across the life of a particle
+	static const unsigned int CurveTableSize = 256;
 
-    int mNumParticle;
-    float mAlpha;
-    float mScale;
-    float mRotation;
+	void BakeCurves();
+	void Spawn(unsigned int count);
 
-};
+	// Random number in [0, 1)
+	float Random();
+
+	ParticleEmitterSettings mSettings;
+	CVector3 mPosition;
+	CVector3 mTangent, mBitangent; // At right angles to the (normalised) direction, for the cone
+	bool     mEmitting = true;
+	float    mSpawnDebt = 0.0f; // Fraction of a particle left over from the last spawn
+	unsigned int mBurst = 0;
+	uint32_t mRandom = 0x9E3779B9u;
+
+	CAABB mBounds;
+	float mMaxSize = 1.0f;
 
+	// Colour as packed RGBA and size at evenly spaced ages, with a copy of the last entry for age 1 exactly
+	uint32_t mColourTable[CurveTableSize + 1];
+	float    mSizeTable[CurveTableSize + 1];
+
+	// Pool, one array per value, each sized to maxParticles rounded up to a multiple of 4 so the SSE loops can run
+	// past the last particle
+	unsigned int mNumParticles = 0;
+	unsigned int mCapacity = 0;
+	std::vector<float> mPositionX, mPositionY, mPositionZ;
+	std::vector<float> mVelocityX, mVelocityY, mVelocityZ;
+	std::vector<float> mAge;
+	std::vector<float> mInvLife;  // 1 / life, so age * mInvLife is 0 - 1 over the life
+	std::vector<float> mRotation;
+	std::vector<float> mSpin;
+	std::vector<float>    mSize;   // From the curves, updated by Simulate
+	std::vector<uint32_t> mColour;
+};
@@ -0,0 +1,249 @@
+//--------------------------------------------------------------------------------------
+// Particle system - updates all particle emitters and draws their particles as billboards
+//--------------------------------------------------------------------------------------
+
+#include "ParticleSystem.h"
+#include "Common.h"
+#include "Shader.h"
+#include "State.h"
+#include "StateCache.h"
+#include "ResourceCache.h"
+#include "JobSystem.h"
+
+#include <algorithm>
+#include <limits>
+#include <stdexcept>
+
+
+CParticleSystem::~CParticleSystem()
+{
+	for (auto& e : mEmitters)
+	{
+		if (e.textureSRV) e.textureSRV->Release();
+		if (e.texture)    e.texture->Release();
+	}
+}
+
+
+CParticleEmitter* CParticleSystem::AddEmitter(const ParticleEmitterSettings& settings, const CVector3& position)
+{
+	Emitter e;
+	if (!LoadSharedTexture(settings.texture, &e.texture, &e.textureSRV))
+	{
+		throw std::runtime_error("Error loading particle texture " + settings.texture);
+	}
+
+	try
+	{
+		e.emitter = std::make_unique<CParticleEmitter>(settings, position);
+	}
+	catch (...)
+	{
+		if (e.textureSRV) e.textureSRV->Release();
+		if (e.texture)    e.texture->Release();
+		throw;
+	}
+
+	mEmitters.push_back(std::move(e));
+	return mEmitters.back().emitter.get();
+}
+
+
+unsigned int CParticleSystem::NumParticles() const
+{
+	unsigned int count = 0;
+	for (auto& e : mEmitters)  count += e.emitter->NumParticles();
+	return count;
+}
+
+
+/*-----------------------------------------------------------------------------------------
+    Update
+-----------------------------------------------------------------------------------------*/
+
+void CParticleSystem::Update(float frameTime)
+{
+	// Split every pool into ranges, remembering where each emitter's ranges start
+	mRanges.clear();
+	mEmitterRanges.clear();
+	for (unsigned int i = 0; i < mEmitters.size(); ++i)
+	{
+		mEmitterRanges.push_back(static_cast<unsigned int>(mRanges.size()));
+
+		const auto numParticles = mEmitters[i].emitter->NumParticles();
+		for (unsigned int begin = 0; begin < numParticles; begin += RangeSize)
+		{
+			mRanges.push_back({ i, begin, std::min(begin + RangeSize, numParticles), 0 });
+		}
+	}
+	mEmitterRanges.push_back(static_cast<unsigned int>(mRanges.size()));
+	mRangeBounds.resize(mRanges.size());
+
+	// Move the particles, the bulk of the work, across all threads
+	ParallelFor(static_cast<unsigned int>(mRanges.size()), 1, [&](unsigned int begin, unsigned int end)
+	{
+		for (auto r = begin; r < end; ++r)
+		{
+			const auto& range = mRanges[r];
+			mRangeBounds[r] = mEmitters[range.emitter].emitter->Simulate(range.begin, range.end, frameTime);
+		}
+	});
+
+	// Then remove and spawn particles, which changes the whole pool so is done one thread per emitter
+	ParallelFor(static_cast<unsigned int>(mEmitters.size()), 1, [&](unsigned int begin, unsigned int end)
+	{
+		for (auto i = begin; i < end; ++i)
+		{
+			auto bounds = CAABB::Empty();
+			for (auto r = mEmitterRanges[i]; r < mEmitterRanges[i + 1]; ++r)  bounds.Encapsulate(mRangeBounds[r]);
+
+			mEmitters[i].emitter->Emit(frameTime, bounds);
+		}
+	});
+}
+
+
+/*-----------------------------------------------------------------------------------------
+    Rendering
+-----------------------------------------------------------------------------------------*/
+
+void CParticleSystem::Prepare(const CFrustum& frustum, const CMatrix4x4& cameraMatrix)
+{
+	const auto cameraPosition = cameraMatrix.GetPosition();
+	const auto cameraForward = Normalise(cameraMatrix.GetZAxis());
+
+	// Find the emitters on screen
+	mVisibleEmitters.clear();
+	mVisibleDepths.clear();
+	for (unsigned int i = 0; i < mEmitters.size(); ++i)
+	{
+		const auto& emitter = *mEmitters[i].emitter;
+		if (emitter.NumParticles() == 0)  continue;
+
+		// A billboard can reach past its centre by half its diagonal
+		auto bounds = emitter.Bounds();
+		bounds.Inflate(emitter.MaxSize() * 0.7072f);
+		if (!frustum.Intersects(bounds))  continue;
+
+		mVisibleEmitters.push_back(i);
+		mVisibleDepths.push_back(Dot(bounds.Centre() - cameraPosition, cameraForward));
+	}
+	mNumRendered = 0;
+	mNumSorted = 0;
+	mNextDraw = 0;
+	mDrawEmitters.clear();
+	mDrawInstances.clear();
+	mDrawDepths.clear();
+	if (mVisibleEmitters.empty())  return;
+
+	// Draw them back to front, each with a block of the instance buffer
+	for (auto visible : mEmitterSorter.Sort(mVisibleDepths.data(), static_cast<unsigned int>(mVisibleEmitters.size())))
+	{
+		mDrawEmitters.push_back(mVisibleEmitters[visible]);
+		mDrawInstances.push_back(mNumRendered);
+		mDrawDepths.push_back(mVisibleDepths[visible]);
+		mNumRendered += mEmitters[mVisibleEmitters[visible]].emitter->NumParticles();
+	}
+
+	// Depths of the particles of blended emitters across all threads, then sort each emitter (the sorts are parallel)
+	mRanges.clear();
+	for (auto i : mDrawEmitters)
+	{
+		auto& e = mEmitters[i];
+		if (e.emitter->Settings().additive)  continue;
+
+		const auto numParticles = e.emitter->NumParticles();
+		e.depths.resize(numParticles);
+		for (unsigned int begin = 0; begin < numParticles; begin += RangeSize)
+		{
+			mRanges.push_back({ i, begin, std::min(begin + RangeSize, numParticles), 0 });
+		}
+	}
+
+	ParallelFor(static_cast<unsigned int>(mRanges.size()), 1, [&](unsigned int begin, unsigned int end)
+	{
+		for (auto r = begin; r < end; ++r)
+		{
+			const auto& range = mRanges[r];
+			auto& e = mEmitters[range.emitter];
+			e.emitter->ViewDepths(range.begin, range.end, cameraPosition, cameraForward, e.depths.data());
+		}
+	});
+
+	for (auto i : mDrawEmitters)
+	{
+		auto& e = mEmitters[i];
+		if (e.emitter->Settings().additive)  continue;
+
+		e.sorter.Sort(e.depths.data(), e.emitter->NumParticles());
+		mNumSorted += e.emitter->NumParticles();
+	}
+
+	mRanges.clear();
+	for (unsigned int d = 0; d < mDrawEmitters.size(); ++d)
+	{
+		const auto numParticles = mEmitters[mDrawEmitters[d]].emitter->NumParticles();
+		for (unsigned int begin = 0; begin < numParticles; begin += RangeSize)
+		{
+			mRanges.push_back({ mDrawEmitters[d], begin, std::min(begin + RangeSize, numParticles), mDrawInstances[d] + begin });
+		}
+	}
+
+	// Write the particles straight into the mapped buffer from all threads
+	auto instances = static_cast<ParticleInstance*>(mInstances.BeginWrite(mNumRendered));
+	if (!instances)
+	{
+		mNextDraw = static_cast<unsigned int>(mDrawEmitters.size());
+		return;
+	}
+
+	ParallelFor(static_cast<unsigned int>(mRanges.size()), 1, [&](unsigned int begin, unsigned int end)
+	{
+		for (auto r = begin; r < end; ++r)
+		{
+			// Blended emitters are written through their sorted order, reading only what goes into the instances
+			const auto& range = mRanges[r];
+			const auto& e = mEmitters[range.emitter];
+			const auto order = e.emitter->Settings().additive ? nullptr : e.sorter.Order().data();
+			e.emitter->WriteInstances(range.begin, range.end, order, instances + range.firstInstance);
+		}
+	});
+	mInstances.EndWrite();
+}
+
+
+float CParticleSystem::NextDepth() const
+{
+	return mNextDraw < mDrawDepths.size() ? mDrawDepths[mNextDraw] : std::numeric_limits<float>::lowest();
+}
+
+
+void CParticleSystem::RenderBehind(float depth)
+{
+	if (NextDepth() <= depth)  return;
+
+	// No vertex buffer, the vertex shader reads the instances
+	gStateCache.SetInputLayout(nullptr);
+	gStateCache.SetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+	gStateCache.SetVertexShader(gParticleVertexShader);
+	gStateCache.SetGeometryShader(nullptr);
+	gStateCache.SetPixelShader(gParticlePixelShader);
+	auto view = mInstances.View();
+	gD3DContext->VSSetShaderResources(ParticleBufferSlot, 1, &view);
+
+	// Blended over the scene, hidden by opaque objects but not by each other, seen from both sides
+	gStateCache.SetDepthStencilState(gDepthReadOnlyState);
+	gStateCache.SetRasterizerState(gCullNoneState);
+	gD3DContext->PSSetSamplers(ParticleSamplerSlot, 1, &gTrilinearSampler);
+
+	for (; mNextDraw < mDrawEmitters.size() && mDrawDepths[mNextDraw] > depth; ++mNextDraw)
+	{
+		const auto d = mNextDraw;
+		const auto& e = mEmitters[mDrawEmitters[d]];
+		gStateCache.SetBlendState(e.emitter->Settings().additive ? gAdditiveBlendingState : gAlphaBlendingState);
+		gStateCache.SetPSShaderResource(0, e.textureSRV);
+
+		// Six vertices per particle. SV_VertexID counts from the start vertex, so it finds the right instance
+		gD3DContext->Draw(e.emitter->NumParticles() * 6, mDrawInstances[d] * 6);
+	}
+}
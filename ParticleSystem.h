@@ -0,0 +1,112 @@
+//--------------------------------------------------------------------------------------
+// Particle system - updates all particle emitters and draws their particles as billboards
+//--------------------------------------------------------------------------------------
+// Code in .cpp file
+//
+// Emitters are split into ranges of a few thousand particles which are simulated on all threads at once, so one
+// large emitter is spread across cores as well as many small ones. Particles are then removed and spawned one
+// emitter per thread. To render, the emitters on screen write their particles straight into a single dynamic
+// structured buffer of ParticleInstance, again in parallel ranges, and each emitter is drawn with one Draw call.
+// There is no vertex buffer: the vertex shader builds two triangles facing the camera from the vertex number.
+//
+// Emitters are drawn back to front, in among the transparent objects by view depth (see
+// CGameObjectManager::RenderObjects), and the particles of alpha blended emitters are sorted back to front too (see
+// DepthSorter.h). Each emitter's sorter keeps its order from frame to frame, so the next sort starts nearly sorted,
+// and the particles are written out through that order in parallel ranges. The pools themselves are never reordered.
+// Additive particles look the same in any order so aren't sorted.
+
+#pragma once
+
+#include "ParticleEmitter.h"
+#include "DepthSorter.h"
+#include "StructuredBuffer.h"
+
+#include <d3d11.h>
+#include <memory>
+#include <vector>
+
+
+class CParticleSystem
+{
+public:
+	CParticleSystem() : mInstances(sizeof(ParticleInstance), true) {}
+	~CParticleSystem();
+
+	CParticleSystem(const CParticleSystem&) = delete;
+	CParticleSystem& operator=(const CParticleSystem&) = delete;
+
+	// Add an emitter at a world position and load its texture (settings.texture). The system owns the emitter.
+	// Throws a std::runtime_error if the texture can't be loaded
+	CParticleEmitter* AddEmitter(const ParticleEmitterSettings& settings, const CVector3& position);
+
+	unsigned int      NumEmitters() const { return static_cast<unsigned int>(mEmitters.size()); }
+	CParticleEmitter* GetEmitter(unsigned int i) { return mEmitters[i].emitter.get(); }
+
+	// Live particles in all emitters, and how many were drawn and depth sorted by the last Render
+	unsigned int NumParticles() const;
+	unsigned int NumRendered() const { return mNumRendered; }
+	unsigned int NumSorted() const { return mNumSorted; }
+
+	// Move, kill and spawn the particles of every emitter, spread across the job system's threads
+	void Update(float frameTime);
+
+	// Find the emitters inside the frustum, seen from a camera with the given world matrix, sort them and write their
+	// particles into the instance buffer ready for RenderBehind. Call once per camera before drawing
+	void Prepare(const CFrustum& frustum, const CMatrix4x4& cameraMatrix);
+
+	// View depth of the next emitter RenderBehind will draw, the lowest float if all the prepared ones have been drawn
+	float NextDepth() const;
+
+	// Draw the prepared emitters not drawn yet whose view depth is greater than the given one, back to front. The
+	// per-frame constants must hold the camera given to Prepare. Particles test against the depth buffer but don't
+	// write to it, so draw them after the opaque objects. Pass the lowest float to draw all that are left
+	void RenderBehind(float depth);
+
+
+//-------------------------------------
+// Private members
+//-------------------------------------
+private:
+	// Particles in each range of work for the threads, a multiple of 4 (see CParticleEmitter::Simulate)
+	static const unsigned int RangeSize = 8192;
+
+	// Vertex shader slot of the instance buffer, t1 in Particle_vs.hlsl
+	static const UINT ParticleBufferSlot = 1;
+
+	// Pixel shader slot of the texture sampler, s2 in Particle_ps.hlsl. The objects drawn in between use s0 and s1
+	static const UINT ParticleSamplerSlot = 2;
+
+	struct Emitter
+	{
+		std::unique_ptr<CParticleEmitter> emitter;
+		ID3D11Resource*           texture = nullptr;
+		ID3D11ShaderResourceView* textureSRV = nullptr;
+
+		// Blended emitters only: depths of the particles and their sorter
+		std::vector<float> depths;
+		CDepthSorter       sorter;
+	};
+	std::vector<Emitter> mEmitters;
+
+	// Working data kept to avoid allocations every frame
+	struct Range
+	{
+		unsigned int emitter;
+		unsigned int begin, end;    // Particles in the emitter's pool
+		unsigned int firstInstance; // When rendering, where the range's particles go in the instance buffer
+	};
+	std::vector<Range>        mRanges;
+	std::vector<CAABB>        mRangeBounds;
+	std::vector<unsigned int> mEmitterRanges; // First range of each emitter and the end, when updating
+	std::vector<unsigned int> mVisibleEmitters; // Emitters on screen and their depths
+	std::vector<float>        mVisibleDepths;
+	CDepthSorter              mEmitterSorter;
+	std::vector<unsigned int> mDrawEmitters;    // Emitters on screen back to front, the first instance and depth of each
+	std::vector<unsigned int> mDrawInstances;
+	std::vector<float>        mDrawDepths;
+	unsigned int              mNextDraw = 0;    // First of them RenderBehind hasn't drawn yet
+
+	CStructuredBuffer mInstances;
+	unsigned int      mNumRendered = 0;
+	unsigned int      mNumSorted = 0;
+};
@@ -3,34 +3,18 @@
 #include "Common.h"
 #include "State.h"
 
-void CPlant::Render(bool basicGeometry)
+void CPlant::GetPipelineStates(PipelineState& pipeline) const
 {
-	if (basicGeometry)
-	{
-		CGameObject::Render(basicGeometry);
-	}
-	else
-	{
-		//store previous settings
-		ID3D11BlendState* pBlendState = nullptr;
-		ID3D11DepthStencilState* pBPSState = nullptr;
-		ID3D11RasterizerState* pRSState = nullptr;
-
-		gD3DContext->OMGetBlendState(&pBlendState, nullptr, nullptr);
-		gD3DContext->OMGetDepthStencilState(&pBPSState, 0);
-		gD3DContext->RSGetState(&pRSState);
-
-		// additive blending, read-only depth buffer and no culling (standard set-up for blending)
-		gD3DContext->OMSetBlendState(gNoBlendingState, NULL, 0xffffff);
-		gD3DContext->OMSetDepthStencilState(gUseDepthBufferState, 0);
-		gD3DContext->RSSetState(gCullNoneState);
-
-		CGameObject::Render(basicGeometry);
+	// no blending, normal depth buffer and no culling (leaves are single sided quads). Leaves are cut out of their
+	// quads by the alpha tested pixel shader, so they stay opaque and keep their depth writes
+	pipeline.blendState = gNoBlendingState;
+	pipeline.depthStencilState = gUseDepthBufferState;
+	pipeline.rasterizerState = gCullNoneState;
+}
 
-		//set preavious states
-		gD3DContext->OMSetBlendState(pBlendState, nullptr, 0xffffff);
-		gD3DContext->OMSetDepthStencilState(pBPSState, 0);
-		gD3DContext->RSSetState(pRSState);
-		
-	}
+std::string& CPlant::AlphaTestedPixelShader(std::string& pixelShader)
+{
+	if      (pixelShader == "PixelLighting_ps")  pixelShader = "PixelLightingAlphaTest_ps";
+	else if (pixelShader == "PBR_ps")            pixelShader = "PBRAlphaTest_ps";
+	return pixelShader;
 }
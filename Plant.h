@@ -8,12 +8,17 @@ class CPlant : public CGameObject
 {
 public:
 
-	CPlant(std::string mesh, std::string name,
+	CPlant(const std::string& mesh, const std::string& name,
 	       const std::string& diffuse, std::string& vertexShader, std::string& pixelShader,
 		CVector3 position = { 0,0,0 }, CVector3 rotation = { 0,0,0 }, float scale = 1)
-		: CGameObject(std::move(mesh), std::move(name),diffuse,vertexShader,pixelShader, position, rotation, scale) {}
+		: CGameObject(mesh, name,diffuse,vertexShader,AlphaTestedPixelShader(pixelShader), position, rotation, scale) {}
 
-	void Render(bool basicGeometry = false) override;
+protected:
+	void GetPipelineStates(PipelineState& pipeline) const override;
+
+private:
+	// Swap a pixel shader name for its alpha tested variant (ALPHA_TEST defined), if it has one, in place
+	static std::string& AlphaTestedPixelShader(std::string& pixelShader);
 
 };
 
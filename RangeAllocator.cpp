@@ -0,0 +1,93 @@
+//--------------------------------------------------------------------------------------
+// Range allocator - hands out ranges of elements from a fixed size array
+//--------------------------------------------------------------------------------------
+
+#include "RangeAllocator.h"
+
+
+CRangeAllocator::CRangeAllocator(unsigned int size)
+	: mSize(size)
+{
+	Clear();
+}
+
+void CRangeAllocator::Clear()
+{
+	mFreeByStart.clear();
+	mFreeBySize.clear();
+	mFreeSpace = 0;
+	if (mSize > 0) AddFree(0, mSize);
+}
+
+
+/*-----------------------------------------------------------------------------------------
+    Allocation
+-----------------------------------------------------------------------------------------*/
+
+bool CRangeAllocator::Allocate(unsigned int count, unsigned int& start)
+{
+	if (count == 0)
+	{
+		start = 0;
+		return true;
+	}
+
+	// Smallest free range of at least count elements
+	const auto best = mFreeBySize.lower_bound({ count, 0 });
+	if (best == mFreeBySize.end()) return false;
+
+	start = best->second;
+	const auto rangeCount = best->first;
+	RemoveFree(mFreeByStart.find(start));
+
+	// The rest of the range stays free
+	if (rangeCount > count) AddFree(start + count, rangeCount - count);
+	return true;
+}
+
+void CRangeAllocator::Free(unsigned int start, unsigned int count)
+{
+	if (count == 0) return;
+
+	// Merge with the free range after this one
+	auto next = mFreeByStart.find(start + count);
+	if (next != mFreeByStart.end())
+	{
+		count += next->second;
+		RemoveFree(next);
+	}
+
+	// And the one before
+	auto previous = mFreeByStart.lower_bound(start);
+	if (previous != mFreeByStart.begin())
+	{
+		--previous;
+		if (previous->first + previous->second == start)
+		{
+			start = previous->first;
+			count += previous->second;
+			RemoveFree(previous);
+		}
+	}
+
+	AddFree(start, count);
+}
+
+
+/*-----------------------------------------------------------------------------------------
+    Free list
+-----------------------------------------------------------------------------------------*/
+
+void CRangeAllocator::AddFree(unsigned int start, unsigned int count)
+{
+	mFreeByStart.emplace(start, count);
+	mFreeBySize.emplace(count, start);
+	mFreeSpace += count;
+}
+
+void CRangeAllocator::RemoveFree(std::map<unsigned int, unsigned int>::iterator range)
+{
+	mFreeSpace -= range->second;
+	mFreeBySize.erase({ range->second, range->first });
+	mFreeByStart.erase(range);
+}
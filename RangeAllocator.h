@@ -0,0 +1,54 @@
+//--------------------------------------------------------------------------------------
+// Range allocator - hands out ranges of elements from a fixed size array
+//--------------------------------------------------------------------------------------
+// Code in .cpp file
+//
+// A free list of ranges: allocation takes the smallest free range that fits (best fit, lowest start on a
+// tie, so results are repeatable) and freed ranges are merged with free neighbours so space doesn't
+// fragment into unusable slivers as things are loaded and unloaded. The free ranges are indexed by start
+// and by size, both operations take logarithmic time. Used to share large GPU buffers between many
+// meshes (see GeometryAllocator.h). No graphics API is used here.
+
+#pragma once
+
+#include <map>
+#include <set>
+#include <utility>
+
+
+class CRangeAllocator
+{
+public:
+	// Ranges are taken from [0, size)
+	explicit CRangeAllocator(unsigned int size);
+
+	// Find count free elements in a row. Returns false if there is no free range that big
+	bool Allocate(unsigned int count, unsigned int& start);
+
+	// Return a range from Allocate
+	void Free(unsigned int start, unsigned int count);
+
+	// Free everything
+	void Clear();
+
+	unsigned int Size()      const { return mSize; }
+	unsigned int FreeSpace() const { return mFreeSpace; }
+	bool         Empty()     const { return mFreeSpace == mSize; }
+
+	// Largest range Allocate could currently return
+	unsigned int LargestFreeRange() const { return mFreeBySize.empty() ? 0 : mFreeBySize.rbegin()->first; }
+
+
+//-------------------------------------
+// Private members
+//-------------------------------------
+private:
+	void AddFree(unsigned int start, unsigned int count);
+	void RemoveFree(std::map<unsigned int, unsigned int>::iterator range);
+
+	unsigned int mSize;
+	unsigned int mFreeSpace;
+
+	std::map<unsigned int, unsigned int>            mFreeByStart; // Start -> count
+	std::set<std::pair<unsigned int, unsigned int>> mFreeBySize;  // (count, start)
+};
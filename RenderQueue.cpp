@@ -0,0 +1,126 @@
+//--------------------------------------------------------------------------------------
+// Render queue - draws sorted by a 64-bit key to minimise state changes
+//--------------------------------------------------------------------------------------
+
+#include "RenderQueue.h"
+
+#include <algorithm>
+
+
+namespace
+{
+	// Key layout, most significant bits first
+	//   All draws:    pass (2) | blend (2)
+	//   Not blended:  shader (12) | material (14) | mesh (12) | depth (22)            - grouped by state, front to back
+	//   Blended:      inverted depth (24) | shader (12) | material (12) | mesh (12)   - back to front
+	// Resource ids larger than their field wrap around, which only costs some extra state changes
+	const int PassShift  = 62;
+	const int BlendShift = 60;
+
+	const int OpaqueShaderShift   = 48, OpaqueShaderBits   = 12;
+	const int OpaqueMaterialShift = 34, OpaqueMaterialBits = 14;
+	const int OpaqueMeshShift     = 22, OpaqueMeshBits     = 12;
+	const int OpaqueDepthBits     = 22;
+
+	const int BlendedDepthShift    = 36, BlendedDepthBits    = 24;
+	const int BlendedShaderShift   = 24, BlendedShaderBits   = 12;
+	const int BlendedMaterialShift = 12, BlendedMaterialBits = 12;
+	const int BlendedMeshBits      = 12;
+
+	uint64_t Field(uint32_t value, int bits, int shift)
+	{
+		return (static_cast<uint64_t>(value) & ((1ull << bits) - 1)) << shift;
+	}
+
+	uint32_t QuantiseDepth(float depth, int bits)
+	{
+		depth = std::min(std::max(depth, 0.0f), 1.0f);
+		return static_cast<uint32_t>(depth * static_cast<float>((1u << bits) - 1));
+	}
+}
+
+
+/*-----------------------------------------------------------------------------------------
+    Building the queue
+-----------------------------------------------------------------------------------------*/
+
+uint32_t CRenderQueue::ResourceId(const void* resource)
+{
+	if (resource == nullptr) return 0;
+
+	const auto id = mResourceIds.emplace(resource, static_cast<uint32_t>(mResourceIds.size() + 1));
+	return id.first->second;
+}
+
+uint64_t CRenderQueue::MakeKey(ERenderPass pass, EBlendMode blend, uint32_t shader, uint32_t material, uint32_t mesh, float depth)
+{
+	auto key = Field(pass, 2, PassShift) | Field(blend, 2, BlendShift);
+
+	if (blend == Blend_None)
+	{
+		key |= Field(shader,   OpaqueShaderBits,   OpaqueShaderShift);
+		key |= Field(material, OpaqueMaterialBits, OpaqueMaterialShift);
+		key |= Field(mesh,     OpaqueMeshBits,     OpaqueMeshShift);
+		key |= Field(QuantiseDepth(depth, OpaqueDepthBits), OpaqueDepthBits, 0);
+	}
+	else
+	{
+		const auto maxDepth = (1u << BlendedDepthBits) - 1;
+		key |= Field(maxDepth - QuantiseDepth(depth, BlendedDepthBits), BlendedDepthBits, BlendedDepthShift);
+		key |= Field(shader,   BlendedShaderBits,   BlendedShaderShift);
+		key |= Field(material, BlendedMaterialBits, BlendedMaterialShift);
+		key |= Field(mesh,     BlendedMeshBits,     0);
+	}
+	return key;
+}
+
+
+/*-----------------------------------------------------------------------------------------
+    Sorting
+-----------------------------------------------------------------------------------------*/
+
+// LSD radix sort, one byte per pass. The histograms for all eight bytes are built in a single read of the keys,
+// and any byte that has the same value in every key (all its entries in one bucket) needs no pass at all
+void CRenderQueue::Sort()
+{
+	const auto count = mItems.size();
+	if (count < 2) return;
+
+	uint32_t histograms[8][256] = {};
+	for (const auto& item : mItems)
+	{
+		for (int byte = 0; byte < 8; ++byte)
+		{
+			++histograms[byte][(item.key >> (byte * 8)) & 0xFF];
+		}
+	}
+
+	mScratch.resize(count);
+	auto* source = &mItems;
+	auto* destination = &mScratch;
+
+	for (int byte = 0; byte < 8; ++byte)
+	{
+		auto& histogram = histograms[byte];
+		const auto shift = byte * 8;
+
+		if (histogram[(mItems[0].key >> shift) & 0xFF] == count) continue;
+
+		// Bucket counts to starting offsets
+		uint32_t offset = 0;
+		for (auto& bucket : histogram)
+		{
+			const auto bucketCount = bucket;
+			bucket = offset;
+			offset += bucketCount;
+		}
+
+		for (const auto& item : *source)
+		{
+			(*destination)[histogram[(item.key >> shift) & 0xFF]++] = item;
+		}
+		std::swap(source, destination);
+	}
+
+	if (source != &mItems) mItems.swap(mScratch);
+}
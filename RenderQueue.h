@@ -0,0 +1,79 @@
+//--------------------------------------------------------------------------------------
+// Render queue - draws sorted by a 64-bit key to minimise state changes
+//--------------------------------------------------------------------------------------
+// Code in .cpp file
+//
+// Each draw is given a key packing, from the most significant bits down: render pass, blend mode,
+// shader, material, mesh and camera depth. Sorting the keys groups draws that share state so the
+// state cache can drop most binds, and orders opaque draws front to back within each group so early
+// depth rejection works. Blended passes put depth above the state fields instead and sort back to
+// front, since blending order matters more than state changes there.
+// The keys are sorted with an LSD radix sort, skipping any byte that is the same in every key.
+
+#pragma once
+
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+class CGameObject;
+
+
+// Passes in the order they are drawn
+enum ERenderPass : unsigned int
+{
+	RenderPass_Opaque      = 0,
+	RenderPass_Sky         = 1, // After the opaque objects so most of it is rejected by the depth buffer
+	RenderPass_Transparent = 2,
+};
+
+enum EBlendMode : unsigned int
+{
+	Blend_None     = 0,
+	Blend_Additive = 1,
+	Blend_Alpha    = 2,
+};
+
+
+class CRenderQueue
+{
+public:
+	struct Item
+	{
+		uint64_t     key;
+		CGameObject* object;
+	};
+
+	//-------------------------------------
+	// Building the queue
+	//-------------------------------------
+
+	void Clear() { mItems.clear(); }
+
+	void Add(uint64_t key, CGameObject* object) { mItems.push_back({ key, object }); }
+
+	// Small id for a shader / material / mesh, stable for the lifetime of the queue. Null resources get id 0
+	uint32_t ResourceId(const void* resource);
+
+	// Pack a sort key. depth is the normalised distance from the camera (0 near - 1 far), values outside are clamped
+	static uint64_t MakeKey(ERenderPass pass, EBlendMode blend, uint32_t shader, uint32_t material, uint32_t mesh, float depth);
+
+	//-------------------------------------
+	// Sorting
+	//-------------------------------------
+
+	// Sort the items by key, equal keys keep the order they were added in
+	void Sort();
+
+	const std::vector<Item>& Items() const { return mItems; }
+
+
+//-------------------------------------
+// Private members
+//-------------------------------------
+private:
+	std::vector<Item> mItems;
+	std::vector<Item> mScratch;
+
+	std::unordered_map<const void*, uint32_t> mResourceIds;
+};
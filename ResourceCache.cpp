@@ -0,0 +1,119 @@
+//--------------------------------------------------------------------------------------
+// Shared loading of meshes, shaders and textures
+//--------------------------------------------------------------------------------------
+
+#include "ResourceCache.h"
+
+#include "Shader.h"
+#include "GraphicsHelpers.h"
+#include "StringId.h"
+
+#include <mutex>
+#include <unordered_map>
+
+
+namespace
+{
+	struct CachedTexture
+	{
+		ID3D11Resource*           texture;
+		ID3D11ShaderResourceView* view;
+	};
+
+	// Keyed on the hash of the file name. Meshes are weak so the cache doesn't keep them alive
+	std::unordered_map<uint64_t, std::weak_ptr<CMesh>>  gMeshes;
+	std::unordered_map<uint64_t, ID3D11VertexShader*>   gVertexShaders;
+	std::unordered_map<uint64_t, ID3D11PixelShader*>    gPixelShaders;
+	std::unordered_map<uint64_t, CachedTexture>         gTextures;
+
+	std::mutex gResourceCacheMutex;
+
+
+	// Shared lookup for the shader maps, the cache keeps one reference and gives one to the caller
+	template <typename Shader, typename Loader>
+	Shader* LoadSharedShader(std::unordered_map<uint64_t, Shader*>& shaders, const std::string& shaderName, Loader load)
+	{
+		std::lock_guard<std::mutex> lock(gResourceCacheMutex);
+
+		const auto key = HashString(shaderName);
+		auto entry = shaders.find(key);
+		if (entry == shaders.end())
+		{
+			entry = shaders.emplace(key, load(shaderName)).first;
+		}
+
+		if (entry->second) entry->second->AddRef();
+		return entry->second;
+	}
+}
+
+
+std::shared_ptr<CMesh> LoadSharedMesh(const std::string& fileName, bool requireTangents, bool generateLods)
+{
+	std::lock_guard<std::mutex> lock(gResourceCacheMutex);
+
+	const auto key = HashString(fileName) ^ (requireTangents ? 1ull : 0ull) ^ (generateLods ? 2ull : 0ull);
+	auto mesh = gMeshes[key].lock();
+	if (!mesh)
+	{
+		mesh = std::make_shared<CMesh>(fileName, requireTangents, generateLods);
+		gMeshes[key] = mesh;
+	}
+	return mesh;
+}
+
+
+ID3D11VertexShader* LoadSharedVertexShader(const std::string& shaderName)
+{
+	return LoadSharedShader(gVertexShaders, shaderName, LoadVertexShader);
+}
+
+ID3D11PixelShader* LoadSharedPixelShader(const std::string& shaderName)
+{
+	return LoadSharedShader(gPixelShaders, shaderName, LoadPixelShader);
+}
+
+
+bool LoadSharedTexture(const std::string& fileName, ID3D11Resource** texture, ID3D11ShaderResourceView** textureSRV)
+{
+	std::lock_guard<std::mutex> lock(gResourceCacheMutex);
+
+	const auto key = HashString(fileName);
+	auto entry = gTextures.find(key);
+	if (entry == gTextures.end())
+	{
+		CachedTexture loaded = { nullptr, nullptr };
+		if (!LoadTexture(fileName, &loaded.texture, &loaded.view))
+		{
+			loaded = { nullptr, nullptr };
+		}
+		entry = gTextures.emplace(key, loaded).first;
+	}
+
+	if (!entry->second.texture) return false;
+
+	entry->second.texture->AddRef();
+	entry->second.view->AddRef();
+	*texture = entry->second.texture;
+	*textureSRV = entry->second.view;
+	return true;
+}
+
+
+void ReleaseResourceCache()
+{
+	std::lock_guard<std::mutex> lock(gResourceCacheMutex);
+
+	for (auto& shader : gVertexShaders) if (shader.second) shader.second->Release();
+	for (auto& shader : gPixelShaders)  if (shader.second) shader.second->Release();
+	for (auto& texture : gTextures)
+	{
+		if (texture.second.texture) texture.second.texture->Release();
+		if (texture.second.view)    texture.second.view->Release();
+	}
+
+	gVertexShaders.clear();
+	gPixelShaders.clear();
+	gTextures.clear();
+	gMeshes.clear();
+}
@@ -0,0 +1,33 @@
+//--------------------------------------------------------------------------------------
+// Shared loading of meshes, shaders and textures
+//--------------------------------------------------------------------------------------
+// Code in .cpp file
+//
+// Objects that use the same file get the same GPU object, so they can be drawn together (same key in
+// the render queue, one instanced draw) and the file is only loaded once. Shaders and textures are
+// returned with a reference added, the caller releases them as usual. Meshes are shared pointers and
+// are freed when the last object using them is destroyed.
+// Files that failed to load are remembered too and not tried again.
+
+#pragma once
+
+#include "Mesh.h"
+
+#include <d3d11.h>
+#include <memory>
+#include <string>
+
+
+// Load a mesh or get the already loaded copy. A mesh loaded with tangents or generated levels of detail is a different mesh
+// from one without. Throws a std::runtime_error if the file can't be loaded (see CMesh constructor)
+std::shared_ptr<CMesh> LoadSharedMesh(const std::string& fileName, bool requireTangents = false, bool generateLods = false);
+
+// Same as LoadVertexShader / LoadPixelShader (returns nullptr on failure), but each shader is only created once
+ID3D11VertexShader* LoadSharedVertexShader(const std::string& shaderName);
+ID3D11PixelShader*  LoadSharedPixelShader (const std::string& shaderName);
+
+// Same as LoadTexture, but each texture is only created once
+bool LoadSharedTexture(const std::string& fileName, ID3D11Resource** texture, ID3D11ShaderResourceView** textureSRV);
+
+// Drop the cache's own references, call before shutting down Direct3D
+void ReleaseResourceCache();
@@ -13,6 +13,9 @@
 
 #include "SpotLight.h"
 #include "DirLight.h"
+#include "StateCache.h"
+#include "ResourceCache.h"
+#include "GeometryAllocator.h"
 
 #include "External\imgui\imgui.h"
 #include "External\imgui\imgui_impl_dx11.h"
@@ -35,9 +38,10 @@ ID3D11Buffer* gPerFrameConstantBuffer; // The GPU buffer that will recieve the c
 
 PerModelConstants gPerModelConstants;      // As above, but constant that change per-model (e.g. world matrix)
 ID3D11Buffer* gPerModelConstantBuffer; // --"--
+ID3D11Buffer* gPerModelBonesBuffer;    // Bone matrices for skinned meshes
 
-PerFrameLights gPerFrameLightsConstants;
-ID3D11Buffer* gPerFrameLightsConstBuffer;
+PerFrameClusters gPerFrameClusters;
+ID3D11Buffer* gPerFrameClustersConstBuffer;
 
 PerFrameSpotLights gPerFrameSpotLightsConstants;
 ID3D11Buffer* gPerFrameSpotLightsConstBuffer;
@@ -113,8 +117,12 @@ void DisplayObjects(CGameObjectManager* GOM)
 		ImGui::NewLine();
 		ImGui::Text("Transform");
 
-		//get the direct access to the position of the model and display it 
-		ImGui::DragFloat3("Position", selectedObj->DirectPosition());
+		//display the position, only setting it back if it has changed so the object isn't treated as moved every frame
+		auto position = selectedObj->Position();
+		if (ImGui::DragFloat3("Position", position.GetValuesArray()))
+		{
+			selectedObj->SetPosition(position);
+		}
 
 		//acquire the rotation array
 		float* rot = selectedObj->Rotation().GetValuesArray();
@@ -149,6 +157,45 @@ void DisplayObjects(CGameObjectManager* GOM)
 			selectedObj->SetScale(scale);
 		}
 
+		//vertex cache efficiency of the mesh, as imported and after the import reordering
+		if (auto mesh = selectedObj->GetMesh())
+		{
+			auto imported = mesh->CacheStats(false);
+			auto optimised = mesh->CacheStats(true);
+			ImGui::Text("ACMR: %.2f -> %.2f  ATVR: %.2f -> %.2f", imported.acmr, optimised.acmr, imported.atvr, optimised.atvr);
+			ImGui::Text("Mesh memory: %.1f KB%s", mesh->GpuBytes() / 1024.0f, mesh->IsCompressed() ? " (compressed)" : "");
+
+			//animation playing on the base layer
+			if (auto animator = selectedObj->GetAnimator())
+			{
+				ImGui::NewLine();
+				ImGui::Text("Animation");
+
+				auto clip = animator->GetClip(0);
+				if (ImGui::BeginCombo("Clip", clip ? clip->Name().c_str() : "None"))
+				{
+					for (unsigned int i = 0; i < mesh->NumAnimations(); ++i)
+					{
+						const auto& animation = mesh->GetAnimation(i);
+						if (ImGui::Selectable(animation->Name().c_str(), animation.get() == clip))  animator->Play(animation);
+					}
+					ImGui::EndCombo();
+				}
+
+				if (clip)
+				{
+					auto time = animator->GetTime(0);
+					if (ImGui::SliderFloat("Time", &time, 0.0f, clip->Duration()))  animator->SetTime(0, time);
+
+					auto speed = animator->GetSpeed(0);
+					if (ImGui::DragFloat("Speed", &speed, 0.01f, -4.0f, 4.0f))  animator->SetSpeed(0, speed);
+
+					ImGui::Text("%u nodes, %u frames, %.1f KB%s", clip->NumNodes(), clip->NumFrames(), clip->MemoryBytes() / 1024.0f,
+					            clip->IsStreamed() ? " (streamed)" : clip->IsCompressed() ? " (compressed)" : "");
+				}
+			}
+		}
+
 		if (auto light = dynamic_cast<CLight*>(selectedObj))
 		{
 
@@ -184,6 +231,21 @@ void DisplayObjects(CGameObjectManager* GOM)
 				light->SetStrength(st);
 			}
 
+			//limit the objects drawn into the shadow map (0 = no limit)
+			if (dynamic_cast<CSpotLight*>(selectedObj) || dynamic_cast<CDirLight*>(selectedObj))
+			{
+				auto casterDistance = light->GetMaxShadowCasterDistance();
+				auto maxCasters = light->GetMaxShadowCasters();
+
+				auto changed = ImGui::DragFloat("Caster Distance", &casterDistance, 1.0f, 0.0f, D3D11_FLOAT32_MAX);
+				changed |= ImGui::DragInt("Max Casters", &maxCasters, 1.0f, 0, 100000);
+
+				if (changed)
+				{
+					light->SetShadowCasterLimits(casterDistance, maxCasters);
+				}
+			}
+
 			//if it is a spotlight let it modify few things
 			if (auto spotLight = dynamic_cast<CSpotLight*>(selectedObj))
 			{
@@ -250,19 +312,31 @@ void DisplayObjects(CGameObjectManager* GOM)
 					}
 				}
 
-				//modify near clip and far clip
+				//modify the shadow cascades
 
-				auto nearClip = dirLight->GetNearClip();
-				auto farClip = dirLight->GetFarClip();
+				auto shadowDistance = dirLight->GetShadowDistance();
+				auto backDistance = dirLight->GetBackDistance();
+				auto cascades = static_cast<int>(dirLight->GetCascadeCount());
+				auto splitLambda = dirLight->GetSplitLambda();
 
-				if (ImGui::DragFloat("NearClip", &nearClip, 0.01f, 0.0f, 10.0f))
+				if (ImGui::DragFloat("Shadow Distance", &shadowDistance, 1.0f, 1.0f, D3D11_FLOAT32_MAX))
 				{
-					dirLight->SetNearClip(nearClip);
+					dirLight->SetShadowDistance(shadowDistance);
 				}
 
-				if (ImGui::DragFloat("FarClip", &farClip, 10.0f, 0.0f, D3D11_FLOAT32_MAX))
+				if (ImGui::DragFloat("Back Distance", &backDistance, 1.0f, 0.0f, D3D11_FLOAT32_MAX))
 				{
-					dirLight->SetFarClip(farClip);
+					dirLight->SetBackDistance(backDistance);
+				}
+
+				if (ImGui::SliderInt("Cascades", &cascades, 1, static_cast<int>(CShadowCascades::MaxCascades)))
+				{
+					dirLight->SetCascadeCount(cascades);
+				}
+
+				if (ImGui::SliderFloat("Split Lambda", &splitLambda, 0.0f, 1.0f))
+				{
+					dirLight->SetSplitLambda(splitLambda);
 				}
 			}
 		}
@@ -284,13 +358,13 @@ void DisplayShadowMaps(CGameObjectManager* GOM)
 
 	ImGui::Begin("ShadowMaps");
 
-	for (auto tx : GOM->mShadowsMaps)
+	if (auto shadowAtlas = GOM->GetShadowAtlas())
 	{
 		ImGui::NewLine();
 
-		ImTextureID texId = tx;
+		ImTextureID texId = shadowAtlas->GetSRV();
 
-		ImGui::Image((void*)texId, { 256, 256 });
+		ImGui::Image((void*)texId, { 512, 512 });
 	}
 
 	ImGui::End();
@@ -298,11 +372,29 @@ void DisplayShadowMaps(CGameObjectManager* GOM)
 }
 
 
-void RenderGui(CGameObjectManager* GOM)
+void RenderGui(CGameObjectManager* GOM, const CParticleSystem* particles)
 {
 
 	ImGui::Begin("Objects");
 
+	ImGui::Text("Visible: %d  Culled: %d", GOM->GetVisibleCount(), GOM->GetCulledCount());
+	ImGui::Text("Particles: %u  Drawn: %u  Sorted: %u  Emitters: %u", particles->NumParticles(), particles->NumRendered(),
+	            particles->NumSorted(), particles->NumEmitters());
+	ImGui::Checkbox("Occlusion Culling", GOM->OcclusionCullingEnabled());
+	ImGui::Text("Occluded: %d  Occluder triangles: %u", GOM->GetOccludedCount(), GOM->GetOcclusionBuffer().NumTriangles());
+	ImGui::Text("State changes: %u  Skipped: %u", gStateCache.GetStats().calls, gStateCache.GetStats().skipped);
+	const auto geometry = gGeometryAllocator.GetStats();
+	ImGui::Text("Geometry buffers: %u  Layouts: %u  Used: %.1f / %.1f MB", geometry.buffers, geometry.inputLayouts,
+	            geometry.bytesUsed / (1024.0f * 1024.0f), geometry.bytesReserved / (1024.0f * 1024.0f));
+	ImGui::Checkbox("Meshlet Culling", &gMeshletCulling);
+	const auto meshlets = CMesh::GetMeshletStats();
+	ImGui::Text("Meshlet triangles drawn: %u / %u", meshlets.trianglesDrawn, meshlets.trianglesTested);
+
+	auto& lodSettings = GOM->GetLodSettings();
+	ImGui::DragFloat("LOD Bias", &lodSettings.bias, 0.01f, 0.1f, 10.0f);
+	ImGui::DragFloat("LOD Hysteresis", &lodSettings.hysteresis, 0.01f, 0.0f, 0.5f);
+	ImGui::NewLine();
+
 	DisplayObjects(GOM);
 
 	ImGui::End();
@@ -347,6 +439,9 @@ bool CScene::InitScene(std::string fileName)
 		throw std::runtime_error("No objects loaded");
 	}
 
+	// Objects were inserted into the spatial tree one at a time while loading, build a good quality tree now they are all in
+	mObjManager->RebuildSpatialTree();
+
 	////--------------- GPU states ---------------////
 
 
@@ -362,14 +457,17 @@ bool CScene::InitScene(std::string fileName)
 	// See the comments above where these variable are declared and also the UpdateScene function
 	gPerFrameConstantBuffer = CreateConstantBuffer(sizeof(gPerFrameConstants));
 	gPerModelConstantBuffer = CreateConstantBuffer(sizeof(gPerModelConstants));
-	gPerFrameLightsConstBuffer = CreateConstantBuffer(sizeof(gPerFrameLightsConstants));
-	gPerFrameSpotLightsConstBuffer = CreateConstantBuffer(sizeof(gPerFrameSpotLightsConstants));
-	gPerFrameDirLightsConstBuffer = CreateConstantBuffer(sizeof(gPerFrameDirLightsConstants));
+	gPerModelBonesBuffer = CreateConstantBuffer(sizeof(PerModelBones));
+	// The light buffers are only partly updated when lights change (see LightConstants.h), so they are not dynamic
+	gPerFrameSpotLightsConstBuffer = CreateConstantBuffer(sizeof(gPerFrameSpotLightsConstants), false);
+	gPerFrameDirLightsConstBuffer = CreateConstantBuffer(sizeof(gPerFrameDirLightsConstants), false);
+	gPerFrameClustersConstBuffer = CreateConstantBuffer(sizeof(gPerFrameClusters));
 
 	if (!gPerFrameConstantBuffer ||
 		!gPerModelConstantBuffer ||
+		!gPerModelBonesBuffer ||
 		!gPerFrameDirLightsConstBuffer ||
-		!gPerFrameLightsConstBuffer ||
+		!gPerFrameClustersConstBuffer ||
 		!gPerFrameSpotLightsConstBuffer)
 	{
 		throw std::runtime_error("Error creating constant buffers");
@@ -396,13 +494,14 @@ void CScene::RenderSceneFromCamera(CCamera* camera) const
 	gPerFrameConstants.viewProjectionMatrix = camera->ViewProjectionMatrix();
 
 	UpdateFrameConstantBuffer(gPerFrameConstantBuffer, gPerFrameConstants);
-	UpdateLightBuffer(gPerFrameLightsConstBuffer, gPerFrameLightsConstants);
-	UpdateSpotLightsBuffer(gPerFrameSpotLightsConstBuffer, gPerFrameSpotLightsConstants);
-	UpdateDirLightsBuffer(gPerFrameDirLightsConstBuffer, gPerFrameDirLightsConstants);
+	mObjManager->UploadLightConstBuffers();
+
+	// Find the lights reaching each cluster of this camera's view, pixels are only lit by the lights in their cluster
+	mObjManager->UpdateLightClusters(camera->ViewMatrix(), camera->ProjectionMatrix(), camera->NearClip(), camera->FarClip());
 
 
 	ID3D11Buffer* frameCBuffers[] = { gPerFrameConstantBuffer,
-		gPerFrameLightsConstBuffer,
+		gPerFrameClustersConstBuffer,
 		gPerFrameSpotLightsConstBuffer,
 		gPerFrameDirLightsConstBuffer };
 
@@ -413,25 +512,42 @@ void CScene::RenderSceneFromCamera(CCamera* camera) const
 	////--------------- Render ordinary models ---------------///
 
 	// Select which shaders to use next
-	gD3DContext->GSSetShader(nullptr, nullptr, 0);  ////// Switch off geometry shader when not using it (pass nullptr for first parameter)
+	gStateCache.SetGeometryShader(nullptr);  ////// Switch off geometry shader when not using it (pass nullptr for first parameter)
 
-	//if the shadowmaps array is not empty
-	if (!mObjManager->mShadowsMaps.empty())
+	//send the shadow atlas to the shaders (slot 5), each light finds its shadow map in it with its shadow rect
+	if (auto shadowAtlas = mObjManager->GetShadowAtlas())
 	{
-		//send the shadow maps to the shaders (slot 5)
-		gD3DContext->PSSetShaderResources(5, mObjManager->mShadowsMaps.size(), &mObjManager->mShadowsMaps[0]);
+		gStateCache.SetPSShaderResource(5, shadowAtlas->GetSRV());
 		gD3DContext->PSSetSamplers(1, 1, &gPointSampler);
 	}
 
 	// States - no blending, normal depth buffer and back-face culling (standard set-up for opaque models)
-	gD3DContext->OMSetBlendState(gNoBlendingState, nullptr, 0xffffff);
-	gD3DContext->OMSetDepthStencilState(gUseDepthBufferState, 0);
-	gD3DContext->RSSetState(gCullBackState);
+	gStateCache.SetBlendState(gNoBlendingState);
+	gStateCache.SetDepthStencilState(gUseDepthBufferState);
+	gStateCache.SetRasterizerState(gCullBackState);
 
 	gD3DContext->PSSetSamplers(0, 1, &gAnisotropic4xSampler);
 
-	//Render All Objects, if something went wrong throw an exception
-	if (!mObjManager->RenderAllObjects())
+	// Only submit objects that are at least partially on screen
+	std::vector<CGameObject*> visibleObjects;
+	mObjManager->CullObjects(CFrustum(camera->ViewProjectionMatrix()), visibleObjects);
+
+	// Then drop the ones hidden behind the occluders (hills etc.)
+	mObjManager->CullOccludedObjects(camera->ViewProjectionMatrix(), visibleObjects);
+
+	// Group draws that share shaders / textures / meshes, so the state cache can skip most binds
+	mObjManager->SortForRendering(visibleObjects, camera->ViewMatrix(), camera->FarClip());
+
+	// Dense meshes only draw the meshlets that are on screen and facing the camera
+	MeshletView view;
+	view.position = camera->Position();
+	view.frustum = CFrustum(camera->ViewProjectionMatrix());
+
+	// Sort and write out the particles of the emitters on screen, they are drawn in among the transparent objects
+	mParticleSystem->Prepare(view.frustum, camera->WorldMatrix());
+
+	//Render the visible objects, if something went wrong throw an exception
+	if (!mObjManager->RenderObjects(visibleObjects, &view, mParticleSystem))
 	{
 		throw std::exception("Could not render objects");
 	}
@@ -449,13 +565,6 @@ void CScene::RenderScene(float frameTime) const
 
 	//// Common settings ////
 
-	// Set up the light information in the constant buffer
-	// Don't send to the GPU yet, the function RenderSceneFromCamera will do that
-
-	mObjManager->UpdateLightsConstBuffer(&gPerFrameLightsConstants);
-	mObjManager->UpdateSpotLightsConstBuffer(&gPerFrameSpotLightsConstants);
-	mObjManager->UpdateDirLightsConstBuffer(&gPerFrameDirLightsConstants);
-
 	gPerModelConstants.parallaxDepth = 0.00f;
 
 	gPerFrameConstants.ambientColour = gAmbientColour;
@@ -463,9 +572,24 @@ void CScene::RenderScene(float frameTime) const
 	gPerFrameConstants.cameraPosition = mCamera->Position();
 	gPerFrameConstants.frameTime = frameTime;
 
+	// The GUI and anything else outside the renderer may have changed the pipeline since the last frame
+	gStateCache.Invalidate();
+	gStateCache.ResetStats();
+	CMesh::ResetMeshletStats();
+
+	// Levels of detail are chosen for the main camera and used by the shadow maps as well
+	mObjManager->SelectLods(mCamera->Position(), mCamera->ProjectionMatrix());
+
 	////----- Render form the lights point of view ----------////
 
-	mObjManager->RenderFromAllLights();
+	mObjManager->RenderFromAllLights(mCamera->WorldMatrix(), mCamera->ProjectionMatrix(), mCamera->NearClip());
+
+	// Set up the light information in the constant buffer
+	// Don't send to the GPU yet, the function RenderSceneFromCamera will do that
+	// This comes after the shadow maps, which may have moved lights to new tiles of the shadow atlas
+	mObjManager->UpdateLightsBuffer();
+	mObjManager->UpdateSpotLightsConstBuffer(&gPerFrameSpotLightsConstants);
+	mObjManager->UpdateDirLightsConstBuffer(&gPerFrameDirLightsConstants);
 
 	////--------------- Main scene rendering ---------------////
 
@@ -492,7 +616,7 @@ void CScene::RenderScene(float frameTime) const
 
 
 	//Render the GUI
-	RenderGui(mObjManager);
+	RenderGui(mObjManager, mParticleSystem);
 
 
 
@@ -529,6 +653,23 @@ void CScene::UpdateScene(float frameTime)
 
 	mCamera->Control(frameTime, Key_Up, Key_Down, Key_Left, Key_Right, Key_W, Key_S, Key_A, Key_D);
 
+	// Update objects and keep the spatial tree in step with their transforms
+	mObjManager->UpdateObjects(frameTime);
+
+	mParticleSystem->Update(frameTime);
+
+	// Select objects by clicking in the viewport (unless the click was on the GUI)
+	if (KeyHit(Mouse_LButton) && !ImGui::GetIO().WantCaptureMouse)
+	{
+		const auto ray = mCamera->PickRay(GetMouseX(), GetMouseY(), gViewportWidth, gViewportHeight);
+
+		SceneRayHit hit;
+		if (RayCast(ray, hit, mCamera->FarClip(), Layer_Default | Layer_Lights))
+		{
+			selectedObj = hit.object;
+		}
+	}
+
 
 	// Toggle FPS limiting
 	if (KeyHit(Key_P))
@@ -576,8 +717,7 @@ bool CScene::LoadScene(const std::string& level)
 
 	while (element != nullptr)
 	{
-		std::string elementName = element->Name();
-		if (elementName == "Scene")
+		if (HashString(element->Name()) == "Scene"_sid)
 		{
 			try
 			{
@@ -602,10 +742,9 @@ bool CScene::ParseScene(tinyxml2::XMLElement* sceneEl)
 
 	while (element != nullptr)
 	{
-		std::string elementName = element->Name();
-
-		if (elementName == "Entities")
+		switch (HashString(element->Name()))
 		{
+		case "Entities"_sid:
 			try
 			{
 				ParseEntities(element);
@@ -614,8 +753,9 @@ bool CScene::ParseScene(tinyxml2::XMLElement* sceneEl)
 			{
 				throw std::runtime_error(e.what());
 			}
-		}
-		else if (elementName == "Default")
+			break;
+
+		case "Default"_sid:
 		{
 			const auto elementShaders = element->FirstChildElement("Shaders");
 			if (elementShaders)
@@ -630,6 +770,8 @@ bool CScene::ParseScene(tinyxml2::XMLElement* sceneEl)
 			{
 				throw std::runtime_error("Error loading default scene values");
 			}
+			break;
+		}
 		}
 		element = element->NextSiblingElement();
 	}
@@ -642,6 +784,7 @@ void CScene::LoadObject(tinyxml2::XMLElement* currEntity) const
 	std::string mesh;
 	std::string name;
 	std::string diffuse;
+	std::string occluder;
 	auto vertexShader = mDefaultVs;
 	auto pixelShader = mDefaultPs;
 
@@ -671,6 +814,10 @@ void CScene::LoadObject(tinyxml2::XMLElement* currEntity) const
 
 		const auto PsAttr = geometry->FindAttribute("PS");
 		if (PsAttr) pixelShader = PsAttr->Value();
+
+		// Occluder="true" to hide objects behind this one with its own mesh, or the file name of a simpler proxy mesh
+		const auto occluderAttr = geometry->FindAttribute("Occluder");
+		if (occluderAttr) occluder = occluderAttr->Value();
 	}
 
 	const auto positionEl = currEntity->FirstChildElement("Position");
@@ -698,18 +845,27 @@ void CScene::LoadObject(tinyxml2::XMLElement* currEntity) const
 
 	try
 	{
+		CGameObject* obj;
 		if (ID.empty())
 		{
-			auto obj = new CGameObject(mesh, name, diffuse, vertexShader, pixelShader, pos, rot, scale);
-
-			mObjManager->AddObject(obj);
+			obj = new CGameObject(mesh, name, diffuse, vertexShader, pixelShader, pos, rot, scale);
 		}
 		else
 		{
-			auto obj = new CGameObject(ID, name,vertexShader,pixelShader, pos, rot, scale);
-			mObjManager->AddObject(obj);
+			obj = new CGameObject(ID, name,vertexShader,pixelShader, pos, rot, scale);
+		}
+
+		if (occluder == "true")
+		{
+			obj->SetOccluderMesh(LoadSharedMesh(mesh, false, true));
+		}
+		else if (!occluder.empty())
+		{
+			obj->SetOccluderMesh(LoadSharedMesh(occluder));
 		}
 
+		mObjManager->AddObject(obj);
+
 	}
 	catch (const std::exception& e)
 	{
@@ -1031,6 +1187,120 @@ void CScene::LoadPlant(tinyxml2::XMLElement* currEntity) const
 	}
 }
 
+// A particle emitter. Every element is optional, leaving the ParticleEmitterSettings defaults, e.g.
+//   <Entity Type="Particles" Name="Sparks">
+//     <Emitter Texture="Flare.jpg" MaxParticles="5000" Rate="1000" Additive="true"/>
+//     <Shape Type="Cone" Radius="0.5" Angle="20"/>   (Point, Sphere with Radius, Box with X Y Z half sizes)
+//     <Direction X="0" Y="1" Z="0"/>
+//     <Life Min="1" Max="2"/>  <Speed Min="5" Max="8"/>  <Spin Min="-1" Max="1"/>
+//     <Acceleration X="0" Y="-9.8" Z="0"/>  <Drag Value="0.2"/>
+//     <Colour Age="0" R="1" G="0.8" B="0.3" A="1"/>  (any number of keys, ages 0 - 1)
+//     <Size Age="0" Value="0.5"/>                     (likewise)
+//     <Position X="0" Y="0" Z="0"/>
+//   </Entity>
+void CScene::LoadParticles(tinyxml2::XMLElement* currEntity) const
+{
+	std::string name;
+	const auto entityNameAttr = currEntity->FindAttribute("Name");
+	if (entityNameAttr)
+		name = entityNameAttr->Value();
+
+	ParticleEmitterSettings settings;
+	CVector3 pos = { 0,0,0 };
+
+	const auto emitterEl = currEntity->FirstChildElement("Emitter");
+	if (emitterEl)
+	{
+		const auto textureAttr = emitterEl->FindAttribute("Texture");
+		if (textureAttr) settings.texture = textureAttr->Value();
+
+		emitterEl->QueryUnsignedAttribute("MaxParticles", &settings.maxParticles);
+		emitterEl->QueryFloatAttribute("Rate", &settings.spawnRate);
+		emitterEl->QueryBoolAttribute("Additive", &settings.additive);
+	}
+
+	const auto shapeEl = currEntity->FirstChildElement("Shape");
+	if (shapeEl)
+	{
+		const auto typeAttr = shapeEl->FindAttribute("Type");
+		if (typeAttr)
+		{
+			switch (HashString(typeAttr->Value()))
+			{
+			case "Point"_sid:  settings.shape = EmitterShape_Point;  break;
+			case "Sphere"_sid: settings.shape = EmitterShape_Sphere; break;
+			case "Box"_sid:    settings.shape = EmitterShape_Box;    break;
+			case "Cone"_sid:   settings.shape = EmitterShape_Cone;   break;
+			default: break;
+			}
+		}
+
+		if (settings.shape == EmitterShape_Box)
+		{
+			shapeEl->QueryFloatAttribute("X", &settings.shapeSize.x);
+			shapeEl->QueryFloatAttribute("Y", &settings.shapeSize.y);
+			shapeEl->QueryFloatAttribute("Z", &settings.shapeSize.z);
+		}
+		else
+		{
+			shapeEl->QueryFloatAttribute("Radius", &settings.shapeSize.x);
+			auto angle = ToDegrees(settings.shapeSize.y);
+			shapeEl->QueryFloatAttribute("Angle", &angle);
+			settings.shapeSize.y = ToRadians(angle);
+		}
+	}
+
+	const auto readVector = [&](const char* element, CVector3& v)
+	{
+		const auto el = currEntity->FirstChildElement(element);
+		if (!el) return;
+		el->QueryFloatAttribute("X", &v.x);
+		el->QueryFloatAttribute("Y", &v.y);
+		el->QueryFloatAttribute("Z", &v.z);
+	};
+	const auto readRange = [&](const char* element, float& minimum, float& maximum)
+	{
+		const auto el = currEntity->FirstChildElement(element);
+		if (!el) return;
+		el->QueryFloatAttribute("Min", &minimum);
+		el->QueryFloatAttribute("Max", &maximum);
+	};
+
+	readVector("Direction", settings.direction);
+	readVector("Acceleration", settings.acceleration);
+	readVector("Position", pos);
+	readRange("Life", settings.minLife, settings.maxLife);
+	readRange("Speed", settings.minSpeed, settings.maxSpeed);
+	readRange("Spin", settings.minSpin, settings.maxSpin);
+
+	const auto dragEl = currEntity->FirstChildElement("Drag");
+	if (dragEl) dragEl->QueryFloatAttribute("Value", &settings.drag);
+
+	for (auto colourEl = currEntity->FirstChildElement("Colour"); colourEl; colourEl = colourEl->NextSiblingElement("Colour"))
+	{
+		ColourRGBA colour(1, 1, 1, 1);
+		colourEl->QueryFloatAttribute("R", &colour.r);
+		colourEl->QueryFloatAttribute("G", &colour.g);
+		colourEl->QueryFloatAttribute("B", &colour.b);
+		colourEl->QueryFloatAttribute("A", &colour.a);
+		settings.colourKeys.emplace_back(colourEl->FloatAttribute("Age"), colour);
+	}
+
+	for (auto sizeEl = currEntity->FirstChildElement("Size"); sizeEl; sizeEl = sizeEl->NextSiblingElement("Size"))
+	{
+		settings.sizeKeys.emplace_back(sizeEl->FloatAttribute("Age"), sizeEl->FloatAttribute("Value", 1.0f));
+	}
+
+	try
+	{
+		mParticleSystem->AddEmitter(settings, pos);
+	}
+	catch (const std::exception& e)
+	{
+		throw std::runtime_error(std::string(e.what()) + " of emitter " + name);
+	}
+}
+
 bool CScene::ParseEntities(tinyxml2::XMLElement* entitiesEl)
 {
 
@@ -1038,35 +1308,21 @@ bool CScene::ParseEntities(tinyxml2::XMLElement* entitiesEl)
 
 	while (currEntity)
 	{
-		std::string entityName = currEntity->Name();
-
-		if (entityName == "Entity")
+		if (HashString(currEntity->Name()) == "Entity"_sid)
 		{
 			const auto type = currEntity->FindAttribute("Type");
 
 			if (type)
 			{
-				std::string typeValue = type->Value();
-
-				if (typeValue == "GameObject")
-				{
-					LoadObject(currEntity);
-				}
-				else if (typeValue == "Light")
-				{
-					LoadLight(currEntity);
-				}
-				else if (typeValue == "Sky")
-				{
-					LoadSky(currEntity);
-				}
-				else if (typeValue == "Plant")
-				{
-					LoadPlant(currEntity);
-				}
-				else if (typeValue == "Camera")
+				switch (HashString(type->Value()))
 				{
-					LoadCamera(currEntity);
+				case "GameObject"_sid: LoadObject(currEntity); break;
+				case "Light"_sid:      LoadLight(currEntity);  break;
+				case "Sky"_sid:        LoadSky(currEntity);    break;
+				case "Plant"_sid:      LoadPlant(currEntity);  break;
+				case "Particles"_sid:  LoadParticles(currEntity); break;
+				case "Camera"_sid:     LoadCamera(currEntity); break;
+				default: break;
 				}
 			}
 		}
@@ -1082,13 +1338,23 @@ CScene::~CScene()
 
 	ReleaseStates();
 	if (gPerModelConstantBuffer)  gPerModelConstantBuffer->Release();
+	if (gPerModelBonesBuffer)     gPerModelBonesBuffer->Release();
 	if (gPerFrameConstantBuffer)  gPerFrameConstantBuffer->Release();
 	if (gPerFrameSpotLightsConstBuffer) gPerFrameSpotLightsConstBuffer->Release();
 	if (gPerFrameDirLightsConstBuffer) gPerFrameDirLightsConstBuffer->Release();
+	if (gPerFrameClustersConstBuffer) gPerFrameClustersConstBuffer->Release();
 
 	ReleaseDefaultShaders();
 
 	delete mCamera;
 
 	delete mObjManager;
+
+	delete mParticleSystem;
+
+	// After the objects, which hold their own references to the shared resources
+	ReleaseResourceCache();
+
+	// After the meshes, which return their geometry to it
+	gGeometryAllocator.Release();
 }
@@ -7,6 +7,7 @@
 
 #include "Camera.h"
 #include "GameObjectManager.h"
+#include "ParticleSystem.h"
 
 #include "CVector3.h" 
 #include "GraphicsHelpers.h" // Helper functions to unclutter the code here
@@ -35,6 +36,8 @@ public:
 
 		mObjManager = new CGameObjectManager();
 
+		mParticleSystem = new CParticleSystem();
+
 		try
 		{
 			InitScene(std::move(fileName));
@@ -84,8 +87,26 @@ public:
 
 	void LoadPlant(tinyxml2::XMLElement* currEntity) const;
 
+	void LoadParticles(tinyxml2::XMLElement* currEntity) const;
+
 	bool ParseEntities(tinyxml2::XMLElement* entitiesEl);
 
+	//--------------------------------------------------------------------------------------
+	// Scene Queries
+	//--------------------------------------------------------------------------------------
+
+	// Closest object hit by a world space ray, considering only objects on the layers in layerMask
+	bool RayCast(const CRay& ray, SceneRayHit& hit, float maxDistance = FLT_MAX, unsigned int layerMask = Layer_All) const
+	{
+		return mObjManager->RayCast(ray, hit, maxDistance, layerMask);
+	}
+
+	// All objects hit by a world space ray, nearest first
+	void RayCastAll(const CRay& ray, std::vector<SceneRayHit>& hits, float maxDistance = FLT_MAX, unsigned int layerMask = Layer_All) const
+	{
+		mObjManager->RayCastAll(ray, hits, maxDistance, layerMask);
+	}
+
 
 	~CScene();
 
@@ -97,6 +118,8 @@ private:
 
 	CGameObjectManager* mObjManager;
 
+	CParticleSystem* mParticleSystem;
+
 	// Lock FPS to monitor refresh rate, which will typically set it to 60fps. Press 'p' to toggle to full fps
 	bool lockFPS = true;
 
@@ -171,6 +171,11 @@ ID3DBlob* CreateSignatureForVertexLayout(const D3D11_INPUT_ELEMENT_DESC vertexLa
 		else if (format == DXGI_FORMAT_R32G32_FLOAT)       shaderSource += "float2";
 		else if (format == DXGI_FORMAT_R32_FLOAT)          shaderSource += "float";
 		else if (format == DXGI_FORMAT_R8G8B8A8_UINT)      shaderSource += "uint4";
+		else if (format == DXGI_FORMAT_R16G16B16A16_UNORM) shaderSource += "float4"; // Compressed formats, see VertexCompression.h
+		else if (format == DXGI_FORMAT_R16G16_SNORM)       shaderSource += "float2";
+		else if (format == DXGI_FORMAT_R16G16_UNORM)       shaderSource += "float2";
+		else if (format == DXGI_FORMAT_R16G16_FLOAT)       shaderSource += "float2";
+		else if (format == DXGI_FORMAT_R8G8B8A8_UNORM)     shaderSource += "float4";
 		else return nullptr; // Unsupported type in layout
 
 		const auto index = static_cast<uint8_t>(vertexLayout[elt].SemanticIndex);
@@ -213,7 +218,10 @@ void LoadDefaultShaders()
 	
 	if (!(gDepthOnlyPixelShader = LoadPixelShader("Shaders/DepthOnly_ps")) ||
 		!(gBasicTransformVertexShader = LoadVertexShader("Shaders/BasicTransform_vs")) ||
-		!(gPbrDepthOnlyPixelShader = LoadPixelShader("Shaders/PBRDepthOnly_ps")))
+		!(gPbrDepthOnlyPixelShader = LoadPixelShader("Shaders/PBRDepthOnly_ps")) ||
+		!(gShadowTileClearVertexShader = LoadVertexShader("Shaders/ShadowTileClear_vs")) ||
+		!(gParticleVertexShader = LoadVertexShader("Shaders/Particle_vs")) ||
+		!(gParticlePixelShader = LoadPixelShader("Shaders/Particle_ps")))
 	{
 		throw std::runtime_error("Error loading default shaders");
 	}
@@ -224,17 +232,28 @@ void ReleaseDefaultShaders()
 	if (gDepthOnlyPixelShader) gDepthOnlyPixelShader->Release();
 	if (gBasicTransformVertexShader) gBasicTransformVertexShader->Release();
 	if (gPbrDepthOnlyPixelShader) gPbrDepthOnlyPixelShader->Release();
+	if (gShadowTileClearVertexShader) gShadowTileClearVertexShader->Release();
+	if (gParticleVertexShader) gParticleVertexShader->Release();
+	if (gParticlePixelShader) gParticlePixelShader->Release();
 }
 
 // Create and return a constant buffer of the given size
 // The returned pointer needs to be released before quitting. Returns nullptr on failure. 
-ID3D11Buffer* CreateConstantBuffer(int size)
+ID3D11Buffer* CreateConstantBuffer(int size, bool dynamic)
 {
 	D3D11_BUFFER_DESC cbDesc;
 	cbDesc.BindFlags = D3D11_BIND_CONSTANT_BUFFER;
 	cbDesc.ByteWidth = 16 * ((size + 15) / 16);     // Constant buffer size must be a multiple of 16 - this maths rounds up to the nearest multiple
-	cbDesc.Usage = D3D11_USAGE_DYNAMIC;             // Indicates that the buffer is frequently updated
-	cbDesc.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE; // CPU is only going to write to the constants (not read them)
+	if (dynamic)
+	{
+		cbDesc.Usage = D3D11_USAGE_DYNAMIC;             // Indicates that the buffer is frequently updated
+		cbDesc.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE; // CPU is only going to write to the constants (not read them)
+	}
+	else
+	{
+		cbDesc.Usage = D3D11_USAGE_DEFAULT;
+		cbDesc.CPUAccessFlags = 0;
+	}
 	cbDesc.MiscFlags = 0;
 	ID3D11Buffer* constantBuffer;
 	const auto hr = gD3DDevice->CreateBuffer(&cbDesc, nullptr, &constantBuffer);
@@ -18,6 +18,9 @@
 inline ID3D11PixelShader*	gDepthOnlyPixelShader = nullptr;
 inline ID3D11VertexShader*	gBasicTransformVertexShader = nullptr;
 inline ID3D11PixelShader*	gPbrDepthOnlyPixelShader = nullptr;
+inline ID3D11VertexShader*	gShadowTileClearVertexShader = nullptr;
+inline ID3D11VertexShader*	gParticleVertexShader = nullptr;
+inline ID3D11PixelShader*	gParticlePixelShader = nullptr;
 
 void LoadDefaultShaders();
 
@@ -29,7 +32,8 @@ void ReleaseDefaultShaders();
 
 // Create and return a constant buffer of the given size
 // The returned pointer needs to be released before quitting. Returns nullptr on failure
-ID3D11Buffer* CreateConstantBuffer(int size);
+// Dynamic buffers are updated with Map, others with UpdateSubresource (which can update part of the buffer)
+ID3D11Buffer* CreateConstantBuffer(int size, bool dynamic = true);
 
 
 //--------------------------------------------------------------------------------------
@@ -17,7 +17,7 @@ SimplePixelShaderInput main(BasicVertex modelVertex)
     SimplePixelShaderInput output; // This is the data the pixel shader requires from this vertex shader
 
     // Input position is x,y,z only - need a 4th element to multiply by a 4x4 matrix. Use 1 for a point (0 for a vector) - recall lectures
-    const float4 modelPosition = float4(modelVertex.position, 1); 
+    const float4 modelPosition = float4(DecodePosition(modelVertex.position), 1); 
 
     // Multiply by the world matrix passed from C++ to transform the model vertex position into world space. 
     // In a similar way use the view matrix to transform the vertex from world space into view space (camera's point of view)
@@ -73,6 +73,14 @@ struct SimplePixelShaderInput
     float2 uv : uv;
 };
 
+// Particle billboards, tinted by the particle's colour
+struct ParticlePixelShaderInput
+{
+    float4 projectedPosition : SV_Position;
+    float2 uv : uv;
+    float4 colour : colour;
+};
+
 struct sLight
 {
     float3 position;
@@ -91,17 +99,23 @@ struct sSpotLight
     float cosHalfAngle;     //pre calculate this in the c++ side, for performance reasons
     float4x4 viewMatrix;    //the light view matrix (as it was a camera)
     float4x4 projMatrix;    //--"--
+    float4 shadowRect;      //where the shadow map is in ShadowAtlas
 };
 
 
+static const int MAX_CASCADES = 4;
+
 struct sDirLight
 {
     float3 colour;
     float pad;
     float3 facing;
     int numLights;
-    float4x4 viewMatrix; //the light view matrix (as it was a camera)
-    float4x4 projMatrix; //--"--
+    float4x4 cascadeMatrices[MAX_CASCADES]; //view * projection of each shadow cascade
+    float4 cascadeRects[MAX_CASCADES];      //where each cascade's shadow map is in ShadowAtlas
+    float4 cascadeSplits;                   //the camera view depth each cascade reaches to
+    uint numCascades;
+    uint3 cascadePadding;
 };
 
 //--------------------------------------------------------------------------------------
@@ -129,9 +143,43 @@ cbuffer PerModelConstants : register(b0) // The b1 gives this constant buffer th
     float3   gObjectColour;  // Used for tinting light models
 	float    gParallaxDepth; // Used in the pixel shader to control how much the polygons are bumpy
 
+	uint     gInstanceOffset; // Instanced draws only: index of the first instance's matrix in gInstanceMatrices
+	uint     gOctahedralNormals; // Normals and tangents are octahedral encoded in .xy (compressed meshes, see VertexCompression.h)
+	float2   gPerModelPadding;
+
+	float3   gPositionScale;  // Vertex positions are decoded as position * scale + offset (identity for uncompressed meshes)
+	float    gPerModelPadding2;
+	float3   gPositionOffset;
+	float    gPerModelPadding3;
+}
+
+// Vertex data of compressed meshes, the input assembler has already turned the packed values into floats.
+// Normals and tangents are unfolded from the octahedron (see OctahedralDecode in VertexCompression.cpp)
+float3 DecodePosition(float3 position)
+{
+    return position * gPositionScale + gPositionOffset;
+}
+
+float3 DecodeNormal(float3 normal)
+{
+    if (gOctahedralNormals == 0)  return normal;
+
+    float3 n = float3(normal.xy, 1 - abs(normal.x) - abs(normal.y));
+    const float fold = saturate(-n.z);
+    n.xy += n.xy >= 0 ? -fold : fold;
+    return normalize(n);
+}
+
+// Skinned meshes only, must match the PerModelBones structure in Common.h
+cbuffer PerModelBones : register(b5)
+{
 	float4x4 gBoneMatrices[MAX_BONES];
 }
 
+// World matrices for instanced draws, one per instance. Read by the instanced vertex shaders with
+// gInstanceMatrices[gInstanceOffset + instanceId]. gWorldMatrix is the identity for these draws
+StructuredBuffer<float4x4> gInstanceMatrices : register(t0);
+
 
 cbuffer PerFrameConstants : register(b1) // The b0 gives this constant buffer the number 0 - used in the C++ code
 {
@@ -148,11 +196,26 @@ cbuffer PerFrameConstants : register(b1) // The b0 gives this constant buffer th
 }
 // Note constant buffers are not structs: we don't use the name of the constant buffer, these are really just a collection of global variables (hence the 'g')
 
-cbuffer PerFrameLights : register(b2)
+// Point lights, no fixed limit on their number. Shaders only visit those listed for the pixel's cluster
+StructuredBuffer<sLight> gLights : register(t125);
+
+// Clustered lighting (see ClusteredLighting.h), must match the PerFrameClusters structure in Common.h
+cbuffer PerFrameClusters : register(b2)
 {
-	sLight   gLights[MAX_LIGHTS];
+    float2 gClusterTileScale;  // Tiles per pixel
+    float  gClusterDepthScale; // Slice = log(view depth) * scale + bias
+    float  gClusterDepthBias;
+    uint   gClusterTilesX;
+    uint   gClusterTilesY;
+    uint   gClusterSlices;
+    uint   gClusterPadding;
 }
 
+// For each cluster: offset of its first entry in gClusterLightIndices, and its point light count | spot light count << 16.
+// The cluster's point light indices come first in the list, then its spot light indices
+StructuredBuffer<uint2> gClusters            : register(t126);
+StructuredBuffer<uint>  gClusterLightIndices : register(t127);
+
 
 cbuffer PerFrameSpotLights : register(b3)
 {
@@ -162,4 +225,59 @@ cbuffer PerFrameSpotLights : register(b3)
 cbuffer PerFrameDirLights : register(b4)
 {
     sDirLight gDirLights[MAX_LIGHTS];
-}
\ No newline at end of file
+}
+
+
+// Shadow maps of all the spot and directional lights, each light has a tile (see ShadowAtlas.h)
+Texture2D ShadowAtlas : register(t5);
+
+
+//--------------------------------------------------------------------------------------
+// Shadow atlas
+//--------------------------------------------------------------------------------------
+
+// Depth held in a light's shadow map at a shadow map uv. The uv is clamped to the light's tile, as it would be by a clamp
+// sampler on a texture of its own. A light with no tile (zero shadowRect) casts no shadows, its depth is the far distance
+float SampleShadowAtlas(SamplerState shadowSampler, float2 shadowMapUV, float4 shadowRect)
+{
+    if (shadowRect.z <= 0.0f) return 1.0f;
+    return ShadowAtlas.SampleLevel(shadowSampler, saturate(shadowMapUV) * shadowRect.zw + shadowRect.xy, 0).r;
+}
+
+
+// Shadow cascade of directional light k covering a pixel at the given camera view depth (SV_Position.w). Gives the cascade's
+// view * projection matrix and its rect in the atlas. Pixels beyond the last cascade get a zero rect, so are not shadowed
+void FindShadowCascade(uint k, float viewDepth, out float4x4 viewProjection, out float4 shadowRect)
+{
+    uint cascade = 0;
+    while (cascade + 1 < gDirLights[k].numCascades && viewDepth > gDirLights[k].cascadeSplits[cascade]) ++cascade;
+
+    viewProjection = gDirLights[k].cascadeMatrices[cascade];
+    shadowRect = viewDepth <= gDirLights[k].cascadeSplits[cascade] ? gDirLights[k].cascadeRects[cascade] : float4(0.0f, 0.0f, 0.0f, 0.0f);
+}
+
+
+//--------------------------------------------------------------------------------------
+// Clustered lighting
+//--------------------------------------------------------------------------------------
+
+struct ClusterLights
+{
+    uint offset; // Into gClusterLightIndices
+    uint numPointLights;
+    uint numSpotLights;
+};
+
+// Find the lights reaching the cluster of a pixel. Pass the pixel shader SV_Position input, whose w is the view space depth
+ClusterLights FindClusterLights(float4 projectedPosition)
+{
+    const uint2 tile = min(uint2(projectedPosition.xy * gClusterTileScale), uint2(gClusterTilesX - 1, gClusterTilesY - 1));
+    const float slice = clamp(floor(log(projectedPosition.w) * gClusterDepthScale + gClusterDepthBias), 0.0f, gClusterSlices - 1.0f);
+    const uint2 cluster = gClusters[(uint(slice) * gClusterTilesY + tile.y) * gClusterTilesX + tile.x];
+
+    ClusterLights lights;
+    lights.offset = cluster.x;
+    lights.numPointLights = cluster.y & 0xFFFF;
+    lights.numSpotLights = cluster.y >> 16;
+    return lights;
+}
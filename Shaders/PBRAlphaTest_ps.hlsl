@@ -0,0 +1,8 @@
+//--------------------------------------------------------------------------------------
+// PBR Pixel Shader, alpha tested
+//--------------------------------------------------------------------------------------
+// The PBR shader with texels whose albedo alpha is below one half discarded, for cut-out materials such as leaf
+// cards. Used by plants
+
+#define ALPHA_TEST
+#include "PBR_ps.hlsl"
@@ -0,0 +1,35 @@
+//--------------------------------------------------------------------------------------
+// Instanced Normal / Parallax Mapping Vertex Shader
+//--------------------------------------------------------------------------------------
+// Same as PBR_vs, but each instance takes its world matrix from the instance buffer
+
+#include "Common.hlsli" // Shaders can also use include files - note the extension
+
+
+//--------------------------------------------------------------------------------------
+// Shader code
+//--------------------------------------------------------------------------------------
+
+NormalMappingPixelShaderInput main(TangentVertex modelVertex, uint instanceId : SV_InstanceID)
+{
+    NormalMappingPixelShaderInput output; // This is the data the pixel shader requires from this vertex shader
+
+    const float4x4 worldMatrix = gInstanceMatrices[gInstanceOffset + instanceId];
+
+    const float4 modelPosition = float4(DecodePosition(modelVertex.position), 1); 
+
+    const float4 worldPosition     = mul(worldMatrix,       modelPosition);
+    const float4 viewPosition      = mul(gViewMatrix,       worldPosition);
+    output.projectedPosition = mul(gProjectionMatrix, viewPosition);
+
+    output.worldPosition = worldPosition.xyz; // Also pass world position to pixel shader for lighting
+
+	// The pixel shader transforms normals by gWorldMatrix, which is the identity for instanced draws, so send them
+	// already in world space
+	output.modelNormal  = mul((float3x3) worldMatrix, DecodeNormal(modelVertex.normal));
+	output.modelTangent = mul((float3x3) worldMatrix, DecodeNormal(modelVertex.tangent));
+
+    output.uv = modelVertex.uv;
+
+    return output; // Output data sent down the pipeline (to the pixel shader)
+}
@@ -113,20 +113,21 @@ float4 main(NormalMappingPixelShaderInput input) : SV_Target
     float3 resDiffuse = gAmbientColour;
     float3 resSpecular = 0.0f;
 
-    if (gLights[0].numLights > 0)
+    // Only the point lights that reach this pixel's cluster
+    const ClusterLights clusterLights = FindClusterLights(input.projectedPosition);
+
+    for (uint n = 0; n < clusterLights.numPointLights; ++n)
     {
-        for (int i = 0; i < gLights[0].numLights; ++i)
-        {
-            const float3 lightDir = normalize(gLights[i].position - input.worldPosition);
-            const float3 lightDist = length(gLights[i].position - input.worldPosition);
-
-            const float3 diffuse = gLights[i].colour * max(dot(worldNormal, lightDir), 0) / lightDist;
-            const float3 halfWay = normalize(lightDir + cameraDirection);
-            const float3 specular = diffuse * pow(max(dot(worldNormal, halfWay), 0), gSpecularPower);
-        
-            resDiffuse += diffuse;
-            resSpecular += specular;
-        }
+        const uint i = gClusterLightIndices[clusterLights.offset + n];
+        const float3 lightDir = normalize(gLights[i].position - input.worldPosition);
+        const float3 lightDist = length(gLights[i].position - input.worldPosition);
+
+        const float3 diffuse = gLights[i].colour * max(dot(worldNormal, lightDir), 0) / lightDist;
+        const float3 halfWay = normalize(lightDir + cameraDirection);
+        const float3 specular = diffuse * pow(max(dot(worldNormal, halfWay), 0), gSpecularPower);
+    
+        resDiffuse += diffuse;
+        resSpecular += specular;
     }
 	
     // Sample diffuse material colour for this pixel from a texture using a given sampler that you set up in the C++ code
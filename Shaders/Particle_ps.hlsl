@@ -0,0 +1,25 @@
+//--------------------------------------------------------------------------------------
+// Particle Pixel Shader
+//--------------------------------------------------------------------------------------
+// Samples the emitter's texture tinted by the particle's colour. Additive emitters have their colour already faded
+// by its alpha on the CPU, so the same output works for both blend states
+
+#include "Common.hlsli"
+
+
+//--------------------------------------------------------------------------------------
+// Textures (texture maps)
+//--------------------------------------------------------------------------------------
+
+Texture2D    ParticleTexture : register(t0);
+SamplerState TexSampler      : register(s2); // Not s0, particles are drawn in between objects using that
+
+
+//--------------------------------------------------------------------------------------
+// Shader code
+//--------------------------------------------------------------------------------------
+
+float4 main(ParticlePixelShaderInput input) : SV_Target
+{
+    return ParticleTexture.Sample(TexSampler, input.uv) * input.colour;
+}
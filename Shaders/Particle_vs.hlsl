@@ -0,0 +1,55 @@
+//--------------------------------------------------------------------------------------
+// Particle Vertex Shader
+//--------------------------------------------------------------------------------------
+// Builds a camera facing square for each particle from the instance buffer written by CParticleSystem
+
+#include "Common.hlsli"
+
+
+//--------------------------------------------------------------------------------------
+// Particle data
+//--------------------------------------------------------------------------------------
+
+// Must match ParticleInstance in ParticleEmitter.h
+struct ParticleInstance
+{
+    float3 position;
+    uint   sizeRotation; // Half floats, size in the low 16 bits and rotation in the high 16 bits
+    uint   colour;       // RGBA 8 bits each, red in the low 8 bits
+};
+
+StructuredBuffer<ParticleInstance> gParticles : register(t1);
+
+
+//--------------------------------------------------------------------------------------
+// Shader code
+//--------------------------------------------------------------------------------------
+
+// No vertex buffer, call Draw with six vertices per particle. Each particle is two triangles with the corners
+// taken from the vertex number
+ParticlePixelShaderInput main(uint vertexId : SV_VertexID)
+{
+    const float2 corners[6] = { float2(-1, 1), float2(1, 1), float2(-1, -1), float2(-1, -1), float2(1, 1), float2(1, -1) };
+
+    const ParticleInstance particle = gParticles[vertexId / 6];
+    const float2 corner = corners[vertexId % 6];
+
+    // Rotate the corner in the plane of the screen and scale it to the particle's size
+    const float size = f16tof32(particle.sizeRotation);
+    const float rotation = f16tof32(particle.sizeRotation >> 16);
+    float s, c;
+    sincos(rotation, s, c);
+    const float2 offset = float2(corner.x * c - corner.y * s, corner.x * s + corner.y * c) * (size * 0.5f);
+
+    // The camera's right and up axes are the first two rows of its world matrix (columns here, as the C++ matrices
+    // are row major)
+    const float3 right = gCameraMatrix._11_21_31;
+    const float3 up    = gCameraMatrix._12_22_32;
+    const float3 worldPosition = particle.position + right * offset.x + up * offset.y;
+
+    ParticlePixelShaderInput output;
+    output.projectedPosition = mul(gViewProjectionMatrix, float4(worldPosition, 1.0f));
+    output.uv = corner * float2(0.5f, -0.5f) + 0.5f;
+    output.colour = float4(particle.colour & 0xFF, (particle.colour >> 8) & 0xFF, (particle.colour >> 16) & 0xFF, particle.colour >> 24) / 255.0f;
+    return output;
+}
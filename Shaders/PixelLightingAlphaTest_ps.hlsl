@@ -0,0 +1,8 @@
+//--------------------------------------------------------------------------------------
+// Per-Pixel Lighting Pixel Shader, alpha tested
+//--------------------------------------------------------------------------------------
+// The per-pixel lighting shader with texels whose texture alpha is below one half discarded, for cut-out materials
+// such as leaf cards. Used by plants
+
+#define ALPHA_TEST
+#include "PixelLighting_ps.hlsl"
@@ -0,0 +1,33 @@
+//--------------------------------------------------------------------------------------
+// Instanced Per-Pixel Lighting Vertex Shader
+//--------------------------------------------------------------------------------------
+// Same as PixelLighting_vs, but each instance takes its world matrix from the instance buffer
+
+#include "Common.hlsli" // Shaders can also use include files - note the extension
+
+
+//--------------------------------------------------------------------------------------
+// Shader code
+//--------------------------------------------------------------------------------------
+
+LightingPixelShaderInput main(BasicVertex modelVertex, uint instanceId : SV_InstanceID)
+{
+    LightingPixelShaderInput output; // This is the data the pixel shader requires from this vertex shader
+
+    const float4x4 worldMatrix = gInstanceMatrices[gInstanceOffset + instanceId];
+
+    const float4 modelPosition = float4(DecodePosition(modelVertex.position), 1); 
+
+    const float4 worldPosition     = mul(worldMatrix,       modelPosition);
+    const float4 viewPosition      = mul(gViewMatrix,       worldPosition);
+    output.projectedPosition = mul(gProjectionMatrix, viewPosition);
+
+    const float4 modelNormal = float4(DecodeNormal(modelVertex.normal), 0);
+    output.worldNormal = mul(worldMatrix, modelNormal).xyz;
+
+    output.worldPosition = worldPosition.xyz; // Also pass world position to pixel shader for lighting
+
+    output.uv = modelVertex.uv;
+
+    return output; // Output data sent down the pipeline (to the pixel shader)
+}
@@ -16,7 +16,6 @@
 // Get used to people using the word "texture" and "map" interchangably.
 Texture2D DiffuseSpecularMap : register(t0); // Textures here can contain a diffuse map (main colour) in their rgb channels and a specular map (shininess) in the a channel
 SamplerState TexSampler : register(s0); // A sampler is a filter for a texture like bilinear, trilinear or anisotropic - this is the sampler used for the texture above
-Texture2DArray ShadowMaps : register(t5);
 SamplerState PointClamp : register(s1);
 
 
@@ -44,9 +43,13 @@ float4 main(LightingPixelShaderInput input) : SV_Target
     
     float3 resDiffuse = gAmbientColour;
     float3 resSpecular = 0.0f;
+
+    // Only the point and spot lights that reach this pixel's cluster
+    const ClusterLights clusterLights = FindClusterLights(input.projectedPosition);
     
-    for (int i = 0; i < gLights[0].numLights; ++i)
+    for (uint n = 0; n < clusterLights.numPointLights; ++n)
     {
+        const uint i = gClusterLightIndices[clusterLights.offset + n];
         const float3 lightDir = normalize(gLights[i].position - input.worldPosition);
         const float lightDist = length(input.worldPosition - gLights[i].position);
 
@@ -63,8 +66,9 @@ float4 main(LightingPixelShaderInput input) : SV_Target
     const float depthAdjust = 0.0005f;
     
 	//for each spot light
-    for (int j = 0; j < gSpotLights[0].numLights; ++j)
+    for (uint m = 0; m < clusterLights.numSpotLights; ++m)
     {
+        const uint j = gClusterLightIndices[clusterLights.offset + clusterLights.numPointLights + m];
         const float3 lightDir = normalize(gSpotLights[j].pos - input.worldPosition);
 
     	//if the pixel is in the light cone
@@ -93,7 +97,7 @@ float4 main(LightingPixelShaderInput input) : SV_Target
             {
                 for (int y = -pcfCount; y <= pcfCount; y++)
                 {
-                    const float objNearestLight = ShadowMaps.Sample(PointClamp, float3(shadowMapUV + float2(x, y) * texelSize, j)).r;
+                    const float objNearestLight = SampleShadowAtlas(PointClamp, shadowMapUV + float2(x, y) * texelSize, gSpotLights[j].shadowRect);
                     if (depthFromLight > objNearestLight)
                         total += 1.0f;
                 }
@@ -105,7 +109,7 @@ float4 main(LightingPixelShaderInput input) : SV_Target
 		
 			// Compare pixel depth from light with depth held in shadow map of the light. If shadow map depth is less than something is nearer
 			// to the light than this pixel - so the pixel gets no effect from this light
-            if (depthFromLight < ShadowMaps.Sample(PointClamp, float3(shadowMapUV, j)).r)
+            if (depthFromLight < SampleShadowAtlas(PointClamp, shadowMapUV, gSpotLights[j].shadowRect))
             {
                 const float light1Dist = length(gSpotLights[j].pos - input.worldPosition);
                 float3 diffuseLight = gSpotLights[j].colour * max(dot(input.worldNormal, lightDir), 0) / light1Dist; // Equations from lighting lecture
@@ -124,11 +128,13 @@ float4 main(LightingPixelShaderInput input) : SV_Target
     {
         const float3 lightDir = gDirLights[k].facing;
         
-    	// Using the world position of the current pixel and the matrices of the light (as a camera), find the 2D position of the
-		// pixel *as seen from the light*. Will use this to find which part of the shadow map to look at.
-		// These are the same as the view / projection matrix multiplies in a vertex shader (can improve performance by putting these lines in vertex shader)
-        const float4 viewPosition = mul(gDirLights[k].viewMatrix, float4(input.worldPosition, 1.0f));
-        const float4 projection = mul(gDirLights[k].projMatrix, viewPosition);
+    	// Pick the shadow cascade covering this pixel's distance from the camera, then using the world position of the current pixel
+		// and the matrices of the cascade (as a camera), find the 2D position of the pixel *as seen from the light*.
+		// Will use this to find which part of the shadow map to look at
+        float4x4 cascadeMatrix;
+        float4 shadowRect;
+        FindShadowCascade(k, input.projectedPosition.w, cascadeMatrix, shadowRect);
+        const float4 projection = mul(cascadeMatrix, float4(input.worldPosition, 1.0f));
 
 		// Convert 2D pixel position as viewed from light into texture coordinates for shadow map - an advanced topic related to the projection step
 		// Detail: 2D position x & y get perspective divide, then converted from range -1->1 to UV range 0->1. Also flip V axis
@@ -147,7 +153,7 @@ float4 main(LightingPixelShaderInput input) : SV_Target
         {
             for (int y = -pcfCount; y <= pcfCount; y++)
             {
-                const float objNearestLight = ShadowMaps.Sample(PointClamp, float3(shadowMapUV + float2(x, y) * texelSize, k)).r;
+                const float objNearestLight = SampleShadowAtlas(PointClamp, shadowMapUV + float2(x, y) * texelSize, shadowRect);
                 if (depthFromLight > objNearestLight)
                     total += 1.0f;
             }
@@ -160,7 +166,7 @@ float4 main(LightingPixelShaderInput input) : SV_Target
 		
 		// Compare pixel depth from light with depth held in shadow map of the light. If shadow map depth is less than something is nearer
 		// to the light than this pixel - so the pixel gets no effect from this light
-        if (depthFromLight < ShadowMaps.Sample(PointClamp, float3(shadowMapUV, k + gSpotLights[0].numLights)).r)
+        if (depthFromLight < SampleShadowAtlas(PointClamp, shadowMapUV, shadowRect))
         {
             float3 diffuseLight = gDirLights[k].colour * max(dot(input.worldNormal, lightDir), 0); // Equations from lighting lecture
             const float3 halfway = normalize(lightDir + cameraDirection);
@@ -181,6 +187,11 @@ float4 main(LightingPixelShaderInput input) : SV_Target
     const float3 diffuseMaterialColour = textureColour.rgb; // Diffuse material colour in texture RGB (base colour of model)
     const float specularMaterialColour = textureColour.a; // Specular material colour in texture A (shininess of the surface)
 
+#ifdef ALPHA_TEST
+    // Cut-out materials (leaf cards) hold coverage in the alpha channel instead, discard the uncovered texels
+    clip(textureColour.a - 0.5f);
+#endif
+
     // Combine lighting with texture colours
     float3 finalColour = resDiffuse * diffuseMaterialColour + resSpecular * specularMaterialColour;
 
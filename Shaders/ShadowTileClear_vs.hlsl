@@ -0,0 +1,17 @@
+//--------------------------------------------------------------------------------------
+// Shadow Tile Clear Vertex Shader
+//--------------------------------------------------------------------------------------
+// Draws one triangle covering the whole viewport at the far distance. With the depth test off and no
+// pixel shader this clears the depth of just the viewport area - one tile of the shadow atlas
+
+
+//--------------------------------------------------------------------------------------
+// Shader code
+//--------------------------------------------------------------------------------------
+
+// No vertex buffer, call Draw(3) and the corners come from the vertex number: (-1,1), (3,1), (-1,-3)
+float4 main(uint vertexId : SV_VertexID) : SV_Position
+{
+    const float2 corner = float2((vertexId << 1) & 2, vertexId & 2);
+    return float4(corner * float2(2.0f, -2.0f) + float2(-1.0f, 1.0f), 1.0f, 1.0f);
+}
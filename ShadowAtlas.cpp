@@ -0,0 +1,103 @@
+//--------------------------------------------------------------------------------------
+// Shadow atlas - one depth texture holding the shadow maps of every shadow casting light
+//--------------------------------------------------------------------------------------
+
+#include "ShadowAtlas.h"
+#include "Common.h"
+#include "Shader.h"
+#include "State.h"
+#include "StateCache.h"
+
+#include <stdexcept>
+
+
+CShadowAtlas::CShadowAtlas(unsigned int size)
+	: mAllocator(size, MinTileSize), mTexture(nullptr), mDepthStencil(nullptr), mSRV(nullptr)
+{
+	// The shadow maps contain a single 32-bit value [tech gotcha: have to say typeless because depth buffer and shaders see things slightly differently]
+	D3D11_TEXTURE2D_DESC textureDesc = {};
+	textureDesc.Width = mAllocator.Size();
+	textureDesc.Height = mAllocator.Size();
+	textureDesc.MipLevels = 1;
+	textureDesc.ArraySize = 1;
+	textureDesc.Format = DXGI_FORMAT_R32_TYPELESS;
+	textureDesc.SampleDesc.Count = 1;
+	textureDesc.SampleDesc.Quality = 0;
+	textureDesc.Usage = D3D11_USAGE_DEFAULT;
+	textureDesc.BindFlags = D3D11_BIND_DEPTH_STENCIL | D3D11_BIND_SHADER_RESOURCE; // Rendered to as a depth buffer and also passed to shaders
+	textureDesc.CPUAccessFlags = 0;
+	textureDesc.MiscFlags = 0;
+	if (FAILED(gD3DDevice->CreateTexture2D(&textureDesc, nullptr, &mTexture)))
+	{
+		throw std::runtime_error("Error creating shadow atlas texture");
+	}
+
+	// The depth buffer sees each pixel as a "depth" float
+	D3D11_DEPTH_STENCIL_VIEW_DESC dsvDesc = {};
+	dsvDesc.Format = DXGI_FORMAT_D32_FLOAT;
+	dsvDesc.ViewDimension = D3D11_DSV_DIMENSION_TEXTURE2D;
+	dsvDesc.Texture2D.MipSlice = 0;
+	dsvDesc.Flags = 0;
+	if (FAILED(gD3DDevice->CreateDepthStencilView(mTexture, &dsvDesc, &mDepthStencil)))
+	{
+		throw std::runtime_error("Error creating shadow atlas depth stencil view");
+	}
+
+	// The shaders see it as "red" floats, although they use the value as a depth
+	D3D11_SHADER_RESOURCE_VIEW_DESC srvDesc = {};
+	srvDesc.Format = DXGI_FORMAT_R32_FLOAT;
+	srvDesc.ViewDimension = D3D11_SRV_DIMENSION_TEXTURE2D;
+	srvDesc.Texture2D.MostDetailedMip = 0;
+	srvDesc.Texture2D.MipLevels = 1;
+	if (FAILED(gD3DDevice->CreateShaderResourceView(mTexture, &srvDesc, &mSRV)))
+	{
+		throw std::runtime_error("Error creating shadow atlas shader resource view");
+	}
+
+	// Nothing has been rendered yet, start from the far distance everywhere
+	gD3DContext->ClearDepthStencilView(mDepthStencil, D3D11_CLEAR_DEPTH, 1.0f, 0);
+}
+
+CShadowAtlas::~CShadowAtlas()
+{
+	if (mSRV) mSRV->Release();
+	if (mDepthStencil) mDepthStencil->Release();
+	if (mTexture) mTexture->Release();
+}
+
+
+void CShadowAtlas::BeginTile(const AtlasTile& tile)
+{
+	D3D11_VIEWPORT vp;
+	vp.Width = static_cast<FLOAT>(tile.size);
+	vp.Height = static_cast<FLOAT>(tile.size);
+	vp.MinDepth = 0.0f;
+	vp.MaxDepth = 1.0f;
+	vp.TopLeftX = static_cast<FLOAT>(tile.x);
+	vp.TopLeftY = static_cast<FLOAT>(tile.y);
+	gD3DContext->RSSetViewports(1, &vp);
+
+	// We will not be rendering any pixel colours
+	gD3DContext->OMSetRenderTargets(0, nullptr, mDepthStencil);
+
+	// ClearDepthStencilView would clear the whole atlas, so clear the tile by drawing a triangle covering
+	// the viewport at the far distance, with the depth test off
+	gStateCache.SetInputLayout(nullptr);
+	gStateCache.SetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+	gStateCache.SetVertexShader(gShadowTileClearVertexShader);
+	gStateCache.SetGeometryShader(nullptr);
+	gStateCache.SetPixelShader(nullptr);
+	gStateCache.SetBlendState(gNoBlendingState);
+	gStateCache.SetDepthStencilState(gDepthAlwaysState);
+	gStateCache.SetRasterizerState(gCullNoneState);
+	gD3DContext->Draw(3, 0);
+}
+
+void CShadowAtlas::GetTileRect(const AtlasTile& tile, float rect[4]) const
+{
+	const auto texel = 1.0f / static_cast<float>(mAllocator.Size());
+	rect[0] = (static_cast<float>(tile.x) + 0.5f) * texel;
+	rect[1] = (static_cast<float>(tile.y) + 0.5f) * texel;
+	rect[2] = (static_cast<float>(tile.size) - 1.0f) * texel;
+	rect[3] = rect[2];
+}
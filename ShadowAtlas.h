@@ -0,0 +1,56 @@
+//--------------------------------------------------------------------------------------
+// Shadow atlas - one depth texture holding the shadow maps of every shadow casting light
+//--------------------------------------------------------------------------------------
+// Code in .cpp file
+//
+// Spot and directional lights each get a square tile of the atlas at their shadow map resolution (see
+// AtlasAllocator.h). Tiles keep their contents between frames, so a light only renders its shadow map
+// again when it or one of its casters has changed (see CLight). The shaders sample the single atlas
+// texture, using a rectangle per light to find its tile.
+
+#pragma once
+
+#include "AtlasAllocator.h"
+
+#include <d3d11.h>
+
+
+class CShadowAtlas
+{
+public:
+	static const unsigned int DefaultSize = 4096;
+	static const unsigned int MinTileSize = 128;
+
+	// Creates the atlas texture, throws a std::runtime_error on failure
+	explicit CShadowAtlas(unsigned int size = DefaultSize);
+	~CShadowAtlas();
+
+	// See CAtlasAllocator::Allocate. The tile may be smaller than asked for when the atlas is filling up
+	bool Allocate(unsigned int size, AtlasTile& tile) { return mAllocator.Allocate(size, tile); }
+	void Free(const AtlasTile& tile) { mAllocator.Free(tile); }
+
+	// Select the atlas as the depth buffer with the viewport covering the tile, and clear the tile to the far distance.
+	// The rest of the atlas is left as it is
+	void BeginTile(const AtlasTile& tile);
+
+	// Scale and offset from shadow map uv to atlas uv for the shaders: atlas uv = uv * rect.zw + rect.xy. The rectangle
+	// runs between the centres of the tile's edge texels, so sampling never picks up a neighbouring tile
+	void GetTileRect(const AtlasTile& tile, float rect[4]) const;
+
+	ID3D11ShaderResourceView* GetSRV() const { return mSRV; }
+
+	unsigned int Size() const { return mAllocator.Size(); }
+
+	const CAtlasAllocator& Allocator() const { return mAllocator; }
+
+
+//-------------------------------------
+// Private members
+//-------------------------------------
+private:
+	CAtlasAllocator mAllocator;
+
+	ID3D11Texture2D*          mTexture;
+	ID3D11DepthStencilView*   mDepthStencil;
+	ID3D11ShaderResourceView* mSRV;
+};
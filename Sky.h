@@ -9,34 +9,25 @@
 class CSky : public CGameObject
 {
 public:
-	CSky(std::string mesh, std::string name,
+	CSky(const std::string& mesh, const std::string& name,
 		const std::string& diffuse, std::string& vertexShader, std::string& pixelShader, CVector3 position = { 0,0,0 }, CVector3 rotation = { 0,0,0 }, float scale = 1)
-		: CGameObject(std::move(mesh), std::move(name), diffuse, vertexShader, pixelShader, position, rotation, scale) {}
-
-	void Render(bool basicGeometry = false) override
+		: CGameObject(mesh, name, diffuse, vertexShader, pixelShader, position, rotation, scale)
 	{
-		if (basicGeometry)
-		{
-			CGameObject::Render(basicGeometry);
-		}
-		else
-		{
-
-			//set the colour white for the sky (no tint)
-			gPerModelConstants.objectColour = { 1, 1, 1 };
-
-			ID3D11RasterizerState* pRSState = nullptr;
-
-			gD3DContext->RSGetState(&pRSState);
-
-			// Stars point inwards
-			gD3DContext->RSSetState(gCullFrontState);
-
-			CGameObject::Render(basicGeometry);
+		// Surrounds everything so would be hit by every ray - kept on its own layer so picking can ignore it
+		mLayers = Layer_Sky;
+	}
 
-			gD3DContext->RSSetState(pRSState);
+	// Drawn after the opaque objects so the depth buffer rejects the parts hidden behind them
+	ERenderPass RenderPass() const override { return RenderPass_Sky; }
 
-		}
+protected:
+	// Stars point inwards
+	void GetPipelineStates(PipelineState& pipeline) const override
+	{
+		CGameObject::GetPipelineStates(pipeline);
+		pipeline.rasterizerState = gCullFrontState;
 	}
-};
 
+	//the colour white for the sky (no tint)
+	CVector3 ObjectColour() const override { return { 1, 1, 1 }; }
+};
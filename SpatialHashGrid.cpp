@@ -0,0 +1,347 @@
+//--------------------------------------------------------------------------------------
+// Spatial hash grid for radius and neighbourhood queries
+//--------------------------------------------------------------------------------------
+
+#include "SpatialHashGrid.h"
+
+#include "JobSystem.h"
+
+#include <algorithm>
+#include <cmath>
+
+
+namespace
+{
+	// 21 bits per axis in the cell key, coordinates are clamped to this range
+	const int CellCoordBias  = 1 << 20;
+	const int CellCoordLimit = CellCoordBias - 1;
+
+	// Squared distance from a point to the closest point on a box (0 if inside)
+	float SquaredDistance(const CVector3& p, const CAABB& b)
+	{
+		const auto dx = std::max({ b.min.x - p.x, 0.0f, p.x - b.max.x });
+		const auto dy = std::max({ b.min.y - p.y, 0.0f, p.y - b.max.y });
+		const auto dz = std::max({ b.min.z - p.z, 0.0f, p.z - b.max.z });
+		return dx * dx + dy * dy + dz * dz;
+	}
+}
+
+
+CSpatialHashGrid::CSpatialHashGrid(float cellSize /*= 16.0f*/, int maxCellsPerItem /*= 64*/)
+	: mFreeList(NullItem), mItemCount(0), mCellSize(cellSize), mInvCellSize(1.0f / cellSize), mMaxCellsPerItem(maxCellsPerItem)
+{
+	mOccupiedMin = {  CellCoordLimit,  CellCoordLimit,  CellCoordLimit };
+	mOccupiedMax = { -CellCoordLimit, -CellCoordLimit, -CellCoordLimit };
+}
+
+
+/*-----------------------------------------------------------------------------------------
+    Cell helpers
+-----------------------------------------------------------------------------------------*/
+
+CSpatialHashGrid::CellCoord CSpatialHashGrid::ToCell(const CVector3& point) const
+{
+	auto quantise = [&](float v)
+	{
+		const auto cell = std::floor(v * mInvCellSize);
+		return static_cast<int>(std::min(std::max(cell, static_cast<float>(-CellCoordLimit)), static_cast<float>(CellCoordLimit)));
+	};
+	return { quantise(point.x), quantise(point.y), quantise(point.z) };
+}
+
+uint64_t CSpatialHashGrid::CellKey(int x, int y, int z)
+{
+	return  static_cast<uint64_t>(x + CellCoordBias)        |
+	       (static_cast<uint64_t>(y + CellCoordBias) << 21) |
+	       (static_cast<uint64_t>(z + CellCoordBias) << 42);
+}
+
+bool CSpatialHashGrid::IsFirstSharedCell(const Item& item, const CellCoord& queryMin, int x, int y, int z)
+{
+	return x == std::max(item.cellMin.x, queryMin.x) &&
+	       y == std::max(item.cellMin.y, queryMin.y) &&
+	       z == std::max(item.cellMin.z, queryMin.z);
+}
+
+void CSpatialHashGrid::AddToCells(int itemId)
+{
+	auto& item = mItems[itemId];
+	item.cellMin = ToCell(item.bounds.min);
+	item.cellMax = ToCell(item.bounds.max);
+
+	const auto numCells = static_cast<int64_t>(item.cellMax.x - item.cellMin.x + 1) *
+	                      static_cast<int64_t>(item.cellMax.y - item.cellMin.y + 1) *
+	                      static_cast<int64_t>(item.cellMax.z - item.cellMin.z + 1);
+	item.isLarge = numCells > mMaxCellsPerItem;
+
+	if (item.isLarge)
+	{
+		mLargeItems.push_back(itemId);
+		return;
+	}
+
+	for (int z = item.cellMin.z; z <= item.cellMax.z; ++z)
+	for (int y = item.cellMin.y; y <= item.cellMax.y; ++y)
+	for (int x = item.cellMin.x; x <= item.cellMax.x; ++x)
+	{
+		mCells[CellKey(x, y, z)].push_back(itemId);
+	}
+
+	mOccupiedMin = { std::min(mOccupiedMin.x, item.cellMin.x), std::min(mOccupiedMin.y, item.cellMin.y), std::min(mOccupiedMin.z, item.cellMin.z) };
+	mOccupiedMax = { std::max(mOccupiedMax.x, item.cellMax.x), std::max(mOccupiedMax.y, item.cellMax.y), std::max(mOccupiedMax.z, item.cellMax.z) };
+}
+
+void CSpatialHashGrid::RemoveFromCells(int itemId)
+{
+	const auto& item = mItems[itemId];
+
+	auto eraseFrom = [itemId](std::vector<int>& list)
+	{
+		// Order within a cell does not matter so swap with the last entry
+		const auto it = std::find(list.begin(), list.end(), itemId);
+		if (it != list.end())
+		{
+			*it = list.back();
+			list.pop_back();
+		}
+	};
+
+	if (item.isLarge)
+	{
+		eraseFrom(mLargeItems);
+		return;
+	}
+
+	for (int z = item.cellMin.z; z <= item.cellMax.z; ++z)
+	for (int y = item.cellMin.y; y <= item.cellMax.y; ++y)
+	for (int x = item.cellMin.x; x <= item.cellMax.x; ++x)
+	{
+		const auto cell = mCells.find(CellKey(x, y, z));
+		if (cell == mCells.end()) continue;
+
+		eraseFrom(cell->second);
+		if (cell->second.empty()) mCells.erase(cell);
+	}
+}
+
+
+/*-----------------------------------------------------------------------------------------
+    Usage
+-----------------------------------------------------------------------------------------*/
+
+int CSpatialHashGrid::Insert(const CAABB& bounds, void* userData)
+{
+	int itemId;
+	if (mFreeList != NullItem)
+	{
+		itemId = mFreeList;
+		mFreeList = mItems[itemId].nextFree;
+	}
+	else
+	{
+		itemId = static_cast<int>(mItems.size());
+		mItems.emplace_back();
+	}
+
+	auto& item = mItems[itemId];
+	item.bounds = bounds;
+	item.userData = userData;
+	item.nextFree = NullItem;
+	item.inUse = true;
+
+	AddToCells(itemId);
+	++mItemCount;
+	return itemId;
+}
+
+void CSpatialHashGrid::Remove(int itemId)
+{
+	if (itemId < 0 || itemId >= static_cast<int>(mItems.size()) || !mItems[itemId].inUse) return;
+
+	RemoveFromCells(itemId);
+
+	auto& item = mItems[itemId];
+	item.inUse = false;
+	item.userData = nullptr;
+	item.nextFree = mFreeList;
+	mFreeList = itemId;
+	--mItemCount;
+}
+
+bool CSpatialHashGrid::Update(int itemId, const CAABB& bounds)
+{
+	auto& item = mItems[itemId];
+
+	const auto cellMin = ToCell(bounds.min);
+	const auto cellMax = ToCell(bounds.max);
+
+	// Common case - moved within the same cells, nothing in the hash map changes
+	if (cellMin.x == item.cellMin.x && cellMin.y == item.cellMin.y && cellMin.z == item.cellMin.z &&
+	    cellMax.x == item.cellMax.x && cellMax.y == item.cellMax.y && cellMax.z == item.cellMax.z)
+	{
+		item.bounds = bounds;
+		return false;
+	}
+
+	RemoveFromCells(itemId);
+	item.bounds = bounds;
+	AddToCells(itemId);
+	return true;
+}
+
+void CSpatialHashGrid::Clear()
+{
+	mCells.clear();
+	mLargeItems.clear();
+	mItems.clear();
+	mFreeList = NullItem;
+	mItemCount = 0;
+	mOccupiedMin = {  CellCoordLimit,  CellCoordLimit,  CellCoordLimit };
+	mOccupiedMax = { -CellCoordLimit, -CellCoordLimit, -CellCoordLimit };
+}
+
+
+/*-----------------------------------------------------------------------------------------
+    Queries
+-----------------------------------------------------------------------------------------*/
+
+void CSpatialHashGrid::QueryRadius(const CSphere& sphere, std::vector<int>& result) const
+{
+	const CVector3 r = { sphere.radius, sphere.radius, sphere.radius };
+	const auto queryMin = ToCell(sphere.centre - r);
+	const auto queryMax = ToCell(sphere.centre + r);
+
+	auto testCell = [&](const std::vector<int>& items, int x, int y, int z)
+	{
+		for (auto itemId : items)
+		{
+			const auto& item = mItems[itemId];
+			if (IsFirstSharedCell(item, queryMin, x, y, z) && sphere.Overlaps(item.bounds))
+			{
+				result.push_back(itemId);
+			}
+		}
+	};
+
+	const auto numQueryCells = static_cast<int64_t>(queryMax.x - queryMin.x + 1) *
+	                           static_cast<int64_t>(queryMax.y - queryMin.y + 1) *
+	                           static_cast<int64_t>(queryMax.z - queryMin.z + 1);
+
+	if (numQueryCells <= static_cast<int64_t>(mCells.size()))
+	{
+		// Usual case - look up each cell the sphere covers
+		for (int z = queryMin.z; z <= queryMax.z; ++z)
+		for (int y = queryMin.y; y <= queryMax.y; ++y)
+		for (int x = queryMin.x; x <= queryMax.x; ++x)
+		{
+			const auto cell = mCells.find(CellKey(x, y, z));
+			if (cell != mCells.end()) testCell(cell->second, x, y, z);
+		}
+	}
+	else
+	{
+		// The sphere covers more cells than are occupied, so walk the occupied cells instead
+		for (const auto& cell : mCells)
+		{
+			const auto x = static_cast<int>( cell.first        & 0x1FFFFF) - CellCoordBias;
+			const auto y = static_cast<int>((cell.first >> 21) & 0x1FFFFF) - CellCoordBias;
+			const auto z = static_cast<int>((cell.first >> 42) & 0x1FFFFF) - CellCoordBias;
+
+			if (x < queryMin.x || x > queryMax.x || y < queryMin.y || y > queryMax.y || z < queryMin.z || z > queryMax.z) continue;
+
+			testCell(cell.second, x, y, z);
+		}
+	}
+
+	for (auto itemId : mLargeItems)
+	{
+		if (sphere.Overlaps(mItems[itemId].bounds)) result.push_back(itemId);
+	}
+}
+
+void CSpatialHashGrid::QueryNearest(const CVector3& point, int k, std::vector<int>& result) const
+{
+	if (k <= 0 || mItemCount == 0) return;
+
+	// Max-heap of the best k candidates found so far, keyed on squared distance
+	std::vector<std::pair<float, int>> best;
+	best.reserve(k + 1);
+
+	auto consider = [&](int itemId)
+	{
+		const auto distance = SquaredDistance(point, mItems[itemId].bounds);
+		if (static_cast<int>(best.size()) == k && distance >= best.front().first) return;
+
+		// Items spanning several cells are seen more than once
+		for (const auto& candidate : best)
+		{
+			if (candidate.second == itemId) return;
+		}
+
+		best.emplace_back(distance, itemId);
+		std::push_heap(best.begin(), best.end());
+		if (static_cast<int>(best.size()) > k)
+		{
+			std::pop_heap(best.begin(), best.end());
+			best.pop_back();
+		}
+	};
+
+	for (auto itemId : mLargeItems) consider(itemId);
+
+	auto visitCell = [&](int x, int y, int z)
+	{
+		const auto cell = mCells.find(CellKey(x, y, z));
+		if (cell == mCells.end()) return;
+		for (auto itemId : cell->second) consider(itemId);
+	};
+
+	// Search outwards in cubic shells of cells around the point's cell. Anything not found after shell s
+	// is entirely outside the (2s+1)^3 block of cells, so at least s cells away from the point
+	const auto c = ToCell(point);
+	const auto maxShell = std::max({ c.x - mOccupiedMin.x, mOccupiedMax.x - c.x,
+	                                 c.y - mOccupiedMin.y, mOccupiedMax.y - c.y,
+	                                 c.z - mOccupiedMin.z, mOccupiedMax.z - c.z, 0 });
+
+	for (int s = 0; s <= maxShell; ++s)
+	{
+		for (int dz = -s; dz <= s; ++dz)
+		for (int dy = -s; dy <= s; ++dy)
+		{
+			if (std::abs(dz) == s || std::abs(dy) == s)
+			{
+				// On a face of the shell in y or z - the whole row of x is in the shell
+				for (int dx = -s; dx <= s; ++dx) visitCell(c.x + dx, c.y + dy, c.z + dz);
+			}
+			else
+			{
+				// Inside the shell in y and z - only the two ends of the row are on the shell
+				visitCell(c.x - s, c.y + dy, c.z + dz);
+				if (s > 0) visitCell(c.x + s, c.y + dy, c.z + dz);
+			}
+		}
+
+		const auto searched = s * mCellSize;
+		if (static_cast<int>(best.size()) == k && best.front().first <= searched * searched) break;
+	}
+
+	std::sort_heap(best.begin(), best.end());
+	for (const auto& candidate : best)
+	{
+		result.push_back(candidate.second);
+	}
+}
+
+void CSpatialHashGrid::QueryRadiusBatch(const std::vector<CSphere>& spheres, std::vector<std::vector<int>>& results) const
+{
+	results.resize(spheres.size());
+
+	ParallelFor(static_cast<unsigned int>(spheres.size()), 4, [&](unsigned int begin, unsigned int end)
+	{
+		for (auto i = begin; i < end; ++i)
+		{
+			results[i].clear();
+			QueryRadius(spheres[i], results[i]);
+		}
+	});
+}
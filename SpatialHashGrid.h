@@ -0,0 +1,127 @@
+//--------------------------------------------------------------------------------------
+// Spatial hash grid for radius and neighbourhood queries
+//--------------------------------------------------------------------------------------
+// World space is divided into cubic cells of a fixed size. Only cells that contain something are
+// stored, in a hash map keyed by the quantised cell coordinates, so the grid is unbounded and its
+// memory use follows the number of items rather than the size of the world.
+//
+// Each item is stored in every cell its bounds overlap. Items remember the cell range they occupy,
+// so updating an item that has not crossed a cell boundary only copies its new bounds. Items that
+// would cover a large number of cells (terrain, sky) are kept in a separate list that every query
+// tests directly - there are normally only a handful of these.
+//
+// Queries only read the grid, so any number of them can run at the same time on different threads.
+
+#pragma once
+
+#include "BoundingVolumes.h"
+
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+
+class CSpatialHashGrid
+{
+public:
+	static const int NullItem = -1;
+
+	//-------------------------------------
+	// Construction / Usage
+	//-------------------------------------
+
+	// Cell size should be around the size of a typical object / query radius. Items overlapping more than
+	// maxCellsPerItem cells are treated as large items (see above)
+	explicit CSpatialHashGrid(float cellSize = 16.0f, int maxCellsPerItem = 64);
+
+	// Add an item with the given world bounds. Returns the item id used in later calls
+	int Insert(const CAABB& bounds, void* userData);
+
+	void Remove(int itemId);
+
+	// Update an item's bounds. Returns true if the item changed cells (i.e. the grid had to be modified)
+	bool Update(int itemId, const CAABB& bounds);
+
+	void Clear();
+
+
+	//-------------------------------------
+	// Queries
+	//-------------------------------------
+	// Results are appended to the given vector as item ids, each item at most once
+
+	// All items whose bounds overlap the sphere
+	void QueryRadius(const CSphere& sphere, std::vector<int>& result) const;
+
+	// The k items whose bounds are nearest to the point, closest first. Distance is measured to the
+	// bounds, so a point inside an item's box is at distance 0 from it
+	void QueryNearest(const CVector3& point, int k, std::vector<int>& result) const;
+
+	// Many radius queries at once, spread over the job system's threads. results[i] receives the
+	// items for spheres[i] (the vector is resized to match and each entry is cleared first)
+	void QueryRadiusBatch(const std::vector<CSphere>& spheres, std::vector<std::vector<int>>& results) const;
+
+
+	//-------------------------------------
+	// Data access
+	//-------------------------------------
+
+	void* GetUserData(int itemId) const { return mItems[itemId].userData; }
+
+	const CAABB& GetBounds(int itemId) const { return mItems[itemId].bounds; }
+
+	float GetCellSize() const { return mCellSize; }
+
+	int GetItemCount() const { return mItemCount; }
+
+	int GetOccupiedCellCount() const { return static_cast<int>(mCells.size()); }
+
+
+//-------------------------------------
+// Private members
+//-------------------------------------
+private:
+
+	struct CellCoord
+	{
+		int x, y, z;
+	};
+
+	struct Item
+	{
+		CAABB bounds;
+		void* userData;
+		CellCoord cellMin;
+		CellCoord cellMax;
+		bool isLarge;
+		int  nextFree; // NullItem when in use (or at the end of the free list)
+		bool inUse;
+	};
+
+	CellCoord ToCell(const CVector3& point) const;
+
+	// Cell coordinates packed into a single 64-bit hash map key (21 bits per axis)
+	static uint64_t CellKey(int x, int y, int z);
+
+	void AddToCells(int itemId);
+	void RemoveFromCells(int itemId);
+
+	// True if this cell is the first cell (lowest x, y, z) shared by the item and the query range. Used so
+	// items that span several cells are only reported once without needing any per-query scratch memory
+	static bool IsFirstSharedCell(const Item& item, const CellCoord& queryMin, int x, int y, int z);
+
+
+	std::unordered_map<uint64_t, std::vector<int>> mCells;
+	std::vector<int>  mLargeItems;
+	std::vector<Item> mItems;
+	int   mFreeList;
+	int   mItemCount;
+
+	float mCellSize;
+	float mInvCellSize;
+	int   mMaxCellsPerItem;
+
+	// Range of cells that have ever been occupied, limits how far nearest neighbour searches expand
+	CellCoord mOccupiedMin;
+	CellCoord mOccupiedMax;
+};
@@ -7,15 +7,15 @@ class CSpotLight :
 {
 	
 public:
-	CSpotLight(std::string mesh, std::string name,
+	CSpotLight(const std::string& mesh, const std::string& name,
 	          const std::string& diffuse, std::string& vertexShader, std::string& pixelShader,
 	          CVector3 colour = {0.0f, 0.0f, 0.0f}, float strength = 0.0f,
 		CVector3 position = { 0, 0, 0 }, CVector3 rotation = { 0, 0, 0 }, float scale = 1, CVector3 facing = { 0,0,1 });
 
-	void Render(bool basicGeometry = false) override;
 
-
-	ID3D11ShaderResourceView* RenderFromThis(CGameObjectManager* CGOM);
+	// Render the shadow map into this light's tile of the atlas, if anything has changed since it was last rendered.
+	// Returns false if the tile was kept from an earlier frame
+	bool RenderFromThis(CGameObjectManager* CGOM, CShadowAtlas& atlas);
 
 	void SetShadowMapsSize(int value);
 
@@ -37,6 +37,7 @@ public:
 	{
 		mFacing = v;
 		mWorldMatrices[0].FaceTarget(Position()+v);
+		LightChanged();
 	}
 	
 	void SetRotation(CVector3 rotation, int node = 0) override
@@ -45,18 +46,10 @@ public:
 		//mFacing = Normalise(Rotation());
 	}
 
-	~CSpotLight();
-
 private:
 
 	int mShadowMapSize;
 	float mConeAngle;
 	CVector3 mFacing;
-	
-
-	ID3D11Texture2D* mShadowMap;
-	ID3D11DepthStencilView* mShadowMapDepthStencil;
-	ID3D11ShaderResourceView* mShadowMapSRV;
-	
 };
 
@@ -40,6 +40,7 @@ ID3D11RasterizerState* gCullNoneState  = nullptr;
 ID3D11DepthStencilState* gUseDepthBufferState = nullptr;
 ID3D11DepthStencilState* gDepthReadOnlyState  = nullptr;
 ID3D11DepthStencilState* gNoDepthBufferState  = nullptr;
+ID3D11DepthStencilState* gDepthAlwaysState    = nullptr;
 
 
 
@@ -279,6 +280,21 @@ bool CreateStates()
         return false;
     }
 
+
+    ////-------- Write depth buffer without testing --------////
+    // Every pixel drawn overwrites the depth buffer - used to clear part of a depth buffer (a tile of the shadow atlas)
+    depthStencilDesc.DepthEnable      = TRUE;
+    depthStencilDesc.DepthWriteMask   = D3D11_DEPTH_WRITE_MASK_ALL;
+    depthStencilDesc.DepthFunc        = D3D11_COMPARISON_ALWAYS;
+    depthStencilDesc.StencilEnable    = FALSE;
+
+    // Create a DirectX object for the description above that can be used by a shader
+    if (FAILED(gD3DDevice->CreateDepthStencilState(&depthStencilDesc, &gDepthAlwaysState)))
+    {
+        gLastError = "Error creating depth-always state";
+        return false;
+    }
+
     return true;
 }
 
@@ -289,6 +305,7 @@ void ReleaseStates()
     if (gUseDepthBufferState)    gUseDepthBufferState->Release();
     if (gDepthReadOnlyState)     gDepthReadOnlyState->Release();
     if (gNoDepthBufferState)     gNoDepthBufferState->Release();
+    if (gDepthAlwaysState)       gDepthAlwaysState->Release();
     if (gCullBackState)          gCullBackState->Release();
     if (gCullFrontState)         gCullFrontState->Release();
     if (gCullNoneState)          gCullNoneState->Release();
@@ -0,0 +1,129 @@
+//--------------------------------------------------------------------------------------
+// CPU side shadow of the pipeline state, drops redundant binds
+//--------------------------------------------------------------------------------------
+
+#include "StateCache.h"
+
+#include "Common.h"
+
+
+CStateCache gStateCache;
+
+
+void CStateCache::Invalidate()
+{
+	mVertexShader.known   = false;
+	mGeometryShader.known = false;
+	mPixelShader.known    = false;
+	for (auto& resource : mPSResources) resource.known = false;
+
+	mBlendState.known        = false;
+	mDepthStencilState.known = false;
+	mRasterizerState.known   = false;
+
+	mInputLayout.known  = false;
+	mVertexBuffer.known = false;
+	mVertexStride.known = false;
+	mIndexBuffer.known  = false;
+	mIndexFormat.known  = false;
+	mTopology.known     = false;
+}
+
+
+/*-----------------------------------------------------------------------------------------
+    Shaders and resources
+-----------------------------------------------------------------------------------------*/
+
+void CStateCache::SetVertexShader(ID3D11VertexShader* shader)
+{
+	if (Update(mVertexShader, shader)) gD3DContext->VSSetShader(shader, nullptr, 0);
+}
+
+void CStateCache::SetGeometryShader(ID3D11GeometryShader* shader)
+{
+	if (Update(mGeometryShader, shader)) gD3DContext->GSSetShader(shader, nullptr, 0);
+}
+
+void CStateCache::SetPixelShader(ID3D11PixelShader* shader)
+{
+	if (Update(mPixelShader, shader)) gD3DContext->PSSetShader(shader, nullptr, 0);
+}
+
+void CStateCache::SetPSShaderResource(UINT slot, ID3D11ShaderResourceView* view)
+{
+	// Slots beyond those tracked are always set
+	if (slot >= NumPSResourceSlots)
+	{
+		gD3DContext->PSSetShaderResources(slot, 1, &view);
+		++mStats.calls;
+		return;
+	}
+
+	if (Update(mPSResources[slot], view)) gD3DContext->PSSetShaderResources(slot, 1, &view);
+}
+
+
+/*-----------------------------------------------------------------------------------------
+    States
+-----------------------------------------------------------------------------------------*/
+
+void CStateCache::SetBlendState(ID3D11BlendState* state)
+{
+	if (Update(mBlendState, state)) gD3DContext->OMSetBlendState(state, nullptr, 0xffffff);
+}
+
+void CStateCache::SetDepthStencilState(ID3D11DepthStencilState* state)
+{
+	if (Update(mDepthStencilState, state)) gD3DContext->OMSetDepthStencilState(state, 0);
+}
+
+void CStateCache::SetRasterizerState(ID3D11RasterizerState* state)
+{
+	if (Update(mRasterizerState, state)) gD3DContext->RSSetState(state);
+}
+
+
+/*-----------------------------------------------------------------------------------------
+    Input assembler
+-----------------------------------------------------------------------------------------*/
+
+// Two entries updated for a single context call were counted twice by Update, correct the stats to one
+void CStateCache::CountPair(bool firstChanged, bool secondChanged)
+{
+	if (firstChanged && secondChanged) --mStats.calls;
+	else                               --mStats.skipped;
+}
+
+void CStateCache::SetInputLayout(ID3D11InputLayout* layout)
+{
+	if (Update(mInputLayout, layout)) gD3DContext->IASetInputLayout(layout);
+}
+
+void CStateCache::SetVertexBuffer(ID3D11Buffer* buffer, UINT stride)
+{
+	// Buffer and stride are set together, so both entries must be updated whichever one changed
+	const auto bufferChanged = Update(mVertexBuffer, buffer);
+	const auto strideChanged = Update(mVertexStride, stride);
+	CountPair(bufferChanged, strideChanged);
+	if (bufferChanged || strideChanged)
+	{
+		UINT offset = 0;
+		gD3DContext->IASetVertexBuffers(0, 1, &buffer, &stride, &offset);
+	}
+}
+
+void CStateCache::SetIndexBuffer(ID3D11Buffer* buffer, DXGI_FORMAT format)
+{
+	const auto bufferChanged = Update(mIndexBuffer, buffer);
+	const auto formatChanged = Update(mIndexFormat, format);
+	CountPair(bufferChanged, formatChanged);
+	if (bufferChanged || formatChanged)
+	{
+		gD3DContext->IASetIndexBuffer(buffer, format, 0);
+	}
+}
+
+void CStateCache::SetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY topology)
+{
+	if (Update(mTopology, topology)) gD3DContext->IASetPrimitiveTopology(topology);
+}
@@ -0,0 +1,125 @@
+//--------------------------------------------------------------------------------------
+// CPU side shadow of the pipeline state, drops redundant binds
+//--------------------------------------------------------------------------------------
+// Code in .cpp file
+//
+// Remembers the shaders, textures, states and input assembler buffers last set through it and only
+// calls the device context when a value actually changes. Reading state back with the context's
+// Get functions is slow and adds a reference to each object returned, so the cache is used instead.
+// Anything that changes these states directly on the context (e.g. the GUI) must be followed by
+// Invalidate, which makes the next set of each state go through unconditionally.
+
+#pragma once
+
+#include <d3d11.h>
+
+
+class CStateCache
+{
+public:
+	// Texture slots tracked for the pixel shader
+	static const UINT NumPSResourceSlots = 16;
+
+	// Number of context calls made and avoided since the last ResetStats
+	struct Stats
+	{
+		unsigned int calls;
+		unsigned int skipped;
+	};
+
+	CStateCache() { Invalidate(); ResetStats(); }
+
+	// Forget everything that is bound, call at the start of a frame or after other code has changed the pipeline
+	void Invalidate();
+
+	//-------------------------------------
+	// Shaders and resources
+	//-------------------------------------
+
+	void SetVertexShader(ID3D11VertexShader* shader);
+	void SetGeometryShader(ID3D11GeometryShader* shader);
+	void SetPixelShader(ID3D11PixelShader* shader);
+
+	void SetPSShaderResource(UINT slot, ID3D11ShaderResourceView* view);
+
+	//-------------------------------------
+	// States
+	//-------------------------------------
+
+	void SetBlendState(ID3D11BlendState* state);
+	void SetDepthStencilState(ID3D11DepthStencilState* state);
+	void SetRasterizerState(ID3D11RasterizerState* state);
+
+	// Last states set through the cache, for code that temporarily changes a state and puts it back
+	ID3D11BlendState*        BlendState()        const { return mBlendState.value; }
+	ID3D11DepthStencilState* DepthStencilState() const { return mDepthStencilState.value; }
+	ID3D11RasterizerState*   RasterizerState()   const { return mRasterizerState.value; }
+
+	//-------------------------------------
+	// Input assembler
+	//-------------------------------------
+
+	void SetInputLayout(ID3D11InputLayout* layout);
+	void SetVertexBuffer(ID3D11Buffer* buffer, UINT stride);
+	void SetIndexBuffer(ID3D11Buffer* buffer, DXGI_FORMAT format);
+	void SetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY topology);
+
+	//-------------------------------------
+	// Statistics
+	//-------------------------------------
+
+	void ResetStats() { mStats = { 0, 0 }; }
+	const Stats& GetStats() const { return mStats; }
+
+
+//-------------------------------------
+// Private members
+//-------------------------------------
+private:
+
+	template <typename T>
+	struct Entry
+	{
+		T    value;
+		bool known; // False after Invalidate - the value on the context is unknown
+	};
+
+	// Returns true if the context needs to be called, and records the new value
+	template <typename T>
+	bool Update(Entry<T>& entry, T value)
+	{
+		if (entry.known && entry.value == value)
+		{
+			++mStats.skipped;
+			return false;
+		}
+		entry.value = value;
+		entry.known = true;
+		++mStats.calls;
+		return true;
+	}
+
+	void CountPair(bool firstChanged, bool secondChanged);
+
+	Entry<ID3D11VertexShader*>   mVertexShader;
+	Entry<ID3D11GeometryShader*> mGeometryShader;
+	Entry<ID3D11PixelShader*>    mPixelShader;
+	Entry<ID3D11ShaderResourceView*> mPSResources[NumPSResourceSlots];
+
+	Entry<ID3D11BlendState*>        mBlendState;
+	Entry<ID3D11DepthStencilState*> mDepthStencilState;
+	Entry<ID3D11RasterizerState*>   mRasterizerState;
+
+	Entry<ID3D11InputLayout*>        mInputLayout;
+	Entry<ID3D11Buffer*>             mVertexBuffer;
+	Entry<UINT>                      mVertexStride;
+	Entry<ID3D11Buffer*>             mIndexBuffer;
+	Entry<DXGI_FORMAT>               mIndexFormat;
+	Entry<D3D11_PRIMITIVE_TOPOLOGY>  mTopology;
+
+	Stats mStats;
+};
+
+
+// The cache used for the immediate context
+extern CStateCache gStateCache;
@@ -0,0 +1,91 @@
+//--------------------------------------------------------------------------------------
+// GPU structured buffer with a shader resource view, grown as needed
+//--------------------------------------------------------------------------------------
+
+#include "StructuredBuffer.h"
+
+#include "Common.h"
+
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+
+CStructuredBuffer::~CStructuredBuffer()
+{
+	if (mView)   mView->Release();
+	if (mBuffer) mBuffer->Release();
+}
+
+
+bool CStructuredBuffer::Reserve(unsigned int count)
+{
+	if (count <= mCapacity && mBuffer) return false;
+
+	if (mView)   mView->Release();
+	if (mBuffer) mBuffer->Release();
+	mView = nullptr;
+	mBuffer = nullptr;
+
+	// Grow with some slack so a slowly increasing count doesn't recreate the buffer every frame
+	mCapacity = std::max(count + count / 2, 256u);
+
+	D3D11_BUFFER_DESC bufferDesc = {};
+	bufferDesc.ByteWidth = mCapacity * mStride;
+	bufferDesc.Usage = mDynamic ? D3D11_USAGE_DYNAMIC : D3D11_USAGE_DEFAULT;
+	bufferDesc.BindFlags = D3D11_BIND_SHADER_RESOURCE;
+	bufferDesc.CPUAccessFlags = mDynamic ? D3D11_CPU_ACCESS_WRITE : 0;
+	bufferDesc.MiscFlags = D3D11_RESOURCE_MISC_BUFFER_STRUCTURED;
+	bufferDesc.StructureByteStride = mStride;
+	if (FAILED(gD3DDevice->CreateBuffer(&bufferDesc, nullptr, &mBuffer)))
+	{
+		mCapacity = 0;
+		throw std::runtime_error("Error creating structured buffer");
+	}
+
+	D3D11_SHADER_RESOURCE_VIEW_DESC srvDesc = {};
+	srvDesc.Format = DXGI_FORMAT_UNKNOWN;
+	srvDesc.ViewDimension = D3D11_SRV_DIMENSION_BUFFER;
+	srvDesc.Buffer.FirstElement = 0;
+	srvDesc.Buffer.NumElements = mCapacity;
+	if (FAILED(gD3DDevice->CreateShaderResourceView(mBuffer, &srvDesc, &mView)))
+	{
+		mCapacity = 0;
+		throw std::runtime_error("Error creating structured buffer view");
+	}
+
+	return true;
+}
+
+void CStructuredBuffer::Write(const void* data, unsigned int count)
+{
+	Reserve(count);
+	if (count == 0) return;
+
+	auto elements = BeginWrite(count);
+	if (!elements) return;
+	std::memcpy(elements, data, count * mStride);
+	EndWrite();
+}
+
+void* CStructuredBuffer::BeginWrite(unsigned int count)
+{
+	Reserve(count);
+
+	D3D11_MAPPED_SUBRESOURCE mapped;
+	if (FAILED(gD3DContext->Map(mBuffer, 0, D3D11_MAP_WRITE_DISCARD, 0, &mapped))) return nullptr;
+	return mapped.pData;
+}
+
+void CStructuredBuffer::EndWrite()
+{
+	gD3DContext->Unmap(mBuffer, 0);
+}
+
+void CStructuredBuffer::Update(const void* data, unsigned int first, unsigned int count)
+{
+	if (count == 0) return;
+
+	const D3D11_BOX box = { first * mStride, 0, 0, (first + count) * mStride, 1, 1 };
+	gD3DContext->UpdateSubresource(mBuffer, 0, &box, data, 0, 0);
+}
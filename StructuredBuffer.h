@@ -0,0 +1,56 @@
+//--------------------------------------------------------------------------------------
+// GPU structured buffer with a shader resource view, grown as needed
+//--------------------------------------------------------------------------------------
+// Code in .cpp file
+//
+// Holds an array of fixed size elements for shaders to read (StructuredBuffer<T> in HLSL). Dynamic
+// buffers are rewritten in full each time with Write. Default usage buffers keep their contents and
+// can have part of the array replaced with Update, for data that rarely changes.
+
+#pragma once
+
+#include <d3d11.h>
+
+
+class CStructuredBuffer
+{
+public:
+	CStructuredBuffer(unsigned int stride, bool dynamic)
+		: mStride(stride), mDynamic(dynamic), mCapacity(0), mBuffer(nullptr), mView(nullptr) {}
+	~CStructuredBuffer();
+
+	CStructuredBuffer(const CStructuredBuffer&) = delete;
+	CStructuredBuffer& operator=(const CStructuredBuffer&) = delete;
+
+	// Make room for at least count elements. Returns true if the buffer was recreated, in which case its contents are
+	// lost. Throws a std::runtime_error if the buffer can't be created
+	bool Reserve(unsigned int count);
+
+	// Dynamic buffers only: replace the contents with count elements, growing the buffer if needed
+	void Write(const void* data, unsigned int count);
+
+	// Dynamic buffers only: map the buffer for count elements, growing it if needed, and return where to write them
+	// (several threads may write at once). Call EndWrite when done. Returns nullptr, with no EndWrite needed, if the
+	// buffer can't be mapped
+	void* BeginWrite(unsigned int count);
+	void  EndWrite();
+
+	// Default usage buffers only: replace elements [first, first + count). They must be within the reserved size
+	void Update(const void* data, unsigned int first, unsigned int count);
+
+	ID3D11Buffer*             Buffer() const { return mBuffer; }
+	ID3D11ShaderResourceView* View()   const { return mView; }
+	unsigned int              Capacity() const { return mCapacity; }
+
+
+//-------------------------------------
+// Private members
+//-------------------------------------
+private:
+	unsigned int mStride;
+	bool         mDynamic;
+	unsigned int mCapacity;
+
+	ID3D11Buffer*             mBuffer;
+	ID3D11ShaderResourceView* mView;
+};
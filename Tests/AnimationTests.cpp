@@ -0,0 +1,226 @@
+//--------------------------------------------------------------------------------------
+// Animation tests - clip compression and the clip file, loaded whole and streamed
+//--------------------------------------------------------------------------------------
+
+#include "Test.h"
+#include "Animation.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+#include <thread>
+
+
+namespace
+{
+	const unsigned int NumNodes = 7;
+	const float Duration = 12.0f; // 361 frames, 12 chunks
+
+	// Keys for a made up hierarchy: swinging and twisting joints, a root moving along, a node that doesn't move and
+	// one that pulses in scale. Keys are irregularly spaced, as imported ones can be
+	std::vector<AnimationKeys> MakeKeys()
+	{
+		std::vector<AnimationKeys> keys(NumNodes);
+		for (unsigned int node = 0; node < NumNodes; ++node)
+		{
+			if (node == 3)  continue;
+			for (float time = 0.0f; time <= Duration; time += 0.05f + 0.03f * std::sin(time * 7.0f + node))
+			{
+				const auto swing = 0.8f * std::sin(time * (1.0f + 0.3f * node)) + 0.2f * std::sin(time * 5.3f);
+				const CVector3 axis = { std::sin(node * 1.1f), std::cos(node * 0.7f), 0.4f + 0.1f * std::sin(time) };
+				const auto s = std::sin(swing * 0.5f) / Length(axis);
+				keys[node].rotations.push_back({ time, { axis.x * s, axis.y * s, axis.z * s, std::cos(swing * 0.5f) } });
+
+				if (node == 0)  keys[node].positions.push_back({ time, { time * 1.5f, 0.1f * std::sin(time * 9.0f), 2.0f * std::cos(time * 0.5f) } });
+				if (node == 5)  keys[node].scales.push_back({ time, CVector3{ 1.0f, 1.0f, 1.0f } * (1.0f + 0.25f * std::sin(time * 3.0f)) });
+			}
+		}
+		return keys;
+	}
+
+	std::vector<CMatrix4x4> MakeRestMatrices()
+	{
+		std::vector<CMatrix4x4> rest;
+		for (unsigned int node = 0; node < NumNodes; ++node)  rest.push_back(MatrixTranslation({ 0.0f, 1.0f * node, 0.2f }));
+		return rest;
+	}
+
+	CAnimationClip MakeClip()
+	{
+		return CAnimationClip("Test", Duration, MakeRestMatrices(), MakeKeys());
+	}
+
+	// Largest difference of any rotation, position and scale value between two poses
+	struct PoseErrors
+	{
+		float rotation = 0.0f, position = 0.0f, scale = 0.0f;
+	};
+
+	void AddErrors(const CAnimationPose& a, const CAnimationPose& b, PoseErrors& errors)
+	{
+		for (int channel = 0; channel < CAnimationPose::NumChannels; ++channel)
+		{
+			const auto c = static_cast<CAnimationPose::EChannel>(channel);
+			auto& error = channel <= CAnimationPose::RotationW ? errors.rotation : channel <= CAnimationPose::PositionZ ? errors.position : errors.scale;
+			for (unsigned int node = 0; node < a.NumNodes(); ++node)  error = std::max(error, std::abs(a.Channel(c)[node] - b.Channel(c)[node]));
+		}
+	}
+
+	bool SamePose(const CAnimationPose& a, const CAnimationPose& b)
+	{
+		PoseErrors errors;
+		AddErrors(a, b, errors);
+		return a.NumNodes() == b.NumNodes() && errors.rotation == 0.0f && errors.position == 0.0f && errors.scale == 0.0f;
+	}
+
+	std::string TempFile(const char* name)
+	{
+		return (std::filesystem::temp_directory_path() / name).string();
+	}
+
+
+	// Every frame of a compressed clip is within the errors of the original, and times between frames within twice that
+	// (compression error plus the nlerp of each clip normalising differently)
+	void CompressionStaysWithinErrors()
+	{
+		const auto original = MakeClip();
+		auto compressed = MakeClip();
+		const auto originalBytes = compressed.MemoryBytes();
+		const AnimationCompression settings;
+		compressed.Compress(settings);
+		CHECK(compressed.IsCompressed());
+		CHECK(compressed.NumFrames() == original.NumFrames());
+
+		// The still node, and the ones with only rotations, make for plenty of constant tracks
+		CHECK(compressed.MemoryBytes() * 4 < originalBytes);
+
+		CAnimationPose expected, actual;
+		PoseErrors frameErrors, betweenErrors;
+		for (unsigned int frame = 0; frame < original.NumFrames(); ++frame)
+		{
+			for (auto offset : { 0.0f, 0.3f, 0.5f })
+			{
+				if (frame + 1 == original.NumFrames() && offset > 0.0f)  break;
+				const auto time = (frame + offset) * Duration / (original.NumFrames() - 1);
+				original.Sample(time, false, expected);
+				compressed.Sample(time, false, actual);
+				AddErrors(expected, actual, offset == 0.0f ? frameErrors : betweenErrors);
+			}
+		}
+		CHECK(frameErrors.rotation <= settings.rotationError + 1e-6f);
+		CHECK(frameErrors.position <= settings.positionError + 1e-5f);
+		CHECK(frameErrors.scale <= settings.scaleError + 1e-6f);
+		CHECK(betweenErrors.rotation <= 2.0f * settings.rotationError);
+		CHECK(betweenErrors.position <= 2.0f * settings.positionError);
+		CHECK(betweenErrors.scale <= 2.0f * settings.scaleError);
+
+		// Tighter limits keep more keys
+		auto tighter = MakeClip();
+		tighter.Compress({ 0.0001f, 0.0001f, 0.0001f });
+		CHECK(tighter.MemoryBytes() > compressed.MemoryBytes());
+	}
+
+	// A saved clip loads back to exactly the same samples, whether loaded whole or streamed
+	void SaveAndLoadReproduceTheClip()
+	{
+		auto clip = MakeClip();
+		bool threw = false;
+		try { clip.Save(TempFile("AnimationTests_Uncompressed.anim")); } catch (const std::runtime_error&) { threw = true; }
+		CHECK(threw);
+
+		clip.Compress();
+		const auto fileName = TempFile("AnimationTests.anim");
+		clip.Save(fileName);
+
+		for (auto stream : { false, true })
+		{
+			const auto loaded = CAnimationClip::Load(fileName, stream);
+			CHECK(loaded->IsStreamed() == stream);
+			CHECK(loaded->IsCompressed());
+			CHECK(loaded->Name() == clip.Name());
+			CHECK(loaded->Duration() == clip.Duration());
+			CHECK(loaded->NumNodes() == clip.NumNodes() && loaded->NumFrames() == clip.NumFrames());
+
+			// Forwards, looping round, then jumping about so streamed chunks are dropped and read again
+			CAnimationPose expected, actual;
+			for (float time = 0.0f; time < 2.5f * Duration; time += 0.037f)
+			{
+				clip.Sample(time, true, expected);
+				loaded->Sample(time, true, actual);
+				CHECK(SamePose(expected, actual));
+			}
+			std::srand(3);
+			for (int i = 0; i < 200; ++i)
+			{
+				const auto time = Duration * std::rand() / RAND_MAX;
+				clip.Sample(time, false, expected);
+				loaded->Sample(time, false, actual);
+				CHECK(SamePose(expected, actual));
+			}
+
+			// Streaming only keeps a few chunks in memory
+			if (stream)  CHECK(loaded->MemoryBytes() < clip.MemoryBytes());
+			else         CHECK(loaded->MemoryBytes() == clip.MemoryBytes());
+		}
+		std::filesystem::remove(fileName);
+	}
+
+	// Several threads sampling one streamed clip at different places see the same poses as the clip in memory
+	void StreamedClipSharedByThreads()
+	{
+		auto clip = MakeClip();
+		clip.Compress();
+		const auto fileName = TempFile("AnimationTests_Threads.anim");
+		clip.Save(fileName);
+
+		std::vector<int> failures(4, 0);
+		{
+			const auto streamed = CAnimationClip::Load(fileName, true);
+			std::vector<std::thread> threads;
+			for (unsigned int t = 0; t < failures.size(); ++t)
+			{
+				threads.emplace_back([&, t]
+				{
+					CAnimationPose expected, actual;
+					for (float time = t * Duration / 4; time < t * Duration / 4 + 2.0f * Duration; time += 0.05f * (t + 1))
+					{
+						clip.Sample(time, true, expected);
+						streamed->Sample(time, true, actual);
+						if (!SamePose(expected, actual))  ++failures[t];
+					}
+				});
+			}
+			for (auto& thread : threads)  thread.join();
+		}
+		for (auto count : failures)  CHECK(count == 0);
+		std::filesystem::remove(fileName);
+	}
+
+	void BadFilesThrow()
+	{
+		const auto fileName = TempFile("AnimationTests_Bad.anim");
+		std::ofstream(fileName, std::ios::binary) << "not an animation";
+
+		bool threw = false;
+		try { CAnimationClip::Load(fileName); } catch (const std::runtime_error&) { threw = true; }
+		CHECK(threw);
+
+		threw = false;
+		try { CAnimationClip::Load(TempFile("AnimationTests_Missing.anim")); } catch (const std::runtime_error&) { threw = true; }
+		CHECK(threw);
+		std::filesystem::remove(fileName);
+	}
+}
+
+
+int main()
+{
+	CompressionStaysWithinErrors();
+	SaveAndLoadReproduceTheClip();
+	StreamedClipSharedByThreads();
+	BadFilesThrow();
+	return TestResult("AnimationTests");
+}
@@ -0,0 +1,160 @@
+//--------------------------------------------------------------------------------------
+// Cascaded shadow map tests - split distances and cascade fitting
+//--------------------------------------------------------------------------------------
+
+#include "Test.h"
+#include "CascadedShadows.h"
+
+#include <cmath>
+#include <initializer_list>
+
+
+namespace
+{
+	// Row vector times matrix, with the divide by w
+	CVector3 TransformPoint(const CVector3& p, const CMatrix4x4& m)
+	{
+		const auto w = p.x * m.e03 + p.y * m.e13 + p.z * m.e23 + m.e33;
+		return CVector3{ p.x * m.e00 + p.y * m.e10 + p.z * m.e20 + m.e30,
+		                 p.x * m.e01 + p.y * m.e11 + p.z * m.e21 + m.e31,
+		                 p.x * m.e02 + p.y * m.e12 + p.z * m.e22 + m.e32 } * (1.0f / w);
+	}
+
+	// Left handed perspective projection like the engine's, only e00 and e11 matter to the fitting
+	CMatrix4x4 Projection(float fovX, float aspectRatio, float nearClip, float farClip)
+	{
+		const auto x = 1.0f / std::tan(fovX * 0.5f);
+		const auto range = farClip / (farClip - nearClip);
+		return CMatrix4x4{ x,    0.0f,            0.0f,               0.0f,
+		                   0.0f, x * aspectRatio, 0.0f,               0.0f,
+		                   0.0f, 0.0f,            range,              1.0f,
+		                   0.0f, 0.0f,            -nearClip * range,  0.0f };
+	}
+
+	CMatrix4x4 Camera(const CVector3& position, float yaw, float pitch)
+	{
+		return MatrixRotationX(pitch) * MatrixRotationY(yaw) * MatrixTranslation(position);
+	}
+
+	const float NearClip = 0.5f;
+	const float ShadowDistance = 200.0f;
+	const unsigned int ShadowMapSize = 1024;
+	const float FovX = 1.2f;
+	const float AspectRatio = 16.0f / 9.0f;
+	const CVector3 LightDirection = { 0.3f, -1.0f, 0.45f };
+
+
+	void SplitsEndAtNearAndFar()
+	{
+		for (unsigned int count = 1; count <= CShadowCascades::MaxCascades; ++count)
+		{
+			for (auto lambda : { 0.0f, 0.5f, 0.75f, 1.0f })
+			{
+				float splits[CShadowCascades::MaxCascades + 1];
+				CShadowCascades::CalculateSplits(NearClip, ShadowDistance, count, lambda, splits);
+				CHECK(splits[0] == NearClip);
+				CHECK(splits[count] == ShadowDistance);
+				for (unsigned int i = 0; i < count; ++i)  CHECK(splits[i] < splits[i + 1]);
+			}
+		}
+	}
+
+	void SplitsBlendLogAndUniform()
+	{
+		const unsigned int count = 4;
+		float uniform[count + 1], logarithmic[count + 1], blend[count + 1];
+		CShadowCascades::CalculateSplits(NearClip, ShadowDistance, count, 0.0f, uniform);
+		CShadowCascades::CalculateSplits(NearClip, ShadowDistance, count, 1.0f, logarithmic);
+		CShadowCascades::CalculateSplits(NearClip, ShadowDistance, count, 0.25f, blend);
+
+		for (unsigned int i = 0; i <= count; ++i)
+		{
+			const auto fraction = static_cast<float>(i) / count;
+			CHECK_NEAR(uniform[i], NearClip + (ShadowDistance - NearClip) * fraction, 1e-3);
+			CHECK_NEAR(logarithmic[i], NearClip * std::pow(ShadowDistance / NearClip, fraction), 1e-3);
+			CHECK_NEAR(blend[i], 0.25f * logarithmic[i] + 0.75f * uniform[i], 1e-3);
+
+			// Logarithmic splits are nearer the camera, a blend lies in between
+			CHECK(logarithmic[i] <= uniform[i] + 1e-3f);
+			CHECK(blend[i] >= logarithmic[i] - 1e-3f && blend[i] <= uniform[i] + 1e-3f);
+		}
+	}
+
+	void SpheresContainTheirSlices()
+	{
+		const auto cameraMatrix = Camera({ 10.0f, 5.0f, -30.0f }, 0.7f, 0.2f);
+		const auto projection = Projection(FovX, AspectRatio, NearClip, 1000.0f);
+
+		for (auto lambda : { 0.0f, 0.75f, 1.0f })
+		{
+			CShadowCascades cascades(4, lambda);
+			cascades.Fit(cameraMatrix, projection, NearClip, ShadowDistance, LightDirection, ShadowMapSize, 50.0f);
+
+			const auto tanHalfX = 1.0f / projection.e00;
+			const auto tanHalfY = 1.0f / projection.e11;
+			for (unsigned int c = 0; c < cascades.Count(); ++c)
+			{
+				const auto& cascade = cascades.Cascade(c);
+				CHECK(c == 0 || cascade.nearDistance == cascades.Cascade(c - 1).farDistance);
+
+				// Every corner of the slice is in the sphere and inside the shadow map's view
+				for (auto depth : { cascade.nearDistance, cascade.farDistance })
+				{
+					for (auto sx : { -1.0f, 1.0f })
+					{
+						for (auto sy : { -1.0f, 1.0f })
+						{
+							const CVector3 local = { sx * depth * tanHalfX, sy * depth * tanHalfY, depth };
+							const auto corner = TransformPoint(local, cameraMatrix);
+							CHECK(Length(corner - cascade.centre) <= cascade.radius * 1.0001f);
+
+							const auto shadow = TransformPoint(corner, cascade.viewProjectionMatrix);
+							CHECK(std::abs(shadow.x) <= 1.0f && std::abs(shadow.y) <= 1.0f);
+							CHECK(shadow.z >= 0.0f && shadow.z <= 1.0f);
+						}
+					}
+				}
+			}
+		}
+	}
+
+	void SnappingKeepsWholeTexels()
+	{
+		const auto projection = Projection(FovX, AspectRatio, NearClip, 1000.0f);
+		const CVector3 worldPoint = { 3.0f, 1.0f, 7.0f };
+
+		CShadowCascades start(4);
+		start.Fit(Camera({ 0.0f, 2.0f, 0.0f }, 0.3f, 0.1f), projection, NearClip, ShadowDistance, LightDirection, ShadowMapSize, 50.0f);
+
+		// Moving the camera (without turning it) changes the centres but the texel grid stays put: a fixed world point
+		// lands at the same place within a shadow map texel
+		for (auto step : { 0.013f, 0.37f, 1.9f, 11.3f })
+		{
+			CShadowCascades moved(4);
+			const CVector3 position = { step, 2.0f + step * 0.5f, -step * 0.8f };
+			moved.Fit(Camera(position, 0.3f, 0.1f), projection, NearClip, ShadowDistance, LightDirection, ShadowMapSize, 50.0f);
+
+			for (unsigned int c = 0; c < moved.Count(); ++c)
+			{
+				CHECK_NEAR(moved.Cascade(c).radius, start.Cascade(c).radius, 1e-4 * start.Cascade(c).radius);
+
+				const auto before = TransformPoint(worldPoint, start.Cascade(c).viewProjectionMatrix);
+				const auto after = TransformPoint(worldPoint, moved.Cascade(c).viewProjectionMatrix);
+				for (auto texels : { (after.x - before.x) * 0.5f * ShadowMapSize, (after.y - before.y) * 0.5f * ShadowMapSize })
+				{
+					CHECK_NEAR(texels, std::round(texels), 2e-2);
+				}
+			}
+		}
+	}
+}
+
+
+int main()
+{
+	SplitsEndAtNearAndFar();
+	SplitsBlendLogAndUniform();
+	SpheresContainTheirSlices();
+	SnappingKeepsWholeTexels();
+	return TestResult("CascadedShadowsTests");
+}
@@ -0,0 +1,202 @@
+//--------------------------------------------------------------------------------------
+// Clustered lighting tests - binning light spheres and the cluster output layout
+//--------------------------------------------------------------------------------------
+
+#include "Test.h"
+#include "ClusteredLighting.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <initializer_list>
+
+
+namespace
+{
+	const float NearClip = 0.5f;
+	const float FarClip = 200.0f;
+
+	// Left handed perspective projection like the engine's, only e00 and e11 are used by the clusters
+	CMatrix4x4 Projection(float fovX, float aspectRatio)
+	{
+		const auto x = 1.0f / std::tan(fovX * 0.5f);
+		CMatrix4x4 projection = MatrixIdentity();
+		projection.e00 = x;
+		projection.e11 = x * aspectRatio;
+		return projection;
+	}
+
+	// Clusters for a camera at the origin looking down z, so view space is world space
+	CLightClusters MakeClusters()
+	{
+		CLightClusters clusters(16, 9, 24);
+		clusters.SetCamera(MatrixIdentity(), Projection(1.4f, 16.0f / 9.0f), NearClip, FarClip);
+		return clusters;
+	}
+
+	float Random(float a, float b)
+	{
+		return a + (b - a) * static_cast<float>(std::rand()) / RAND_MAX;
+	}
+
+	// Whether a cluster lists a light, in the point part or the spot part
+	bool ClusterHasLight(const CLightClusters& clusters, int cluster, uint32_t light, bool spot)
+	{
+		const auto& entry = clusters.Clusters()[cluster];
+		const auto numPoints = entry.counts & 0xFFFF;
+		const auto numSpots = entry.counts >> 16;
+		const auto first = clusters.LightIndices().begin() + entry.offset + (spot ? numPoints : 0);
+		const auto last = first + (spot ? numSpots : numPoints);
+		return std::find(first, last, light) != last;
+	}
+
+	unsigned int NumClustersWithLights(const CLightClusters& clusters)
+	{
+		unsigned int count = 0;
+		for (const auto& cluster : clusters.Clusters())  count += cluster.counts != 0;
+		return count;
+	}
+
+
+	// Offsets run through the index list in cluster order without gaps, points then spots in each cluster
+	void LayoutIsPackedInClusterOrder()
+	{
+		std::srand(1);
+		std::vector<LightSphere> points, spots;
+		for (int i = 0; i < 300; ++i)
+		{
+			auto& lights = i % 3 ? points : spots;
+			lights.push_back({ { Random(-80.0f, 80.0f), Random(-40.0f, 40.0f), Random(-10.0f, 220.0f) }, Random(0.5f, 15.0f) });
+		}
+
+		auto clusters = MakeClusters();
+		clusters.Build(points, spots);
+
+		const auto& entries = clusters.Clusters();
+		CHECK(entries.size() == 16u * 9u * 24u);
+		uint32_t expectedOffset = 0;
+		for (const auto& entry : entries)
+		{
+			CHECK(entry.offset == expectedOffset);
+			const auto numPoints = entry.counts & 0xFFFF;
+			const auto numSpots = entry.counts >> 16;
+			for (uint32_t i = 0; i < numPoints; ++i)  CHECK(clusters.LightIndices()[entry.offset + i] < points.size());
+			for (uint32_t i = 0; i < numSpots; ++i)   CHECK(clusters.LightIndices()[entry.offset + numPoints + i] < spots.size());
+			expectedOffset += numPoints + numSpots;
+		}
+		CHECK(expectedOffset == clusters.LightIndices().size());
+
+		// x fastest, then y from the top of the screen, then slice
+		CHECK(clusters.ClusterIndex(1, 0, 0) == 1);
+		CHECK(clusters.ClusterIndex(0, 1, 0) == 16);
+		CHECK(clusters.ClusterIndex(0, 0, 1) == 16 * 9);
+
+		// Depth 1 is in slice floor(24 * log(1 / 0.5) / log(200 / 0.5)) = 2. Just off centre is in the middle row, near
+		// the top left corner is in the top row
+		const auto projection = Projection(1.4f, 16.0f / 9.0f);
+		const auto tanHalfX = 1.0f / projection.e00, tanHalfY = 1.0f / projection.e11;
+		CHECK(clusters.FindCluster({ 0.01f, 0.01f, 1.0f }) == static_cast<int>(clusters.ClusterIndex(8, 4, 2)));
+		CHECK(clusters.FindCluster({ -0.8f * tanHalfX, 0.8f * tanHalfY, 1.0f }) == static_cast<int>(clusters.ClusterIndex(1, 0, 2)));
+		CHECK(clusters.FindCluster({ 0.0f, 0.0f, 0.1f }) == -1);
+		CHECK(clusters.FindCluster({ 0.0f, 0.0f, 300.0f }) == -1);
+
+		// Every point inside a light that is on screen is in a cluster listing that light
+		for (unsigned int light = 0; light < points.size() + spots.size(); ++light)
+		{
+			const auto spot = light >= points.size();
+			const auto& sphere = spot ? spots[light - points.size()] : points[light];
+			const auto index = static_cast<uint32_t>(spot ? light - points.size() : light);
+			for (int sample = 0; sample < 50; ++sample)
+			{
+				CVector3 offset = { Random(-1.0f, 1.0f), Random(-1.0f, 1.0f), Random(-1.0f, 1.0f) };
+				if (Length(offset) > 1.0f)  continue;
+
+				const auto cluster = clusters.FindCluster(sphere.centre + offset * sphere.radius);
+				if (cluster >= 0)  CHECK(ClusterHasLight(clusters, cluster, index, spot));
+			}
+		}
+	}
+
+	// A light centred on a slice boundary and on the line between two tiles reaches the clusters on both sides
+	void LightOnClusterBoundary()
+	{
+		auto clusters = MakeClusters();
+		const auto boundary = std::exp((10.0f - clusters.DepthBias()) / clusters.DepthScale());
+		const auto tileHeight = 2.0f * boundary / clusters.TilesY() / Projection(1.4f, 16.0f / 9.0f).e11;
+		const CVector3 centre = { 0.0f, tileHeight * 0.5f, boundary };
+		const float radius = 0.05f;
+
+		clusters.Build({ { centre, radius } }, {});
+
+		for (auto dx : { -0.01f, 0.01f })
+		{
+			for (auto dz : { -0.01f, 0.01f })
+			{
+				const auto cluster = clusters.FindCluster(centre + CVector3{ dx, 0.0f, dz });
+				CHECK(cluster >= 0 && ClusterHasLight(clusters, cluster, 0, false));
+			}
+		}
+		CHECK(clusters.FindCluster(centre + CVector3{ 0.0f, 0.0f, -0.01f }) != clusters.FindCluster(centre + CVector3{ 0.0f, 0.0f, 0.01f }));
+		CHECK(clusters.FindCluster(centre + CVector3{ -0.01f, 0.0f, 0.0f }) != clusters.FindCluster(centre + CVector3{ 0.01f, 0.0f, 0.0f }));
+
+		// Small enough to stay within the 2 x 2 tiles and 2 slices around the boundary
+		CHECK(NumClustersWithLights(clusters) <= 8);
+	}
+
+	void LightBehindCamera()
+	{
+		auto clusters = MakeClusters();
+
+		// Entirely behind, for both light types
+		clusters.Build({ { { 0.0f, 0.0f, -10.0f }, 5.0f } }, { { { 3.0f, 1.0f, -2.0f }, 1.0f } });
+		CHECK(NumClustersWithLights(clusters) == 0);
+		CHECK(clusters.LightIndices().empty());
+
+		// Behind but reaching past the near clip, lights the first slice only
+		clusters.Build({}, { { { 0.0f, 0.0f, -1.0f }, 1.6f } });
+		CHECK(NumClustersWithLights(clusters) > 0);
+		const auto cluster = clusters.FindCluster({ 0.0f, 0.0f, 0.55f });
+		CHECK(cluster >= 0 && ClusterHasLight(clusters, cluster, 0, true));
+		for (unsigned int i = 0; i < clusters.Clusters().size(); ++i)
+		{
+			if (clusters.Clusters()[i].counts)  CHECK(i / (clusters.TilesX() * clusters.TilesY()) == 0);
+		}
+	}
+
+	void LightBeyondFarPlane()
+	{
+		auto clusters = MakeClusters();
+
+		clusters.Build({ { { 0.0f, 0.0f, FarClip + 10.0f }, 5.0f } }, {});
+		CHECK(NumClustersWithLights(clusters) == 0);
+
+		// Reaching back over the far clip, lights the last slice only
+		clusters.Build({ { { 0.0f, 0.0f, FarClip + 1.0f }, 5.0f } }, {});
+		CHECK(NumClustersWithLights(clusters) > 0);
+		const auto cluster = clusters.FindCluster({ 0.0f, 0.0f, FarClip - 1.0f });
+		CHECK(cluster >= 0 && ClusterHasLight(clusters, cluster, 0, false));
+		for (unsigned int i = 0; i < clusters.Clusters().size(); ++i)
+		{
+			if (clusters.Clusters()[i].counts)  CHECK(i / (clusters.TilesX() * clusters.TilesY()) == clusters.Slices() - 1);
+		}
+	}
+
+	// Off to the side of the frustum at a depth it covers, but not overlapping it
+	void LightOutsideTheSides()
+	{
+		auto clusters = MakeClusters();
+		clusters.Build({ { { 100.0f, 0.0f, 10.0f }, 5.0f } }, { { { 0.0f, -100.0f, 10.0f }, 5.0f } });
+		CHECK(NumClustersWithLights(clusters) == 0);
+	}
+}
+
+
+int main()
+{
+	LayoutIsPackedInClusterOrder();
+	LightOnClusterBoundary();
+	LightBehindCamera();
+	LightBeyondFarPlane();
+	LightOutsideTheSides();
+	return TestResult("ClusteredLightingTests");
+}
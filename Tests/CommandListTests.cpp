@@ -0,0 +1,170 @@
+//--------------------------------------------------------------------------------------
+// Command list tests - recording draws and executing them on the null backend
+//--------------------------------------------------------------------------------------
+
+#include "Test.h"
+#include "CommandBackend.h"
+
+#include <cstring>
+
+
+namespace
+{
+	// Stand-ins for GPU objects, only their addresses are used
+	int gVertexShader, gPixelShader, gBlend, gDepth, gRasterizer, gOtherPixelShader;
+	int gDiffuse, gNormal, gShadows;
+	int gVertexBuffer, gLayout, gIndexBuffer, gOtherVertexBuffer, gConstants;
+
+	const PipelineState Pipeline      = { &gVertexShader, nullptr, &gPixelShader, &gBlend, &gDepth, &gRasterizer };
+	const PipelineState OtherPipeline = { &gVertexShader, nullptr, &gOtherPixelShader, &gBlend, &gDepth, &gRasterizer };
+
+	struct ModelConstants
+	{
+		float world[16];
+		float colour[3];
+	};
+
+	// What an object records to draw itself (see CGameObject::Record)
+	void RecordModel(CCommandList& list, const PipelineState& pipeline, GpuHandle vertexBuffer, float colour, unsigned int indexCount)
+	{
+		list.SetPipeline(pipeline);
+		list.SetTexture(0, &gDiffuse);
+		list.SetTexture(1, &gNormal);
+		list.SetVertexBuffer(vertexBuffer, &gLayout, 32);
+		list.SetIndexBuffer(&gIndexBuffer);
+
+		ModelConstants constants = {};
+		constants.colour[0] = colour;
+		list.UpdateConstants(&gConstants, 0, &constants, sizeof(constants));
+		list.DrawIndexed(indexCount);
+	}
+
+
+	// Binds repeating the last one in the list are dropped, everything else reaches the backend
+	void RepeatedBindsAreDropped()
+	{
+		CCommandList list;
+		RecordModel(list, Pipeline, &gVertexBuffer, 1.0f, 300);
+		RecordModel(list, Pipeline, &gVertexBuffer, 2.0f, 300);      // Only its constants and draw
+		RecordModel(list, OtherPipeline, &gVertexBuffer, 3.0f, 600); // And its pipeline
+		RecordModel(list, OtherPipeline, &gOtherVertexBuffer, 4.0f, 900); // And its vertex buffer
+
+		CNullCommandBackend backend;
+		backend.Execute(list);
+		const auto& stats = backend.GetStats();
+		CHECK(stats.pipelineChanges == 2);
+		CHECK(stats.textureBinds == 2);
+		CHECK(stats.bufferBinds == 3);
+		CHECK(stats.constantUpdates == 4);
+		CHECK(stats.constantBytes == 4 * sizeof(ModelConstants));
+		CHECK(stats.draws == 4 && stats.instances == 4);
+		CHECK(stats.indices == 2100);
+		CHECK(stats.commands == 2 + 2 + 3 + 4 + 4);
+		CHECK(stats.commands == list.Commands().size());
+
+		// Texture slots past the tracked ones and null buffers are always recorded
+		list.Reset();
+		list.SetTexture(CCommandList::NumTrackedTextures, &gShadows);
+		list.SetTexture(CCommandList::NumTrackedTextures, &gShadows);
+		list.SetVertexBuffer(nullptr, nullptr, 0);
+		list.SetVertexBuffer(nullptr, nullptr, 0);
+		CHECK(list.Commands().size() == 4);
+
+		// Unbinding a texture is a change like any other
+		list.Reset();
+		list.SetTexture(2, nullptr);
+		list.SetTexture(2, &gShadows);
+		list.SetTexture(2, nullptr);
+		list.SetTexture(2, nullptr);
+		CHECK(list.Commands().size() == 3);
+	}
+
+	// A new list, or one that has been reset, doesn't know what the last list bound, so it binds everything again
+	void ListsStartWithNothingBound()
+	{
+		CCommandList first, second;
+		RecordModel(first, Pipeline, &gVertexBuffer, 1.0f, 300);
+		RecordModel(second, Pipeline, &gVertexBuffer, 1.0f, 300);
+
+		CNullCommandBackend backend;
+		backend.Execute(first);
+		backend.Execute(second);
+		CHECK(backend.GetStats().pipelineChanges == 2);
+		CHECK(backend.GetStats().textureBinds == 4);
+		CHECK(backend.GetStats().draws == 2);
+
+		first.Reset();
+		CHECK(first.Empty() && first.ConstantDataSize() == 0 && first.InstanceMatrices().empty());
+		RecordModel(first, Pipeline, &gVertexBuffer, 1.0f, 300);
+		backend.ResetStats();
+		backend.Execute(first);
+		CHECK(backend.GetStats().pipelineChanges == 1 && backend.GetStats().bufferBinds == 2);
+		CHECK(backend.GetStats().draws == 1);
+	}
+
+	// Constants are copied into the list 16-byte aligned and read back unchanged
+	void ConstantsAreKept()
+	{
+		CCommandList list;
+		const float small[3] = { 1.0f, 2.0f, 3.0f };
+		ModelConstants model = {};
+		for (int i = 0; i < 16; ++i)  model.world[i] = static_cast<float>(i);
+		list.UpdateConstants(&gConstants, 0, small, sizeof(small));
+		list.UpdateConstants(&gConstants, 2, &model, sizeof(model));
+
+		const auto& commands = list.Commands();
+		CHECK(commands.size() == 2);
+		CHECK(commands[0].type == ECommand::UpdateConstants && commands[1].type == ECommand::UpdateConstants);
+		CHECK(commands[1].constants.slot == 2 && commands[1].constants.size == sizeof(model));
+		CHECK(commands[1].constants.dataOffset % 16 == 0);
+		CHECK(std::memcmp(list.ConstantData(commands[0]), small, sizeof(small)) == 0);
+		CHECK(std::memcmp(list.ConstantData(commands[1]), &model, sizeof(model)) == 0);
+		CHECK(list.ConstantDataSize() == 16 + sizeof(model));
+
+		CNullCommandBackend backend;
+		backend.Execute(list);
+		CHECK(backend.GetStats().constantBytes == sizeof(small) + sizeof(model));
+		CHECK(backend.GetStats().draws == 0);
+	}
+
+	// An instanced draw counts once as a draw and once per object as an instance
+	void InstancedDraws()
+	{
+		CCommandList list;
+		CMatrix4x4 matrices[5];
+		for (int i = 0; i < 5; ++i)  matrices[i] = MatrixTranslation({ static_cast<float>(i), 0.0f, 0.0f });
+
+		list.SetPipeline(Pipeline);
+		list.SetVertexBuffer(&gVertexBuffer, &gLayout, 32);
+		list.SetIndexBuffer(&gIndexBuffer, 2);
+		CHECK(list.AddInstanceMatrices(matrices, 3) == 0);
+		list.DrawIndexedInstanced(120, 3);
+		CHECK(list.AddInstanceMatrices(matrices + 3, 2) == 3);
+		list.DrawIndexedInstanced(60, 2, 30, 4);
+		list.DrawIndexed(36);
+		CHECK(list.InstanceMatrices().size() == 5);
+		CHECK(list.InstanceMatrices()[4].GetPosition().x == 4.0f);
+
+		const auto& draw = list.Commands().back().draw;
+		CHECK(draw.indexCount == 36 && draw.instanceCount == 1);
+		CHECK(list.Commands()[2].indexBuffer.indexSize == 2);
+
+		CNullCommandBackend backend;
+		backend.Execute(list);
+		const auto& stats = backend.GetStats();
+		CHECK(stats.draws == 3);
+		CHECK(stats.instances == 6);
+		CHECK(stats.indices == 120 * 3 + 60 * 2 + 36);
+		CHECK(stats.constantUpdates == 0 && stats.constantBytes == 0);
+	}
+}
+
+
+int main()
+{
+	RepeatedBindsAreDropped();
+	ListsStartWithNothingBound();
+	ConstantsAreKept();
+	InstancedDraws();
+	return TestResult("CommandListTests");
+}
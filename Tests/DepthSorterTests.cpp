@@ -0,0 +1,204 @@
+//--------------------------------------------------------------------------------------
+// Depth sorter tests - back to front order, stability and reuse of the last order
+//--------------------------------------------------------------------------------------
+
+#include "Test.h"
+#include "DepthSorter.h"
+#include "JobSystem.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <initializer_list>
+#include <vector>
+
+
+namespace
+{
+	// Enough items to be split into blocks sorted on several threads, and few enough to be sorted as one
+	const unsigned int LargeCount = 100000;
+	const unsigned int SmallCount = 1000;
+
+	// Depths on a grid far coarser than the sorter's key resolution, so items at different depths never share a key
+	std::vector<float> RandomDepths(unsigned int count, int numDepths)
+	{
+		std::vector<float> depths(count);
+		for (auto& depth : depths)  depth = (std::rand() % numDepths) * 0.01f - 20.0f;
+		return depths;
+	}
+
+	// The order holds each index below the count once, farthest first, with equal depths in ascending index if ties
+	// are expected to be in the order they were added
+	bool IsBackToFront(const std::vector<uint32_t>& order, const std::vector<float>& depths, bool tiesInIndexOrder)
+	{
+		if (order.size() != depths.size())  return false;
+
+		std::vector<bool> seen(depths.size(), false);
+		for (unsigned int i = 0; i < order.size(); ++i)
+		{
+			if (order[i] >= depths.size() || seen[order[i]])  return false;
+			seen[order[i]] = true;
+
+			if (i == 0)  continue;
+			const auto previous = depths[order[i - 1]], current = depths[order[i]];
+			if (previous < current)  return false;
+			if (tiesInIndexOrder && previous == current && order[i - 1] > order[i])  return false;
+		}
+		return true;
+	}
+
+
+	void SortsBackToFront()
+	{
+		for (auto count : { SmallCount, LargeCount })
+		{
+			std::srand(count);
+			const auto depths = RandomDepths(count, 100000);
+			CDepthSorter sorter;
+			CHECK(IsBackToFront(sorter.Sort(depths.data(), count), depths, true));
+			CHECK(!sorter.WasAlreadySorted());
+			CHECK(sorter.Order() == sorter.Sort(depths.data(), count));
+		}
+
+		// Two items are told apart however close, as long as they are a millionth of the range apart
+		const float depths[] = { 0.0f, 1000.0f, 0.0015f };
+		CDepthSorter sorter;
+		CHECK((sorter.Sort(depths, 3) == std::vector<uint32_t>{ 1, 2, 0 }));
+	}
+
+	// Few distinct depths, so many items share each one. Equal items keep the order they were in
+	void EqualDepthsKeepTheirOrder()
+	{
+		for (auto count : { SmallCount, LargeCount })
+		{
+			std::srand(count + 1);
+			auto depths = RandomDepths(count, 20);
+			CDepthSorter sorter;
+			CHECK(IsBackToFront(sorter.Sort(depths.data(), count), depths, true));
+
+			// Move some items to new depths. Those that still tie keep last frame's order, not their index order
+			const auto previous = sorter.Order();
+			for (unsigned int i = 0; i < count; i += 7)  depths[i] = (std::rand() % 20) * 0.01f - 20.0f;
+			const auto& order = sorter.Sort(depths.data(), count);
+			CHECK(IsBackToFront(order, depths, false));
+
+			std::vector<unsigned int> previousPlace(count);
+			for (unsigned int i = 0; i < count; ++i)  previousPlace[previous[i]] = i;
+			auto stable = true;
+			for (unsigned int i = 1; i < count; ++i)
+			{
+				if (depths[order[i - 1]] == depths[order[i]])  stable &= previousPlace[order[i - 1]] < previousPlace[order[i]];
+			}
+			CHECK(stable);
+		}
+	}
+
+	// Items removed from the end and added there between sorts, as particle pools do
+	void CountChangesBetweenSorts()
+	{
+		for (auto count : { SmallCount, LargeCount })
+		{
+			std::srand(count + 2);
+			auto depths = RandomDepths(count, 100000);
+			CDepthSorter sorter;
+			sorter.Sort(depths.data(), count);
+
+			depths.resize(count / 3);
+			CHECK(IsBackToFront(sorter.Sort(depths.data(), count / 3), depths, true));
+
+			// Items still there that tie keep their last order from here on
+			depths = RandomDepths(count * 2, 100000);
+			CHECK(IsBackToFront(sorter.Sort(depths.data(), count * 2), depths, false));
+
+			// Shrinking without moving anything leaves the remaining items in order
+			depths.resize(count);
+			CHECK(IsBackToFront(sorter.Sort(depths.data(), count), depths, false));
+			CHECK(sorter.WasAlreadySorted());
+
+			// Down to one and none
+			CHECK((sorter.Sort(depths.data(), 1) == std::vector<uint32_t>{ 0 }));
+			CHECK(sorter.Sort(depths.data(), 0).empty());
+		}
+	}
+
+	// Sorting again with the same or slightly moved depths finds the last order still holds and does no passes
+	void AlreadySortedIsDetected()
+	{
+		for (auto count : { SmallCount, LargeCount })
+		{
+			std::srand(count + 3);
+			auto depths = RandomDepths(count, 100000);
+			CDepthSorter sorter;
+			const auto first = sorter.Sort(depths.data(), count);
+			CHECK(!sorter.WasAlreadySorted());
+
+			CHECK(sorter.Sort(depths.data(), count) == first);
+			CHECK(sorter.WasAlreadySorted());
+
+			// Everything moving the same way changes no places
+			for (auto& depth : depths)  depth += 3.0f;
+			CHECK(sorter.Sort(depths.data(), count) == first);
+			CHECK(sorter.WasAlreadySorted());
+
+			// Moving the farthest item to the front and the nearest to the back does change the order, and is noticed
+			// wherever in the blocks they are
+			const auto nearest = depths[first.back()], farthest = depths[first.front()];
+			depths[first.front()] = nearest - 1.0f;
+			depths[first.back()] = farthest + 1.0f;
+			const auto& order = sorter.Sort(depths.data(), count);
+			CHECK(!sorter.WasAlreadySorted());
+			CHECK(IsBackToFront(order, depths, false));
+			CHECK(order.front() == first.back() && order.back() == first.front());
+
+			// Two halves each in order but not as a whole. With four threads the large sort has four blocks, so this
+			// is only seen by comparing the ends of neighbouring blocks
+			for (unsigned int i = 0; i < count; ++i)  depths[i] = -0.01f * (i % (count / 2));
+			sorter.Reset();
+			sorter.Sort(depths.data(), count);
+			CHECK(!sorter.WasAlreadySorted());
+			CHECK(IsBackToFront(sorter.Order(), depths, true));
+
+			// Forgetting the last order starts again from index order
+			sorter.Reset();
+			sorter.Sort(depths.data(), count);
+			CHECK(!sorter.WasAlreadySorted());
+			CHECK(IsBackToFront(sorter.Order(), depths, true));
+		}
+	}
+
+	// With every depth the same there is nothing to sort by, the last order stands
+	void AllDepthsEqual()
+	{
+		for (auto count : { SmallCount, LargeCount })
+		{
+			std::srand(count + 4);
+			const std::vector<float> equal(count, 5.0f);
+			CDepthSorter sorter;
+			auto& order = sorter.Sort(equal.data(), count);
+			CHECK(sorter.WasAlreadySorted());
+			auto identity = true;
+			for (unsigned int i = 0; i < count; ++i)  identity &= order[i] == i;
+			CHECK(identity);
+
+			const auto depths = RandomDepths(count, 100000);
+			const auto sorted = sorter.Sort(depths.data(), count);
+			CHECK(sorter.Sort(equal.data(), count) == sorted);
+			CHECK(sorter.WasAlreadySorted());
+		}
+	}
+}
+
+
+int main()
+{
+	// Several threads, so the large sorts are split into blocks
+	InitJobSystem(3);
+
+	SortsBackToFront();
+	EqualDepthsKeepTheirOrder();
+	CountChangesBetweenSorts();
+	AlreadySortedIsDetected();
+	AllDepthsEqual();
+
+	ShutdownJobSystem();
+	return TestResult("DepthSorterTests");
+}
@@ -0,0 +1,118 @@
+//--------------------------------------------------------------------------------------
+// Mesh BVH tests - ray casts against the hierarchy match testing every triangle
+//--------------------------------------------------------------------------------------
+
+#include "Test.h"
+#include "MeshBVH.h"
+
+#include <cstdlib>
+#include <initializer_list>
+
+
+namespace
+{
+	float Random(float a, float b)
+	{
+		return a + (b - a) * static_cast<float>(std::rand()) / RAND_MAX;
+	}
+
+	// Closest hit by testing every triangle, using a BVH of that triangle alone
+	bool BruteForceRayCast(const CMeshBVH& bvh, const CRay& ray, float maxT, CMeshBVH::Hit& hit)
+	{
+		auto found = false;
+		for (unsigned int t = 0; t < bvh.NumTriangles(); ++t)
+		{
+			CMeshBVH single;
+			single.Build({ bvh.Positions()[bvh.Indices()[t * 3]], bvh.Positions()[bvh.Indices()[t * 3 + 1]], bvh.Positions()[bvh.Indices()[t * 3 + 2]] }, { 0, 1, 2 });
+			CMeshBVH::Hit triangleHit;
+			if (single.RayCast(ray, maxT, triangleHit))
+			{
+				hit = { triangleHit.distance, t, triangleHit.u, triangleHit.v };
+				maxT = triangleHit.distance;
+				found = true;
+			}
+		}
+		return found;
+	}
+
+	void CheckRay(const CMeshBVH& bvh, const CRay& ray, float maxT)
+	{
+		CMeshBVH::Hit expected = {}, actual = {};
+		const auto expectedFound = BruteForceRayCast(bvh, ray, maxT, expected);
+		const auto found = bvh.RayCast(ray, maxT, actual);
+		CHECK(found == expectedFound);
+		if (found && expectedFound)
+		{
+			CHECK(actual.triangle == expected.triangle);
+			CHECK_NEAR(actual.distance, expected.distance, 1e-4 * expected.distance);
+		}
+	}
+
+
+	// A random soup of triangles, rays from all over
+	void MatchesBruteForce()
+	{
+		std::srand(5);
+		std::vector<CVector3> positions;
+		std::vector<uint32_t> indices;
+		for (uint32_t t = 0; t < 500; ++t)
+		{
+			const CVector3 centre = { Random(-20.0f, 20.0f), Random(-20.0f, 20.0f), Random(-20.0f, 20.0f) };
+			for (int corner = 0; corner < 3; ++corner)
+			{
+				positions.push_back(centre + CVector3{ Random(-2.0f, 2.0f), Random(-2.0f, 2.0f), Random(-2.0f, 2.0f) });
+				indices.push_back(t * 3 + corner);
+			}
+		}
+		CMeshBVH bvh;
+		bvh.Build(positions, indices);
+
+		for (int i = 0; i < 300; ++i)
+		{
+			const CVector3 origin = { Random(-30.0f, 30.0f), Random(-30.0f, 30.0f), Random(-30.0f, 30.0f) };
+			const CVector3 target = { Random(-20.0f, 20.0f), Random(-20.0f, 20.0f), Random(-20.0f, 20.0f) };
+			CheckRay(bvh, CRay(origin, target - origin), i % 3 ? 1.0f : 2.0f);
+		}
+	}
+
+	// Triangles twice as far along x each time, so each split only takes a few off the end and the tree is lopsided and
+	// deep. A ray along the row passes through both children of every node, leaving a node waiting on the stack at each
+	// level, and must still find the nearest triangle however deep it is
+	void LopsidedTreeFindsTheNearest()
+	{
+		const uint32_t NumTriangles = 80;
+		for (auto sign : { 1.0f, -1.0f })
+		{
+			std::vector<CVector3> positions;
+			std::vector<uint32_t> indices;
+			auto x = 1.0f;
+			for (uint32_t t = 0; t < NumTriangles; ++t, x *= 2.0f)
+			{
+				positions.insert(positions.end(), { { sign * x, -1.0f, -1.0f }, { sign * x, 2.0f, -1.0f }, { sign * x, -1.0f, 2.0f } });
+				indices.insert(indices.end(), { t * 3, t * 3 + 1, t * 3 + 2 });
+			}
+			CMeshBVH bvh;
+			bvh.Build(positions, indices);
+
+			// From just before the first triangle, outwards along the row, and from beyond the last one, inwards
+			const auto far = 2.0f * x;
+			CMeshBVH::Hit hit;
+			CHECK(bvh.RayCast(CRay({ sign * 0.5f, 0.0f, 0.0f }, { sign, 0.0f, 0.0f }), far, hit));
+			CHECK(hit.triangle == 0 && hit.distance == 0.5f);
+			CHECK(bvh.RayCast(CRay({ sign * far, 0.0f, 0.0f }, { -sign, 0.0f, 0.0f }), far, hit));
+			CHECK(hit.triangle == NumTriangles - 1);
+
+			// Starting part way along, the next triangle on either way
+			CheckRay(bvh, CRay({ sign * 50.0f, 0.0f, 0.0f }, { 1.0f, 0.0f, 0.0f }), far);
+			CheckRay(bvh, CRay({ sign * 50.0f, 0.0f, 0.0f }, { -1.0f, 0.0f, 0.0f }), far);
+		}
+	}
+}
+
+
+int main()
+{
+	MatchesBruteForce();
+	LopsidedTreeFindsTheNearest();
+	return TestResult("MeshBVHTests");
+}
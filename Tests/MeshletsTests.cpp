@@ -0,0 +1,260 @@
+//--------------------------------------------------------------------------------------
+// Meshlet tests - building meshlets, their bounds, and cone culling
+//--------------------------------------------------------------------------------------
+
+#include "Test.h"
+#include "Meshlets.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <initializer_list>
+
+
+namespace
+{
+	struct Mesh
+	{
+		std::vector<CVector3> positions;
+		std::vector<uint32_t> indices;
+	};
+
+	// A wavy grid of quads with a scatter of separate triangles after it, like leaves
+	Mesh MakeGridAndLeaves(unsigned int size, unsigned int leaves)
+	{
+		Mesh mesh;
+		for (unsigned int y = 0; y <= size; ++y)
+		{
+			for (unsigned int x = 0; x <= size; ++x)
+			{
+				mesh.positions.push_back({ static_cast<float>(x), std::sin(x * 0.3f) * std::cos(y * 0.2f), static_cast<float>(y) });
+			}
+		}
+		for (unsigned int y = 0; y < size; ++y)
+		{
+			for (unsigned int x = 0; x < size; ++x)
+			{
+				const auto v = y * (size + 1) + x;
+				mesh.indices.insert(mesh.indices.end(), { v, v + size + 1, v + 1, v + 1, v + size + 1, v + size + 2 });
+			}
+		}
+		for (unsigned int i = 0; i < leaves; ++i)
+		{
+			const auto v = static_cast<uint32_t>(mesh.positions.size());
+			const CVector3 base = { static_cast<float>(i % 7) * 3.0f, 5.0f, static_cast<float>(i / 7) * 3.0f };
+			mesh.positions.insert(mesh.positions.end(), { base, base + CVector3{ 1, 0, 0 }, base + CVector3{ 0, 0.5f, 1 } });
+			mesh.indices.insert(mesh.indices.end(), { v, v + 1, v + 2 });
+		}
+		return mesh;
+	}
+
+	// A closed sphere with every triangle wound so its normal (Cross(p1 - p0, p2 - p0)) points outwards
+	Mesh MakeSphere(unsigned int rings, unsigned int segments, float radius)
+	{
+		Mesh mesh;
+		for (unsigned int ring = 0; ring <= rings; ++ring)
+		{
+			const auto theta = 3.14159265f * ring / rings;
+			for (unsigned int segment = 0; segment <= segments; ++segment)
+			{
+				const auto phi = 2.0f * 3.14159265f * segment / segments;
+				mesh.positions.push_back(CVector3{ std::sin(theta) * std::cos(phi), std::cos(theta), std::sin(theta) * std::sin(phi) } * radius);
+			}
+		}
+		for (unsigned int ring = 0; ring < rings; ++ring)
+		{
+			for (unsigned int segment = 0; segment < segments; ++segment)
+			{
+				const auto v = ring * (segments + 1) + segment;
+				for (auto triangle : { std::array<uint32_t, 3>{ v, v + 1, v + segments + 1 }, std::array<uint32_t, 3>{ v + 1, v + segments + 2, v + segments + 1 } })
+				{
+					const auto& p0 = mesh.positions[triangle[0]];
+					const auto normal = Cross(mesh.positions[triangle[1]] - p0, mesh.positions[triangle[2]] - p0);
+					if (Length(normal) < 1e-6f)  continue; // Slivers at the poles
+					if (Dot(normal, p0) < 0.0f)  std::swap(triangle[1], triangle[2]);
+					mesh.indices.insert(mesh.indices.end(), triangle.begin(), triangle.end());
+				}
+			}
+		}
+		return mesh;
+	}
+
+	// Planes that every sphere is inside, so only the cone test culls
+	MeshletView OpenView(const CVector3& position)
+	{
+		MeshletView view;
+		view.position = position;
+		for (auto& plane : view.frustum.planes)  plane = { { 0.0f, 0.0f, 0.0f }, 1.0f };
+		return view;
+	}
+
+	CVector3 TransformPoint(const CVector3& p, const CMatrix4x4& m)
+	{
+		return { p.x * m.e00 + p.y * m.e10 + p.z * m.e20 + m.e30,
+		         p.x * m.e01 + p.y * m.e11 + p.z * m.e21 + m.e31,
+		         p.x * m.e02 + p.y * m.e12 + p.z * m.e22 + m.e32 };
+	}
+
+	// Meshlets kept by CullMeshlets, as a flag per meshlet
+	std::vector<bool> VisibleMeshlets(const std::vector<Meshlet>& meshlets, const MeshletView& view)
+	{
+		std::vector<MeshletRange> ranges;
+		CullMeshlets(meshlets, view, ranges);
+
+		std::vector<bool> visible(meshlets.size(), false);
+		for (size_t m = 0; m < meshlets.size(); ++m)
+		{
+			for (const auto& range : ranges)
+			{
+				visible[m] = visible[m] || (meshlets[m].firstIndex >= range.firstIndex && meshlets[m].firstIndex < range.firstIndex + range.numIndices);
+			}
+		}
+		return visible;
+	}
+
+	// Whether a world space triangle faces away from a viewpoint (edge on counts as away)
+	bool BackFacing(const CVector3& p0, const CVector3& p1, const CVector3& p2, const CVector3& viewpoint)
+	{
+		const auto normal = Cross(p1 - p0, p2 - p0);
+		return Dot(normal, viewpoint - p0) <= 1e-4f * Length(normal) * Length(viewpoint - p0);
+	}
+
+
+	// Meshlets are consecutive ranges within the limits, and hold every input triangle exactly once, corners in order
+	void LimitsAndEveryTriangleOnce()
+	{
+		const auto mesh = MakeGridAndLeaves(40, 60);
+		for (auto limits : { std::array<unsigned int, 2>{ MeshletMaxVertices, MeshletMaxTriangles }, std::array<unsigned int, 2>{ 16, 10 } })
+		{
+			auto indices = mesh.indices;
+			std::vector<Meshlet> meshlets;
+			BuildMeshlets(indices, mesh.positions, meshlets, limits[0], limits[1]);
+			CHECK(!meshlets.empty());
+
+			uint32_t nextIndex = 0;
+			for (const auto& meshlet : meshlets)
+			{
+				CHECK(meshlet.firstIndex == nextIndex);
+				CHECK(meshlet.numTriangles >= 1 && meshlet.numTriangles <= limits[1]);
+
+				std::vector<uint32_t> vertices(indices.begin() + meshlet.firstIndex, indices.begin() + meshlet.firstIndex + meshlet.numTriangles * 3);
+				std::sort(vertices.begin(), vertices.end());
+				CHECK(std::unique(vertices.begin(), vertices.end()) - vertices.begin() <= static_cast<long>(limits[0]));
+				nextIndex += meshlet.numTriangles * 3;
+			}
+			CHECK(nextIndex == indices.size());
+
+			auto triangles = [](const std::vector<uint32_t>& list)
+			{
+				std::vector<std::array<uint32_t, 3>> result;
+				for (size_t i = 0; i + 2 < list.size(); i += 3)  result.push_back({ list[i], list[i + 1], list[i + 2] });
+				std::sort(result.begin(), result.end());
+				return result;
+			};
+			CHECK(triangles(indices) == triangles(mesh.indices));
+		}
+
+		// A connected grid packs well, at least 60 triangles per meshlet on average
+		auto grid = MakeGridAndLeaves(40, 0);
+		std::vector<Meshlet> meshlets;
+		BuildMeshlets(grid.indices, grid.positions, meshlets);
+		CHECK(meshlets.size() <= (grid.indices.size() / 3 + 59) / 60);
+	}
+
+	void SpheresContainTheirVertices()
+	{
+		for (const auto& mesh : { MakeGridAndLeaves(30, 40), MakeSphere(24, 48, 10.0f) })
+		{
+			auto indices = mesh.indices;
+			std::vector<Meshlet> meshlets;
+			BuildMeshlets(indices, mesh.positions, meshlets);
+			for (const auto& meshlet : meshlets)
+			{
+				for (uint32_t i = 0; i < meshlet.numTriangles * 3; ++i)
+				{
+					CHECK(Length(mesh.positions[indices[meshlet.firstIndex + i]] - meshlet.centre) <= meshlet.radius * 1.00001f + 1e-6f);
+				}
+			}
+		}
+	}
+
+	// From any viewpoint, a meshlet is only culled if all its triangles face away. Seen from outside a sphere, the far
+	// side's meshlets are culled
+	void ConeRejectsOnlyBackFacing()
+	{
+		const auto sphere = MakeSphere(24, 48, 10.0f);
+		auto indices = sphere.indices;
+		std::vector<Meshlet> meshlets;
+		BuildMeshlets(indices, sphere.positions, meshlets);
+
+		unsigned int culled = 0;
+		for (const auto& viewpoint : { CVector3{ 0, 0, -40 }, CVector3{ 25, 12, 5 }, CVector3{ 0, 11, 0 }, CVector3{ 1, -2, 3 } })
+		{
+			const auto visible = VisibleMeshlets(meshlets, OpenView(viewpoint));
+			for (size_t m = 0; m < meshlets.size(); ++m)
+			{
+				if (visible[m])  continue;
+				++culled;
+				for (uint32_t t = 0; t < meshlets[m].numTriangles; ++t)
+				{
+					const auto i = meshlets[m].firstIndex + t * 3;
+					CHECK(BackFacing(sphere.positions[indices[i]], sphere.positions[indices[i + 1]], sphere.positions[indices[i + 2]], viewpoint));
+				}
+			}
+		}
+		CHECK(culled > 0);
+
+		// From the centre every triangle faces away, and with cone culling off nothing is culled
+		const auto inside = VisibleMeshlets(meshlets, OpenView({ 0, 0, 0 }));
+		CHECK(std::count(inside.begin(), inside.end(), false) > 0);
+		auto noCones = OpenView({ 0, 0, -40 });
+		noCones.coneCulling = false;
+		const auto all = VisibleMeshlets(meshlets, noCones);
+		CHECK(std::count(all.begin(), all.end(), true) == static_cast<long>(meshlets.size()));
+	}
+
+	// A world space view moved into a node's space culls the same back facing meshlets, and a mirroring matrix turns cone
+	// culling off
+	void TransformedViews()
+	{
+		const auto sphere = MakeSphere(24, 48, 10.0f);
+		auto indices = sphere.indices;
+		std::vector<Meshlet> meshlets;
+		BuildMeshlets(indices, sphere.positions, meshlets);
+
+		const CVector3 viewpoint = { 30, 20, -50 };
+		const auto world = MatrixScaling(2.0f) * MatrixRotationY(0.8f) * MatrixRotationX(-0.3f) * MatrixTranslation({ 5, -3, 12 });
+		const auto nodeView = TransformMeshletView(OpenView(viewpoint), world);
+		CHECK(nodeView.coneCulling);
+
+		const auto visible = VisibleMeshlets(meshlets, nodeView);
+		CHECK(std::count(visible.begin(), visible.end(), false) > 0);
+		for (size_t m = 0; m < meshlets.size(); ++m)
+		{
+			if (visible[m])  continue;
+			for (uint32_t t = 0; t < meshlets[m].numTriangles; ++t)
+			{
+				const auto i = meshlets[m].firstIndex + t * 3;
+				CHECK(BackFacing(TransformPoint(sphere.positions[indices[i]], world), TransformPoint(sphere.positions[indices[i + 1]], world),
+				                 TransformPoint(sphere.positions[indices[i + 2]], world), viewpoint));
+			}
+		}
+
+		// Mirrored, the node's back faces are drawn as front faces, so no meshlet may be cone culled
+		const auto mirrored = MatrixScaling({ -1.0f, 1.0f, 1.0f }) * world;
+		const auto mirroredView = TransformMeshletView(OpenView(viewpoint), mirrored);
+		CHECK(!mirroredView.coneCulling);
+		const auto all = VisibleMeshlets(meshlets, mirroredView);
+		CHECK(std::count(all.begin(), all.end(), true) == static_cast<long>(meshlets.size()));
+	}
+}
+
+
+int main()
+{
+	LimitsAndEveryTriangleOnce();
+	SpheresContainTheirVertices();
+	ConeRejectsOnlyBackFacing();
+	TransformedViews();
+	return TestResult("MeshletsTests");
+}
@@ -0,0 +1,177 @@
+//--------------------------------------------------------------------------------------
+// Occlusion culling tests - the occluder rasteriser and the box visibility test
+//--------------------------------------------------------------------------------------
+
+#include "Test.h"
+#include "OcclusionCulling.h"
+
+#include <cmath>
+#include <initializer_list>
+
+
+namespace
+{
+	// 8 x 8 tiles
+	const unsigned int BufferSize = 64;
+
+	// Left handed perspective projection like the engine's, 90 degrees across, square. With an identity view this is
+	// a camera at the origin looking down z
+	CMatrix4x4 Projection(float nearClip, float farClip)
+	{
+		const auto range = farClip / (farClip - nearClip);
+		return CMatrix4x4{ 1.0f, 0.0f, 0.0f,               0.0f,
+		                   0.0f, 1.0f, 0.0f,               0.0f,
+		                   0.0f, 0.0f, range,              1.0f,
+		                   0.0f, 0.0f, -nearClip * range,  0.0f };
+	}
+
+	// Two triangles from corners in order round the quad
+	void AddQuad(COcclusionBuffer& buffer, const CVector3& a, const CVector3& b, const CVector3& c, const CVector3& d)
+	{
+		buffer.AddOccluder({ a, b, c, d }, { 0, 1, 2, 0, 2, 3 });
+	}
+
+
+	// With an identity matrix clip space is world space, so a quad at x, y = +-0.5 covers pixels 16 - 47 exactly
+	void QuadFillsItsPixelsAndTiles()
+	{
+		COcclusionBuffer buffer(BufferSize, BufferSize);
+		buffer.Begin(MatrixIdentity());
+		AddQuad(buffer, { -0.5f, -0.5f, 0.25f }, { 0.5f, -0.5f, 0.25f }, { 0.5f, 0.5f, 0.25f }, { -0.5f, 0.5f, 0.25f });
+		buffer.Rasterise();
+		CHECK(buffer.NumTriangles() == 2);
+
+		for (unsigned int y = 0; y < BufferSize; ++y)
+		{
+			for (unsigned int x = 0; x < BufferSize; ++x)
+			{
+				const auto inside = x >= 16 && x < 48 && y >= 16 && y < 48;
+				CHECK(buffer.Depth(x, y) == (inside ? 0.25f : 1.0f));
+			}
+		}
+
+		const auto tiles = BufferSize / COcclusionBuffer::TileSize;
+		for (unsigned int ty = 0; ty < tiles; ++ty)
+		{
+			for (unsigned int tx = 0; tx < tiles; ++tx)
+			{
+				const auto covered = tx >= 2 && tx < 6 && ty >= 2 && ty < 6;
+				CHECK(buffer.TileMinDepth(tx, ty) == (covered ? 0.25f : 1.0f));
+				CHECK(buffer.TileMaxDepth(tx, ty) == (covered ? 0.25f : 1.0f));
+			}
+		}
+	}
+
+	// A sloping quad ending part way across a row of tiles: depths follow the plane, and the part covered tiles keep the
+	// quad's nearest depth and the clear depth
+	void SlopedQuadDepthsAndPartTiles()
+	{
+		COcclusionBuffer buffer(BufferSize, BufferSize);
+		buffer.Begin(MatrixIdentity());
+		AddQuad(buffer, { -1.0f, -0.3f, 0.2f }, { 0.3f, -0.3f, 0.6f }, { 0.3f, 0.3f, 0.6f }, { -1.0f, 0.3f, 0.2f });
+		buffer.Rasterise();
+
+		// Pixel centres from 0.5 to 41.5 across, 22.5 to 41.5 down
+		for (unsigned int y = 23; y < 41; ++y)
+		{
+			for (unsigned int x = 0; x < 41; ++x)
+			{
+				const auto ndcX = (x + 0.5f) / BufferSize * 2.0f - 1.0f;
+				CHECK_NEAR(buffer.Depth(x, y), 0.2f + (ndcX + 1.0f) / 1.3f * 0.4f, 1e-5);
+			}
+		}
+		CHECK(buffer.Depth(42, 30) == 1.0f);
+
+		// Tile 5 across holds the quad's edge at x = 41.6
+		CHECK_NEAR(buffer.TileMinDepth(5, 3), 0.2f + (40.5f / 32.0f) / 1.3f * 0.4f, 1e-5);
+		CHECK(buffer.TileMaxDepth(5, 3) == 1.0f);
+		CHECK(buffer.TileMinDepth(6, 3) == 1.0f);
+	}
+
+	// A ground triangle running from in front of the camera to behind it is cut at the near plane, not flipped
+	void NearPlaneClipping()
+	{
+		const auto projection = Projection(0.1f, 100.0f);
+		COcclusionBuffer buffer(BufferSize, BufferSize);
+
+		// One corner behind the camera: the part in front is a quad, drawn as two triangles
+		buffer.Begin(projection);
+		buffer.AddOccluder({ { -20.0f, -1.0f, 10.0f }, { 20.0f, -1.0f, 10.0f }, { 0.0f, -1.0f, -10.0f } }, { 0, 1, 2 });
+		buffer.Rasterise();
+		CHECK(buffer.NumTriangles() == 2);
+
+		// Two corners behind: one triangle
+		COcclusionBuffer single(BufferSize, BufferSize);
+		single.Begin(projection);
+		single.AddOccluder({ { -20.0f, -1.0f, -10.0f }, { 20.0f, -1.0f, -10.0f }, { 0.0f, -1.0f, 10.0f } }, { 0, 1, 2 });
+		single.Rasterise();
+		CHECK(single.NumTriangles() == 1);
+
+		// The ground covers the bottom of the screen and never the top, with depths in range
+		for (unsigned int y = 0; y < BufferSize; ++y)
+		{
+			for (unsigned int x = 0; x < BufferSize; ++x)
+			{
+				const auto depth = buffer.Depth(x, y);
+				CHECK(depth >= 0.0f && depth <= 1.0f);
+				if (y < BufferSize / 2)  CHECK(depth == 1.0f);
+			}
+		}
+		CHECK(buffer.Depth(BufferSize / 2, BufferSize - 1) < 1.0f);
+		CHECK(single.Depth(BufferSize / 2, BufferSize - 1) < 1.0f);
+
+		// Entirely behind the camera draws nothing
+		COcclusionBuffer behind(BufferSize, BufferSize);
+		behind.Begin(projection);
+		behind.AddOccluder({ { -20.0f, -1.0f, -10.0f }, { 20.0f, -1.0f, -10.0f }, { 0.0f, -1.0f, -1.0f } }, { 0, 1, 2 });
+		behind.Rasterise();
+		CHECK(behind.NumTriangles() == 0);
+		CHECK(behind.TileMinDepth(4, 7) == 1.0f);
+	}
+
+	// Boxes are only hidden when every pixel they cover is nearer in the buffer
+	void IsVisibleIsConservative()
+	{
+		COcclusionBuffer buffer(BufferSize, BufferSize);
+		buffer.Begin(Projection(0.1f, 100.0f));
+
+		// A wall at depth 10 with a gap a few pixels wide down the middle (a pixel is about 0.3 across there)
+		AddQuad(buffer, { -5.0f, -5.0f, 10.0f }, { -0.5f, -5.0f, 10.0f }, { -0.5f, 5.0f, 10.0f }, { -5.0f, 5.0f, 10.0f });
+		AddQuad(buffer, { 0.5f, -5.0f, 10.0f }, { 5.0f, -5.0f, 10.0f }, { 5.0f, 5.0f, 10.0f }, { 0.5f, 5.0f, 10.0f });
+		buffer.Rasterise();
+
+		// Behind the wall
+		CHECK(!buffer.IsVisible({ { -4.0f, -2.0f, 20.0f }, { -3.0f, 2.0f, 22.0f } }));
+		CHECK(!buffer.IsVisible({ { 2.0f, -1.0f, 30.0f }, { 4.0f, 1.0f, 31.0f } }));
+
+		// Partly covered: behind the wall but reaching out past its edge, or seen through the gap
+		CHECK(buffer.IsVisible({ { 3.0f, -1.0f, 20.0f }, { 12.0f, 1.0f, 22.0f } }));
+		CHECK(buffer.IsVisible({ { -0.2f, -0.2f, 20.0f }, { 0.2f, 0.2f, 21.0f } }));
+		CHECK(buffer.IsVisible({ { -3.0f, -1.0f, 20.0f }, { 3.0f, 1.0f, 22.0f } }));
+
+		// In front of the wall
+		CHECK(buffer.IsVisible({ { -4.0f, -2.0f, 5.0f }, { -3.0f, 2.0f, 6.0f } }));
+
+		// Straddling the near plane, even where the rest of the box is behind the wall
+		CHECK(buffer.IsVisible({ { -4.0f, -2.0f, -1.0f }, { -3.0f, 2.0f, 30.0f } }));
+		CHECK(buffer.IsVisible({ { -0.1f, -0.1f, 0.05f }, { 0.1f, 0.1f, 0.2f } }));
+
+		// A wall right against the camera hides everything behind it, except a box crossing the near plane
+		COcclusionBuffer close(BufferSize, BufferSize);
+		close.Begin(Projection(0.1f, 100.0f));
+		AddQuad(close, { -5.0f, -5.0f, 0.5f }, { 5.0f, -5.0f, 0.5f }, { 5.0f, 5.0f, 0.5f }, { -5.0f, 5.0f, 0.5f });
+		close.Rasterise();
+		CHECK(!close.IsVisible({ { -1.0f, -1.0f, 2.0f }, { 1.0f, 1.0f, 3.0f } }));
+		CHECK(close.IsVisible({ { -1.0f, -1.0f, -2.0f }, { 1.0f, 1.0f, 3.0f } }));
+	}
+}
+
+
+int main()
+{
+	QuadFillsItsPixelsAndTiles();
+	SlopedQuadDepthsAndPartTiles();
+	NearPlaneClipping();
+	IsVisibleIsConservative();
+	return TestResult("OcclusionCullingTests");
+}
@@ -0,0 +1,178 @@
+//--------------------------------------------------------------------------------------
+// Range allocator tests - best fit, merging of freed ranges and the free space totals
+//--------------------------------------------------------------------------------------
+
+#include "Test.h"
+#include "RangeAllocator.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <vector>
+
+
+namespace
+{
+	struct Range
+	{
+		unsigned int start, count;
+	};
+
+	// Largest run of free elements in a map of which elements are in use
+	unsigned int LargestRun(const std::vector<bool>& used)
+	{
+		unsigned int largest = 0, run = 0;
+		for (auto u : used)
+		{
+			run = u ? 0 : run + 1;
+			largest = std::max(largest, run);
+		}
+		return largest;
+	}
+
+
+	// The smallest range that fits is taken, the one with the lowest start if several are the same size
+	void BestFitLowestStartOnTie()
+	{
+		CRangeAllocator allocator(100);
+		unsigned int starts[5];
+		for (auto& start : starts)  CHECK(allocator.Allocate(10, start));
+		CHECK(starts[0] == 0 && starts[4] == 40);
+
+		// Free ranges of 10 at 10 and 30, and the 50 left at the end
+		allocator.Free(30, 10);
+		allocator.Free(10, 10);
+		CHECK(allocator.FreeSpace() == 70);
+		CHECK(allocator.LargestFreeRange() == 50);
+
+		unsigned int start;
+		CHECK(allocator.Allocate(8, start) && start == 10);
+
+		// Now 2 at 18 fits exactly, before the 10 at 30 or the 50
+		CHECK(allocator.Allocate(2, start) && start == 18);
+		CHECK(allocator.Allocate(10, start) && start == 30);
+		CHECK(allocator.Allocate(11, start) && start == 50);
+		CHECK(allocator.FreeSpace() == 39 && allocator.LargestFreeRange() == 39);
+
+		// Too big for any free range, nothing changes
+		CHECK(!allocator.Allocate(40, start));
+		CHECK(allocator.FreeSpace() == 39);
+
+		// Nothing is always available
+		CHECK(allocator.Allocate(0, start));
+		CHECK(allocator.FreeSpace() == 39);
+	}
+
+	// A freed range joins the free ranges before and after it into one
+	void FreedRangesMerge()
+	{
+		// Three ranges of 10 filling the array, the middle one freed last
+		for (int neighbours = 0; neighbours < 3; ++neighbours)
+		{
+			CRangeAllocator allocator(30);
+			unsigned int a, b, c, start;
+			CHECK(allocator.Allocate(10, a) && allocator.Allocate(10, b) && allocator.Allocate(10, c));
+			CHECK(allocator.FreeSpace() == 0 && allocator.LargestFreeRange() == 0);
+
+			if (neighbours != 1)  allocator.Free(a, 10); // Previous free
+			if (neighbours != 0)  allocator.Free(c, 10); // Next free
+			CHECK(allocator.LargestFreeRange() == 10);
+			allocator.Free(b, 10);
+
+			if (neighbours == 0)       CHECK(allocator.Allocate(20, start) && start == 0);
+			else if (neighbours == 1)  CHECK(allocator.Allocate(20, start) && start == 10);
+			else                       CHECK(allocator.Empty() && allocator.LargestFreeRange() == 30);
+		}
+
+		// Freeing at the end of the array, with no range after it
+		CRangeAllocator allocator(30);
+		unsigned int start;
+		CHECK(allocator.Allocate(20, start) && allocator.Allocate(5, start) && allocator.Allocate(5, start) && start == 25);
+		allocator.Free(25, 5);
+		allocator.Free(20, 5);
+		CHECK(allocator.LargestFreeRange() == 10 && allocator.FreeSpace() == 10);
+		CHECK(allocator.Allocate(10, start) && start == 20);
+	}
+
+	// Many allocations of random sizes freed in a random order, checked against a map of the elements in use
+	void RandomAllocationsAndFrees()
+	{
+		std::srand(7);
+		const unsigned int Size = 5000;
+		for (int round = 0; round < 20; ++round)
+		{
+			CRangeAllocator allocator(Size);
+			std::vector<bool> used(Size, false);
+			std::vector<Range> allocated;
+
+			auto overlaps = false, matches = true;
+			for (int i = 0; i < 400; ++i)
+			{
+				// Free a random range now and then, so allocations reuse the holes
+				if (!allocated.empty() && std::rand() % 3 == 0)
+				{
+					const auto which = std::rand() % allocated.size();
+					const auto range = allocated[which];
+					allocated.erase(allocated.begin() + which);
+					allocator.Free(range.start, range.count);
+					std::fill(used.begin() + range.start, used.begin() + range.start + range.count, false);
+				}
+
+				const auto count = 1 + std::rand() % 60;
+				unsigned int start;
+				const auto fits = LargestRun(used) >= static_cast<unsigned int>(count);
+				if (allocator.Allocate(count, start) != fits)
+				{
+					matches = false;
+					continue;
+				}
+				if (!fits)  continue;
+
+				for (auto e = start; e < start + count; ++e)
+				{
+					overlaps |= e >= Size || used[e];
+					if (e < Size)  used[e] = true;
+				}
+				allocated.push_back({ start, static_cast<unsigned int>(count) });
+
+				matches &= allocator.FreeSpace() == static_cast<unsigned int>(std::count(used.begin(), used.end(), false));
+				matches &= allocator.LargestFreeRange() == LargestRun(used);
+			}
+			CHECK(!overlaps);
+			CHECK(matches);
+
+			// Whatever order they are freed in, everything merges back into one range
+			while (!allocated.empty())
+			{
+				const auto which = std::rand() % allocated.size();
+				allocator.Free(allocated[which].start, allocated[which].count);
+				allocated.erase(allocated.begin() + which);
+			}
+			CHECK(allocator.Empty());
+			CHECK(allocator.LargestFreeRange() == Size);
+		}
+	}
+
+	void ClearFreesEverything()
+	{
+		CRangeAllocator allocator(64);
+		unsigned int start;
+		CHECK(allocator.Allocate(16, start) && allocator.Allocate(16, start));
+		allocator.Clear();
+		CHECK(allocator.Empty() && allocator.LargestFreeRange() == 64);
+		CHECK(allocator.Allocate(64, start) && start == 0);
+
+		CRangeAllocator none(0);
+		CHECK(none.Empty() && none.LargestFreeRange() == 0);
+		CHECK(!none.Allocate(1, start));
+	}
+}
+
+
+int main()
+{
+	BestFitLowestStartOnTie();
+	FreedRangesMerge();
+	RandomAllocationsAndFrees();
+	ClearFreesEverything();
+	return TestResult("RangeAllocatorTests");
+}
@@ -0,0 +1,31 @@
+//--------------------------------------------------------------------------------------
+// Test helpers - checks for the headless unit tests
+//--------------------------------------------------------------------------------------
+// Each test program is a main() that calls its tests and returns TestResult(). A failed check prints where it
+// failed and carries on, so one run shows every failure.
+
+#pragma once
+
+#include <cmath>
+#include <cstdio>
+
+
+inline int gTestFailures = 0;
+
+#define CHECK(condition) \
+	do { if (!(condition)) { ++gTestFailures; std::printf("%s(%d): CHECK(%s) failed\n", __FILE__, __LINE__, #condition); } } while (false)
+
+#define CHECK_NEAR(value, expected, tolerance) \
+	do { const double v_ = (value), e_ = (expected); \
+	     if (!(std::abs(v_ - e_) <= (tolerance))) { ++gTestFailures; \
+	         std::printf("%s(%d): CHECK_NEAR(%s, %s) failed, %g vs %g\n", __FILE__, __LINE__, #value, #expected, v_, e_); } \
+	} while (false)
+
+
+// Print a summary and return the exit code for the test program
+inline int TestResult(const char* name)
+{
+	if (gTestFailures)  std::printf("%s: %d check(s) failed\n", name, gTestFailures);
+	else                std::printf("%s: all checks passed\n", name);
+	return gTestFailures ? 1 : 0;
+}
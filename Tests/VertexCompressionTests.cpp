@@ -0,0 +1,243 @@
+//--------------------------------------------------------------------------------------
+// Vertex compression tests - octahedral normals, half floats and bone weights
+//--------------------------------------------------------------------------------------
+
+#include "Test.h"
+#include "VertexCompression.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <vector>
+
+
+namespace
+{
+	float Random(float a, float b)
+	{
+		return a + (b - a) * static_cast<float>(std::rand()) / RAND_MAX;
+	}
+
+	// DecodeNormal in Common.hlsli line by line, after the input assembler has turned the SNORM16 values into floats
+	// (-32768 and -32767 both become -1)
+	CVector3 ShaderDecodeNormal(const int16_t encoded[2])
+	{
+		const float normal[2] = { std::max(encoded[0] / 32767.0f, -1.0f), std::max(encoded[1] / 32767.0f, -1.0f) };
+
+		CVector3 n = { normal[0], normal[1], 1 - std::abs(normal[0]) - std::abs(normal[1]) };
+		const auto fold = std::min(std::max(-n.z, 0.0f), 1.0f);
+		n.x += n.x >= 0 ? -fold : fold;
+		n.y += n.y >= 0 ? -fold : fold;
+		return Normalise(n);
+	}
+
+	// Exact value of a half float
+	float HalfToFloat(uint16_t half)
+	{
+		const auto sign = half & 0x8000 ? -1.0f : 1.0f;
+		const auto exponent = (half >> 10) & 0x1f;
+		const auto mantissa = half & 0x3ff;
+		if (exponent == 0x1f)  return mantissa ? std::numeric_limits<float>::quiet_NaN() : sign * std::numeric_limits<float>::infinity();
+		if (exponent == 0)     return sign * std::ldexp(static_cast<float>(mantissa), -24);
+		return sign * std::ldexp(static_cast<float>(mantissa | 0x400), exponent - 25);
+	}
+
+
+	/*-----------------------------------------------------------------------------------------
+	    Normals
+	-----------------------------------------------------------------------------------------*/
+
+	// Unit vectors all over the sphere, including the axes and the fold along the equator, come back within the
+	// precision of 16 bits
+	void OctahedralRoundTrip()
+	{
+		std::srand(11);
+		std::vector<CVector3> normals = { { 1, 0, 0 }, { -1, 0, 0 }, { 0, 1, 0 }, { 0, -1, 0 }, { 0, 0, 1 }, { 0, 0, -1 },
+		                                  Normalise({ 1, 1, 1 }), Normalise({ -1, 1, -1 }), Normalise({ 1, -1, 0 }), Normalise({ -1, -1, 0 }),
+		                                  Normalise({ 1, 0, -0.0001f }), Normalise({ 0.3f, -0.7f, -1e-6f }) };
+		for (int i = 0; i < 10000; ++i)
+		{
+			const CVector3 v = { Random(-1, 1), Random(-1, 1), Random(-1, 1) };
+			if (Length(v) > 0.01f)  normals.push_back(Normalise(v));
+		}
+
+		auto maxError = 0.0f;
+		for (const auto& normal : normals)
+		{
+			int16_t encoded[2];
+			OctahedralEncode(normal, encoded);
+			maxError = std::max(maxError, Length(OctahedralDecode(encoded) - normal));
+		}
+		CHECK(maxError < 1e-4f);
+
+		// A zero vector has no direction, it encodes to the centre of the square
+		int16_t encoded[2] = { 1, 1 };
+		OctahedralEncode({ 0, 0, 0 }, encoded);
+		CHECK(encoded[0] == 0 && encoded[1] == 0);
+	}
+
+	// Known points of the square, then every corner of a grid across it, decoded as the vertex shader does
+	void DecodeMatchesTheShader()
+	{
+		const auto decoded = [](int16_t u, int16_t w) { const int16_t encoded[2] = { u, w }; return OctahedralDecode(encoded); };
+		const auto near = [](const CVector3& a, const CVector3& b) { return Length(a - b) < 1e-6f; };
+		CHECK(near(decoded(0, 0), { 0, 0, 1 }));
+		CHECK(near(decoded(32767, 0), { 1, 0, 0 }));
+		CHECK(near(decoded(-32768, 0), { -1, 0, 0 }));
+		CHECK(near(decoded(-32767, 0), { -1, 0, 0 }));
+		CHECK(near(decoded(0, 32767), { 0, 1, 0 }));
+		CHECK(near(decoded(0, -32767), { 0, -1, 0 }));
+		for (int16_t u : { 32767, -32767 })  for (int16_t w : { 32767, -32767 })  CHECK(near(decoded(u, w), { 0, 0, -1 }));
+
+		auto matches = true;
+		for (int u = -32768; u <= 32767; u += 97)
+		{
+			for (int w = -32768; w <= 32767; w += 89)
+			{
+				const int16_t encoded[2] = { static_cast<int16_t>(u), static_cast<int16_t>(w) };
+				matches &= Length(OctahedralDecode(encoded) - ShaderDecodeNormal(encoded)) < 1e-6f;
+			}
+		}
+		CHECK(matches);
+	}
+
+
+	/*-----------------------------------------------------------------------------------------
+	    Scalars
+	-----------------------------------------------------------------------------------------*/
+
+	void FloatToHalfSpecialValues()
+	{
+		CHECK(FloatToHalf(0.0f) == 0x0000);
+		CHECK(FloatToHalf(-0.0f) == 0x8000);
+		CHECK(FloatToHalf(1.0f) == 0x3c00);
+		CHECK(FloatToHalf(-2.0f) == 0xc000);
+		CHECK(FloatToHalf(65504.0f) == 0x7bff);
+
+		// Too large, including values that only round up past the largest half
+		CHECK(FloatToHalf(65519.0f) == 0x7bff);
+		CHECK(FloatToHalf(65520.0f) == 0x7c00);
+		CHECK(FloatToHalf(1e10f) == 0x7c00);
+		CHECK(FloatToHalf(-1e10f) == 0xfc00);
+		CHECK(FloatToHalf(std::numeric_limits<float>::infinity()) == 0x7c00);
+		CHECK((FloatToHalf(std::numeric_limits<float>::quiet_NaN()) & 0x7fff) > 0x7c00);
+
+		// Denormals: the smallest normal, the largest and smallest denormals, and below half the smallest
+		CHECK(FloatToHalf(std::ldexp(1.0f, -14)) == 0x0400);
+		CHECK(FloatToHalf(std::ldexp(1023.0f, -24)) == 0x03ff);
+		CHECK(FloatToHalf(std::ldexp(1.0f, -24)) == 0x0001);
+		CHECK(FloatToHalf(-std::ldexp(1.0f, -24)) == 0x8001);
+		CHECK(FloatToHalf(std::ldexp(1.0f, -25)) == 0x0000);      // Halfway to 1, even is 0
+		CHECK(FloatToHalf(std::ldexp(1.5f, -25)) == 0x0001);
+		CHECK(FloatToHalf(std::ldexp(1.0f, -30)) == 0x0000);
+
+		// Rounding carries out of the mantissa into the exponent, from a denormal and from a normal
+		CHECK(FloatToHalf(std::ldexp(2047.0f, -25)) == 0x0400);   // Halfway between 0x3ff and 0x400
+		CHECK(FloatToHalf(2.0f - std::ldexp(1.0f, -11)) == 0x4000); // Halfway between 0x3fff and 0x4000
+		CHECK(FloatToHalf(std::ldexp(4095.0f, -12)) == 0x3c00);   // Halfway between 0x3bff and 1
+	}
+
+	// Every finite half converts back to itself, and every value halfway between two neighbours rounds to the even one
+	void FloatToHalfRoundsToNearestEven()
+	{
+		auto exact = true, halfway = true, between = true;
+		for (uint32_t h = 0; h < 0x7c00; ++h)
+		{
+			for (uint16_t sign : { 0x0000, 0x8000 })
+			{
+				const auto half = static_cast<uint16_t>(h | sign);
+				const auto value = HalfToFloat(half);
+				exact &= FloatToHalf(value) == half;
+
+				if (h + 1 == 0x7c00)  continue;
+				const auto next = static_cast<uint16_t>((h + 1) | sign);
+				const auto middle = (value + HalfToFloat(next)) * 0.5f; // Exact, floats have the bits to spare
+				halfway &= FloatToHalf(middle) == (h & 1 ? next : half);
+				between &= FloatToHalf(std::nextafter(middle, value)) == half && FloatToHalf(std::nextafter(middle, HalfToFloat(next))) == next;
+			}
+		}
+		CHECK(exact);
+		CHECK(halfway);
+		CHECK(between);
+	}
+
+	void FloatToUnorm16Clamps()
+	{
+		CHECK(FloatToUnorm16(0.0f) == 0);
+		CHECK(FloatToUnorm16(1.0f) == 65535);
+		CHECK(FloatToUnorm16(0.5f) == 32768);
+		CHECK(FloatToUnorm16(-0.5f) == 0);
+		CHECK(FloatToUnorm16(7.0f) == 65535);
+	}
+
+
+	/*-----------------------------------------------------------------------------------------
+	    Weights
+	-----------------------------------------------------------------------------------------*/
+
+	int Sum(const uint8_t quantised[4])
+	{
+		return quantised[0] + quantised[1] + quantised[2] + quantised[3];
+	}
+
+	// The bytes always add up to exactly 255, each within one unit of its weight
+	void QuantisedWeightsSumTo255()
+	{
+		std::srand(13);
+		auto sums = true, close = true;
+		for (int i = 0; i < 100000; ++i)
+		{
+			// Some weights zero, as most vertices have fewer than four bones
+			float weights[4];
+			auto total = 0.0f;
+			for (auto& weight : weights)
+			{
+				weight = std::rand() % 3 == 0 ? 0.0f : Random(0.0f, 1.0f);
+				total += weight;
+			}
+			if (total == 0.0f)  continue;
+			for (auto& weight : weights)  weight /= total;
+
+			uint8_t quantised[4];
+			QuantiseWeights(weights, quantised);
+			sums &= Sum(quantised) == 255;
+			for (int w = 0; w < 4; ++w)
+			{
+				close &= std::abs(quantised[w] - weights[w] * 255.0f) < 1.0f;
+				close &= weights[w] > 0.0f || quantised[w] == 0;
+			}
+		}
+		CHECK(sums);
+		CHECK(close);
+
+		// Quarters all lose the same in rounding down (63.75 each), the spare units go to the first ones
+		const float quarters[4] = { 0.25f, 0.25f, 0.25f, 0.25f };
+		uint8_t quantised[4];
+		QuantiseWeights(quarters, quantised);
+		CHECK(quantised[0] == 64 && quantised[1] == 64 && quantised[2] == 64 && quantised[3] == 63);
+
+		// Weights that don't add up to 1 are scaled to, negative ones count as 0
+		const float unscaled[4] = { 2.0f, 2.0f, -1.0f, 0.0f };
+		QuantiseWeights(unscaled, quantised);
+		CHECK(quantised[0] + quantised[1] == 255 && quantised[2] == 0 && quantised[3] == 0);
+
+		// No weight at all goes to the first bone
+		const float none[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+		QuantiseWeights(none, quantised);
+		CHECK(quantised[0] == 255 && quantised[1] == 0 && quantised[2] == 0 && quantised[3] == 0);
+	}
+}
+
+
+int main()
+{
+	OctahedralRoundTrip();
+	DecodeMatchesTheShader();
+	FloatToHalfSpecialValues();
+	FloatToHalfRoundsToNearestEven();
+	FloatToUnorm16Clamps();
+	QuantisedWeightsSumTo255();
+	return TestResult("VertexCompressionTests");
+}
@@ -39,63 +39,6 @@ inline void UpdateFrameConstantBuffer(ID3D11Buffer* buffer, PerFrameConstants& b
     gD3DContext->Unmap(buffer, 0);
 }
 
-inline void UpdateLightBuffer(ID3D11Buffer* buffer, PerFrameLights& bufferData)
-{
-	D3D11_MAPPED_SUBRESOURCE cb;
-    gD3DContext->Map(buffer, 0, D3D11_MAP_WRITE_DISCARD, 0, &cb);
-
-    //calculate the size of the frame constant buffer
-
-    //remove the lights array from the equation
-    auto size = sizeof(PerFrameLights) - sizeof(bufferData.lights);
-
-    const auto sizeOfLightStruct = sizeof(sLight);
-	
-	//add just the lights used
-	size += sizeOfLightStruct * bufferData.lights[0].numLights;
-
-    memcpy(cb.pData, &bufferData, size);
-    gD3DContext->Unmap(buffer, 0);
-}
-
-inline void UpdateSpotLightsBuffer(ID3D11Buffer* buffer, PerFrameSpotLights& bufferData)
-{
-	D3D11_MAPPED_SUBRESOURCE cb;
-    gD3DContext->Map(buffer, 0, D3D11_MAP_WRITE_DISCARD, 0, &cb);
-
-    //calculate the size of the frame constant buffer
-
-    //remove the lights array from the equation
-    auto size = sizeof(PerFrameSpotLights) - sizeof(bufferData.spotLights);
-
-    const auto sizeOfLightStruct = sizeof(sSpotLight);
-	
-	//add just the lights used
-	size += sizeOfLightStruct * bufferData.spotLights[0].numLights;
-
-    memcpy(cb.pData, &bufferData, size);
-    gD3DContext->Unmap(buffer, 0);
-}
-
-inline void UpdateDirLightsBuffer(ID3D11Buffer* buffer, PerFrameDirLights& bufferData)
-{
-	D3D11_MAPPED_SUBRESOURCE cb;
-    gD3DContext->Map(buffer, 0, D3D11_MAP_WRITE_DISCARD, 0, &cb);
-
-    //calculate the size of the frame constant buffer
-
-    //remove the lights array from the equation
-    auto size = sizeof(PerFrameDirLights) - sizeof(bufferData.dirLights);
-
-    const auto sizeOfLightStruct = sizeof(sDirLights);
-	
-	//add just the lights used
-	size += sizeOfLightStruct * bufferData.dirLights[0].numLights;
-
-    memcpy(cb.pData, &bufferData, size);
-    gD3DContext->Unmap(buffer, 0);
-}
-
 //--------------------------------------------------------------------------------------
 // Texture Loading
 //--------------------------------------------------------------------------------------
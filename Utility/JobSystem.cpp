@@ -0,0 +1,159 @@
+//--------------------------------------------------------------------------------------
+// Job system - a pool of worker threads used to spread CPU work across cores
+//--------------------------------------------------------------------------------------
+
+#include "JobSystem.h"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+//--------------------------------------------------------------------------------------
+// Worker pool
+//--------------------------------------------------------------------------------------
+// Globals used to keep code simpler, in the same way as the DirectX objects elsewhere in the app
+
+namespace
+{
+	std::vector<std::thread>           gWorkers;
+	std::deque<std::function<void()>>  gTaskQueue;
+	std::mutex                         gTaskMutex;
+	std::condition_variable            gTaskAvailable;
+	bool                               gStopWorkers = false;
+
+	void WorkerLoop()
+	{
+		while (true)
+		{
+			std::function<void()> task;
+			{
+				std::unique_lock<std::mutex> lock(gTaskMutex);
+				gTaskAvailable.wait(lock, [] { return gStopWorkers || !gTaskQueue.empty(); });
+
+				if (gStopWorkers && gTaskQueue.empty()) return;
+
+				task = std::move(gTaskQueue.front());
+				gTaskQueue.pop_front();
+			}
+			task();
+		}
+	}
+
+
+	// Shared state of one ParallelFor call. Helpers hold a shared_ptr to it so it stays alive even if a helper
+	// task only starts after the call has returned
+	struct ParallelForState
+	{
+		std::function<void(unsigned int, unsigned int)> function;
+		unsigned int count;
+		unsigned int grainSize;
+		unsigned int numChunks;
+		std::atomic<unsigned int> nextChunk{ 0 };
+		std::atomic<unsigned int> chunksDone{ 0 };
+
+		// Grab and process chunks until there are none left
+		void Run()
+		{
+			while (true)
+			{
+				const auto chunk = nextChunk.fetch_add(1);
+				if (chunk >= numChunks) return;
+
+				const auto begin = chunk * grainSize;
+				const auto end = std::min(count, begin + grainSize);
+				function(begin, end);
+
+				chunksDone.fetch_add(1, std::memory_order_release);
+			}
+		}
+	};
+}
+
+
+void InitJobSystem(unsigned int numWorkers /*= 0*/)
+{
+	if (!gWorkers.empty()) return;
+
+	if (numWorkers == 0)
+	{
+		const auto hardwareThreads = std::thread::hardware_concurrency();
+		numWorkers = hardwareThreads > 1 ? hardwareThreads - 1 : 0;
+	}
+
+	gStopWorkers = false;
+	for (unsigned int i = 0; i < numWorkers; ++i)
+	{
+		gWorkers.emplace_back(WorkerLoop);
+	}
+}
+
+void ShutdownJobSystem()
+{
+	{
+		std::lock_guard<std::mutex> lock(gTaskMutex);
+		gStopWorkers = true;
+	}
+	gTaskAvailable.notify_all();
+
+	for (auto& worker : gWorkers)
+	{
+		worker.join();
+	}
+	gWorkers.clear();
+}
+
+unsigned int JobSystemThreadCount()
+{
+	return static_cast<unsigned int>(gWorkers.size()) + 1;
+}
+
+
+void ParallelFor(unsigned int count, unsigned int grainSize, const std::function<void(unsigned int, unsigned int)>& function)
+{
+	if (count == 0) return;
+	grainSize = std::max(1u, grainSize);
+
+	const auto numChunks = (count + grainSize - 1) / grainSize;
+
+	// Not worth waking anyone up - do the work here
+	if (numChunks == 1 || gWorkers.empty())
+	{
+		for (unsigned int begin = 0; begin < count; begin += grainSize)
+		{
+			function(begin, std::min(count, begin + grainSize));
+		}
+		return;
+	}
+
+	auto state = std::make_shared<ParallelForState>();
+	state->function = function;
+	state->count = count;
+	state->grainSize = grainSize;
+	state->numChunks = numChunks;
+
+	// One helper per worker that could usefully join in. The calling thread also takes part, which means
+	// ParallelFor can safely be called from inside another ParallelFor without deadlocking
+	const auto numHelpers = std::min(static_cast<unsigned int>(gWorkers.size()), numChunks - 1);
+	{
+		std::lock_guard<std::mutex> lock(gTaskMutex);
+		for (unsigned int i = 0; i < numHelpers; ++i)
+		{
+			gTaskQueue.emplace_back([state] { state->Run(); });
+		}
+	}
+	gTaskAvailable.notify_all();
+
+	state->Run();
+
+	// Wait for chunks still being processed by other threads
+	while (state->chunksDone.load(std::memory_order_acquire) < numChunks)
+	{
+		std::this_thread::yield();
+	}
+}
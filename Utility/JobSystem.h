@@ -0,0 +1,33 @@
+//--------------------------------------------------------------------------------------
+// Job system - a pool of worker threads used to spread CPU work across cores
+//--------------------------------------------------------------------------------------
+// Code in .cpp file
+//
+// Usage: call InitJobSystem once at start up and ShutdownJobSystem before exit. ParallelFor then
+// splits a range of work into chunks that are processed by the workers *and* the calling thread.
+// ParallelFor blocks until all chunks are done, so it can be used anywhere a normal loop would be.
+// If the job system has not been initialised the work is simply done on the calling thread.
+
+#ifndef _JOB_SYSTEM_H_INCLUDED_
+#define _JOB_SYSTEM_H_INCLUDED_
+
+#include <functional>
+
+
+// Start the worker threads. Pass 0 to use one worker per hardware thread (minus the calling thread)
+void InitJobSystem(unsigned int numWorkers = 0);
+
+// Finish outstanding work and stop the worker threads
+void ShutdownJobSystem();
+
+// Number of threads that can take part in a ParallelFor (workers + the calling thread)
+unsigned int JobSystemThreadCount();
+
+
+// Call function(begin, end) for consecutive sub-ranges of [0, count), each at most grainSize long, spread
+// across all threads. Returns when the whole range has been processed. Function calls may run concurrently
+// so they must only write to data owned by their own sub-range
+void ParallelFor(unsigned int count, unsigned int grainSize, const std::function<void(unsigned int, unsigned int)>& function);
+
+
+#endif //_JOB_SYSTEM_H_INCLUDED_
@@ -0,0 +1,60 @@
+//--------------------------------------------------------------------------------------
+// Interned strings - names and asset paths stored once and compared by hash
+//--------------------------------------------------------------------------------------
+
+#include "StringId.h"
+
+#include <mutex>
+#include <stdexcept>
+#include <unordered_map>
+
+
+namespace
+{
+	// Function-local statics so the table can be used safely from other global constructors.
+	// unordered_map never moves its elements, so pointers to the strings stay valid
+	std::unordered_map<uint64_t, std::string>& StringTable()
+	{
+		static std::unordered_map<uint64_t, std::string> table;
+		return table;
+	}
+
+	std::mutex& StringTableMutex()
+	{
+		static std::mutex mutex;
+		return mutex;
+	}
+}
+
+
+CStringId::CStringId(const std::string& str)
+{
+	if (str.empty())
+	{
+		mHash = 0;
+		mString = &EmptyString();
+		return;
+	}
+
+	mHash = HashString(str);
+
+	std::lock_guard<std::mutex> lock(StringTableMutex());
+	const auto entry = StringTable().emplace(mHash, str).first;
+	if (entry->second != str)
+	{
+		throw std::runtime_error("String id hash collision between '" + entry->second + "' and '" + str + "'");
+	}
+	mString = &entry->second;
+}
+
+size_t CStringId::TableSize()
+{
+	std::lock_guard<std::mutex> lock(StringTableMutex());
+	return StringTable().size();
+}
+
+const std::string& CStringId::EmptyString()
+{
+	static const std::string empty;
+	return empty;
+}
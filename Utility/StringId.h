@@ -0,0 +1,84 @@
+//--------------------------------------------------------------------------------------
+// Interned strings - names and asset paths stored once and compared by hash
+//--------------------------------------------------------------------------------------
+// Code in .cpp file
+//
+// A CStringId is a 64-bit hash plus a pointer to the single shared copy of the string in a global
+// table, so it is cheap to copy, compare and use as a hash map key, and repeated names / paths only
+// take memory once. Literals can be hashed at compile time with the _sid suffix, e.g.
+//     switch (HashString(element->Name())) { case "Light"_sid: ... }
+//     auto sun = objectManager->FindObject("Sun"_sid);
+
+#ifndef _STRING_ID_H_INCLUDED_
+#define _STRING_ID_H_INCLUDED_
+
+#include <cstdint>
+#include <functional>
+#include <string>
+
+
+// 64-bit FNV-1a hash. Usable at compile time
+constexpr uint64_t HashString(const char* str)
+{
+	uint64_t hash = 14695981039346656037ull;
+	while (*str)
+	{
+		hash ^= static_cast<unsigned char>(*str++);
+		hash *= 1099511628211ull;
+	}
+	return hash;
+}
+
+inline uint64_t HashString(const std::string& str) { return HashString(str.c_str()); }
+
+// Compile time hash of a string literal: "GameObject"_sid
+constexpr uint64_t operator"" _sid(const char* str, size_t)
+{
+	return HashString(str);
+}
+
+
+class CStringId
+{
+public:
+	// Empty id (empty string, hash 0)
+	CStringId() : mHash(0), mString(&EmptyString()) {}
+
+	// Intern the string (add it to the global table if not already there). Throws a std::runtime_error if a
+	// different string already has the same hash
+	explicit CStringId(const std::string& str);
+	explicit CStringId(const char* str) : CStringId(std::string(str)) {}
+
+	uint64_t Hash() const { return mHash; }
+
+	const std::string& Str() const { return *mString; }
+	const char* CStr() const { return mString->c_str(); }
+
+	bool Empty() const { return mHash == 0; }
+
+	bool operator==(const CStringId& other) const { return mHash == other.mHash; }
+	bool operator!=(const CStringId& other) const { return mHash != other.mHash; }
+	bool operator< (const CStringId& other) const { return mHash <  other.mHash; }
+
+	// Number of distinct strings interned so far
+	static size_t TableSize();
+
+private:
+	static const std::string& EmptyString();
+
+	uint64_t mHash;
+	const std::string* mString; // Points into the global table, which never moves or frees its strings
+};
+
+
+namespace std
+{
+	template <>
+	struct hash<CStringId>
+	{
+		size_t operator()(const CStringId& id) const { return static_cast<size_t>(id.Hash()); }
+	};
+}
+
+
+#endif //_STRING_ID_H_INCLUDED_
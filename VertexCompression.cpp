@@ -0,0 +1,141 @@
+//--------------------------------------------------------------------------------------
+// Vertex compression - packing vertex attributes into fewer bytes
+//--------------------------------------------------------------------------------------
+
+#include "VertexCompression.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+
+namespace
+{
+	int16_t FloatToSnorm16(float value)
+	{
+		return static_cast<int16_t>(std::lround(std::min(std::max(value, -1.0f), 1.0f) * 32767.0f));
+	}
+
+	float SignNotZero(float value) { return value >= 0.0f ? 1.0f : -1.0f; }
+}
+
+
+/*-----------------------------------------------------------------------------------------
+    Normals
+-----------------------------------------------------------------------------------------*/
+
+// Project onto the octahedron |x| + |y| + |z| = 1, then fold the lower half over the upper one
+void OctahedralEncode(const CVector3& v, int16_t encoded[2])
+{
+	const auto sum = std::abs(v.x) + std::abs(v.y) + std::abs(v.z);
+	if (sum == 0.0f)
+	{
+		encoded[0] = encoded[1] = 0;
+		return;
+	}
+
+	auto u = v.x / sum;
+	auto w = v.y / sum;
+	if (v.z < 0.0f)
+	{
+		const auto foldedU = (1.0f - std::abs(w)) * SignNotZero(u);
+		const auto foldedW = (1.0f - std::abs(u)) * SignNotZero(w);
+		u = foldedU;
+		w = foldedW;
+	}
+	encoded[0] = FloatToSnorm16(u);
+	encoded[1] = FloatToSnorm16(w);
+}
+
+// Same as DecodeNormal in Common.hlsli
+CVector3 OctahedralDecode(const int16_t encoded[2])
+{
+	const auto u = std::max(encoded[0] / 32767.0f, -1.0f);
+	const auto w = std::max(encoded[1] / 32767.0f, -1.0f);
+	CVector3 v = { u, w, 1.0f - std::abs(u) - std::abs(w) };
+	const auto fold = std::max(-v.z, 0.0f);
+	v.x += v.x >= 0.0f ? -fold : fold;
+	v.y += v.y >= 0.0f ? -fold : fold;
+	return Normalise(v);
+}
+
+
+/*-----------------------------------------------------------------------------------------
+    Scalars
+-----------------------------------------------------------------------------------------*/
+
+uint16_t FloatToUnorm16(float value)
+{
+	return static_cast<uint16_t>(std::lround(std::min(std::max(value, 0.0f), 1.0f) * 65535.0f));
+}
+
+uint16_t FloatToHalf(float value)
+{
+	uint32_t bits;
+	std::memcpy(&bits, &value, 4);
+
+	const auto sign = static_cast<uint16_t>((bits >> 16) & 0x8000);
+	const auto exponent = static_cast<int>((bits >> 23) & 0xff) - 127 + 15;
+	auto mantissa = bits & 0x7fffff;
+
+	if (((bits >> 23) & 0xff) == 0xff) return sign | 0x7c00 | (mantissa ? 0x200 : 0); // Infinity or NaN
+	if (exponent >= 31) return sign | 0x7c00;                                         // Too large
+	if (exponent <= 0)
+	{
+		// Denormal or zero
+		if (exponent < -10) return sign;
+		mantissa |= 0x800000;
+		const auto shift = 14 - exponent;
+		auto half = mantissa >> shift;
+		const auto remainder = mantissa & ((1u << shift) - 1);
+		const auto halfway = 1u << (shift - 1);
+		if (remainder > halfway || (remainder == halfway && (half & 1))) ++half;
+		return sign | static_cast<uint16_t>(half);
+	}
+
+	// Normal, round to nearest even. A carry out of the mantissa correctly moves up the exponent
+	auto half = static_cast<uint32_t>(exponent << 10) | (mantissa >> 13);
+	const auto remainder = mantissa & 0x1fff;
+	if (remainder > 0x1000 || (remainder == 0x1000 && (half & 1))) ++half;
+	return sign | static_cast<uint16_t>(std::min(half, 0x7c00u));
+}
+
+
+/*-----------------------------------------------------------------------------------------
+    Weights
+-----------------------------------------------------------------------------------------*/
+
+// Round each weight down, then give the remaining units to the weights that lost the most in rounding
+void QuantiseWeights(const float weights[4], uint8_t quantised[4])
+{
+	float total = 0.0f;
+	for (int i = 0; i < 4; ++i) total += std::max(weights[i], 0.0f);
+	if (total <= 0.0f)
+	{
+		quantised[0] = 255;
+		quantised[1] = quantised[2] = quantised[3] = 0;
+		return;
+	}
+
+	float lost[4];
+	int sum = 0;
+	for (int i = 0; i < 4; ++i)
+	{
+		const auto scaled = std::max(weights[i], 0.0f) / total * 255.0f;
+		quantised[i] = static_cast<uint8_t>(scaled);
+		lost[i] = scaled - quantised[i];
+		sum += quantised[i];
+	}
+
+	while (sum < 255)
+	{
+		auto most = 0;
+		for (int i = 1; i < 4; ++i)
+		{
+			if (lost[i] > lost[most]) most = i;
+		}
+		++quantised[most];
+		lost[most] = -1.0f;
+		++sum;
+	}
+}
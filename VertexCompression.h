@@ -0,0 +1,34 @@
+//--------------------------------------------------------------------------------------
+// Vertex compression - packing vertex attributes into fewer bytes
+//--------------------------------------------------------------------------------------
+// Code in .cpp file
+//
+// Helpers used by CMesh to store its vertices in compact GPU formats:
+// - Positions as 16-bit unsigned normalised values across the mesh bounds, the vertex shader scales and offsets
+//   them back (gPositionScale / gPositionOffset)
+// - Normals and tangents as two 16-bit signed normalised values, octahedral encoded: the unit sphere is folded
+//   onto an octahedron and then flattened into a square. The vertex shader decodes them (DecodeNormal)
+// - UVs as 16-bit unsigned normalised values if they are all in [0,1], otherwise as half floats. Both are
+//   converted to floats by the input assembler, no shader work needed
+// - Bone weights as 8-bit unsigned normalised values that still add up to 1
+// No graphics API is used here.
+
+#pragma once
+
+#include "CVector3.h"
+
+#include <cstdint>
+
+
+// Octahedral encoding of a unit vector into two signed normalised 16-bit values, and its inverse
+void     OctahedralEncode(const CVector3& v, int16_t encoded[2]);
+CVector3 OctahedralDecode(const int16_t encoded[2]);
+
+// Value in [0,1] to an unsigned normalised 16-bit value (clamped)
+uint16_t FloatToUnorm16(float value);
+
+// IEEE half float, rounding to nearest. Values too large become infinity
+uint16_t FloatToHalf(float value);
+
+// Four weights (adding up to 1) to unsigned normalised bytes that add up to exactly 255
+void QuantiseWeights(const float weights[4], uint8_t quantised[4]);